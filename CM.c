@@ -11,6 +11,9 @@
 /* ============================================================================
  * INCLUDES
  * ============================================================================ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // accept4, MAP_NORESERVE
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,6 +35,29 @@
 #include <signal.h>
 #include <setjmp.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sched.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define CM_HAVE_IO_URING 1
+#endif
+#endif
+#endif
 #include "CM.h"
 
 /* ============================================================================
@@ -54,14 +80,13 @@ void cm_printf(const char* format, ...) {
     va_list args;
     va_start(args, format);
     
+    // No fflush per call: stdout keeps its own buffering (line-buffered on a terminal)
     #ifdef __ANDROID__
         // على Android، نستخدم printf العادي
         vprintf(format, args);
-        fflush(stdout);
     #else
         if (stdout) {
             vprintf(format, args);
-            fflush(stdout);
         }
     #endif
     
@@ -84,23 +109,16 @@ void cm_error(const char* format, ...) {
         va_end(args);
         va_start(args, format);
         
-        // 3. طباعة على stdout (لتظهر على الشاشة)
-        printf("❌ ERROR: ");
-        vprintf(format, args);
-        printf("\n");
-        fflush(stdout);
+        // 3. عبر الـ logger (يظهر على الشاشة بدون fflush لكل سطر)
+        cm_logv(CM_LOG_ERROR, format, args);
     #else
-        if (stderr) {
-            vfprintf(stderr, format, args);
-            fprintf(stderr, "\n");
-        } else if (stdout) {
-            printf("ERROR: ");
-            vprintf(format, args);
-            printf("\n");
-        }
+        cm_logv(CM_LOG_ERROR, format, args);
     #endif
     
     va_end(args);
+
+    // Synchronous: an error is often the last thing logged before abort()
+    cm_log_flush();
 }
 
 // قراءة مدخلات (مع fallback)
@@ -134,958 +152,9256 @@ char* cm_gets(char* buffer, size_t size) {
 }
 #endif
 
+static void cm_runtime_register(void);  // fork handlers, armed before the first background thread
+static uint64_t cm_monotonic_ns(void);
+
+// Retries short writes and EINTR; returns CM_ERROR_IO on any other failure
+static int cm_fd_write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return CM_ERROR_IO;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return CM_SUCCESS;
+}
+
 /* ============================================================================
- * INTERNAL STRUCTURES (المعرفة محلياً فقط)
+ * LOGGING IMPLEMENTATION (per-thread rings, background flusher)
  * ============================================================================ */
-// هذا الـ struct غير موجود في CM.h所以要定义在这里
-typedef struct CMObject CMObject;  // تأكد من تعريف CMObject
+#define CM_LOG_RING_SLOTS 512            // 64 KB per logging thread
+#define CM_LOG_SLOT_TEXT  104            // text bytes in a record's first slot
+#define CM_LOG_MAX_LINE   1024
+#define CM_LOG_FLUSH_MS   50
+#define CM_LOG_OUT_BUFFER (64 * 1024)
+#define CM_LOG_KIND_TEXT  0xFF           // pre-formatted text record
+#define CM_LOG_KIND_PAD   0xFE           // filler up to the end of the ring
 
 typedef struct {
-    CMObject* head;
-    CMObject* tail;
-    size_t total_memory;
-    size_t gc_last_collection;
-    pthread_mutex_t gc_lock;
-    CMArena* current_arena;
-    pthread_mutex_t arena_lock;
-
-    size_t peak_memory;
-    size_t allocations;
-    size_t frees;
-    size_t collections;
-    double avg_collection_time;
-    size_t total_objects;
-} CMMemorySystem;
+    uint64_t ts;                         // CLOCK_REALTIME ns
+    uint8_t level;
+    uint8_t kind;                        // deferred arg count, or CM_LOG_KIND_*
+    uint16_t slots;                      // slots this record spans
+    uint32_t len;
+    const char* fmt;
+    union {
+        uintptr_t args[CM_LOG_MAX_ARGS];
+        char text[CM_LOG_SLOT_TEXT];     // long text runs on into the next slots
+    } u;
+} cm_log_slot_t;
+
+typedef struct cm_log_ring {
+    size_t head __attribute__((aligned(64)));   // written by the owning thread only
+    size_t tail __attribute__((aligned(64)));   // written by the drainer only
+    int orphaned;                               // owner exited; freed once empty
+    struct cm_log_ring* next;
+    cm_log_slot_t slots[CM_LOG_RING_SLOTS];
+} cm_log_ring_t;
+
+static int cm_log_level_runtime = CM_LOG_LEVEL;
+static int cm_log_fd = STDERR_FILENO;
+static size_t cm_log_drop_count = 0;
+
+static __thread cm_log_ring_t* cm_log_ring = NULL;
+static cm_log_ring_t* cm_log_rings = NULL;
+static pthread_mutex_t cm_log_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t cm_log_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cm_log_key;
+
+static pthread_once_t cm_log_once = PTHREAD_ONCE_INIT;
+static pthread_t cm_log_thread;
+static pthread_mutex_t cm_log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cm_log_cond = PTHREAD_COND_INITIALIZER;
+static int cm_log_async = 0;             // flusher running: records go through rings
+static int cm_log_kicked = 0;
+static int cm_log_stopping = 0;
+
+static const char* const cm_log_names[] = { "OFF  ", "ERROR", "WARN ", "INFO ", "DEBUG", "TRACE" };
+
+int cm_log_enabled(int level) {
+    return level > CM_LOG_OFF && level <= __atomic_load_n(&cm_log_level_runtime, __ATOMIC_RELAXED);
+}
 
-// المتغير العام الوحيد
-static CMMemorySystem cm_mem = {0};
+void cm_log_set_level(int level) {
+    if (level < CM_LOG_OFF) level = CM_LOG_OFF;
+    if (level > CM_LOG_LEVEL) level = CM_LOG_LEVEL;
+    __atomic_store_n(&cm_log_level_runtime, level, __ATOMIC_RELAXED);
+}
 
-// المتغيرات العامة الأخرى (غير static لأنها extern في CM.h)
-// CM.c - السطر 64
-__thread jmp_buf* cm_exception_buffer = NULL;  // ✅ thread-local
-int cm_last_error = 0;
-char cm_error_message[1024] = {0};
-/* ============================================================================
- * IMPLEMENTATION - كل الدوال كما هي من CM_full.h
- * ============================================================================ */
+int cm_log_get_level(void) {
+    return __atomic_load_n(&cm_log_level_runtime, __ATOMIC_RELAXED);
+}
 
-/* GC Implementation */
-void cm_gc_init(void) {
-    memset(&cm_mem, 0, sizeof(CMMemorySystem)); 
-    pthread_mutex_init(&cm_mem.gc_lock, NULL);
-    pthread_mutex_init(&cm_mem.arena_lock, NULL);
+void cm_log_set_fd(int fd) {
+    if (fd >= 0) __atomic_store_n(&cm_log_fd, fd, __ATOMIC_RELAXED);
 }
 
-CMArena* cm_arena_create(size_t size) {
-    CMArena* arena = (CMArena*)malloc(sizeof(CMArena));
-    if (!arena) return NULL;
-    arena->block = malloc(size);
-    if (!arena->block) { free(arena); return NULL; }
-    arena->block_size = size;
-    arena->offset = 0;
-    arena->name = "dynamic_arena";
-    arena->next = NULL;
-    arena->peak_usage = 0;
-    return arena;
+size_t cm_log_dropped(void) {
+    return __atomic_load_n(&cm_log_drop_count, __ATOMIC_RELAXED);
 }
 
-void cm_arena_destroy(CMArena* arena) {
-    if (!arena) return;
-    if (arena->block) free(arena->block);
-    free(arena);
+static uint64_t cm_log_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
 }
 
-void cm_arena_push(CMArena* arena) {
-    pthread_mutex_lock(&cm_mem.arena_lock);
-    cm_mem.current_arena = arena;
-    pthread_mutex_unlock(&cm_mem.arena_lock);
+static void cm_log_write_all(const char* data, size_t len) {
+    cm_fd_write_all(__atomic_load_n(&cm_log_fd, __ATOMIC_RELAXED), data, len);
 }
 
-void cm_arena_pop(void) {
-    pthread_mutex_lock(&cm_mem.arena_lock);
-    cm_mem.current_arena = NULL;
-    pthread_mutex_unlock(&cm_mem.arena_lock);
+// "YYYY-MM-DD HH:MM:SS.mmm LEVEL message\n"; returns bytes written to out
+static size_t cm_log_format(char* out, size_t cap, uint64_t ts, int level,
+                            const char* fmt, int kind, const uintptr_t* args,
+                            const char* text, size_t len) {
+    // localtime_r is costly: convert once per second per thread
+    static __thread time_t cached_sec = (time_t)-1;
+    static __thread char cached_stamp[32];
+    time_t sec = (time_t)(ts / 1000000000ull);
+    if (sec != cached_sec) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(cached_stamp, sizeof(cached_stamp), "%Y-%m-%d %H:%M:%S", &tm);
+        cached_sec = sec;
+    }
+    int n = snprintf(out, cap, "%s.%03d %s ", cached_stamp,
+                     (int)(ts / 1000000ull % 1000), cm_log_names[level]);
+    size_t used = n > 0 ? (size_t)n : 0;
+    if (used >= cap) used = cap - 1;
+
+    if (kind == CM_LOG_KIND_TEXT) {
+        if (len > cap - used - 1) len = cap - used - 1;
+        memcpy(out + used, text, len);
+        used += len;
+    } else {
+        // Every deferred arg is passed as a full word; extra ones are ignored
+        n = snprintf(out + used, cap - used, fmt, args[0], args[1], args[2],
+                     args[3], args[4], args[5]);
+        if (n > 0) used += (size_t)n < cap - used ? (size_t)n : cap - used - 1;
+    }
+
+    // One line per record, even if the message brought its own newline
+    while (used > 0 && out[used - 1] == '\n') used--;
+    out[used++] = '\n';
+    return used;
 }
 
-void* cm_alloc(size_t size, const char* type, const char* file, int line) {
-    if (size == 0) return NULL;
+/* ---- draining: one thread at a time, merged across rings by timestamp ---- */
+static char cm_log_out[CM_LOG_OUT_BUFFER];
 
-    /* 🚀 1. Fast Path: Check Arena allocation system for maximum performance */
-    if (cm_mem.current_arena) {
-        /* Align memory to 8 bytes for CPU efficiency and to prevent alignment faults */
-        size_t aligned_size = (size + 7) & ~7;
+#define CM_LOG_DRAIN_WINDOW 64                   // rings merged without allocating
 
-        if (cm_mem.current_arena->offset + aligned_size <= cm_mem.current_arena->block_size) {
-            void* ptr = (char*)cm_mem.current_arena->block + cm_mem.current_arena->offset;
-            cm_mem.current_arena->offset += aligned_size;
+static cm_log_slot_t* cm_log_peek(cm_log_ring_t* r, size_t limit) {
+    while (r->tail < limit) {
+        cm_log_slot_t* s = &r->slots[r->tail & (CM_LOG_RING_SLOTS - 1)];
+        if (s->kind != CM_LOG_KIND_PAD) return s;
+        __atomic_store_n(&r->tail, r->tail + s->slots, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
 
-            /* Update Arena usage statistics */
-            if (cm_mem.current_arena->offset > cm_mem.current_arena->peak_usage) {
-                cm_mem.current_arena->peak_usage = cm_mem.current_arena->offset;
-            }
+static void cm_log_drain(void) {
+    pthread_mutex_lock(&cm_log_drain_lock);
+
+    pthread_mutex_lock(&cm_log_rings_lock);
+    cm_log_ring_t* first = cm_log_rings;
+    pthread_mutex_unlock(&cm_log_rings_lock);
+
+    // Bound the pass by what each ring held when we started. Without memory for
+    // every ring, merge them a window at a time: order then holds per window.
+    size_t count = 0;
+    for (cm_log_ring_t* r = first; r; r = r->next) count++;
+    size_t stack_limits[CM_LOG_DRAIN_WINDOW];
+    size_t* limits = count <= CM_LOG_DRAIN_WINDOW ? stack_limits
+                                                  : (size_t*)malloc(count * sizeof(size_t));
+    size_t window = count;
+    if (!limits) {
+        limits = stack_limits;
+        window = CM_LOG_DRAIN_WINDOW;
+    }
 
-            /* ✅ IMPORTANT: Arena objects are not tracked by GC to eliminate overhead */
-            return ptr; /* Immediate return for maximum speed */
+    size_t used = 0;
+    static const uintptr_t no_args[CM_LOG_MAX_ARGS];
+    uintptr_t args[CM_LOG_MAX_ARGS];
+    for (cm_log_ring_t* start = first; start;) {
+        cm_log_ring_t* end = start;
+        size_t i = 0;
+        for (; end && i < window; end = end->next) {
+            limits[i++] = __atomic_load_n(&end->head, __ATOMIC_ACQUIRE);
         }
 
-        /* Fallback mechanism if the current arena is exhausted */
-        cm_error("[ARENA] Warning: Arena '%s' full, falling back to GC", 
-         cm_mem.current_arena->name);
-    }
-    void* ptr = malloc(size);
-    if (!ptr) return NULL;
+        for (;;) {
+            cm_log_ring_t* best = NULL;
+            cm_log_slot_t* best_slot = NULL;
+            i = 0;
+            for (cm_log_ring_t* r = start; r != end; r = r->next, i++) {
+                cm_log_slot_t* s = cm_log_peek(r, limits[i]);
+                if (s && (!best_slot || s->ts < best_slot->ts)) {
+                    best = r;
+                    best_slot = s;
+                }
+            }
+            if (!best) break;
 
-    CMObject* obj = (CMObject*)malloc(sizeof(CMObject));
-    if (!obj) {
-        free(ptr);
-        return NULL;
+            if (used + CM_LOG_MAX_LINE + 128 > sizeof(cm_log_out)) {
+                cm_log_write_all(cm_log_out, used);
+                used = 0;
+            }
+            const uintptr_t* a = no_args;
+            if (best_slot->kind != CM_LOG_KIND_TEXT) {
+                memset(args, 0, sizeof(args));
+                memcpy(args, best_slot->u.args, best_slot->kind * sizeof(uintptr_t));
+                a = args;
+            }
+            used += cm_log_format(cm_log_out + used, CM_LOG_MAX_LINE + 128, best_slot->ts,
+                                  best_slot->level, best_slot->fmt, best_slot->kind, a,
+                                  best_slot->u.text, best_slot->len);
+            __atomic_store_n(&best->tail, best->tail + best_slot->slots, __ATOMIC_RELEASE);
+        }
+        start = end;
+    }
+    if (limits != stack_limits) free(limits);
+
+    static size_t reported = 0;
+    size_t dropped = cm_log_dropped();
+    if (dropped != reported) {
+        char line[128];
+        int n = snprintf(line, sizeof(line), "[LOG] %zu records dropped (rings full)", dropped - reported);
+        reported = dropped;
+        if (used + sizeof(line) + 64 > sizeof(cm_log_out)) {
+            cm_log_write_all(cm_log_out, used);
+            used = 0;
+        }
+        used += cm_log_format(cm_log_out + used, sizeof(line) + 64, cm_log_clock(), CM_LOG_WARN,
+                              NULL, CM_LOG_KIND_TEXT, no_args, line, (size_t)n);
+    }
+    if (used) cm_log_write_all(cm_log_out, used);
+
+    // Rings of exited threads go once they are empty
+    pthread_mutex_lock(&cm_log_rings_lock);
+    for (cm_log_ring_t** pp = &cm_log_rings; *pp;) {
+        cm_log_ring_t* r = *pp;
+        if (__atomic_load_n(&r->orphaned, __ATOMIC_ACQUIRE) &&
+            r->tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+            *pp = r->next;
+            free(r);
+        } else {
+            pp = &r->next;
+        }
     }
+    pthread_mutex_unlock(&cm_log_rings_lock);
 
-    obj->ptr = ptr;
-    obj->size = size;
-    obj->type = type ? type : "unknown";
-    obj->file = file ? file : "unknown";
-    obj->line = line;
-    obj->alloc_time = time(NULL);
-    obj->ref_count = 1;
-    obj->marked = 0;
-    obj->hash = 0;
-    obj->next = NULL;
-    obj->prev = NULL;
-    obj->destructor = NULL;
-    obj->mark_cb = NULL;
+    pthread_mutex_unlock(&cm_log_drain_lock);
+}
 
-    pthread_mutex_lock(&cm_mem.gc_lock);
+static void cm_log_kick(void) {
+    pthread_mutex_lock(&cm_log_lock);
+    cm_log_kicked = 1;
+    pthread_cond_signal(&cm_log_cond);
+    pthread_mutex_unlock(&cm_log_lock);
+}
 
-    if (cm_mem.tail) {
-        cm_mem.tail->next = obj;
-        obj->prev = cm_mem.tail;
-        cm_mem.tail = obj;
-    } else {
-        cm_mem.head = cm_mem.tail = obj;
-    }
+static void* cm_log_flusher(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&cm_log_lock);
+    while (!cm_log_stopping) {
+        if (!cm_log_kicked) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += CM_LOG_FLUSH_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&cm_log_cond, &cm_log_lock, &ts);
+        }
+        cm_log_kicked = 0;
+        pthread_mutex_unlock(&cm_log_lock);
 
-    cm_mem.total_objects++;
-    cm_mem.total_memory += size;
-    cm_mem.allocations++;
+        cm_log_drain();
 
-    if (cm_mem.total_memory > cm_mem.peak_memory) {
-        cm_mem.peak_memory = cm_mem.total_memory;
+        pthread_mutex_lock(&cm_log_lock);
     }
+    pthread_mutex_unlock(&cm_log_lock);
+    return NULL;
+}
 
-    pthread_mutex_unlock(&cm_mem.gc_lock);
-
-    return ptr;
+static void cm_log_thread_exit(void* ptr) {
+    __atomic_store_n(&((cm_log_ring_t*)ptr)->orphaned, 1, __ATOMIC_RELEASE);
 }
 
-void cm_free(void* ptr) {
-    if (!ptr) return;
+static void cm_log_start(void) {
+    cm_runtime_register();
+    if (pthread_key_create(&cm_log_key, cm_log_thread_exit) != 0) return;
+    if (pthread_create(&cm_log_thread, NULL, cm_log_flusher, NULL) != 0) return;
+    __atomic_store_n(&cm_log_async, 1, __ATOMIC_RELEASE);
+}
 
-    pthread_mutex_lock(&cm_mem.gc_lock);
+static cm_log_ring_t* cm_log_ring_get(void) {
+    cm_log_ring_t* r = cm_log_ring;
+    if (r) return r;
 
-    for (CMObject* obj = cm_mem.head; obj; obj = obj->next) {
-        if (obj->ptr == ptr) {
-            obj->ref_count--;
+    pthread_once(&cm_log_once, cm_log_start);
+    if (!__atomic_load_n(&cm_log_async, __ATOMIC_ACQUIRE)) return NULL;
 
-            if (obj->ref_count <= 0) {
-                if (obj->destructor) {
-                    obj->destructor(ptr);
-                }
+    r = (cm_log_ring_t*)calloc(1, sizeof(cm_log_ring_t));
+    if (!r) return NULL;
+    pthread_setspecific(cm_log_key, r);
 
-                free(ptr);
+    pthread_mutex_lock(&cm_log_rings_lock);
+    r->next = cm_log_rings;
+    cm_log_rings = r;
+    pthread_mutex_unlock(&cm_log_rings_lock);
 
-                // ✅ تحديث الـ linked list
-                if (obj->prev) {
-                    obj->prev->next = obj->next;
-                } else {
-                    cm_mem.head = obj->next;
-                }
+    cm_log_ring = r;
+    return r;
+}
 
-                if (obj->next) {
-                    obj->next->prev = obj->prev;
-                } else {
-                    cm_mem.tail = obj->prev;
-                }
+// Formats and writes one record on the calling thread
+static void cm_log_write_now(int level, const char* fmt, const uintptr_t* args, int nargs,
+                             const char* text, size_t len) {
+    char line[CM_LOG_MAX_LINE + 128];
+    uintptr_t a[CM_LOG_MAX_ARGS] = {0};
+    if (!text) memcpy(a, args, (size_t)nargs * sizeof(uintptr_t));
+    size_t n = cm_log_format(line, sizeof(line), cm_log_clock(), level, fmt,
+                             text ? CM_LOG_KIND_TEXT : nargs, a, text, len);
+    cm_log_write_all(line, n);
+}
 
-                // ✅ تحديث الإحصائيات
-                cm_mem.total_objects--;
-                cm_mem.total_memory -= obj->size;
-                cm_mem.frees++;
+// Copies one record into the calling thread's ring; only errors that find
+// the ring full block, on I/O, rather than being dropped
+static void cm_log_push(int level, const char* fmt, const uintptr_t* args, int nargs,
+                        const char* text, size_t len) {
+    cm_log_ring_t* r = cm_log_ring_get();
+    if (!r || !__atomic_load_n(&cm_log_async, __ATOMIC_ACQUIRE)) {
+        // No flusher (not started, failed, or shut down): write through
+        cm_log_write_now(level, fmt, args, nargs, text, len);
+        return;
+    }
 
-                free(obj);
-            }
+    size_t need = 1;
+    if (text && len > CM_LOG_SLOT_TEXT) {
+        need += (len - CM_LOG_SLOT_TEXT + sizeof(cm_log_slot_t) - 1) / sizeof(cm_log_slot_t);
+    }
 
-            pthread_mutex_unlock(&cm_mem.gc_lock);
+    size_t head = r->head;
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    size_t pos = head & (CM_LOG_RING_SLOTS - 1);
+    size_t pad = pos + need > CM_LOG_RING_SLOTS ? CM_LOG_RING_SLOTS - pos : 0;
+    if (head + pad + need - tail > CM_LOG_RING_SLOTS) {
+        if (level > CM_LOG_ERROR) {
+            __atomic_add_fetch(&cm_log_drop_count, 1, __ATOMIC_RELAXED);
+            cm_log_kick();
             return;
         }
+        // Errors are never dropped: drain the backlog here, which keeps this
+        // thread's records in order, then write the error itself through
+        cm_log_drain();
+        cm_log_write_now(level, fmt, args, nargs, text, len);
+        return;
     }
 
-    // ✅ من Arena = اتجاهله
-    pthread_mutex_unlock(&cm_mem.gc_lock);
-}
+    if (pad) {
+        r->slots[pos].kind = CM_LOG_KIND_PAD;
+        r->slots[pos].slots = (uint16_t)pad;
+        head += pad;
+        pos = 0;
+    }
 
-void cm_gc_collect(void) {
-    pthread_mutex_lock(&cm_mem.gc_lock);
+    cm_log_slot_t* s = &r->slots[pos];
+    s->ts = cm_log_clock();
+    s->level = (uint8_t)level;
+    s->slots = (uint16_t)need;
+    s->fmt = fmt;
+    if (text) {
+        s->kind = CM_LOG_KIND_TEXT;
+        s->len = (uint32_t)len;
+        memcpy(s->u.text, text, len);
+    } else {
+        s->kind = (uint8_t)nargs;
+        s->len = 0;
+        memcpy(s->u.args, args, (size_t)nargs * sizeof(uintptr_t));
+    }
 
-    cm_printf("[GC] Starting collection...\n");
+    size_t used_before = head - tail;
+    __atomic_store_n(&r->head, head + need, __ATOMIC_RELEASE);
 
-    for (CMObject* obj = cm_mem.head; obj; obj = obj->next) {
-        obj->marked = (obj->ref_count > 0) ? 1 : 0;
+    // Errors go out promptly; otherwise only wake the flusher past half full
+    if (level <= CM_LOG_ERROR ||
+        (used_before < CM_LOG_RING_SLOTS / 2 && used_before + need >= CM_LOG_RING_SLOTS / 2)) {
+        cm_log_kick();
     }
+}
 
-    CMObject* current = cm_mem.head;
-    size_t freed_memory = 0;
-    int freed_objects = 0;
+void cm_logv(int level, const char* format, va_list args) {
+    if (!format || !cm_log_enabled(level)) return;
 
-    while (current) {
-        CMObject* next = current->next;
+    char text[CM_LOG_MAX_LINE];
+    int n = vsnprintf(text, sizeof(text), format, args);
+    if (n < 0) return;
+    size_t len = (size_t)n < sizeof(text) ? (size_t)n : sizeof(text) - 1;
+    cm_log_push(level, NULL, NULL, 0, text, len);
+}
 
-        if (!current->marked) {
-            freed_memory += current->size;
-            freed_objects++;
+void cm_log(int level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    cm_logv(level, format, args);
+    va_end(args);
+}
 
-            if (current->destructor) {
-                current->destructor(current->ptr);
-            }
-            free(current->ptr);
+void cm_log_deferred(int level, const char* format, const uintptr_t* args, int nargs) {
+    if (!format || !cm_log_enabled(level)) return;
+    if (nargs < 0) nargs = 0;
+    if (nargs > CM_LOG_MAX_ARGS) nargs = CM_LOG_MAX_ARGS;
+    cm_log_push(level, format, args, nargs, NULL, 0);
+}
 
-            if (current->prev) {
-                current->prev->next = current->next;
-            } else {
-                cm_mem.head = current->next;
-            }
+void cm_log_flush(void) {
+    if (__atomic_load_n(&cm_log_async, __ATOMIC_ACQUIRE)) cm_log_drain();
+}
 
-            if (current->next) {
-                current->next->prev = current->prev;
-            } else {
-                cm_mem.tail = current->prev;
-            }
+// Stops the flusher after a final drain; later records are written through
+static void cm_log_shutdown(void) {
+    if (!__atomic_load_n(&cm_log_async, __ATOMIC_ACQUIRE)) return;
 
-            cm_mem.total_objects--;
-            cm_mem.total_memory -= current->size;
-            cm_mem.frees++;
+    pthread_mutex_lock(&cm_log_lock);
+    cm_log_stopping = 1;
+    pthread_cond_signal(&cm_log_cond);
+    pthread_mutex_unlock(&cm_log_lock);
+    pthread_join(cm_log_thread, NULL);
 
-            free(current);
-        }
+    __atomic_store_n(&cm_log_async, 0, __ATOMIC_RELEASE);
+    cm_log_drain();
+}
 
-        current = next;
+/* ============================================================================
+ * TRACING IMPLEMENTATION (per-thread event buffers, Chrome trace export)
+ * ============================================================================ */
+#define CM_TRACE_CHUNK_EVENTS 4096
+#define CM_TRACE_MAX_CHUNKS   64                 // per thread (~6 MB); later events are dropped
+#define CM_TRACE_INSTANT_DUR  UINT64_MAX
+
+typedef struct {
+    const char* name;
+    uint64_t ts;                                 // cm_trace_now() ticks
+    uint64_t dur;                                // CM_TRACE_INSTANT_DUR for instant events
+} cm_trace_event_t;
+
+typedef struct cm_trace_chunk {
+    struct cm_trace_chunk* next;                 // set once, before the owner moves on
+    size_t count;                                // published with release
+    cm_trace_event_t events[CM_TRACE_CHUNK_EVENTS];
+} cm_trace_chunk_t;
+
+// Single writer (the owning thread); cm_trace_write consumes from head
+typedef struct cm_trace_buf {
+    struct cm_trace_buf* next;
+    int tid;
+    int chunks;
+    cm_trace_chunk_t* tail;                      // owner only
+    cm_trace_chunk_t* head;                      // exporter only
+    size_t read;                                 // events of head already exported
+    int orphaned;                                // owner exited; freed once exported
+} cm_trace_buf_t;
+
+int cm_trace_active = 0;
+static int cm_trace_tsc = 0;                     // ticks are TSC cycles rather than ns
+static uint64_t cm_trace_tsc0, cm_trace_ns0;     // calibration origin
+static pthread_once_t cm_trace_once = PTHREAD_ONCE_INIT;
+static size_t cm_trace_drop_count = 0;
+static __thread cm_trace_buf_t* cm_trace_tls = NULL;
+static cm_trace_buf_t* cm_trace_bufs = NULL;
+static pthread_mutex_t cm_trace_lock = PTHREAD_MUTEX_INITIALIZER;   // buffer list + exporter
+static pthread_once_t cm_trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cm_trace_key;
+static int cm_trace_key_ok = 0;
+
+// An invariant TSC is about half the cost of clock_gettime; cycles are
+// converted to ns at export time against the monotonic clock
+static void cm_trace_clock_init(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned a, b, c, d;
+    if (__get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1u << 8))) {
+        cm_trace_ns0 = cm_monotonic_ns();
+        cm_trace_tsc0 = __rdtsc();
+        cm_trace_tsc = 1;
     }
-    cm_mem.gc_last_collection = freed_memory;
-    cm_mem.collections++;
+#endif
+}
 
-cm_printf("[GC] Completed: freed %d objects (%zu bytes)\n", freed_objects, freed_memory);
+static double cm_trace_ns_per_tick(void) {
+    if (!cm_trace_tsc) return 1.0;
+#if defined(__x86_64__) || defined(__i386__)
+    // Widen the window to at least 1 ms so the ratio is stable
+    uint64_t ns, tsc;
+    do {
+        ns = cm_monotonic_ns();
+        tsc = __rdtsc();
+    } while (ns - cm_trace_ns0 < 1000000);
+    return (double)(ns - cm_trace_ns0) / (double)(tsc - cm_trace_tsc0);
+#else
+    return 1.0;
+#endif
+}
 
-    pthread_mutex_unlock(&cm_mem.gc_lock);
+void cm_trace_start(void) {
+    pthread_once(&cm_trace_once, cm_trace_clock_init);
+    __atomic_store_n(&cm_trace_active, 1, __ATOMIC_RELAXED);
 }
 
-void cm_gc_stats(void) {
-    pthread_mutex_lock(&cm_mem.gc_lock);
+void cm_trace_stop(void) {
+    __atomic_store_n(&cm_trace_active, 0, __ATOMIC_RELAXED);
+}
 
-    cm_printf("\n");
-cm_printf("══════════════════════════════════════════════════════════════\n");
-cm_printf("              GARBAGE COLLECTOR STATISTICS\n");
-cm_printf("──────────────────────────────────────────────────────────────\n");
-cm_printf("  Total objects    │ %20zu\n", cm_mem.total_objects);
-cm_printf("  Total memory     │ %20zu bytes\n", cm_mem.total_memory);
-cm_printf("  Peak memory      │ %20zu bytes\n", cm_mem.peak_memory);
-cm_printf("  Allocations      │ %20zu\n", cm_mem.allocations);
-cm_printf("  Frees            │ %20zu\n", cm_mem.frees);
-cm_printf("  Collections      │ %20zu\n", cm_mem.collections);
-cm_printf("──────────────────────────────────────────────────────────────\n");
-cm_printf("  Avg collection   │ %19.3f ms\n", cm_mem.avg_collection_time * 1000);
-cm_printf("  Last freed       │ %20zu bytes\n", cm_mem.gc_last_collection);
-if (cm_mem.current_arena) {
-    cm_printf("──────────────────────────────────────────────────────────────\n");
-    cm_printf("  ARENA STATISTICS\n");
-    cm_printf("  Arena name       │ %20s\n", cm_mem.current_arena->name);
-    cm_printf("  Arena size       │ %20zu bytes\n", cm_mem.current_arena->block_size);
-    cm_printf("  Arena used       │ %20zu bytes\n", cm_mem.current_arena->offset);
-    cm_printf("  Arena peak       │ %20zu bytes\n", cm_mem.current_arena->peak_usage);
+size_t cm_trace_dropped(void) {
+    return __atomic_load_n(&cm_trace_drop_count, __ATOMIC_RELAXED);
 }
-cm_printf("══════════════════════════════════════════════════════════════\n");
-if (cm_mem.total_objects > 0 && CM_LOG_LEVEL >= 3) {
-    cm_printf("\nACTIVE OBJECTS:\n");
-    cm_printf("──────────────────────────────────────────────────────────────\n");
 
-int i=0;
-    for (CMObject* obj = cm_mem.head; obj; obj = obj->next) {
-        cm_printf("  [%d] %s (%zu bytes) at %s:%d [refs: %d]\n",
-                  ++i, obj->type ? obj->type : "unknown",
-                  obj->size, obj->file ? obj->file : "unknown",
-                  obj->line, obj->ref_count);
-    }
+uint64_t cm_trace_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (cm_trace_tsc) return __rdtsc();
+#endif
+    return cm_monotonic_ns();
 }
 
-    pthread_mutex_unlock(&cm_mem.gc_lock);
+static void cm_trace_thread_exit(void* ptr) {
+    // Later destructors that trace start a fresh buffer rather than reuse this one
+    cm_trace_tls = NULL;
+    __atomic_store_n(&((cm_trace_buf_t*)ptr)->orphaned, 1, __ATOMIC_RELEASE);
 }
 
-void cm_retain(void* ptr) {
-    if (!ptr) return;
+static void cm_trace_key_init(void) {
+    cm_trace_key_ok = pthread_key_create(&cm_trace_key, cm_trace_thread_exit) == 0;
+}
 
-    pthread_mutex_lock(&cm_mem.gc_lock);
+static cm_trace_buf_t* cm_trace_buf_get(void) {
+    cm_trace_buf_t* b = cm_trace_tls;
+    if (b) return b;
 
-    for (CMObject* obj = cm_mem.head; obj; obj = obj->next) {
-        if (obj->ptr == ptr) {
-            obj->ref_count++;
-            break;
-        }
-    }
+    pthread_once(&cm_trace_key_once, cm_trace_key_init);
 
-    pthread_mutex_unlock(&cm_mem.gc_lock);
-}
+    b = (cm_trace_buf_t*)calloc(1, sizeof(cm_trace_buf_t));
+    cm_trace_chunk_t* chunk = (cm_trace_chunk_t*)calloc(1, sizeof(cm_trace_chunk_t));
+    if (!b || !chunk) {
+        free(b);
+        free(chunk);
+        return NULL;
+    }
+#ifdef __linux__
+    b->tid = (int)syscall(SYS_gettid);
+#else
+    b->tid = (int)(uintptr_t)pthread_self();
+#endif
+    b->chunks = 1;
+    b->head = b->tail = chunk;
 
+    pthread_mutex_lock(&cm_trace_lock);
+    b->next = cm_trace_bufs;
+    cm_trace_bufs = b;
+    pthread_mutex_unlock(&cm_trace_lock);
 
-// في ملف CM.c - أضف هذه الدالة
-void cm_arena_cleanup(void* ptr) {
-    CMArena** arena_ptr = (CMArena**)ptr;
-    if (*arena_ptr) {
-        // POP الأول
-        pthread_mutex_lock(&cm_mem.arena_lock);
-        cm_mem.current_arena = NULL;
-        pthread_mutex_unlock(&cm_mem.arena_lock);
-        
-        // بعد كده Destroy
-        cm_arena_destroy(*arena_ptr);
-        *arena_ptr = NULL;
-        
-        cm_printf("[ARENA] Cleanup auto-destroyed arena\n");
-    }
+    if (cm_trace_key_ok) pthread_setspecific(cm_trace_key, b);
+    cm_trace_tls = b;
+    return b;
 }
 
+static void cm_trace_push(const char* name, uint64_t ts, uint64_t dur) {
+    cm_trace_buf_t* b = cm_trace_buf_get();
+    if (!b) {
+        __atomic_add_fetch(&cm_trace_drop_count, 1, __ATOMIC_RELAXED);
+        return;
+    }
 
-
-/* ============================================================================
- * ERROR HANDLING IMPLEMENTATION
- * ============================================================================ */
-const char* cm_error_string(int error) {
-    switch(error) {
-        case CM_SUCCESS: return "Success";
-        case CM_ERROR_MEMORY: return "Memory allocation failed";
-        case CM_ERROR_NULL_POINTER: return "Null pointer dereference";
-        case CM_ERROR_OUT_OF_BOUNDS: return "Index out of bounds";
-        case CM_ERROR_DIVISION_BY_ZERO: return "Division by zero";
-        case CM_ERROR_OVERFLOW: return "Integer overflow";
-        case CM_ERROR_UNDERFLOW: return "Integer underflow";
-        case CM_ERROR_INVALID_ARGUMENT: return "Invalid argument";
-        case CM_ERROR_NOT_FOUND: return "Not found";
-        case CM_ERROR_ALREADY_EXISTS: return "Already exists";
-        case CM_ERROR_PERMISSION_DENIED: return "Permission denied";
-        case CM_ERROR_IO: return "I/O error";
-        case CM_ERROR_NETWORK: return "Network error";
-        case CM_ERROR_TIMEOUT: return "Operation timed out";
-        case CM_ERROR_THREAD: return "Thread error";
-        case CM_ERROR_SYNC: return "Synchronization error";
-        case CM_ERROR_PARSE: return "Parse error";
-        case CM_ERROR_TYPE: return "Type error";
-        case CM_ERROR_UNIMPLEMENTED: return "Unimplemented";
-        case CM_ERROR_UNKNOWN: return "Unknown error";
-        default: return "Unknown error code";
+    cm_trace_chunk_t* chunk = b->tail;
+    size_t n = chunk->count;
+    if (n == CM_TRACE_CHUNK_EVENTS) {
+        cm_trace_chunk_t* fresh = NULL;
+        if (__atomic_load_n(&b->chunks, __ATOMIC_RELAXED) < CM_TRACE_MAX_CHUNKS) {
+            fresh = (cm_trace_chunk_t*)calloc(1, sizeof(cm_trace_chunk_t));
+        }
+        if (!fresh) {
+            __atomic_add_fetch(&cm_trace_drop_count, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        __atomic_add_fetch(&b->chunks, 1, __ATOMIC_RELAXED);
+        // The old chunk is never touched again once next is visible
+        __atomic_store_n(&chunk->next, fresh, __ATOMIC_RELEASE);
+        b->tail = chunk = fresh;
+        n = 0;
     }
+
+    cm_trace_event_t* e = &chunk->events[n];
+    e->name = name;
+    e->ts = ts;
+    e->dur = dur;
+    __atomic_store_n(&chunk->count, n + 1, __ATOMIC_RELEASE);
 }
 
-const char* cm_error_get_message(void) {
-    return cm_error_message;
+void cm_trace_end(cm_trace_span_t* span) {
+    if (!span->start) return;
+    cm_trace_push(span->name, span->start, cm_trace_now() - span->start);
 }
 
-int cm_error_get_last(void) {
-    return cm_last_error;
+void cm_trace_instant(const char* name) {
+    cm_trace_push(name, cm_trace_now(), CM_TRACE_INSTANT_DUR);
 }
 
-void cm_error_clear(void) {
-    cm_last_error = 0;
-    cm_error_message[0] = '\0';
+typedef struct {
+    int fd;
+    int status;
+    size_t len;
+    char buf[64 * 1024];
+} cm_trace_out_t;
+
+static void cm_trace_out_flush(cm_trace_out_t* out) {
+    if (out->len && cm_fd_write_all(out->fd, out->buf, out->len) != CM_SUCCESS) {
+        out->status = CM_ERROR_IO;
+    }
+    out->len = 0;
 }
 
-void cm_error_set(int error, const char* message) {
-    cm_last_error = error;
-    if (message) {
-        strncpy(cm_error_message, message, sizeof(cm_error_message) - 1);
+static void cm_trace_out_event(cm_trace_out_t* out, int pid, int tid, const cm_trace_event_t* e,
+                               double scale, int first) {
+    if (sizeof(out->buf) - out->len < 512) cm_trace_out_flush(out);
+
+    char* p = out->buf + out->len;
+    char* end = p + 256;
+    p += sprintf(p, "%s{\"name\":\"", first ? "" : ",\n");
+    for (const char* s = e->name ? e->name : "?"; *s && p < end; s++) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\') *p++ = '\\';
+        *p++ = ch < 0x20 ? '?' : (char)ch;
+    }
+
+    // Chrome trace timestamps are microseconds
+    uint64_t ts = cm_trace_tsc ? cm_trace_ns0 + (uint64_t)((double)(e->ts - cm_trace_tsc0) * scale) : e->ts;
+    uint64_t dur = e->dur == CM_TRACE_INSTANT_DUR ? 0 : (uint64_t)((double)e->dur * scale);
+    if (e->dur == CM_TRACE_INSTANT_DUR) {
+        p += sprintf(p, "\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRIu64 ".%03u,\"pid\":%d,\"tid\":%d}",
+                     ts / 1000, (unsigned)(ts % 1000), pid, tid);
+    } else {
+        p += sprintf(p, "\",\"ph\":\"X\",\"ts\":%" PRIu64 ".%03u,\"dur\":%" PRIu64 ".%03u,"
+                        "\"pid\":%d,\"tid\":%d}",
+                     ts / 1000, (unsigned)(ts % 1000), dur / 1000, (unsigned)(dur % 1000), pid, tid);
     }
+    out->len = (size_t)(p - out->buf);
+}
+
+// Exports and releases everything recorded since the previous call, so a
+// long-running process can stream consecutive trace files
+int cm_trace_write(int fd) {
+    if (fd < 0) return CM_ERROR_INVALID_ARGUMENT;
+
+    cm_trace_out_t* out = (cm_trace_out_t*)malloc(sizeof(cm_trace_out_t));
+    if (!out) return CM_ERROR_MEMORY;
+    out->fd = fd;
+    out->status = CM_SUCCESS;
+    out->len = 0;
+
+    int pid = (int)getpid();
+    int first = 1;
+    double scale = cm_trace_ns_per_tick();
+    out->len = (size_t)sprintf(out->buf, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&cm_trace_lock);
+    for (cm_trace_buf_t** pp = &cm_trace_bufs; *pp;) {
+        cm_trace_buf_t* b = *pp;
+        int orphaned = __atomic_load_n(&b->orphaned, __ATOMIC_ACQUIRE);
+        for (;;) {
+            cm_trace_chunk_t* chunk = b->head;
+            // next first: once it is linked, count is final
+            cm_trace_chunk_t* next = __atomic_load_n(&chunk->next, __ATOMIC_ACQUIRE);
+            size_t count = __atomic_load_n(&chunk->count, __ATOMIC_ACQUIRE);
+            for (; b->read < count; b->read++) {
+                cm_trace_out_event(out, pid, b->tid, &chunk->events[b->read], scale, first);
+                first = 0;
+            }
+
+            if (!next) break;
+            // Full and superseded: the owner has moved on to next
+            b->head = next;
+            b->read = 0;
+            free(chunk);
+            __atomic_sub_fetch(&b->chunks, 1, __ATOMIC_RELAXED);
+        }
+
+        // The owner exited before this pass began, so nothing was left unread
+        if (orphaned) {
+            *pp = b->next;
+            free(b->head);
+            free(b);
+        } else {
+            pp = &b->next;
+        }
+    }
+    pthread_mutex_unlock(&cm_trace_lock);
+
+    if (sizeof(out->buf) - out->len < 64) cm_trace_out_flush(out);
+    out->len += (size_t)sprintf(out->buf + out->len, "\n]}\n");
+    cm_trace_out_flush(out);
+
+    int status = out->status;
+    free(out);
+    return status;
+}
+
+/* ============================================================================
+ * INTERNAL STRUCTURES (المعرفة محلياً فقط)
+ * ============================================================================ */
+// هذا الـ struct غير موجود في CM.h所以要定义在这里
+typedef struct CMObject CMObject;  // تأكد من تعريف CMObject
+
+typedef struct {
+    CMObject* head;
+    CMObject* tail;
+    uintptr_t span_lo, span_hi;          // bounds of every GC block so far; pointers outside are not ours
+    size_t total_memory;
+    size_t gc_last_collection;
+    pthread_mutex_t gc_lock;
+
+    size_t peak_memory;
+    size_t allocations;
+    size_t frees;
+    size_t collections;
+    uint64_t gc_pause_total_ns;
+    uint64_t gc_pause_max_ns;
+    uint64_t gc_pause_hist[CM_METRICS_PAUSE_BUCKETS];
+    size_t total_objects;
+} CMMemorySystem;
+
+// Counters outside gc_lock, on their own cache line
+typedef struct {
+    size_t arenas_live;
+    size_t arena_bytes_reserved;
+    size_t arena_bytes_used;
+    size_t arena_fallbacks;
+    size_t map_lookups;
+    size_t map_probes;
+    size_t map_probe_max;
+} __attribute__((aligned(64))) CMRuntimeCounters;
+
+// Written with relaxed atomics (GC fields still under gc_lock) so that
+// cm_runtime_metrics can read everything without taking a lock
+#define CM_STAT_ADD(field, n) __atomic_add_fetch(&(field), (n), __ATOMIC_RELAXED)
+#define CM_STAT_SUB(field, n) __atomic_sub_fetch(&(field), (n), __ATOMIC_RELAXED)
+#define CM_STAT_GET(field)    __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define CM_STAT_SET(field, v) __atomic_store_n(&(field), (v), __ATOMIC_RELAXED)
+
+// المتغير العام الوحيد
+static CMMemorySystem cm_mem = {
+    .gc_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static CMRuntimeCounters cm_stats;
+
+// المتغيرات العامة الأخرى (غير static لأنها extern في CM.h)
+// CM.c - السطر 64
+// Arenas and the cleanup stack (CM_TRY frames included) are per thread;
+// the scheduler swaps both in and out with each coroutine slice
+static __thread CMArena* cm_current_arena = NULL;
+static __thread cm_cleanup_t* cm_cleanup_top = NULL;
+static __thread int cm_try_caught = 0;  // set by a throw, consumed by the CM_CATCH it lands in
+__thread jmp_buf* cm_exception_buffer = NULL;
+
+/* ============================================================================
+ * HEAP PROFILER IMPLEMENTATION (sampled allocation sites)
+ * ============================================================================ */
+#define CM_HEAP_SITES        4096            // distinct file:line sites; later ones share "(other)"
+#define CM_HEAP_DEFAULT_RATE (512 * 1024)    // mean bytes between samples
+
+// Written under gc_lock with relaxed atomics; dumps read them lock-free
+// (from a signal handler too), so a site is published by storing file last
+typedef struct {
+    const char* file;
+    const char* type;
+    int line;
+    uint32_t hash;
+    size_t alloc_samples;
+    size_t alloc_bytes;                      // estimated bytes ever allocated here
+    size_t live_samples;
+    size_t live_bytes;                       // estimated bytes still live
+} cm_heap_site_t;
+
+static cm_heap_site_t cm_heap_sites[CM_HEAP_SITES + 1];
+static size_t cm_heap_rate = 0;              // 0: not sampling
+static volatile sig_atomic_t cm_heap_signal_fd = -1;
+
+static __thread int64_t cm_heap_tls_left = 0;
+static __thread uint64_t cm_heap_tls_rng = 0;
+
+// Exponentially distributed gap with mean rate, so periodic allocation
+// patterns cannot alias with the sampler
+static int64_t cm_heap_interval(size_t rate) {
+    uint64_t x = cm_heap_tls_rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    cm_heap_tls_rng = x;
+    double u = ((double)(x >> 11) + 1.0) / 9007199254740993.0;   // (0, 1)
+    return (int64_t)(-log(u) * (double)rate) + 1;
+}
+
+// Weight to book for this allocation, or 0 when it is not sampled
+static size_t cm_heap_sample(size_t size) {
+    size_t rate = __atomic_load_n(&cm_heap_rate, __ATOMIC_RELAXED);
+    if (!rate) return 0;
+
+    if (!cm_heap_tls_rng) {
+        cm_heap_tls_rng = (uint64_t)(uintptr_t)&cm_heap_tls_rng ^ cm_monotonic_ns() ^ 0x9E3779B97F4A7C15ull;
+        cm_heap_tls_left = cm_heap_interval(rate);
+    }
+    cm_heap_tls_left -= (int64_t)size;
+    if (cm_heap_tls_left > 0) return 0;
+    cm_heap_tls_left = cm_heap_interval(rate);
+
+    // An allocation of s bytes is sampled with p = 1 - e^(-s/rate); s/p is unbiased
+    double p = 1.0 - exp(-(double)size / (double)rate);
+    return (size_t)((double)size / p + 0.5);
+}
+
+static uint32_t cm_heap_site_hash(const char* file, int line) {
+    uint32_t h = 2166136261u;
+    for (const char* s = file; *s; s++) h = (h ^ (uint8_t)*s) * 16777619u;
+    return (h ^ (uint32_t)line) * 16777619u;
+}
+
+// Caller holds gc_lock; returns the site index + 1 for CMObject->hash
+static uint32_t cm_heap_record(const char* file, int line, const char* type, size_t weight) {
+    uint32_t h = cm_heap_site_hash(file, line);
+    uint32_t idx = CM_HEAP_SITES;            // "(other)" once the table is full
+
+    for (uint32_t i = 0; i < CM_HEAP_SITES; i++) {
+        uint32_t slot = (h + i) & (CM_HEAP_SITES - 1);
+        cm_heap_site_t* s = &cm_heap_sites[slot];
+        if (!s->file) {
+            s->type = type;
+            s->line = line;
+            s->hash = h;
+            __atomic_store_n(&s->file, file, __ATOMIC_RELEASE);
+            idx = slot;
+            break;
+        }
+        if (s->hash == h && s->line == line && strcmp(s->file, file) == 0) {
+            idx = slot;
+            break;
+        }
+    }
+
+    cm_heap_site_t* s = &cm_heap_sites[idx];
+    CM_STAT_ADD(s->alloc_samples, 1);
+    CM_STAT_ADD(s->alloc_bytes, weight);
+    CM_STAT_ADD(s->live_samples, 1);
+    CM_STAT_ADD(s->live_bytes, weight);
+    return idx + 1;
+}
+
+// Caller holds gc_lock
+static void cm_heap_unrecord(const CMObject* obj) {
+    if (!obj->sample_bytes) return;
+    cm_heap_site_t* s = &cm_heap_sites[obj->hash - 1];
+    CM_STAT_SUB(s->live_samples, 1);
+    CM_STAT_SUB(s->live_bytes, obj->sample_bytes);
+}
+
+int cm_heap_profile_start(size_t sample_bytes) {
+    if (!sample_bytes) sample_bytes = CM_HEAP_DEFAULT_RATE;
+    if (sample_bytes > (size_t)INT64_MAX / 64) return CM_ERROR_INVALID_ARGUMENT;
+    __atomic_store_n(&cm_heap_rate, sample_bytes, __ATOMIC_RELAXED);
+    return CM_SUCCESS;
+}
+
+// Sampled objects that are still live keep being subtracted as they are freed
+void cm_heap_profile_stop(void) {
+    __atomic_store_n(&cm_heap_rate, 0, __ATOMIC_RELAXED);
+}
+
+/* ---- folded-stack dump (async-signal-safe: no locks, no stdio, no malloc) ---- */
+typedef struct {
+    int fd;
+    int status;
+    size_t len;
+    char buf[4096];
+} cm_heap_out_t;
+
+static void cm_heap_out_flush(cm_heap_out_t* out) {
+    if (out->len && cm_fd_write_all(out->fd, out->buf, out->len) != CM_SUCCESS) {
+        out->status = CM_ERROR_IO;
+    }
+    out->len = 0;
+}
+
+static void cm_heap_out_char(cm_heap_out_t* out, char ch) {
+    if (out->len == sizeof(out->buf)) cm_heap_out_flush(out);
+    out->buf[out->len++] = ch;
+}
+
+// Frames are ';'-separated and the value follows a space, so both are escaped
+static void cm_heap_out_frame(cm_heap_out_t* out, const char* s) {
+    for (; *s; s++) {
+        cm_heap_out_char(out, (*s == ';' || *s == ' ' || *s == '\n') ? '_' : *s);
+    }
+}
+
+static void cm_heap_out_num(cm_heap_out_t* out, size_t v) {
+    char digits[24];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n) cm_heap_out_char(out, digits[--n]);
+}
+
+int cm_heap_profile_write(int fd, int what) {
+    if (fd < 0 || what < CM_HEAP_INUSE_BYTES || what > CM_HEAP_ALLOC_OBJECTS) {
+        return CM_ERROR_INVALID_ARGUMENT;
+    }
+
+    cm_heap_out_t out;
+    out.fd = fd;
+    out.status = CM_SUCCESS;
+    out.len = 0;
+
+    for (int i = 0; i <= CM_HEAP_SITES; i++) {
+        const cm_heap_site_t* s = &cm_heap_sites[i];
+        const char* file = i < CM_HEAP_SITES ? __atomic_load_n(&s->file, __ATOMIC_ACQUIRE) : "(other)";
+        if (!file) continue;
+
+        size_t v = 0;
+        switch (what) {
+            case CM_HEAP_INUSE_BYTES:   v = CM_STAT_GET(s->live_bytes); break;
+            case CM_HEAP_INUSE_OBJECTS: v = CM_STAT_GET(s->live_samples); break;
+            case CM_HEAP_ALLOC_BYTES:   v = CM_STAT_GET(s->alloc_bytes); break;
+            case CM_HEAP_ALLOC_OBJECTS: v = CM_STAT_GET(s->alloc_samples); break;
+        }
+        if (!v) continue;
+
+        // file:line;type value
+        cm_heap_out_frame(&out, file);
+        if (i < CM_HEAP_SITES) {
+            cm_heap_out_char(&out, ':');
+            cm_heap_out_num(&out, (size_t)(s->line > 0 ? s->line : 0));
+            if (s->type) {
+                cm_heap_out_char(&out, ';');
+                cm_heap_out_frame(&out, s->type);
+            }
+        }
+        cm_heap_out_char(&out, ' ');
+        cm_heap_out_num(&out, v);
+        cm_heap_out_char(&out, '\n');
+    }
+    cm_heap_out_flush(&out);
+    return out.status;
+}
+
+static void cm_heap_signal_handler(int signo) {
+    (void)signo;
+    int saved = errno;
+    if (cm_heap_signal_fd >= 0) cm_heap_profile_write(cm_heap_signal_fd, CM_HEAP_INUSE_BYTES);
+    errno = saved;
+}
+
+int cm_heap_profile_signal(int signo, int fd) {
+    if (fd < 0) return CM_ERROR_INVALID_ARGUMENT;
+    cm_heap_signal_fd = fd;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = cm_heap_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(signo, &sa, NULL) != 0) {
+        cm_error_set(CM_ERROR_INVALID_ARGUMENT, "cm_heap_profile_signal: sigaction failed");
+        return CM_ERROR_INVALID_ARGUMENT;
+    }
+    return CM_SUCCESS;
+}
+
+/* ============================================================================
+ * IMPLEMENTATION - كل الدوال كما هي من CM_full.h
+ * ============================================================================ */
+
+/* GC Implementation */
+void cm_gc_init(void) {
+    memset(&cm_mem, 0, sizeof(CMMemorySystem)); 
+    pthread_mutex_init(&cm_mem.gc_lock, NULL);
+}
+
+// Zeroed bytes in front of every arena block, as many as a GC header, so that
+// cm_gc_object can look at the header in front of any arena pointer in bounds
+#define CM_ARENA_GUARD ((sizeof(CMObject) + sizeof(uintptr_t) + 15) & ~(size_t)15)
+
+// An overflow block chained onto an arena: header, guard, then the bytes
+struct cm_arena_chunk {
+    struct cm_arena_chunk* next;
+    size_t size;
+    size_t offset;
+};
+#define CM_ARENA_CHUNK_HEADER ((sizeof(struct cm_arena_chunk) + 15) & ~(size_t)15)
+
+CMArena* cm_arena_create(size_t size) {
+    CMArena* arena = (CMArena*)malloc(sizeof(CMArena));
+    if (!arena) return NULL;
+    // The guard keeps cm_free's header check on the first allocations inside the block
+    char* raw = (char*)calloc(1, CM_ARENA_GUARD + size);
+    if (!raw) { free(arena); return NULL; }
+    arena->block = raw + CM_ARENA_GUARD;
+    arena->block_size = size;
+    arena->offset = 0;
+    arena->name = "dynamic_arena";
+    arena->next = NULL;
+    arena->peak_usage = 0;
+    arena->chain = NULL;
+    CM_STAT_ADD(cm_stats.arenas_live, 1);
+    CM_STAT_ADD(cm_stats.arena_bytes_reserved, size);
+    return arena;
+}
+
+void cm_arena_destroy(CMArena* arena) {
+    if (!arena) return;
+    CM_STAT_SUB(cm_stats.arenas_live, 1);
+    CM_STAT_SUB(cm_stats.arena_bytes_reserved, arena->block_size);
+    CM_STAT_ADD(cm_stats.arena_bytes_used, arena->peak_usage);
+    while (arena->chain) {
+        struct cm_arena_chunk* chunk = arena->chain;
+        arena->chain = chunk->next;
+        CM_STAT_SUB(cm_stats.arena_bytes_reserved, chunk->size);
+        CM_STAT_ADD(cm_stats.arena_bytes_used, chunk->offset);
+        free(chunk);
+    }
+    if (arena->block) free((char*)arena->block - CM_ARENA_GUARD);
+    free(arena);
+}
+
+// Pushes nest: popping brings back whichever arena was current before
+void cm_arena_push(CMArena* arena) {
+    if (!arena) return;
+    arena->next = cm_current_arena;
+    cm_current_arena = arena;
+}
+
+void cm_arena_pop(void) {
+    if (cm_current_arena) cm_current_arena = cm_current_arena->next;
+}
+
+// Bumps straight from arena, current or not; NULL once it is full (no GC fallback)
+void* cm_arena_alloc(CMArena* arena, size_t size) {
+    if (!arena || size == 0) return NULL;
+    size_t aligned_size = (size + 7) & ~(size_t)7;
+    if (aligned_size > arena->block_size - arena->offset) return NULL;
+
+    void* ptr = (char*)arena->block + arena->offset;
+    arena->offset += aligned_size;
+    if (arena->offset > arena->peak_usage) arena->peak_usage = arena->offset;
+    return ptr;
+}
+
+// Same bump as cm_arena_alloc, but once the block is full it chains another
+// one (each twice the last), so callers that cannot size the arena up front
+// never run dry. Chained blocks live until cm_arena_destroy.
+void* cm_arena_alloc_grow(CMArena* arena, size_t size) {
+    void* ptr = cm_arena_alloc(arena, size);
+    if (ptr || !arena || size == 0) return ptr;
+
+    size_t aligned_size = (size + 7) & ~(size_t)7;
+    struct cm_arena_chunk* chunk = arena->chain;
+    if (!chunk || aligned_size > chunk->size - chunk->offset) {
+        size_t cap = chunk ? chunk->size * 2 : arena->block_size;
+        if (cap < 4096) cap = 4096;
+        if (cap < aligned_size) cap = aligned_size;
+        if (cap > SIZE_MAX - CM_ARENA_CHUNK_HEADER - CM_ARENA_GUARD) return NULL;
+        chunk = (struct cm_arena_chunk*)malloc(CM_ARENA_CHUNK_HEADER + CM_ARENA_GUARD + cap);
+        if (!chunk) return NULL;
+        memset((char*)chunk + CM_ARENA_CHUNK_HEADER, 0, CM_ARENA_GUARD);
+        chunk->size = cap;
+        chunk->offset = 0;
+        chunk->next = arena->chain;
+        arena->chain = chunk;
+        CM_STAT_ADD(cm_stats.arena_bytes_reserved, cap);
+    }
+    ptr = (char*)chunk + CM_ARENA_CHUNK_HEADER + CM_ARENA_GUARD + chunk->offset;
+    chunk->offset += aligned_size;
+    return ptr;
+}
+
+void cm_arena_release(void* ptr) {
+    CMArena* arena = (CMArena*)ptr;
+    if (!arena) return;
+    // Unlink it wherever it sits in the stack, not just on top
+    for (CMArena** pp = &cm_current_arena; *pp; pp = &(*pp)->next) {
+        if (*pp == arena) {
+            *pp = arena->next;
+            break;
+        }
+    }
+    cm_arena_destroy(arena);
+}
+
+cm_cleanup_t* cm_arena_scope(cm_cleanup_t* scope) {
+    cm_cleanup_push(scope, cm_arena_release, scope->arg);
+    if (!scope->arg) return NULL;
+    cm_arena_push((CMArena*)scope->arg);
+    return scope;
+}
+
+/* ---- Object headers and reference counts ----
+ * A GC allocation is a single malloc block: its CMObject, a tag word, then the
+ * caller's bytes. The tag (address ^ CM_GC_TAG) lets cm_free and cm_retain go
+ * from a pointer to its object in O(1) and tells arena memory apart; the
+ * header's magic and ptr fields then confirm the match, and pointers outside
+ * the span of all GC blocks are turned away before anything is read. The
+ * global list under gc_lock is touched only when an object is born and when
+ * it dies; retain and release in between are lock-free.
+ *
+ * obj->refs holds the shared count above CM_RC_SHIFT flag bits. Objects that
+ * cm_alloc hands out while cm_gc_bias_thread(1) is on are biased: the owning
+ * thread counts its references in biased_refs without atomics, other threads
+ * use the shared count, which may go negative. The first time it does, the
+ * object goes on the owner's queue, and the owner later folds biased_refs in
+ * (cm_gc_drain). When the owner drops its last reference, the same happens
+ * at once, and from then on only the shared count matters. */
+#define CM_GC_TAG    ((uintptr_t)0xC3A5C85C97CB3127ull)
+#define CM_GC_HEADER ((sizeof(CMObject) + sizeof(uintptr_t) + 15) & ~(size_t)15)
+#define CM_GC_MAGIC  0x434D474F424A4543ull     // "CMGOBJEC"
+#define CM_RC_MERGED 1                   // no biased count left: the shared count is the whole count
+#define CM_RC_QUEUED 2                   // on the owner's queue, waiting for a merge
+#define CM_RC_DYING  4                   // count reached zero; whoever set this frees the object
+#define CM_RC_SHIFT  3
+#define CM_RC_ONE    ((int64_t)1 << CM_RC_SHIFT)
+#define CM_RC_COUNT(w) ((w) >> CM_RC_SHIFT)   // arithmetic shift: biased objects go negative
+
+typedef struct {
+    pthread_mutex_t lock;
+    CMObject* queue;                     // linked through queue_next
+    int alive;                           // cleared when the thread exits
+    int pending;                         // atomic hint that queue is non-empty
+    size_t refs;                         // atomic: the thread plus each object still biased to it
+} cm_gc_owner_t;
+
+static __thread cm_gc_owner_t* cm_gc_self = NULL;
+static __thread int cm_gc_biasing = 0;
+static pthread_key_t cm_gc_owner_key;
+static pthread_once_t cm_gc_owner_once = PTHREAD_ONCE_INIT;
+
+static inline uintptr_t* cm_gc_tag(void* ptr) {
+    return (uintptr_t*)ptr - 1;
+}
+
+// NULL for memory the GC does not track. Arena blocks reserve a header's
+// worth of bytes in front of their first allocation, so both reads stay in
+// bounds; other foreign pointers mostly fail the span check with no read.
+static inline CMObject* cm_gc_object(void* ptr) {
+    uintptr_t lo = __atomic_load_n(&cm_mem.span_lo, __ATOMIC_RELAXED);
+    uintptr_t hi = __atomic_load_n(&cm_mem.span_hi, __ATOMIC_RELAXED);
+    if ((uintptr_t)ptr - lo >= hi - lo) return NULL;
+    if (*cm_gc_tag(ptr) != ((uintptr_t)ptr ^ CM_GC_TAG)) return NULL;
+    CMObject* obj = (CMObject*)((char*)ptr - CM_GC_HEADER);
+    if (obj->magic != CM_GC_MAGIC || obj->ptr != ptr) return NULL;
+    return obj;
+}
+
+// References as a reader sees them; biased_refs is only exact on the owner
+static int cm_gc_refs(const CMObject* obj) {
+    int64_t w = __atomic_load_n(&obj->refs, __ATOMIC_RELAXED);
+    int n = (int)CM_RC_COUNT(w);
+    if (!(w & CM_RC_MERGED)) n += __atomic_load_n(&obj->biased_refs, __ATOMIC_RELAXED);
+    return n;
+}
+
+/* Slow path shared by cm_alloc and runtime objects that must never land in an arena */
+static void* cm_gc_alloc(size_t size, const char* type, const char* file, int line,
+                         void (*destructor)(void*)) {
+    if (size > SIZE_MAX - CM_GC_HEADER) return NULL;
+    CMObject* obj = (CMObject*)malloc(CM_GC_HEADER + size);
+    if (!obj) return NULL;
+    void* ptr = (char*)obj + CM_GC_HEADER;
+
+    obj->ptr = ptr;
+    obj->magic = CM_GC_MAGIC;
+    obj->size = size;
+    obj->type = type ? type : "unknown";
+    obj->file = file ? file : "unknown";
+    obj->line = line;
+    obj->alloc_time = time(NULL);
+    obj->refs = CM_RC_ONE | CM_RC_MERGED;
+    obj->biased_refs = 0;
+    obj->owner = NULL;
+    obj->queue_next = NULL;
+    obj->marked = 0;
+    obj->hash = 0;
+    obj->next = NULL;
+    obj->prev = NULL;
+    obj->destructor = destructor;
+    obj->mark_cb = NULL;
+    obj->sample_bytes = cm_heap_sample(size);
+    *cm_gc_tag(ptr) = (uintptr_t)ptr ^ CM_GC_TAG;
+
+    pthread_mutex_lock(&cm_mem.gc_lock);
+
+    // Only the start of a block is ever looked up, so that is all the span covers
+    uintptr_t end = (uintptr_t)ptr + 1;
+    if (!cm_mem.span_hi || (uintptr_t)ptr < cm_mem.span_lo) {
+        __atomic_store_n(&cm_mem.span_lo, (uintptr_t)ptr, __ATOMIC_RELAXED);
+    }
+    if (end > cm_mem.span_hi) __atomic_store_n(&cm_mem.span_hi, end, __ATOMIC_RELAXED);
+
+    if (obj->sample_bytes) {
+        obj->hash = cm_heap_record(obj->file, line, obj->type, obj->sample_bytes);
+    }
+
+    if (cm_mem.tail) {
+        cm_mem.tail->next = obj;
+        obj->prev = cm_mem.tail;
+        cm_mem.tail = obj;
+    } else {
+        cm_mem.head = cm_mem.tail = obj;
+    }
+
+    CM_STAT_ADD(cm_mem.total_objects, 1);
+    size_t live = CM_STAT_ADD(cm_mem.total_memory, size);
+    CM_STAT_ADD(cm_mem.allocations, 1);
+
+    if (live > cm_mem.peak_memory) {
+        CM_STAT_SET(cm_mem.peak_memory, live);
+    }
+
+    pthread_mutex_unlock(&cm_mem.gc_lock);
+
+    return ptr;
+}
+
+// Caller holds gc_lock
+static void cm_gc_unlink(CMObject* obj) {
+    if (obj->prev) {
+        obj->prev->next = obj->next;
+    } else {
+        cm_mem.head = obj->next;
+    }
+
+    if (obj->next) {
+        obj->next->prev = obj->prev;
+    } else {
+        cm_mem.tail = obj->prev;
+    }
+
+    CM_STAT_SUB(cm_mem.total_objects, 1);
+    CM_STAT_SUB(cm_mem.total_memory, obj->size);
+    CM_STAT_ADD(cm_mem.frees, 1);
+    cm_heap_unrecord(obj);
+}
+
+// Runs after this thread set CM_RC_DYING, so no one else can reach obj
+static void cm_gc_destroy(CMObject* obj) {
+    if (obj->destructor) {
+        obj->destructor(obj->ptr);
+    }
+    pthread_mutex_lock(&cm_mem.gc_lock);
+    cm_gc_unlink(obj);
+    pthread_mutex_unlock(&cm_mem.gc_lock);
+    *cm_gc_tag(obj->ptr) = 0;
+    obj->magic = 0;
+    free(obj);
+}
+
+static void cm_gc_owner_put(cm_gc_owner_t* o) {
+    if (__atomic_sub_fetch(&o->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_destroy(&o->lock);
+        free(o);
+    }
+}
+
+// Folds biased_refs into the shared count. Only the owner may call this,
+// or anyone once the owner has exited. Returns 1 if obj is now dying.
+static int cm_gc_merge(CMObject* obj) {
+    cm_gc_owner_t* owner = (cm_gc_owner_t*)__atomic_load_n(&obj->owner, __ATOMIC_RELAXED);
+    int64_t biased = __atomic_load_n(&obj->biased_refs, __ATOMIC_RELAXED);
+    int64_t old = __atomic_load_n(&obj->refs, __ATOMIC_RELAXED);
+    int64_t w;
+    do {
+        w = ((old & ~(int64_t)CM_RC_QUEUED) + biased * CM_RC_ONE) | CM_RC_MERGED;
+        if (CM_RC_COUNT(w) == 0) w |= CM_RC_DYING;
+    } while (!__atomic_compare_exchange_n(&obj->refs, &old, w, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    __atomic_store_n(&obj->owner, NULL, __ATOMIC_RELAXED);
+    cm_gc_owner_put(owner);
+    return (w & CM_RC_DYING) != 0;
+}
+
+// The shared count of a biased object went negative: ask its owner to merge
+static void cm_gc_enqueue(CMObject* obj) {
+    cm_gc_owner_t* o = (cm_gc_owner_t*)__atomic_load_n(&obj->owner, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&o->lock);
+    if (o->alive) {
+        obj->queue_next = o->queue;
+        o->queue = obj;
+        __atomic_store_n(&o->pending, 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&o->lock);
+        return;
+    }
+    pthread_mutex_unlock(&o->lock);
+
+    // The owner is gone, so its biased count can no longer change
+    if (cm_gc_merge(obj)) cm_gc_destroy(obj);
+}
+
+static size_t cm_gc_merge_list(CMObject* obj) {
+    size_t n = 0;
+    while (obj) {
+        CMObject* next = obj->queue_next;
+        if (cm_gc_merge(obj)) cm_gc_destroy(obj);
+        obj = next;
+        n++;
+    }
+    return n;
+}
+
+// Merges whatever other threads queued for this one; returns how many objects.
+// cm_alloc and cm_free do this on their own, so only threads that hand out
+// biased objects and then stop allocating need to call it.
+size_t cm_gc_drain(void) {
+    cm_gc_owner_t* o = cm_gc_self;
+    if (!o || !__atomic_load_n(&o->pending, __ATOMIC_ACQUIRE)) return 0;
+
+    pthread_mutex_lock(&o->lock);
+    CMObject* list = o->queue;
+    o->queue = NULL;
+    __atomic_store_n(&o->pending, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&o->lock);
+    return cm_gc_merge_list(list);
+}
+
+static void cm_gc_owner_exit(void* arg) {
+    cm_gc_owner_t* o = (cm_gc_owner_t*)arg;
+    pthread_mutex_lock(&o->lock);
+    o->alive = 0;
+    CMObject* list = o->queue;
+    o->queue = NULL;
+    pthread_mutex_unlock(&o->lock);
+
+    cm_gc_merge_list(list);
+    cm_gc_self = NULL;
+    cm_gc_biasing = 0;
+    cm_gc_owner_put(o);
+}
+
+static void cm_gc_owner_init(void) {
+    pthread_key_create(&cm_gc_owner_key, cm_gc_owner_exit);
+}
+
+// Biases objects this thread allocates from now on toward it (see above).
+// Worth it for objects retained and released mostly by the thread that made
+// them; objects handed off for good are better left unbiased.
+int cm_gc_bias_thread(int enable) {
+    if (enable && !cm_gc_self) {
+        pthread_once(&cm_gc_owner_once, cm_gc_owner_init);
+        cm_gc_owner_t* o = (cm_gc_owner_t*)calloc(1, sizeof(cm_gc_owner_t));
+        if (!o) {
+            cm_error_set(CM_ERROR_MEMORY, "Failed to allocate reference owner");
+            return CM_ERROR_MEMORY;
+        }
+        pthread_mutex_init(&o->lock, NULL);
+        o->alive = 1;
+        o->refs = 1;
+        if (pthread_setspecific(cm_gc_owner_key, o) != 0) {
+            pthread_mutex_destroy(&o->lock);
+            free(o);
+            cm_error_set(CM_ERROR_THREAD, "Failed to register reference owner");
+            return CM_ERROR_THREAD;
+        }
+        cm_gc_self = o;
+    }
+    cm_gc_biasing = enable ? 1 : 0;
+    return CM_SUCCESS;
+}
+
+void* cm_alloc(size_t size, const char* type, const char* file, int line) {
+    if (size == 0) return NULL;
+
+    /* 🚀 1. Fast Path: Check Arena allocation system for maximum performance */
+    CMArena* arena = cm_current_arena;
+    if (arena) {
+        /* Align memory to 8 bytes for CPU efficiency and to prevent alignment faults */
+        size_t aligned_size = (size + 7) & ~7;
+
+        if (arena->offset + aligned_size <= arena->block_size) {
+            void* ptr = (char*)arena->block + arena->offset;
+            arena->offset += aligned_size;
+
+            /* Update Arena usage statistics */
+            if (arena->offset > arena->peak_usage) {
+                arena->peak_usage = arena->offset;
+            }
+
+            /* ✅ IMPORTANT: Arena objects are not tracked by GC to eliminate overhead */
+            return ptr; /* Immediate return for maximum speed */
+        }
+
+        /* Fallback mechanism if the current arena is exhausted */
+        CM_STAT_ADD(cm_stats.arena_fallbacks, 1);
+        CM_TRACE_INSTANT("arena_fallback");
+        CM_LOG(CM_LOG_WARN, "[ARENA] Arena '%s' full, falling back to GC", arena->name);
+    }
+
+    void* ptr = cm_gc_alloc(size, type, file, line, NULL);
+    if (ptr && cm_gc_biasing) {
+        // Not yet visible to any other thread
+        CMObject* obj = (CMObject*)((char*)ptr - CM_GC_HEADER);
+        __atomic_add_fetch(&cm_gc_self->refs, 1, __ATOMIC_RELAXED);
+        obj->owner = cm_gc_self;
+        obj->biased_refs = 1;
+        __atomic_store_n(&obj->refs, 0, __ATOMIC_RELAXED);
+    }
+    if (cm_gc_self && __atomic_load_n(&cm_gc_self->pending, __ATOMIC_RELAXED)) cm_gc_drain();
+    return ptr;
+}
+
+// Drops one reference; the last one runs the destructor and frees the block.
+// Arena pointers are ignored, anything else must come from cm_alloc.
+void cm_free(void* ptr) {
+    if (!ptr) return;
+    CMObject* obj = cm_gc_object(ptr);
+    if (!obj) return;                    // ✅ من Arena = اتجاهله
+
+    cm_gc_owner_t* self = cm_gc_self;
+    if (self && __atomic_load_n(&obj->owner, __ATOMIC_RELAXED) == self) {
+        int biased = obj->biased_refs - 1;
+        __atomic_store_n(&obj->biased_refs, biased, __ATOMIC_RELAXED);
+        if (biased == 0) {
+            // Last owner reference: hand the object over to the shared count,
+            // unless it is queued, in which case the drain below (or a later one) merges it
+            int64_t old = __atomic_load_n(&obj->refs, __ATOMIC_RELAXED);
+            int64_t w;
+            do {
+                if (old & CM_RC_QUEUED) break;
+                w = old | CM_RC_MERGED;
+                if (CM_RC_COUNT(w) == 0) w |= CM_RC_DYING;
+            } while (!__atomic_compare_exchange_n(&obj->refs, &old, w, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+            if (!(old & CM_RC_QUEUED)) {
+                __atomic_store_n(&obj->owner, NULL, __ATOMIC_RELAXED);
+                cm_gc_owner_put(self);
+                if (w & CM_RC_DYING) cm_gc_destroy(obj);
+            }
+        }
+    } else {
+        int64_t old = __atomic_load_n(&obj->refs, __ATOMIC_RELAXED);
+        int64_t w;
+        do {
+            w = old - CM_RC_ONE;
+            if (w & CM_RC_MERGED) {
+                if (CM_RC_COUNT(w) == 0) w |= CM_RC_DYING;
+            } else if (CM_RC_COUNT(w) < 0) {
+                w |= CM_RC_QUEUED;
+            }
+        } while (!__atomic_compare_exchange_n(&obj->refs, &old, w, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+        if (w & CM_RC_DYING) cm_gc_destroy(obj);
+        else if ((w & CM_RC_QUEUED) && !(old & CM_RC_QUEUED)) cm_gc_enqueue(obj);
+    }
+
+    if (self && __atomic_load_n(&self->pending, __ATOMIC_RELAXED)) cm_gc_drain();
+}
+
+// Pause histogram bucket: under 1 us, then one bucket per power of two
+static unsigned cm_gc_pause_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    unsigned b = 0;
+    while (us && b < CM_METRICS_PAUSE_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void cm_gc_collect(void) {
+    CM_TRACE_SCOPE("cm_gc_collect");
+    pthread_mutex_lock(&cm_mem.gc_lock);
+    uint64_t start = cm_monotonic_ns();
+
+    // Logged into this thread's ring; the write happens on the flusher thread
+    CM_LOG(CM_LOG_DEBUG, "[GC] Starting collection...");
+
+    // Garbage is what cm_runtime_shutdown zeroed: a merged count of zero with no
+    // flags. Objects whose last release is in flight are already DYING.
+    for (CMObject* obj = cm_mem.head; obj; obj = obj->next) {
+        int64_t w = CM_RC_MERGED;
+        obj->marked = !__atomic_compare_exchange_n(&obj->refs, &w, CM_RC_MERGED | CM_RC_DYING, 0,
+                                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+
+    CMObject* current = cm_mem.head;
+    size_t freed_memory = 0;
+    int freed_objects = 0;
+
+    while (current) {
+        CMObject* next = current->next;
+
+        if (!current->marked) {
+            freed_memory += current->size;
+            freed_objects++;
+
+            if (current->destructor) {
+                current->destructor(current->ptr);
+            }
+            cm_gc_unlink(current);
+            *cm_gc_tag(current->ptr) = 0;
+            current->magic = 0;
+            free(current);
+        }
+
+        current = next;
+    }
+    CM_STAT_SET(cm_mem.gc_last_collection, freed_memory);
+
+    // Pause = time allocators were locked out
+    uint64_t pause = cm_monotonic_ns() - start;
+    CM_STAT_ADD(cm_mem.gc_pause_total_ns, pause);
+    if (pause > cm_mem.gc_pause_max_ns) CM_STAT_SET(cm_mem.gc_pause_max_ns, pause);
+    CM_STAT_ADD(cm_mem.gc_pause_hist[cm_gc_pause_bucket(pause)], 1);
+    CM_STAT_ADD(cm_mem.collections, 1);
+
+    // Deferred: only the two counters are copied while gc_lock is held
+    CM_LOGF(CM_LOG_DEBUG, "[GC] Completed: freed %ld objects (%lu bytes)", (long)freed_objects, freed_memory);
+
+    pthread_mutex_unlock(&cm_mem.gc_lock);
+}
+
+void cm_gc_stats(void) {
+    cm_metrics_t m;
+    cm_runtime_metrics(&m);
+
+    cm_printf("\n");
+cm_printf("══════════════════════════════════════════════════════════════\n");
+cm_printf("              GARBAGE COLLECTOR STATISTICS\n");
+cm_printf("──────────────────────────────────────────────────────────────\n");
+cm_printf("  Total objects    │ %20zu\n", m.live_objects);
+cm_printf("  Total memory     │ %20zu bytes\n", m.live_bytes);
+cm_printf("  Peak memory      │ %20zu bytes\n", m.peak_bytes);
+cm_printf("  Allocations      │ %20zu\n", m.allocations);
+cm_printf("  Frees            │ %20zu\n", m.frees);
+cm_printf("  Collections      │ %20zu\n", m.collections);
+cm_printf("──────────────────────────────────────────────────────────────\n");
+cm_printf("  Avg collection   │ %19.3f ms\n",
+          m.collections ? (double)m.gc_pause_total_ns / m.collections / 1e6 : 0.0);
+cm_printf("  Max collection   │ %19.3f ms\n", (double)m.gc_pause_max_ns / 1e6);
+cm_printf("  Last freed       │ %20zu bytes\n", m.gc_last_freed);
+if (cm_current_arena) {
+    cm_printf("──────────────────────────────────────────────────────────────\n");
+    cm_printf("  ARENA STATISTICS\n");
+    cm_printf("  Arena name       │ %20s\n", cm_current_arena->name);
+    cm_printf("  Arena size       │ %20zu bytes\n", cm_current_arena->block_size);
+    cm_printf("  Arena used       │ %20zu bytes\n", cm_current_arena->offset);
+    cm_printf("  Arena peak       │ %20zu bytes\n", cm_current_arena->peak_usage);
+}
+cm_printf("══════════════════════════════════════════════════════════════\n");
+
+// Only the object listing needs the lock; lower the log level to skip it
+if (m.live_objects > 0 && cm_log_enabled(CM_LOG_INFO)) {
+    pthread_mutex_lock(&cm_mem.gc_lock);
+    cm_printf("\nACTIVE OBJECTS:\n");
+    cm_printf("──────────────────────────────────────────────────────────────\n");
+
+int i=0;
+    for (CMObject* obj = cm_mem.head; obj; obj = obj->next) {
+        cm_printf("  [%d] %s (%zu bytes) at %s:%d [refs: %d]\n",
+                  ++i, obj->type ? obj->type : "unknown",
+                  obj->size, obj->file ? obj->file : "unknown",
+                  obj->line, cm_gc_refs(obj));
+    }
+    pthread_mutex_unlock(&cm_mem.gc_lock);
+}
+}
+
+void cm_set_destructor(void* ptr, void (*destructor)(void*)) {
+    if (!ptr) return;
+    CMObject* obj = cm_gc_object(ptr);
+    if (!obj) return;
+
+    // cm_gc_collect reads it under the lock
+    pthread_mutex_lock(&cm_mem.gc_lock);
+    obj->destructor = destructor;
+    pthread_mutex_unlock(&cm_mem.gc_lock);
+}
+
+// Lock-free; pair every call with a cm_free
+void cm_retain(void* ptr) {
+    if (!ptr) return;
+    CMObject* obj = cm_gc_object(ptr);
+    if (!obj) return;
+
+    if (cm_gc_self && __atomic_load_n(&obj->owner, __ATOMIC_RELAXED) == cm_gc_self) {
+        __atomic_store_n(&obj->biased_refs, obj->biased_refs + 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&obj->refs, CM_RC_ONE, __ATOMIC_RELAXED);
+    }
+}
+
+
+// في ملف CM.c - أضف هذه الدالة
+void cm_arena_cleanup(void* ptr) {
+    CMArena** arena_ptr = (CMArena**)ptr;
+    if (*arena_ptr) {
+        // POP الأول، بعد كده Destroy
+        cm_arena_release(*arena_ptr);
+        *arena_ptr = NULL;
+        
+        CM_LOG(CM_LOG_DEBUG, "[ARENA] Cleanup auto-destroyed arena");
+    }
+}
+
+
+
+/* ============================================================================
+ * ERROR HANDLING IMPLEMENTATION
+ * ============================================================================ */
+const char* cm_error_string(int error) {
+    switch(error) {
+        case CM_SUCCESS: return "Success";
+        case CM_ERROR_MEMORY: return "Memory allocation failed";
+        case CM_ERROR_NULL_POINTER: return "Null pointer dereference";
+        case CM_ERROR_OUT_OF_BOUNDS: return "Index out of bounds";
+        case CM_ERROR_DIVISION_BY_ZERO: return "Division by zero";
+        case CM_ERROR_OVERFLOW: return "Integer overflow";
+        case CM_ERROR_UNDERFLOW: return "Integer underflow";
+        case CM_ERROR_INVALID_ARGUMENT: return "Invalid argument";
+        case CM_ERROR_NOT_FOUND: return "Not found";
+        case CM_ERROR_ALREADY_EXISTS: return "Already exists";
+        case CM_ERROR_PERMISSION_DENIED: return "Permission denied";
+        case CM_ERROR_IO: return "I/O error";
+        case CM_ERROR_NETWORK: return "Network error";
+        case CM_ERROR_TIMEOUT: return "Operation timed out";
+        case CM_ERROR_THREAD: return "Thread error";
+        case CM_ERROR_SYNC: return "Synchronization error";
+        case CM_ERROR_PARSE: return "Parse error";
+        case CM_ERROR_TYPE: return "Type error";
+        case CM_ERROR_UNIMPLEMENTED: return "Unimplemented";
+        case CM_ERROR_UNKNOWN: return "Unknown error";
+        case CM_ERROR_WOULD_BLOCK: return "Operation would block";
+        case CM_ERROR_CLOSED: return "Channel closed";
+        default: return "Unknown error code";
+    }
+}
+
+// Each thread owns its error state; a running coroutine points this at its own
+static __thread cm_error_t cm_error_thread;
+static __thread char cm_error_thread_text[CM_ERROR_MESSAGE_MAX];
+static __thread cm_error_t* cm_error_state = NULL;
+
+cm_error_t* cm_error_current(void) {
+    return cm_error_state ? cm_error_state : &cm_error_thread;
+}
+
+static char* cm_error_text(cm_error_t* e) {
+    if (!e->text) {
+        e->text = e == &cm_error_thread ? cm_error_thread_text
+                                        : (char*)malloc(CM_ERROR_MESSAGE_MAX);
+    }
+    return e->text;
+}
+
+const char* cm_error_get_message(void) {
+    cm_error_t* e = cm_error_current();
+    if (e->fmt) {
+        char* text = cm_error_text(e);
+        if (text) {
+            uintptr_t a[CM_LOG_MAX_ARGS] = {0};
+            memcpy(a, e->args, (size_t)e->nargs * sizeof(uintptr_t));
+            snprintf(text, CM_ERROR_MESSAGE_MAX, e->fmt, a[0], a[1], a[2], a[3], a[4], a[5]);
+            e->message = text;
+        } else {
+            e->message = e->fmt;
+        }
+        e->fmt = NULL;
+    }
+    return e->message ? e->message : "";
+}
+
+int cm_error_get_last(void) {
+    return cm_error_current()->code;
+}
+
+void cm_error_clear(void) {
+    cm_error_t* e = cm_error_current();
+    e->code = 0;
+    e->message = NULL;
+    e->fmt = NULL;
+}
+
+void cm_error_set(int error, const char* message) {
+    cm_error_t* e = cm_error_current();
+    e->code = error;
+    if (!message) return;
+
+    char* text = cm_error_text(e);
+    if (!text) {
+        e->message = "(error message lost: out of memory)";
+    } else {
+        // memmove: rethrowing cm_error_get_message() passes our own buffer back in
+        // memchr, which is defined to stop at the first match, so callers'
+        // short buffers (cm_json_parse's 128 bytes) do not trip -O3 overread checks
+        const char* end = (const char*)memchr(message, '\0', CM_ERROR_MESSAGE_MAX - 1);
+        size_t n = end ? (size_t)(end - message) : CM_ERROR_MESSAGE_MAX - 1;
+        memmove(text, message, n);
+        text[n] = '\0';
+        e->message = text;
+    }
+    e->fmt = NULL;
+}
+
+void cm_error_set_static(int error, const char* message) {
+    cm_error_t* e = cm_error_current();
+    e->code = error;
+    e->message = message;
+    e->fmt = NULL;
+}
+
+void cm_error_set_deferred(int error, const char* format, const uintptr_t* args, int nargs) {
+    cm_error_t* e = cm_error_current();
+    if (nargs < 0) nargs = 0;
+    if (nargs > CM_LOG_MAX_ARGS) nargs = CM_LOG_MAX_ARGS;
+    e->code = error;
+    e->message = NULL;
+    e->fmt = format;
+    e->nargs = nargs;
+    if (nargs) memcpy(e->args, args, (size_t)nargs * sizeof(uintptr_t));
+}
+
+// Runs the cleanups above the innermost CM_TRY, newest first, then jumps to it.
+// Each entry is unlinked before it runs, so a cleanup that throws keeps unwinding.
+void cm_error_throw(int error) {
+    cm_cleanup_t* frame = cm_cleanup_top;
+    while (frame && frame->fn) frame = frame->prev;
+    if (!frame) {
+        if (cm_exception_buffer) longjmp(*cm_exception_buffer, error ? error : 1);
+        fprintf(stderr, "FATAL: Uncaught exception: %s\n", cm_error_get_message());
+        exit(error);
+    }
+
+    while (cm_cleanup_top != frame) {
+        cm_cleanup_t* c = cm_cleanup_top;
+        cm_cleanup_top = c->prev;
+        c->fn(c->arg);
+    }
+    cm_cleanup_top = frame->prev;
+    jmp_buf* target = (jmp_buf*)frame->arg;
+    frame->arg = NULL;                   // popped: its cleanup attribute has nothing left to do
+    cm_try_caught = 1;
+    longjmp(*target, error ? error : 1);
+}
+
+int cm_try_end(void) {
+    if (cm_try_caught) {
+        cm_try_caught = 0;
+        return 1;
+    }
+    // The body ran to completion: nothing it pushed is left above its frame
+    cm_cleanup_t* frame = cm_cleanup_top;
+    cm_cleanup_top = frame->prev;
+    frame->arg = NULL;
+    return 0;
+}
+
+void cm_try_leave(cm_cleanup_t* frame) {
+    if (!frame->arg) return;
+    cm_cleanup_top = frame->prev;
+    frame->arg = NULL;
+}
+
+cm_cleanup_t* cm_cleanup_push(cm_cleanup_t* c, void (*fn)(void*), void* arg) {
+    c->fn = fn;
+    c->arg = arg;
+    c->prev = cm_cleanup_top;
+    cm_cleanup_top = c;
+    return c;
+}
+
+void cm_cleanup_pop(cm_cleanup_t* c, int run) {
+    cm_cleanup_top = c->prev;
+    if (run && c->fn) c->fn(c->arg);
+}
+
+void cm_cleanup_leave(cm_cleanup_t* c) {
+    cm_cleanup_pop(c, 1);
+}
+
+/* ============================================================================
+ * OBJECT POOL IMPLEMENTATION
+ * ============================================================================ */
+#define CM_POOL_SLOTS 64                 // pools past this many share one locked free list
+#define CM_POOL_BATCH 32                 // objects moved between a thread cache and the pool at once
+#define CM_POOL_ALIGN 16
+
+struct cm_pool {
+    size_t obj_size;                     // rounded up to CM_POOL_ALIGN
+    size_t per_chunk;
+    void (*ctor)(void*);
+    void (*dtor)(void*);
+
+    pthread_mutex_t lock;                // guards everything below except the counters
+    void* free_list;                     // linked through each object's first word
+    size_t free_count;
+    void* chunks;                        // linked through each chunk's first word
+    size_t chunk_count;
+
+    int slot;                            // thread cache index, -1 if none
+    uint64_t serial;                     // tells a reused slot from the pool that held it
+    size_t allocs;                       // atomic; thread caches publish in batches
+    size_t frees;
+};
+
+// Each thread keeps a short free list per pool slot. The serial check drops a
+// cache left over from a destroyed pool without touching its (freed) objects.
+typedef struct {
+    uint64_t serial;
+    void* head;
+    size_t count;
+    size_t allocs;                       // not yet added to the pool's counters
+    size_t frees;
+} cm_pool_cache_t;
+
+static __thread cm_pool_cache_t cm_pool_caches[CM_POOL_SLOTS];
+static __thread int cm_pool_thread_armed = 0;
+static cm_pool_t* cm_pool_slots[CM_POOL_SLOTS];
+static uint64_t cm_pool_next_serial = 0;
+static pthread_mutex_t cm_pool_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cm_pool_key;
+static pthread_once_t cm_pool_once = PTHREAD_ONCE_INIT;
+
+static inline void* cm_pool_next(void* obj) {
+    return *(void**)obj;
+}
+
+static inline void cm_pool_link(void* obj, void* next) {
+    *(void**)obj = next;
+}
+
+static void cm_pool_publish(cm_pool_t* pool, cm_pool_cache_t* c) {
+    if (c->allocs) __atomic_add_fetch(&pool->allocs, c->allocs, __ATOMIC_RELAXED);
+    if (c->frees) __atomic_add_fetch(&pool->frees, c->frees, __ATOMIC_RELAXED);
+    c->allocs = 0;
+    c->frees = 0;
+}
+
+// Moves up to n objects from the front of the cache to the pool's list; pool->lock held
+static void cm_pool_spill(cm_pool_t* pool, cm_pool_cache_t* c, size_t n) {
+    while (n-- > 0 && c->head) {
+        void* obj = c->head;
+        c->head = cm_pool_next(obj);
+        c->count--;
+        cm_pool_link(obj, pool->free_list);
+        pool->free_list = obj;
+        pool->free_count++;
+    }
+}
+
+// Hands every cache this thread holds back to its pool, if the pool still exists
+static void cm_pool_thread_exit(void* unused) {
+    (void)unused;
+    pthread_mutex_lock(&cm_pool_registry_lock);
+    for (int i = 0; i < CM_POOL_SLOTS; i++) {
+        cm_pool_cache_t* c = &cm_pool_caches[i];
+        cm_pool_t* pool = cm_pool_slots[i];
+        if (pool && pool->serial == c->serial) {
+            pthread_mutex_lock(&pool->lock);
+            cm_pool_spill(pool, c, c->count);
+            pthread_mutex_unlock(&pool->lock);
+            cm_pool_publish(pool, c);
+        }
+        memset(c, 0, sizeof(*c));
+    }
+    pthread_mutex_unlock(&cm_pool_registry_lock);
+}
+
+static void cm_pool_init(void) {
+    pthread_key_create(&cm_pool_key, cm_pool_thread_exit);
+}
+
+static inline cm_pool_cache_t* cm_pool_cache(cm_pool_t* pool) {
+    if (pool->slot < 0) return NULL;
+
+    cm_pool_cache_t* c = &cm_pool_caches[pool->slot];
+    if (c->serial != pool->serial) {
+        if (!cm_pool_thread_armed) {
+            // Any non-NULL value makes the key's destructor run at thread exit
+            pthread_setspecific(cm_pool_key, cm_pool_caches);
+            cm_pool_thread_armed = 1;
+        }
+        memset(c, 0, sizeof(*c));
+        c->serial = pool->serial;
+    }
+    return c;
+}
+
+// Carves one more chunk onto the free list; pool->lock held
+static int cm_pool_grow(cm_pool_t* pool) {
+    char* chunk = (char*)malloc(CM_POOL_ALIGN + pool->obj_size * pool->per_chunk);
+    if (!chunk) return CM_ERROR_MEMORY;
+
+    cm_pool_link(chunk, pool->chunks);
+    pool->chunks = chunk;
+    pool->chunk_count++;
+
+    // Link back to front so that objects come out in address order
+    char* base = chunk + CM_POOL_ALIGN;
+    for (size_t i = pool->per_chunk; i-- > 0;) {
+        void* obj = base + i * pool->obj_size;
+        cm_pool_link(obj, pool->free_list);
+        pool->free_list = obj;
+    }
+    pool->free_count += pool->per_chunk;
+    return CM_SUCCESS;
+}
+
+// Pops one object off the shared list, growing it if empty; pool->lock held
+static void* cm_pool_take(cm_pool_t* pool) {
+    if (!pool->free_list && cm_pool_grow(pool) != CM_SUCCESS) return NULL;
+    void* obj = pool->free_list;
+    pool->free_list = cm_pool_next(obj);
+    pool->free_count--;
+    return obj;
+}
+
+static int cm_pool_refill(cm_pool_t* pool, cm_pool_cache_t* c) {
+    pthread_mutex_lock(&pool->lock);
+    for (size_t i = 0; i < CM_POOL_BATCH; i++) {
+        void* obj = cm_pool_take(pool);
+        if (!obj) break;
+        cm_pool_link(obj, c->head);
+        c->head = obj;
+        c->count++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    cm_pool_publish(pool, c);
+    return c->head ? CM_SUCCESS : CM_ERROR_MEMORY;
+}
+
+cm_pool_t* cm_pool_create(size_t obj_size, size_t per_chunk) {
+    if (obj_size == 0) {
+        cm_error_set(CM_ERROR_INVALID_ARGUMENT, "Pool object size must be non-zero");
+        return NULL;
+    }
+    if (per_chunk == 0) per_chunk = CM_POOL_DEFAULT_CHUNK;
+    if (obj_size < sizeof(void*)) obj_size = sizeof(void*);
+    obj_size = (obj_size + CM_POOL_ALIGN - 1) & ~(size_t)(CM_POOL_ALIGN - 1);
+    if (per_chunk > (SIZE_MAX - CM_POOL_ALIGN) / obj_size) {
+        cm_error_set(CM_ERROR_OVERFLOW, "Pool chunk size overflows");
+        return NULL;
+    }
+
+    pthread_once(&cm_pool_once, cm_pool_init);
+
+    cm_pool_t* pool = (cm_pool_t*)calloc(1, sizeof(cm_pool_t));
+    if (!pool) {
+        cm_error_set(CM_ERROR_MEMORY, "Failed to allocate pool");
+        return NULL;
+    }
+    pool->obj_size = obj_size;
+    pool->per_chunk = per_chunk;
+    pool->slot = -1;
+    pthread_mutex_init(&pool->lock, NULL);
+
+    pthread_mutex_lock(&cm_pool_registry_lock);
+    pool->serial = ++cm_pool_next_serial;
+    for (int i = 0; i < CM_POOL_SLOTS; i++) {
+        if (!cm_pool_slots[i]) {
+            cm_pool_slots[i] = pool;
+            pool->slot = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cm_pool_registry_lock);
+    return pool;
+}
+
+// ctor runs on every object cm_pool_alloc returns, dtor on every object cm_pool_free takes back
+void cm_pool_set_hooks(cm_pool_t* pool, void (*ctor)(void*), void (*dtor)(void*)) {
+    if (!pool) return;
+    pool->ctor = ctor;
+    pool->dtor = dtor;
+}
+
+void* cm_pool_alloc(cm_pool_t* pool) {
+    if (!pool) return NULL;
+
+    void* obj;
+    cm_pool_cache_t* c = cm_pool_cache(pool);
+    if (c) {
+        if (!c->head && cm_pool_refill(pool, c) != CM_SUCCESS) {
+            cm_error_set(CM_ERROR_MEMORY, "Failed to grow pool");
+            return NULL;
+        }
+        obj = c->head;
+        c->head = cm_pool_next(obj);
+        c->count--;
+        c->allocs++;
+    } else {
+        pthread_mutex_lock(&pool->lock);
+        obj = cm_pool_take(pool);
+        pthread_mutex_unlock(&pool->lock);
+        if (!obj) {
+            cm_error_set(CM_ERROR_MEMORY, "Failed to grow pool");
+            return NULL;
+        }
+        __atomic_add_fetch(&pool->allocs, 1, __ATOMIC_RELAXED);
+    }
+
+    if (pool->ctor) pool->ctor(obj);
+    return obj;
+}
+
+// Objects may be freed from any thread; they join that thread's cache
+void cm_pool_free(cm_pool_t* pool, void* obj) {
+    if (!pool || !obj) return;
+    if (pool->dtor) pool->dtor(obj);
+
+    cm_pool_cache_t* c = cm_pool_cache(pool);
+    if (c) {
+        cm_pool_link(obj, c->head);
+        c->head = obj;
+        c->count++;
+        c->frees++;
+        if (c->count >= 2 * CM_POOL_BATCH) {
+            pthread_mutex_lock(&pool->lock);
+            cm_pool_spill(pool, c, CM_POOL_BATCH);
+            pthread_mutex_unlock(&pool->lock);
+            cm_pool_publish(pool, c);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    cm_pool_link(obj, pool->free_list);
+    pool->free_list = obj;
+    pool->free_count++;
+    pthread_mutex_unlock(&pool->lock);
+    __atomic_add_fetch(&pool->frees, 1, __ATOMIC_RELAXED);
+}
+
+// Counts from other threads lag by up to one batch each; the caller's own are exact
+void cm_pool_stats(cm_pool_t* pool, cm_pool_stats_t* out) {
+    if (!pool || !out) return;
+    memset(out, 0, sizeof(*out));
+
+    pthread_mutex_lock(&pool->lock);
+    out->chunks = pool->chunk_count;
+    out->capacity = pool->chunk_count * pool->per_chunk;
+    out->free_shared = pool->free_count;
+    pthread_mutex_unlock(&pool->lock);
+
+    out->obj_size = pool->obj_size;
+    out->allocs = __atomic_load_n(&pool->allocs, __ATOMIC_RELAXED);
+    out->frees = __atomic_load_n(&pool->frees, __ATOMIC_RELAXED);
+    if (pool->slot >= 0 && cm_pool_caches[pool->slot].serial == pool->serial) {
+        out->allocs += cm_pool_caches[pool->slot].allocs;
+        out->frees += cm_pool_caches[pool->slot].frees;
+    }
+    out->in_use = out->allocs > out->frees ? out->allocs - out->frees : 0;
+}
+
+// Releases every chunk at once. Objects still out are gone with it, and their
+// dtor does not run; other threads must be done with the pool by now.
+void cm_pool_destroy(cm_pool_t* pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&cm_pool_registry_lock);
+    if (pool->slot >= 0) cm_pool_slots[pool->slot] = NULL;
+    pthread_mutex_unlock(&cm_pool_registry_lock);
+    if (pool->slot >= 0) memset(&cm_pool_caches[pool->slot], 0, sizeof(cm_pool_cache_t));
+
+    void* chunk = pool->chunks;
+    while (chunk) {
+        void* next = cm_pool_next(chunk);
+        free(chunk);
+        chunk = next;
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+#if CM_POOLS
+// Fixed-size headers the library allocates constantly draw from these
+static cm_pool_t* cm_map_entry_pool;
+static cm_pool_t* cm_string_header_pool;
+static pthread_once_t cm_builtin_pools_once = PTHREAD_ONCE_INIT;
+
+static void cm_builtin_pools_init(void) {
+    cm_map_entry_pool = cm_pool_create(sizeof(cm_map_entry_t), 0);
+    cm_string_header_pool = cm_pool_create(sizeof(cm_string_t), 0);
+}
+
+static inline cm_pool_t* cm_builtin_pool(cm_pool_t** pool) {
+    pthread_once(&cm_builtin_pools_once, cm_builtin_pools_init);
+    return *pool;
+}
+#endif
+
+/* ============================================================================
+ * STRING IMPLEMENTATION
+ * ============================================================================ */
+#define CM_STRING_COPY 0x01
+#define CM_STRING_NOCOPY 0x02            // data is borrowed from the caller (cm_string_wrap)
+#define CM_STRING_INLINE 0x04            // data lives in the same allocation as the header
+#define CM_STRING_SHARED 0x08            // data is the text of a refcounted cm_strbuf_t
+#define CM_STRING_POOLED 0x10            // header came from cm_string_header_pool
+#define CM_STRING_STACK_FORMAT 256       // first formatting attempt goes here
+#define CM_STRING_SHARE_MIN 64           // shorter inline texts are copied rather than shared
+
+// Separately allocated text carries its own refcount so that cm_string_copy
+// can hand the same bytes to several headers; writers copy while it is > 1
+typedef struct {
+    int refs;
+    char text[];
+} cm_strbuf_t;
+
+static char* cm_strbuf_new(size_t capacity) {
+    cm_strbuf_t* b = (cm_strbuf_t*)cm_alloc(sizeof(cm_strbuf_t) + capacity, "string_data", __FILE__, __LINE__);
+    if (!b) return NULL;
+    b->refs = 1;
+    return b->text;
+}
+
+static inline cm_strbuf_t* cm_strbuf_of(const char* text) {
+    return (cm_strbuf_t*)(text - offsetof(cm_strbuf_t, text));
+}
+
+static void cm_strbuf_release(char* text) {
+    cm_strbuf_t* b = cm_strbuf_of(text);
+    if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0) cm_free(b);
+}
+
+// Header and text in one allocation (and so in the current arena, if any)
+static cm_string_t* cm_string_alloc_inline(const char* text, size_t len, size_t capacity) {
+    cm_string_t* s = (cm_string_t*)cm_alloc(sizeof(cm_string_t) + capacity, "string", __FILE__, __LINE__);
+    if (!s) return NULL;
+
+    s->data = (char*)(s + 1);
+    s->length = len;
+    s->capacity = capacity;
+    s->ref_count = 1;
+    s->hash = 0;
+    s->created = time(NULL);
+    s->flags = CM_STRING_COPY | CM_STRING_INLINE;
+    if (text) memcpy(s->data, text, len);
+    s->data[len] = '\0';
+    return s;
+}
+
+static cm_string_t* cm_string_alloc_header(char* data, size_t len, size_t capacity, int flags) {
+#if CM_POOLS
+    cm_string_t* s = (cm_string_t*)cm_pool_alloc(cm_builtin_pool(&cm_string_header_pool));
+    if (s) flags |= CM_STRING_POOLED;
+#else
+    cm_string_t* s = (cm_string_t*)cm_alloc(sizeof(cm_string_t), "string", __FILE__, __LINE__);
+#endif
+    if (!s) return NULL;
+
+    s->data = data;
+    s->length = len;
+    s->capacity = capacity;
+    s->ref_count = 1;
+    s->hash = 0;
+    s->created = time(NULL);
+    s->flags = flags;
+    return s;
+}
+
+static void cm_string_release_text(cm_string_t* s) {
+    if (!s->data) return;
+    if (s->flags & CM_STRING_SHARED) cm_strbuf_release(s->data);
+    else if (!(s->flags & (CM_STRING_NOCOPY | CM_STRING_INLINE))) cm_free(s->data);
+}
+
+// Replaces s->data with a fresh cm_strbuf_new text, letting go of the old one
+static void cm_string_adopt(cm_string_t* s, char* data, size_t capacity) {
+    cm_string_release_text(s);
+    s->data = data;
+    s->capacity = capacity;
+    s->flags &= ~(CM_STRING_NOCOPY | CM_STRING_INLINE);
+    s->flags |= CM_STRING_SHARED;
+}
+
+// Borrowed text and text another header still reads must be copied before a write
+static inline int cm_string_writable(const cm_string_t* s) {
+    if (s->flags & CM_STRING_NOCOPY) return 0;
+    if (s->flags & CM_STRING_SHARED) {
+        return __atomic_load_n(&cm_strbuf_of(s->data)->refs, __ATOMIC_ACQUIRE) == 1;
+    }
+    return 1;
+}
+
+cm_string_t* cm_string_new(const char* initial) {
+    size_t len = initial ? strlen(initial) : 0;
+    return cm_string_alloc_inline(initial, len, len + 1);
+}
+
+// data must outlive the string; it is only read, and copied on the first write.
+// Every reader may treat s->data as a C string, so text without a NUL at
+// data[length] (which must be readable) is copied instead of borrowed.
+cm_string_t* cm_string_wrap(const char* data, size_t length) {
+    if (!data) return NULL;
+    if (data[length] != '\0') return cm_string_alloc_inline(data, length, length + 1);
+    return cm_string_alloc_header((char*)data, length, length, CM_STRING_NOCOPY);
+}
+
+cm_string_t* cm_string_copy(cm_string_t* s) {
+    if (!s || !s->data) return NULL;
+    if (s->flags & CM_STRING_NOCOPY) return cm_string_wrap(s->data, s->length);
+
+    if (!(s->flags & CM_STRING_SHARED)) {
+        if (s->length < CM_STRING_SHARE_MIN) {
+            return cm_string_alloc_inline(s->data, s->length, s->length + 1);
+        }
+        // s may have concurrent readers, so it is left alone: the copy gets its own
+        // shareable text, and copies of the copy are then just headers
+        char* text = cm_strbuf_new(s->length + 1);
+        if (!text) return NULL;
+        memcpy(text, s->data, s->length + 1);
+        cm_string_t* c = cm_string_alloc_header(text, s->length, s->length + 1,
+                                                CM_STRING_COPY | CM_STRING_SHARED);
+        if (!c) {
+            cm_strbuf_release(text);
+            return NULL;
+        }
+        c->hash = s->hash;
+        return c;
+    }
+
+    cm_string_t* c = cm_string_alloc_header(s->data, s->length, s->capacity, CM_STRING_COPY | CM_STRING_SHARED);
+    if (!c) return NULL;
+    c->hash = s->hash;
+    __atomic_add_fetch(&cm_strbuf_of(s->data)->refs, 1, __ATOMIC_RELAXED);
+    return c;
+}
+
+void cm_string_retain(cm_string_t* s) {
+    if (s) __atomic_add_fetch(&s->ref_count, 1, __ATOMIC_RELAXED);
+}
+
+void cm_string_free(cm_string_t* s) {
+    if (!s) return;
+
+    if (__atomic_sub_fetch(&s->ref_count, 1, __ATOMIC_ACQ_REL) <= 0) {
+        cm_string_release_text(s);
+#if CM_POOLS
+        if (s->flags & CM_STRING_POOLED) {
+            cm_pool_free(cm_string_header_pool, s);
+            return;
+        }
+#endif
+        cm_free(s);
+    }
+}
+
+size_t cm_string_length(cm_string_t* s) {
+    return s ? s->length : 0;
+}
+
+int cm_string_reserve(cm_string_t* s, size_t capacity) {
+    if (!s) return CM_ERROR_NULL_POINTER;
+    int writable = cm_string_writable(s);
+    if (capacity <= s->capacity && writable) return CM_SUCCESS;
+
+    size_t cap = s->length + 1;
+    if (capacity > s->capacity) {
+        cap = s->capacity * 2;
+        if (cap < capacity) cap = capacity;
+    } else if (cap < s->capacity) {
+        cap = s->capacity;
+    }
+    char* data = cm_strbuf_new(cap);
+    if (!data) return CM_ERROR_MEMORY;
+    memcpy(data, s->data, s->length);
+    data[s->length] = '\0';
+    cm_string_adopt(s, data, cap);
+    return CM_SUCCESS;
+}
+
+/* ---- Formatter ----
+ * Writes into a growable buffer in one pass. Integers, %s, %c and %.Nf take
+ * the fast paths below; any other conversion is handed to snprintf on its own,
+ * and formats using '*' or %n go to vsnprintf as a whole. */
+typedef struct cm_fmt_out {
+    char* data;
+    size_t len;
+    size_t cap;                           // bytes available at data, terminator included
+    int (*grow)(struct cm_fmt_out* out, size_t need);
+    void* ctx;
+    int failed;                           // a grow failed, so some output was dropped
+} cm_fmt_out_t;
+
+static const char cm_fmt_digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static inline int cm_fmt_reserve(cm_fmt_out_t* out, size_t n) {
+    if (out->len + n < out->cap) return 0;
+    if (out->grow(out, out->len + n + 1) == 0) return 0;
+    out->failed = 1;
+    return -1;
+}
+
+// Drops what it cannot fit; out->failed tells the caller afterwards
+static inline void cm_fmt_put(cm_fmt_out_t* out, const char* text, size_t n) {
+    if (cm_fmt_reserve(out, n) != 0) return;
+    memcpy(out->data + out->len, text, n);
+    out->len += n;
+}
+
+// Digits of v written backwards so they end at end; returns their count
+static inline size_t cm_fmt_u64(char* end, uint64_t v) {
+    char* p = end;
+    while (v >= 100) {
+        const char* d = cm_fmt_digits + (v % 100) * 2;
+        v /= 100;
+        *--p = d[1];
+        *--p = d[0];
+    }
+    if (v >= 10) {
+        const char* d = cm_fmt_digits + v * 2;
+        *--p = d[1];
+        *--p = d[0];
+    } else {
+        *--p = (char)('0' + v);
+    }
+    return (size_t)(end - p);
+}
+
+static void cm_fmt_int(cm_fmt_out_t* out, int64_t v) {
+    char buf[24];
+    uint64_t mag = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+    size_t n = cm_fmt_u64(buf + sizeof(buf), mag);
+    if (v < 0) buf[sizeof(buf) - ++n] = '-';
+    cm_fmt_put(out, buf + sizeof(buf) - n, n);
+}
+
+static void cm_fmt_uint(cm_fmt_out_t* out, uint64_t v) {
+    char buf[24];
+    size_t n = cm_fmt_u64(buf + sizeof(buf), v);
+    cm_fmt_put(out, buf + sizeof(buf) - n, n);
+}
+
+static void cm_fmt_hex(cm_fmt_out_t* out, uint64_t v, int upper) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char buf[16];
+    char* p = buf + sizeof(buf);
+    do {
+        *--p = digits[v & 15];
+        v >>= 4;
+    } while (v);
+    cm_fmt_put(out, p, (size_t)(buf + sizeof(buf) - p));
+}
+
+// %.Nf without snprintf. x * 10^N carries a single rounding error, far below
+// 2^-12 while it stays under 2^40, so rounding it agrees with printf's exact
+// decimal rounding unless it lands next to a tie; those return -1.
+static int cm_fmt_fixed(cm_fmt_out_t* out, double x, int prec) {
+    static const double scale[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+    static const uint64_t iscale[] = { 1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull,
+                                       1000000ull, 10000000ull, 100000000ull, 1000000000ull };
+    if (prec > 9 || !isfinite(x)) return -1;
+
+    double v = fabs(x) * scale[prec];
+    if (v >= 1099511627776.0) return -1;
+    double whole = floor(v);
+    double frac = v - whole;
+    if (fabs(frac - 0.5) < 1e-3) return -1;
+    uint64_t r = (uint64_t)whole + (frac > 0.5);
+
+    char buf[48];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    if (prec > 0) {
+        uint64_t f = r % iscale[prec];
+        for (int i = 0; i < prec; i++) {
+            *--p = (char)('0' + f % 10);
+            f /= 10;
+        }
+        *--p = '.';
+    }
+    p -= cm_fmt_u64(p, r / iscale[prec]);
+    if (signbit(x)) *--p = '-';
+    cm_fmt_put(out, p, (size_t)(end - p));
+    return 0;
+}
+
+// One conversion through snprintf, straight into the output buffer
+#define CM_FMT_SNPRINTF(out, spec, value) \
+    do { \
+        size_t __room = (out)->cap - (out)->len; \
+        int __n = snprintf((out)->data + (out)->len, __room, spec, value); \
+        if (__n < 0) goto fail; \
+        if ((size_t)__n >= __room) { \
+            if ((out)->grow(out, (out)->len + (size_t)__n + 1) != 0) goto fail; \
+            snprintf((out)->data + (out)->len, (size_t)__n + 1, spec, value); \
+        } \
+        (out)->len += (size_t)__n; \
+    } while (0)
+
+static int cm_fmt_whole(cm_fmt_out_t* out, size_t base, const char* format, va_list args) {
+    va_list again;
+    va_copy(again, args);
+    out->len = base;
+    out->failed = 0;                      // everything from base is rendered again
+    size_t room = out->cap - out->len;
+    int n = vsnprintf(out->data + out->len, room, format, args);
+    if (n >= 0 && (size_t)n >= room) {
+        if (out->grow(out, out->len + (size_t)n + 1) != 0) {
+            out->failed = 1;
+            n = -1;
+        } else vsnprintf(out->data + out->len, (size_t)n + 1, format, again);
+    }
+    va_end(again);
+    if (n < 0) return -1;
+    out->len += (size_t)n;
+    return 0;
+}
+
+static int cm_fmt_vformat(cm_fmt_out_t* out, const char* format, va_list args) {
+    size_t base = out->len;
+    va_list start;
+    va_copy(start, args);
+
+    const char* f = format;
+    while (*f) {
+        const char* pct = strchr(f, '%');
+        if (!pct) {
+            cm_fmt_put(out, f, strlen(f));
+            break;
+        }
+        if (pct > f) cm_fmt_put(out, f, (size_t)(pct - f));
+
+        // %[flags][width][.precision][length]conversion
+        const char* p = pct + 1;
+        int plain = 1;
+        while (*p && strchr("-+ #0'", *p)) { p++; plain = 0; }
+        while (*p >= '0' && *p <= '9') { p++; plain = 0; }
+        int prec = -1;
+        if (*p == '.') {
+            prec = 0;
+            for (p++; *p >= '0' && *p <= '9'; p++) prec = prec * 10 + (*p - '0');
+        }
+        if (*p == '*') goto whole;
+        size_t head = (size_t)(p - pct);  // '%' through the precision
+        int len = 0;                      // 0 int, 1 long, 2 long long, 3 size_t, 4 intmax_t, 5 ptrdiff_t, 6 short, 7 char, 8 long double
+        switch (*p) {
+            case 'l': len = 1; if (*++p == 'l') { len = 2; p++; } break;
+            case 'z': len = 3; p++; break;
+            case 'j': len = 4; p++; break;
+            case 't': len = 5; p++; break;
+            case 'h': len = 6; if (*++p == 'h') { len = 7; p++; } break;
+            case 'L': len = 8; p++; break;
+        }
+        char conv = *p;
+        if (!conv || conv == 'n') goto whole;
+
+        // Fallback specs: as written, or widened to ll for the integer conversions
+        char spec[32], wide[32];
+        size_t spec_len = (size_t)(p - pct) + 1;
+        if (spec_len >= sizeof(spec) || head + 4 > sizeof(wide)) goto whole;
+        memcpy(spec, pct, spec_len);
+        spec[spec_len] = '\0';
+        memcpy(wide, pct, head);
+        memcpy(wide + head, "ll", 2);
+        wide[head + 2] = conv;
+        wide[head + 3] = '\0';
+        int fast = plain && prec < 0;
+
+        switch (conv) {
+            case '%':
+                cm_fmt_put(out, "%", 1);
+                break;
+            case 'd': case 'i': {
+                int64_t v;
+                switch (len) {
+                    case 1: v = va_arg(args, long); break;
+                    case 2: v = va_arg(args, long long); break;
+                    case 3: v = va_arg(args, ssize_t); break;
+                    case 4: v = va_arg(args, intmax_t); break;
+                    case 5: v = va_arg(args, ptrdiff_t); break;
+                    case 6: v = (short)va_arg(args, int); break;
+                    case 7: v = (signed char)va_arg(args, int); break;
+                    default: v = va_arg(args, int); break;
+                }
+                if (fast) cm_fmt_int(out, v);
+                else CM_FMT_SNPRINTF(out, wide, (long long)v);
+                break;
+            }
+            case 'u': case 'x': case 'X': case 'o': {
+                uint64_t v;
+                switch (len) {
+                    case 1: v = va_arg(args, unsigned long); break;
+                    case 2: v = va_arg(args, unsigned long long); break;
+                    case 3: v = va_arg(args, size_t); break;
+                    case 4: v = va_arg(args, uintmax_t); break;
+                    case 5: v = (uint64_t)va_arg(args, ptrdiff_t); break;
+                    case 6: v = (unsigned short)va_arg(args, unsigned); break;
+                    case 7: v = (unsigned char)va_arg(args, unsigned); break;
+                    default: v = va_arg(args, unsigned); break;
+                }
+                if (fast && conv == 'u') cm_fmt_uint(out, v);
+                else if (fast && conv != 'o') cm_fmt_hex(out, v, conv == 'X');
+                else CM_FMT_SNPRINTF(out, wide, (unsigned long long)v);
+                break;
+            }
+            case 'c': {
+                if (len != 0) goto whole;  // %lc
+                int c = va_arg(args, int);
+                if (fast) { char ch = (char)c; cm_fmt_put(out, &ch, 1); }
+                else CM_FMT_SNPRINTF(out, spec, c);
+                break;
+            }
+            case 's': {
+                if (len != 0) goto whole;  // %ls
+                const char* str = va_arg(args, const char*);
+                if (fast) { if (!str) str = "(null)"; cm_fmt_put(out, str, strlen(str)); }
+                else CM_FMT_SNPRINTF(out, spec, str);
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                if (len == 8) {
+                    long double v = va_arg(args, long double);
+                    CM_FMT_SNPRINTF(out, spec, v);
+                    break;
+                }
+                double v = va_arg(args, double);
+                if (!(plain && (conv == 'f' || conv == 'F') && cm_fmt_fixed(out, v, prec < 0 ? 6 : prec) == 0)) {
+                    CM_FMT_SNPRINTF(out, spec, v);
+                }
+                break;
+            }
+            case 'p': {
+                void* v = va_arg(args, void*);
+                CM_FMT_SNPRINTF(out, spec, v);
+                break;
+            }
+            default:
+                goto whole;
+        }
+        f = p + 1;
+    }
+
+    va_end(start);
+    if (cm_fmt_reserve(out, 0) != 0 || out->failed) return -1;
+    out->data[out->len] = '\0';
+    return 0;
+
+whole:
+    {
+        int rc = cm_fmt_whole(out, base, format, start);
+        va_end(start);
+        return rc;
+    }
+fail:
+    va_end(start);
+    return -1;
+}
+
+// Stack buffer first; spills to the heap only for long results
+static int cm_fmt_grow_spill(cm_fmt_out_t* out, size_t need) {
+    size_t cap = out->cap * 2;
+    if (cap < need) cap = need;
+    char* data;
+    if (out->ctx) {
+        data = (char*)realloc(out->data, cap);
+        if (!data) return -1;
+    } else {
+        data = (char*)malloc(cap);
+        if (!data) return -1;
+        memcpy(data, out->data, out->len);
+        out->ctx = data;                   // marks the buffer as ours to free
+    }
+    out->data = data;
+    out->ctx = data;
+    out->cap = cap;
+    return 0;
+}
+
+static int cm_fmt_grow_string(cm_fmt_out_t* out, size_t need) {
+    cm_string_t* s = (cm_string_t*)out->ctx;
+    s->length = out->len;
+    if (cm_string_reserve(s, need) != CM_SUCCESS) return -1;
+    out->data = s->data;
+    out->cap = s->capacity;
+    return 0;
+}
+
+cm_string_t* cm_string_vformat(const char* format, va_list args) {
+    if (!format) return NULL;
+
+    char stack[CM_STRING_STACK_FORMAT];
+    cm_fmt_out_t out = { stack, 0, sizeof(stack), cm_fmt_grow_spill, NULL, 0 };
+    cm_string_t* result = NULL;
+    if (cm_fmt_vformat(&out, format, args) == 0) {
+        result = cm_string_alloc_inline(out.data, out.len, out.len + 1);
+    } else if (out.failed) {
+        cm_error_set(CM_ERROR_MEMORY, "cm_string_vformat: out of memory");
+    }
+    free(out.ctx);
+    return result;
+}
+
+cm_string_t* cm_string_format(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    cm_string_t* result = cm_string_vformat(format, args);
+    va_end(args);
+    return result;
+}
+
+int cm_string_vappendf(cm_string_t* s, const char* format, va_list args) {
+    if (!s || !format) return CM_ERROR_NULL_POINTER;
+    int rc = cm_string_reserve(s, s->length + 1);
+    if (rc != CM_SUCCESS) return rc;
+
+    cm_fmt_out_t out = { s->data, s->length, s->capacity, cm_fmt_grow_string, s, 0 };
+    size_t before = s->length;
+    if (cm_fmt_vformat(&out, format, args) != 0) {
+        s->length = before;
+        s->data[before] = '\0';
+        return CM_ERROR_MEMORY;
+    }
+    s->length = out.len;
+    s->hash = 0;
+    return CM_SUCCESS;
+}
+
+int cm_string_appendf(cm_string_t* s, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int rc = cm_string_vappendf(s, format, args);
+    va_end(args);
+    return rc;
+}
+
+int cm_string_append(cm_string_t* s, const char* text) {
+    if (!s || !text) return CM_ERROR_NULL_POINTER;
+    size_t n = strlen(text);
+    int rc = cm_string_reserve(s, s->length + n + 1);
+    if (rc != CM_SUCCESS) return rc;
+    memcpy(s->data + s->length, text, n + 1);
+    s->length += n;
+    s->hash = 0;
+    return CM_SUCCESS;
+}
+
+void cm_string_set(cm_string_t* s, const char* value) {
+    if (!s) return;
+    if (!value) value = "";
+
+    size_t len = strlen(value);
+
+    // Copy before adopting: value may point into the text being replaced
+    if (len + 1 > s->capacity || !cm_string_writable(s)) {
+        char* new_data = cm_strbuf_new(len + 1);
+        if (!new_data) return;
+        memcpy(new_data, value, len + 1);
+        cm_string_adopt(s, new_data, len + 1);
+    } else {
+        memmove(s->data, value, len + 1);
+    }
+    s->length = len;
+    s->hash = 0;
+}
+
+void cm_string_upper(cm_string_t* s) {
+    if (!s || !s->data) return;
+    if (cm_string_reserve(s, s->length + 1) != CM_SUCCESS) return;
+
+    for (size_t i = 0; i < s->length; i++) {
+        s->data[i] = toupper(s->data[i]);
+    }
+    s->hash = 0;
+}
+
+void cm_string_lower(cm_string_t* s) {
+    if (!s || !s->data) return;
+    if (cm_string_reserve(s, s->length + 1) != CM_SUCCESS) return;
+
+    for (size_t i = 0; i < s->length; i++) {
+        s->data[i] = tolower(s->data[i]);
+    }
+    s->hash = 0;
+}
+
+/* ============================================================================
+ * STRING VIEW IMPLEMENTATION
+ * ============================================================================ */
+cm_strview_t cm_strview(const char* cstr) {
+    cm_strview_t v = { cstr, cstr ? strlen(cstr) : 0 };
+    return v;
+}
+
+cm_strview_t cm_strview_of(const cm_string_t* s) {
+    cm_strview_t v = { s ? s->data : NULL, s ? s->length : 0 };
+    return v;
+}
+
+// Out-of-range positions and lengths are clamped to the view
+cm_strview_t cm_strview_sub(cm_strview_t v, size_t pos, size_t len) {
+    if (pos > v.length) pos = v.length;
+    if (len > v.length - pos) len = v.length - pos;
+    cm_strview_t r = { v.data + pos, len };
+    return r;
+}
+
+int cm_strview_eq(cm_strview_t a, cm_strview_t b) {
+    return a.length == b.length && (a.length == 0 || memcmp(a.data, b.data, a.length) == 0);
+}
+
+int cm_strview_cmp(cm_strview_t a, cm_strview_t b) {
+    size_t n = a.length < b.length ? a.length : b.length;
+    int c = n ? memcmp(a.data, b.data, n) : 0;
+    if (c) return c;
+    return (a.length > b.length) - (a.length < b.length);
+}
+
+int cm_strview_starts_with(cm_strview_t v, cm_strview_t prefix) {
+    return prefix.length <= v.length && (prefix.length == 0 || memcmp(v.data, prefix.data, prefix.length) == 0);
+}
+
+size_t cm_strview_find_char(cm_strview_t v, char c) {
+    const char* hit = v.length ? (const char*)memchr(v.data, c, v.length) : NULL;
+    return hit ? (size_t)(hit - v.data) : CM_STRVIEW_NPOS;
+}
+
+size_t cm_strview_find(cm_strview_t v, cm_strview_t needle) {
+    if (needle.length == 0) return 0;
+    if (needle.length > v.length) return CM_STRVIEW_NPOS;
+    const char* hit = (const char*)memmem(v.data, v.length, needle.data, needle.length);
+    return hit ? (size_t)(hit - v.data) : CM_STRVIEW_NPOS;
+}
+
+cm_strview_t cm_strview_trim(cm_strview_t v) {
+    while (v.length && isspace((unsigned char)v.data[0])) { v.data++; v.length--; }
+    while (v.length && isspace((unsigned char)v.data[v.length - 1])) v.length--;
+    return v;
+}
+
+// strsep-style: "a,,b" yields "a", "" and "b". rest->data turns NULL once the
+// last token has been handed out.
+int cm_strview_split(cm_strview_t* rest, char sep, cm_strview_t* token) {
+    if (!rest || !token || !rest->data) return 0;
+    size_t at = cm_strview_find_char(*rest, sep);
+    if (at == CM_STRVIEW_NPOS) {
+        *token = *rest;
+        rest->data = NULL;
+        rest->length = 0;
+    } else {
+        token->data = rest->data;
+        token->length = at;
+        rest->data += at + 1;
+        rest->length -= at + 1;
+    }
+    return 1;
+}
+
+// strtok-style: runs of any character in seps separate tokens, empty ones are skipped
+int cm_strview_split_any(cm_strview_t* rest, const char* seps, cm_strview_t* token) {
+    if (!rest || !token || !rest->data || !seps) return 0;
+    size_t i = 0;
+    while (i < rest->length && strchr(seps, rest->data[i]) && rest->data[i]) i++;
+    if (i == rest->length) {
+        rest->data = NULL;
+        rest->length = 0;
+        return 0;
+    }
+    size_t j = i;
+    while (j < rest->length && !(rest->data[j] && strchr(seps, rest->data[j]))) j++;
+    token->data = rest->data + i;
+    token->length = j - i;
+    rest->data += j;
+    rest->length -= j;
+    return 1;
+}
+
+int cm_strview_to_int(cm_strview_t v, int64_t* out) {
+    if (!out || v.length == 0) return CM_ERROR_PARSE;
+    size_t i = 0;
+    int neg = 0;
+    if (v.data[0] == '-' || v.data[0] == '+') {
+        neg = v.data[0] == '-';
+        if (++i == v.length) return CM_ERROR_PARSE;
+    }
+    uint64_t mag = 0;
+    uint64_t limit = neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    for (; i < v.length; i++) {
+        unsigned d = (unsigned char)v.data[i] - '0';
+        if (d > 9) return CM_ERROR_PARSE;
+        if (mag > (limit - d) / 10) return CM_ERROR_OVERFLOW;
+        mag = mag * 10 + d;
+    }
+    *out = neg ? (int64_t)(0 - mag) : (int64_t)mag;
+    return CM_SUCCESS;
+}
+
+cm_string_t* cm_strview_to_string(cm_strview_t v) {
+    return cm_string_alloc_inline(v.data, v.length, v.length + 1);
+}
+
+/* ============================================================================
+ * ARRAY IMPLEMENTATION
+ * ============================================================================ */
+cm_array_t* cm_array_new(size_t element_size, size_t initial_capacity) {
+    if (element_size == 0) return NULL;
+
+    cm_array_t* arr = (cm_array_t*)cm_alloc(sizeof(cm_array_t), "array", __FILE__, __LINE__);
+    if (!arr) return NULL;
+
+    arr->element_size = element_size;
+    arr->capacity = initial_capacity > 0 ? initial_capacity : 16;
+    arr->length = 0;
+    arr->data = cm_alloc(element_size * arr->capacity, "array_data", __FILE__, __LINE__);
+    arr->ref_counts = (int*)cm_alloc(sizeof(int) * arr->capacity, "array_refs", __FILE__, __LINE__);
+    arr->element_destructor = NULL;
+    arr->flags = 0;
+
+    if (!arr->data || !arr->ref_counts) {
+        if (arr->data) cm_free(arr->data);
+        if (arr->ref_counts) cm_free(arr->ref_counts);
+        cm_free(arr);
+        return NULL;
+    }
+
+    memset(arr->ref_counts, 0, sizeof(int) * arr->capacity);
+
+    return arr;
+}
+
+void cm_array_free(cm_array_t* arr) {
+    if (!arr) return;
+
+    if (arr->element_destructor) {
+        for (size_t i = 0; i < arr->length; i++) {
+            void* elem = (char*)arr->data + (i * arr->element_size);
+            arr->element_destructor(elem);
+        }
+    }
+
+    cm_free(arr->data);
+    cm_free(arr->ref_counts);
+    cm_free(arr);
+}
+
+void* cm_array_get(cm_array_t* arr, size_t index) {
+    if (!arr) return NULL;
+    if (index >= arr->length) return NULL;
+
+    arr->ref_counts[index]++;
+    return (char*)arr->data + (index * arr->element_size);
+}
+
+void cm_array_push(cm_array_t* arr, const void* value) {
+    if (!arr || !value) return;
+
+    if (arr->length >= arr->capacity) {
+        size_t new_capacity = arr->capacity * 2;
+        void* new_data = cm_alloc(arr->element_size * new_capacity, "array_data", __FILE__, __LINE__);
+        int* new_refs = (int*)cm_alloc(sizeof(int) * new_capacity, "array_refs", __FILE__, __LINE__);
+
+        if (!new_data || !new_refs) {
+            if (new_data) cm_free(new_data);
+            if (new_refs) cm_free(new_refs);
+            return;
+        }
+
+        memcpy(new_data, arr->data, arr->element_size * arr->length);
+        memset(new_refs, 0, sizeof(int) * new_capacity);
+
+        cm_free(arr->data);
+        cm_free(arr->ref_counts);
+
+        arr->data = new_data;
+        arr->ref_counts = new_refs;
+        arr->capacity = new_capacity;
+    }
+
+    void* dest = (char*)arr->data + (arr->length * arr->element_size);
+    memcpy(dest, value, arr->element_size);
+    arr->length++;
+}
+
+void* cm_array_pop(cm_array_t* arr) {
+    if (!arr || arr->length == 0) return NULL;
+
+    arr->length--;
+    return (char*)arr->data + (arr->length * arr->element_size);
+}
+
+size_t cm_array_length(cm_array_t* arr) {
+    return arr ? arr->length : 0;
+}
+
+/* ============================================================================
+ * MAP IMPLEMENTATION
+ * ============================================================================ */
+#define CM_MAP_INITIAL_SIZE 16
+#define CM_MAP_LOAD_FACTOR 0.75
+#define CM_MAP_STAT_BATCH 256            // lookups a thread counts before publishing
+
+// Probe lengths are tallied per thread and published in batches, so a
+// snapshot may miss up to CM_MAP_STAT_BATCH lookups per thread
+static __thread size_t cm_map_tls_lookups = 0;
+static __thread size_t cm_map_tls_probes = 0;
+static __thread size_t cm_map_tls_max = 0;
+
+static void cm_map_count_probes(size_t probes) {
+    cm_map_tls_probes += probes;
+    if (probes > cm_map_tls_max) {
+        cm_map_tls_max = probes;
+        size_t cur = CM_STAT_GET(cm_stats.map_probe_max);
+        while (probes > cur &&
+               !__atomic_compare_exchange_n(&cm_stats.map_probe_max, &cur, probes, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+    if (++cm_map_tls_lookups == CM_MAP_STAT_BATCH) {
+        CM_STAT_ADD(cm_stats.map_lookups, cm_map_tls_lookups);
+        CM_STAT_ADD(cm_stats.map_probes, cm_map_tls_probes);
+        cm_map_tls_lookups = 0;
+        cm_map_tls_probes = 0;
+    }
+}
+
+static uint32_t cm_hash_string(const char* str) {
+    uint32_t hash = 5381;
+    int c;
+
+    while ((c = *str++)) {
+        hash = ((hash << 5) + hash) + c;
+    }
+
+    return hash;
+}
+
+static void* cm_map_snapshot_get(const struct cm_map_snapshot* snap, const char* key);
+static void cm_map_snapshot_close(struct cm_map_snapshot* snap);
+
+cm_map_t* cm_map_new(void) {
+    cm_map_t* map = (cm_map_t*)cm_alloc(sizeof(cm_map_t), "map", __FILE__, __LINE__);
+    if (!map) return NULL;
+
+    map->bucket_count = CM_MAP_INITIAL_SIZE;
+    map->size = 0;
+    map->load_factor = CM_MAP_LOAD_FACTOR;
+    map->growth_factor = 2;
+    map->snapshot = NULL;
+    map->buckets = (cm_map_entry_t**)cm_alloc(sizeof(cm_map_entry_t*) * map->bucket_count, 
+                                               "map_buckets", __FILE__, __LINE__);
+
+    if (!map->buckets) {
+        cm_free(map);
+        return NULL;
+    }
+
+    memset(map->buckets, 0, sizeof(cm_map_entry_t*) * map->bucket_count);
+
+    return map;
+}
+
+static void cm_map_resize(cm_map_t* map, int new_size) {
+    if (!map) return;
+    CM_TRACE_SCOPE("cm_map_resize");
+
+    cm_map_entry_t** new_buckets = (cm_map_entry_t**)cm_alloc(
+        sizeof(cm_map_entry_t*) * new_size, "map_buckets", __FILE__, __LINE__);
+
+    if (!new_buckets) return;
+
+    memset(new_buckets, 0, sizeof(cm_map_entry_t*) * new_size);
+
+    for (int i = 0; i < map->bucket_count; i++) {
+        cm_map_entry_t* entry = map->buckets[i];
+        while (entry) {
+            cm_map_entry_t* next = entry->next;
+
+            int new_index = entry->hash % new_size;
+            entry->next = new_buckets[new_index];
+            new_buckets[new_index] = entry;
+
+            entry = next;
+        }
+    }
+
+    cm_free(map->buckets);
+    map->buckets = new_buckets;
+    map->bucket_count = new_size;
+}
+
+void cm_map_set(cm_map_t* map, const char* key, const void* value, size_t value_size) {
+    if (!map || !key || !value) return;
+    if (map->snapshot) {
+        cm_error_set(CM_ERROR_PERMISSION_DENIED, "Map snapshot is read-only");
+        return;
+    }
+
+    if (map->size >= map->bucket_count * map->load_factor) {
+        cm_map_resize(map, map->bucket_count * map->growth_factor);
+    }
+
+    uint32_t hash = cm_hash_string(key);
+    int index = hash % map->bucket_count;
+
+    cm_map_entry_t* entry = map->buckets[index];
+    size_t probes = 0;
+    while (entry) {
+        probes++;
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            cm_map_count_probes(probes);
+            cm_free(entry->value);
+            entry->value = cm_alloc(value_size, "map_value", __FILE__, __LINE__);
+            memcpy(entry->value, value, value_size);
+            entry->value_size = value_size;
+            return;
+        }
+        entry = entry->next;
+    }
+    cm_map_count_probes(probes);
+
+#if CM_POOLS
+    entry = (cm_map_entry_t*)cm_pool_alloc(cm_builtin_pool(&cm_map_entry_pool));
+#else
+    entry = (cm_map_entry_t*)cm_alloc(sizeof(cm_map_entry_t), "map_entry", __FILE__, __LINE__);
+#endif
+    if (!entry) return;
+
+    entry->key = strdup(key);
+    entry->value = cm_alloc(value_size, "map_value", __FILE__, __LINE__);
+    memcpy(entry->value, value, value_size);
+    entry->value_size = value_size;
+    entry->hash = hash;
+    entry->next = map->buckets[index];
+
+    map->buckets[index] = entry;
+    map->size++;
+}
+
+void* cm_map_get(cm_map_t* map, const char* key) {
+    if (!map || !key) return NULL;
+    if (map->snapshot) return cm_map_snapshot_get(map->snapshot, key);
+
+    uint32_t hash = cm_hash_string(key);
+    int index = hash % map->bucket_count;
+
+    cm_map_entry_t* entry = map->buckets[index];
+    size_t probes = 0;
+    while (entry) {
+        probes++;
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            cm_map_count_probes(probes);
+            return entry->value;
+        }
+        entry = entry->next;
+    }
+
+    cm_map_count_probes(probes);
+    return NULL;
+}
+
+int cm_map_has(cm_map_t* map, const char* key) {
+    return cm_map_get(map, key) != NULL;
+}
+
+void cm_map_free(cm_map_t* map) {
+    if (!map) return;
+    if (map->snapshot) {
+        cm_map_snapshot_close(map->snapshot);
+        cm_free(map);
+        return;
+    }
+
+    for (int i = 0; i < map->bucket_count; i++) {
+        cm_map_entry_t* entry = map->buckets[i];
+        while (entry) {
+            cm_map_entry_t* next = entry->next;
+            free(entry->key);
+            cm_free(entry->value);
+#if CM_POOLS
+            cm_pool_free(cm_map_entry_pool, entry);
+#else
+            cm_free(entry);
+#endif
+            entry = next;
+        }
+    }
+
+    cm_free(map->buckets);
+    cm_free(map);
+}
+
+size_t cm_map_size(cm_map_t* map) {
+    return map ? (size_t)map->size : 0;
+}
+
+// ===== Map snapshots =====
+// A snapshot file is position independent, so every process can map the same
+// pages. Layout, all little-endian as written by the host:
+//   header | slot table (open addressing, 2^slot_bits slots) | entries
+// Each entry is { uint64 value_size; key bytes + NUL; pad; value bytes; pad },
+// padded to 8 bytes, and a slot's entry_off of 0 marks it empty.
+#define CM_SNAPSHOT_MAGIC "CMMAPSN1"
+#define CM_SNAPSHOT_VERSION 1            // bump when the layout or cm_hash_string changes
+#define CM_SNAPSHOT_ENDIAN 0x01020304u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t slot_bits;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t data_off;
+    uint64_t file_size;
+} cm_snapshot_header_t;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t key_len;
+    uint64_t entry_off;
+} cm_snapshot_slot_t;
+
+struct cm_map_snapshot {
+    const char* base;
+    size_t size;
+    const cm_snapshot_slot_t* slots;
+    uint32_t bits;
+};
+
+static inline uint64_t cm_snapshot_pad(uint64_t n) {
+    return (n + 7) & ~(uint64_t)7;
+}
+
+// Value offset within an entry; the value itself follows, padded to 8 bytes
+static inline uint64_t cm_snapshot_value_off(uint64_t key_len) {
+    return cm_snapshot_pad(sizeof(uint64_t) + key_len + 1);
+}
+
+// djb2 is weak in its low bits; spread it before taking the top slot_bits
+static inline uint32_t cm_snapshot_index(uint32_t hash, uint32_t bits) {
+    return (uint32_t)(((uint64_t)(hash * 2654435769u) << 32) >> (64 - bits));
+}
+
+static void* cm_map_snapshot_get(const struct cm_map_snapshot* snap, const char* key) {
+    uint32_t hash = cm_hash_string(key);
+    size_t len = strlen(key);
+    uint32_t mask = (uint32_t)((1ull << snap->bits) - 1);
+    uint32_t i = cm_snapshot_index(hash, snap->bits);
+
+    size_t probes = 0;
+    for (size_t n = 0; n <= mask; n++, i = (i + 1) & mask) {
+        const cm_snapshot_slot_t* slot = &snap->slots[i];
+        if (!slot->entry_off) break;
+        probes++;
+        if (slot->hash != hash || slot->key_len != len) continue;
+
+        // Offsets come from the file, so check them before following any
+        uint64_t off = slot->entry_off;
+        uint64_t value_off = cm_snapshot_value_off(len);
+        if (off > snap->size || snap->size - off < value_off) break;
+        if (memcmp(snap->base + off + sizeof(uint64_t), key, len) != 0) continue;
+
+        uint64_t value_size;
+        memcpy(&value_size, snap->base + off, sizeof(value_size));
+        if (value_size > snap->size - off - value_off) break;
+        cm_map_count_probes(probes);
+        return (void*)(snap->base + off + value_off);
+    }
+
+    cm_map_count_probes(probes);
+    return NULL;
+}
+
+static void cm_map_snapshot_close(struct cm_map_snapshot* snap) {
+    munmap((void*)snap->base, snap->size);
+    free(snap);
+}
+
+static int cm_snapshot_write_entry(FILE* f, const cm_map_entry_t* entry, size_t key_len) {
+    static const char zeros[8] = {0};
+    uint64_t value_size = entry->value_size;
+    uint64_t value_off = cm_snapshot_value_off(key_len);
+    uint64_t head = sizeof(uint64_t) + key_len + 1;
+
+    if (fwrite(&value_size, sizeof(value_size), 1, f) != 1) return CM_ERROR_IO;
+    if (fwrite(entry->key, 1, key_len + 1, f) != key_len + 1) return CM_ERROR_IO;
+    if (fwrite(zeros, 1, value_off - head, f) != value_off - head) return CM_ERROR_IO;
+    if (value_size && fwrite(entry->value, 1, value_size, f) != value_size) return CM_ERROR_IO;
+    size_t tail = cm_snapshot_pad(value_size) - value_size;
+    if (fwrite(zeros, 1, tail, f) != tail) return CM_ERROR_IO;
+    return CM_SUCCESS;
+}
+
+// Values are stored byte for byte, so maps holding pointers (CM_MAP_SET_STRING)
+// do not survive the trip. The file appears at path atomically, via rename.
+int cm_map_save_snapshot(cm_map_t* map, const char* path) {
+    if (!map || !path) return CM_ERROR_NULL_POINTER;
+    if (map->snapshot) {
+        cm_error_set(CM_ERROR_INVALID_ARGUMENT, "Map is already a snapshot");
+        return CM_ERROR_INVALID_ARGUMENT;
+    }
+    CM_TRACE_SCOPE("cm_map_save_snapshot");
+
+    // At most 70% full, so that misses stop at an empty slot quickly
+    uint32_t bits = 1;
+    while (bits < 32 && (1ull << bits) * 7 < (uint64_t)map->size * 10) bits++;
+    size_t nslots = (size_t)1 << bits;
+
+    cm_snapshot_slot_t* slots = (cm_snapshot_slot_t*)calloc(nslots, sizeof(cm_snapshot_slot_t));
+    if (!slots) {
+        cm_error_set(CM_ERROR_MEMORY, "Failed to allocate snapshot slots");
+        return CM_ERROR_MEMORY;
+    }
+
+    cm_snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CM_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = CM_SNAPSHOT_VERSION;
+    header.endian = CM_SNAPSHOT_ENDIAN;
+    header.slot_bits = bits;
+    header.count = (uint64_t)map->size;
+    header.data_off = sizeof(header) + nslots * sizeof(cm_snapshot_slot_t);
+
+    // First pass places every entry; the second writes them in the same order
+    uint64_t off = header.data_off;
+    for (int b = 0; b < map->bucket_count; b++) {
+        for (cm_map_entry_t* entry = map->buckets[b]; entry; entry = entry->next) {
+            size_t key_len = strlen(entry->key);
+            if (key_len > UINT32_MAX) {
+                free(slots);
+                cm_error_set(CM_ERROR_OVERFLOW, "Snapshot key too long");
+                return CM_ERROR_OVERFLOW;
+            }
+            uint32_t i = cm_snapshot_index(entry->hash, bits);
+            while (slots[i].entry_off) i = (i + 1) & (uint32_t)(nslots - 1);
+            slots[i].hash = entry->hash;
+            slots[i].key_len = (uint32_t)key_len;
+            slots[i].entry_off = off;
+            off += cm_snapshot_value_off(key_len) + cm_snapshot_pad(entry->value_size);
+        }
+    }
+    header.file_size = off;
+
+    size_t path_len = strlen(path);
+    char* tmp = (char*)malloc(path_len + 32);
+    if (!tmp) {
+        free(slots);
+        cm_error_set(CM_ERROR_MEMORY, "Failed to allocate snapshot path");
+        return CM_ERROR_MEMORY;
+    }
+    snprintf(tmp, path_len + 32, "%s.tmp.%ld", path, (long)getpid());
+
+    int status = CM_SUCCESS;
+    FILE* f = fopen(tmp, "wb");
+    if (!f) {
+        status = CM_ERROR_IO;
+    } else {
+        if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+            fwrite(slots, sizeof(cm_snapshot_slot_t), nslots, f) != nslots) {
+            status = CM_ERROR_IO;
+        }
+        for (int b = 0; b < map->bucket_count && status == CM_SUCCESS; b++) {
+            for (cm_map_entry_t* entry = map->buckets[b]; entry && status == CM_SUCCESS; entry = entry->next) {
+                status = cm_snapshot_write_entry(f, entry, strlen(entry->key));
+            }
+        }
+        if (fflush(f) != 0 || fsync(fileno(f)) != 0) status = CM_ERROR_IO;
+        if (fclose(f) != 0) status = CM_ERROR_IO;
+        if (status == CM_SUCCESS && rename(tmp, path) != 0) status = CM_ERROR_IO;
+        if (status != CM_SUCCESS) unlink(tmp);
+    }
+
+    if (status != CM_SUCCESS) cm_error_set(status, "Failed to write map snapshot");
+    free(tmp);
+    free(slots);
+    return status;
+}
+
+// The returned map answers cm_map_get / cm_map_has / cm_map_size straight from
+// the mapped file; its values are read-only and cm_map_set refuses it
+cm_map_t* cm_map_open_snapshot(const char* path) {
+    if (!path) return NULL;
+    CM_TRACE_SCOPE("cm_map_open_snapshot");
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        cm_error_set(CM_ERROR_IO, "Failed to open map snapshot");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(cm_snapshot_header_t)) {
+        close(fd);
+        cm_error_set(CM_ERROR_PARSE, "Map snapshot is truncated");
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    void* base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        cm_error_set(CM_ERROR_IO, "Failed to map snapshot");
+        return NULL;
+    }
+
+    cm_snapshot_header_t header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, CM_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CM_SNAPSHOT_VERSION || header.endian != CM_SNAPSHOT_ENDIAN ||
+        header.slot_bits < 1 || header.slot_bits > 32 || header.count > INT_MAX ||
+        header.count >= (1ull << header.slot_bits) || header.file_size != size ||
+        header.data_off != sizeof(header) + (1ull << header.slot_bits) * sizeof(cm_snapshot_slot_t) ||
+        header.data_off > size) {
+        munmap(base, size);
+        cm_error_set(CM_ERROR_PARSE, "Not a map snapshot, or built by an incompatible version");
+        return NULL;
+    }
+    // Lookups touch one slot and one entry each; readahead would only evict
+    madvise(base, size, MADV_RANDOM);
+
+    struct cm_map_snapshot* snap = (struct cm_map_snapshot*)malloc(sizeof(struct cm_map_snapshot));
+    cm_map_t* map = (cm_map_t*)cm_alloc(sizeof(cm_map_t), "map", __FILE__, __LINE__);
+    if (!snap || !map) {
+        free(snap);
+        cm_free(map);
+        munmap(base, size);
+        cm_error_set(CM_ERROR_MEMORY, "Failed to allocate snapshot map");
+        return NULL;
+    }
+    snap->base = (const char*)base;
+    snap->size = size;
+    snap->slots = (const cm_snapshot_slot_t*)((const char*)base + sizeof(header));
+    snap->bits = header.slot_bits;
+
+    map->buckets = NULL;
+    map->bucket_count = 0;
+    map->size = (int)header.count;
+    map->load_factor = CM_MAP_LOAD_FACTOR;
+    map->growth_factor = 2;
+    map->snapshot = snap;
+    return map;
+}
+
+/* ============================================================================
+ * B+TREE IMPLEMENTATION
+ * ============================================================================
+ * Keys are 16-byte slots: an 8-byte ordered prefix plus, for string trees, the
+ * string itself. Integer keys are the prefix alone (sign bit flipped so they
+ * sort unsigned), and most string comparisons end at the prefix too, so a
+ * binary search over one node rarely leaves its own cache lines. */
+#define CM_BTREE_ORDER 32                // keys per node; inner nodes have one more child
+
+typedef struct {
+    uint64_t prefix;                     // first 8 bytes big-endian, or the biased integer
+    char* str;                           // NULL in integer trees
+} cm_btree_key_t;
+
+typedef struct cm_btree_node {
+    int leaf;
+    int count;
+    cm_btree_key_t keys[CM_BTREE_ORDER];
+    union {
+        struct cm_btree_node* children[CM_BTREE_ORDER + 1];
+        struct {
+            void* values[CM_BTREE_ORDER];
+            struct cm_btree_node* next;  // leaves form a list in key order
+        } leaf;
+    } u;
+} cm_btree_node_t;
+
+struct cm_btree {
+    int key_type;
+    size_t size;
+    cm_btree_node_t* root;
+    cm_btree_node_t* first;              // leftmost leaf
+};
+
+static inline uint64_t cm_btree_prefix(const char* s) {
+    uint64_t p = 0;
+    for (int i = 0; i < 8 && s[i]; i++) p |= (uint64_t)(unsigned char)s[i] << (56 - 8 * i);
+    return p;
+}
+
+static inline cm_btree_key_t cm_btree_int_key(int64_t key) {
+    cm_btree_key_t k = { (uint64_t)key ^ (1ull << 63), NULL };
+    return k;
+}
+
+static inline cm_btree_key_t cm_btree_str_key(const char* key) {
+    cm_btree_key_t k = { cm_btree_prefix(key), (char*)key };
+    return k;
+}
+
+static inline int cm_btree_cmp(const cm_btree_key_t* a, const cm_btree_key_t* b) {
+    if (a->prefix != b->prefix) return a->prefix < b->prefix ? -1 : 1;
+    // A zero last byte means both strings ended inside the prefix
+    if (!a->str || !b->str || (a->prefix & 0xFF) == 0) return 0;
+    return strcmp(a->str + 8, b->str + 8);
+}
+
+// First slot whose key is >= key (or > key when upper is set)
+static inline int cm_btree_search(const cm_btree_node_t* n, const cm_btree_key_t* key, int upper) {
+    int lo = 0, hi = n->count;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        int c = cm_btree_cmp(&n->keys[mid], key);
+        if (c < 0 || (upper && c == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static cm_btree_node_t* cm_btree_node_new(int leaf) {
+    cm_btree_node_t* n = (cm_btree_node_t*)aligned_alloc(64, (sizeof(cm_btree_node_t) + 63) & ~(size_t)63);
+    if (!n) return NULL;
+    n->leaf = leaf;
+    n->count = 0;
+    if (leaf) n->u.leaf.next = NULL;
+    return n;
+}
+
+static int cm_btree_key_copy(cm_btree_key_t* dst, const cm_btree_key_t* src) {
+    *dst = *src;
+    if (src->str) {
+        dst->str = strdup(src->str);
+        if (!dst->str) return CM_ERROR_MEMORY;
+    }
+    return CM_SUCCESS;
+}
+
+static void cm_btree_node_free(cm_btree_node_t* n) {
+    if (!n) return;
+    for (int i = 0; i < n->count; i++) free(n->keys[i].str);
+    if (!n->leaf) {
+        for (int i = 0; i <= n->count; i++) cm_btree_node_free(n->u.children[i]);
+    }
+    free(n);
+}
+
+cm_btree_t* cm_btree_new(int key_type) {
+    if (key_type != CM_BTREE_INT && key_type != CM_BTREE_STRING) {
+        cm_error_set(CM_ERROR_INVALID_ARGUMENT, "Unknown B+tree key type");
+        return NULL;
+    }
+    cm_btree_t* t = (cm_btree_t*)calloc(1, sizeof(cm_btree_t));
+    if (!t) {
+        cm_error_set(CM_ERROR_MEMORY, "Failed to allocate B+tree");
+        return NULL;
+    }
+    t->key_type = key_type;
+    return t;
+}
+
+void cm_btree_free(cm_btree_t* t) {
+    if (!t) return;
+    cm_btree_node_free(t->root);
+    free(t);
+}
+
+size_t cm_btree_size(cm_btree_t* t) {
+    return t ? t->size : 0;
+}
+
+static cm_btree_node_t* cm_btree_find_leaf(const cm_btree_t* t, const cm_btree_key_t* key) {
+    cm_btree_node_t* n = t->root;
+    while (n && !n->leaf) n = n->u.children[cm_btree_search(n, key, 1)];
+    return n;
+}
+
+// Splits a full node around the insertion point. On return *sep is the first
+// key of the new right node (a copy, inner nodes own their separators).
+static int cm_btree_split(cm_btree_node_t* n, cm_btree_node_t** right, cm_btree_key_t* sep) {
+    cm_btree_node_t* r = cm_btree_node_new(n->leaf);
+    if (!r) return CM_ERROR_MEMORY;
+
+    int half = n->count / 2;
+    if (n->leaf) {
+        if (cm_btree_key_copy(sep, &n->keys[half]) != CM_SUCCESS) {
+            free(r);
+            return CM_ERROR_MEMORY;
+        }
+        r->count = n->count - half;
+        memcpy(r->keys, n->keys + half, (size_t)r->count * sizeof(cm_btree_key_t));
+        memcpy(r->u.leaf.values, n->u.leaf.values + half, (size_t)r->count * sizeof(void*));
+        n->count = half;
+        r->u.leaf.next = n->u.leaf.next;
+        n->u.leaf.next = r;
+    } else {
+        // The middle key moves up rather than being copied
+        *sep = n->keys[half];
+        r->count = n->count - half - 1;
+        memcpy(r->keys, n->keys + half + 1, (size_t)r->count * sizeof(cm_btree_key_t));
+        memcpy(r->u.children, n->u.children + half + 1, (size_t)(r->count + 1) * sizeof(cm_btree_node_t*));
+        n->count = half;
+    }
+    *right = r;
+    return CM_SUCCESS;
+}
+
+// Returns CM_SUCCESS, with *right set when n split; *added tells a new key from a replaced value
+static int cm_btree_insert(cm_btree_node_t* n, const cm_btree_key_t* key, void* value,
+                           int* added, cm_btree_node_t** right, cm_btree_key_t* sep) {
+    *right = NULL;
+    if (n->leaf) {
+        int i = cm_btree_search(n, key, 0);
+        if (i < n->count && cm_btree_cmp(&n->keys[i], key) == 0) {
+            n->u.leaf.values[i] = value;
+            *added = 0;
+            return CM_SUCCESS;
+        }
+
+        cm_btree_key_t k;
+        if (cm_btree_key_copy(&k, key) != CM_SUCCESS) return CM_ERROR_MEMORY;
+        cm_btree_node_t* target = n;
+        if (n->count == CM_BTREE_ORDER) {
+            if (cm_btree_split(n, right, sep) != CM_SUCCESS) {
+                free(k.str);
+                return CM_ERROR_MEMORY;
+            }
+            if (i > n->count) {
+                target = *right;
+                i -= n->count;
+            }
+        }
+        memmove(target->keys + i + 1, target->keys + i, (size_t)(target->count - i) * sizeof(cm_btree_key_t));
+        memmove(target->u.leaf.values + i + 1, target->u.leaf.values + i, (size_t)(target->count - i) * sizeof(void*));
+        target->keys[i] = k;
+        target->u.leaf.values[i] = value;
+        target->count++;
+        *added = 1;
+        return CM_SUCCESS;
+    }
+
+    int i = cm_btree_search(n, key, 1);
+    cm_btree_node_t* child_right;
+    cm_btree_key_t child_sep;
+    int rc = cm_btree_insert(n->u.children[i], key, value, added, &child_right, &child_sep);
+    if (rc != CM_SUCCESS || !child_right) return rc;
+
+    cm_btree_node_t* target = n;
+    if (n->count == CM_BTREE_ORDER) {
+        if (cm_btree_split(n, right, sep) != CM_SUCCESS) return CM_ERROR_MEMORY;
+        if (i > n->count) {
+            target = *right;
+            i -= n->count + 1;
+        }
+    }
+    memmove(target->keys + i + 1, target->keys + i, (size_t)(target->count - i) * sizeof(cm_btree_key_t));
+    memmove(target->u.children + i + 2, target->u.children + i + 1,
+            (size_t)(target->count - i) * sizeof(cm_btree_node_t*));
+    target->keys[i] = child_sep;
+    target->u.children[i + 1] = child_right;
+    target->count++;
+    return CM_SUCCESS;
+}
+
+static int cm_btree_put(cm_btree_t* t, const cm_btree_key_t* key, void* value) {
+    if (!t->root) {
+        t->root = t->first = cm_btree_node_new(1);
+        if (!t->root) return CM_ERROR_MEMORY;
+    }
+
+    int added = 0;
+    cm_btree_node_t* right;
+    cm_btree_key_t sep;
+    int rc = cm_btree_insert(t->root, key, value, &added, &right, &sep);
+    if (rc != CM_SUCCESS) {
+        cm_error_set(rc, "Failed to grow B+tree");
+        return rc;
+    }
+    if (right) {
+        cm_btree_node_t* root = cm_btree_node_new(0);
+        if (!root) {
+            cm_error_set(CM_ERROR_MEMORY, "Failed to grow B+tree");
+            return CM_ERROR_MEMORY;
+        }
+        root->count = 1;
+        root->keys[0] = sep;
+        root->u.children[0] = t->root;
+        root->u.children[1] = right;
+        t->root = root;
+    }
+    t->size += (size_t)added;
+    return CM_SUCCESS;
+}
+
+static void* cm_btree_get(const cm_btree_t* t, const cm_btree_key_t* key) {
+    cm_btree_node_t* leaf = cm_btree_find_leaf(t, key);
+    if (!leaf) return NULL;
+    int i = cm_btree_search(leaf, key, 0);
+    if (i < leaf->count && cm_btree_cmp(&leaf->keys[i], key) == 0) return leaf->u.leaf.values[i];
+    return NULL;
+}
+
+// Nodes other than the root keep at least this many keys. Below it a node
+// borrows from a sibling with keys to spare, or else merges with it; either
+// way the pair fits in one node (15 + 16 + a separator <= CM_BTREE_ORDER).
+#define CM_BTREE_MIN (CM_BTREE_ORDER / 2)
+
+// Moves one entry into n->u.children[i] from a neighbour, rotating through the
+// separator between them. Inner separators move; leaf separators are copies.
+static int cm_btree_borrow(cm_btree_node_t* n, int i, int from_left) {
+    cm_btree_node_t* child = n->u.children[i];
+    if (from_left) {
+        cm_btree_node_t* left = n->u.children[i - 1];
+        memmove(child->keys + 1, child->keys, (size_t)child->count * sizeof(cm_btree_key_t));
+        if (child->leaf) {
+            cm_btree_key_t sep;
+            if (cm_btree_key_copy(&sep, &left->keys[left->count - 1]) != CM_SUCCESS) {
+                memmove(child->keys, child->keys + 1, (size_t)child->count * sizeof(cm_btree_key_t));
+                return CM_ERROR_MEMORY;
+            }
+            memmove(child->u.leaf.values + 1, child->u.leaf.values, (size_t)child->count * sizeof(void*));
+            child->keys[0] = left->keys[left->count - 1];
+            child->u.leaf.values[0] = left->u.leaf.values[left->count - 1];
+            free(n->keys[i - 1].str);
+            n->keys[i - 1] = sep;
+        } else {
+            memmove(child->u.children + 1, child->u.children, (size_t)(child->count + 1) * sizeof(cm_btree_node_t*));
+            child->keys[0] = n->keys[i - 1];
+            child->u.children[0] = left->u.children[left->count];
+            n->keys[i - 1] = left->keys[left->count - 1];
+        }
+        left->count--;
+        child->count++;
+        return CM_SUCCESS;
+    }
+
+    cm_btree_node_t* right = n->u.children[i + 1];
+    if (right->leaf) {
+        cm_btree_key_t sep;
+        if (cm_btree_key_copy(&sep, &right->keys[1]) != CM_SUCCESS) return CM_ERROR_MEMORY;
+        child->keys[child->count] = right->keys[0];
+        child->u.leaf.values[child->count] = right->u.leaf.values[0];
+        memmove(right->u.leaf.values, right->u.leaf.values + 1, (size_t)(right->count - 1) * sizeof(void*));
+        free(n->keys[i].str);
+        n->keys[i] = sep;
+    } else {
+        child->keys[child->count] = n->keys[i];
+        child->u.children[child->count + 1] = right->u.children[0];
+        n->keys[i] = right->keys[0];
+        memmove(right->u.children, right->u.children + 1, (size_t)right->count * sizeof(cm_btree_node_t*));
+    }
+    memmove(right->keys, right->keys + 1, (size_t)(right->count - 1) * sizeof(cm_btree_key_t));
+    right->count--;
+    child->count++;
+    return CM_SUCCESS;
+}
+
+// Folds n->u.children[i + 1] into n->u.children[i] and drops their separator.
+// The left node survives, so the leaf list only needs the right one unlinked.
+static void cm_btree_merge(cm_btree_node_t* n, int i) {
+    cm_btree_node_t* left = n->u.children[i];
+    cm_btree_node_t* right = n->u.children[i + 1];
+    if (left->leaf) {
+        memcpy(left->keys + left->count, right->keys, (size_t)right->count * sizeof(cm_btree_key_t));
+        memcpy(left->u.leaf.values + left->count, right->u.leaf.values, (size_t)right->count * sizeof(void*));
+        left->count += right->count;
+        left->u.leaf.next = right->u.leaf.next;
+        free(n->keys[i].str);
+    } else {
+        left->keys[left->count] = n->keys[i];
+        memcpy(left->keys + left->count + 1, right->keys, (size_t)right->count * sizeof(cm_btree_key_t));
+        memcpy(left->u.children + left->count + 1, right->u.children, (size_t)(right->count + 1) * sizeof(cm_btree_node_t*));
+        left->count += right->count + 1;
+    }
+    free(right);
+
+    memmove(n->keys + i, n->keys + i + 1, (size_t)(n->count - i - 1) * sizeof(cm_btree_key_t));
+    memmove(n->u.children + i + 1, n->u.children + i + 2, (size_t)(n->count - i - 1) * sizeof(cm_btree_node_t*));
+    n->count--;
+}
+
+// Removes key below n, then tops up the child it came from if it fell under
+// CM_BTREE_MIN. A failed borrow (string separator copy) leaves the tree valid,
+// just with one node under the minimum.
+static int cm_btree_delete(cm_btree_node_t* n, const cm_btree_key_t* key) {
+    if (n->leaf) {
+        int i = cm_btree_search(n, key, 0);
+        if (i == n->count || cm_btree_cmp(&n->keys[i], key) != 0) return CM_ERROR_NOT_FOUND;
+        free(n->keys[i].str);
+        memmove(n->keys + i, n->keys + i + 1, (size_t)(n->count - i - 1) * sizeof(cm_btree_key_t));
+        memmove(n->u.leaf.values + i, n->u.leaf.values + i + 1, (size_t)(n->count - i - 1) * sizeof(void*));
+        n->count--;
+        return CM_SUCCESS;
+    }
+
+    int i = cm_btree_search(n, key, 1);
+    int rc = cm_btree_delete(n->u.children[i], key);
+    if (rc != CM_SUCCESS || n->u.children[i]->count >= CM_BTREE_MIN) return rc;
+
+    if (i > 0 && n->u.children[i - 1]->count > CM_BTREE_MIN) {
+        cm_btree_borrow(n, i, 1);
+    } else if (i < n->count && n->u.children[i + 1]->count > CM_BTREE_MIN) {
+        cm_btree_borrow(n, i, 0);
+    } else {
+        cm_btree_merge(n, i > 0 ? i - 1 : i);
+    }
+    return CM_SUCCESS;
+}
+
+static int cm_btree_remove(cm_btree_t* t, const cm_btree_key_t* key) {
+    if (!t->root) return CM_ERROR_NOT_FOUND;
+    int rc = cm_btree_delete(t->root, key);
+    if (rc != CM_SUCCESS) return rc;
+    t->size--;
+
+    // The root may run down to a single child (or, as a leaf, to nothing)
+    cm_btree_node_t* root = t->root;
+    if (!root->leaf && root->count == 0) {
+        t->root = root->u.children[0];
+        free(root);
+    } else if (root->leaf && root->count == 0) {
+        free(root);
+        t->root = t->first = NULL;
+    }
+    return CM_SUCCESS;
+}
+
+int cm_btree_put_int(cm_btree_t* t, int64_t key, void* value) {
+    if (!t) return CM_ERROR_NULL_POINTER;
+    if (t->key_type != CM_BTREE_INT) return CM_ERROR_TYPE;
+    cm_btree_key_t k = cm_btree_int_key(key);
+    return cm_btree_put(t, &k, value);
+}
+
+int cm_btree_put_str(cm_btree_t* t, const char* key, void* value) {
+    if (!t || !key) return CM_ERROR_NULL_POINTER;
+    if (t->key_type != CM_BTREE_STRING) return CM_ERROR_TYPE;
+    cm_btree_key_t k = cm_btree_str_key(key);
+    return cm_btree_put(t, &k, value);
+}
+
+void* cm_btree_get_int(cm_btree_t* t, int64_t key) {
+    if (!t || t->key_type != CM_BTREE_INT) return NULL;
+    cm_btree_key_t k = cm_btree_int_key(key);
+    return cm_btree_get(t, &k);
+}
+
+void* cm_btree_get_str(cm_btree_t* t, const char* key) {
+    if (!t || !key || t->key_type != CM_BTREE_STRING) return NULL;
+    cm_btree_key_t k = cm_btree_str_key(key);
+    return cm_btree_get(t, &k);
+}
+
+int cm_btree_remove_int(cm_btree_t* t, int64_t key) {
+    if (!t) return CM_ERROR_NULL_POINTER;
+    if (t->key_type != CM_BTREE_INT) return CM_ERROR_TYPE;
+    cm_btree_key_t k = cm_btree_int_key(key);
+    return cm_btree_remove(t, &k);
+}
+
+int cm_btree_remove_str(cm_btree_t* t, const char* key) {
+    if (!t || !key) return CM_ERROR_NULL_POINTER;
+    if (t->key_type != CM_BTREE_STRING) return CM_ERROR_TYPE;
+    cm_btree_key_t k = cm_btree_str_key(key);
+    return cm_btree_remove(t, &k);
+}
+
+// Builds a packed tree bottom-up from n keys in strictly increasing order:
+// const int64_t* for CM_BTREE_INT, const char* const* for CM_BTREE_STRING.
+// The tree must be empty; values may be NULL (every value NULL).
+int cm_btree_load(cm_btree_t* t, const void* keys, void* const* values, size_t n) {
+    if (!t || (!keys && n)) return CM_ERROR_NULL_POINTER;
+    if (t->root) {
+        cm_error_set(CM_ERROR_INVALID_ARGUMENT, "cm_btree_load needs an empty tree");
+        return CM_ERROR_INVALID_ARGUMENT;
+    }
+    if (n == 0) return CM_SUCCESS;
+    CM_TRACE_SCOPE("cm_btree_load");
+
+    cm_btree_key_t prev = { 0, NULL };
+    for (size_t i = 0; i < n; i++) {
+        cm_btree_key_t k = t->key_type == CM_BTREE_INT ? cm_btree_int_key(((const int64_t*)keys)[i])
+                                                        : cm_btree_str_key(((const char* const*)keys)[i]);
+        if (i > 0 && cm_btree_cmp(&prev, &k) >= 0) {
+            cm_error_set(CM_ERROR_INVALID_ARGUMENT, "cm_btree_load keys must be sorted and unique");
+            return CM_ERROR_INVALID_ARGUMENT;
+        }
+        prev = k;
+    }
+
+    // Spread entries evenly so that no node ends up nearly empty. Every node
+    // is also listed in built, which is all there is to free if memory runs out.
+    size_t count = (n + CM_BTREE_ORDER - 1) / CM_BTREE_ORDER;
+    size_t nbuilt = 0;
+    cm_btree_node_t** built = (cm_btree_node_t**)malloc(2 * count * sizeof(cm_btree_node_t*));
+    cm_btree_node_t** level = (cm_btree_node_t**)malloc(count * sizeof(cm_btree_node_t*));
+    cm_btree_key_t* mins = (cm_btree_key_t*)malloc(count * sizeof(cm_btree_key_t));
+    if (!built || !level || !mins) goto oom;
+
+    size_t at = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t take = n / count + (i < n % count);
+        cm_btree_node_t* leaf = cm_btree_node_new(1);
+        if (!leaf) goto oom;
+        built[nbuilt++] = leaf;
+        level[i] = leaf;
+        if (i > 0) level[i - 1]->u.leaf.next = leaf;
+        for (size_t j = 0; j < take; j++, at++) {
+            cm_btree_key_t k = t->key_type == CM_BTREE_INT ? cm_btree_int_key(((const int64_t*)keys)[at])
+                                                            : cm_btree_str_key(((const char* const*)keys)[at]);
+            if (cm_btree_key_copy(&leaf->keys[j], &k) != CM_SUCCESS) goto oom;
+            leaf->u.leaf.values[j] = values ? values[at] : NULL;
+            leaf->count++;
+        }
+        mins[i] = leaf->keys[0];
+    }
+    t->first = level[0];
+
+    while (count > 1) {
+        size_t parents = (count + CM_BTREE_ORDER) / (CM_BTREE_ORDER + 1);
+        size_t child = 0;
+        for (size_t i = 0; i < parents; i++) {
+            size_t take = count / parents + (i < count % parents);
+            cm_btree_node_t* inner = cm_btree_node_new(0);
+            if (!inner) goto oom;
+            built[nbuilt++] = inner;
+            inner->u.children[0] = level[child];
+            cm_btree_key_t min = mins[child];
+            for (size_t j = 1; j < take; j++) {
+                inner->u.children[j] = level[child + j];
+                if (cm_btree_key_copy(&inner->keys[j - 1], &mins[child + j]) != CM_SUCCESS) goto oom;
+                inner->count++;
+            }
+            // In place: slot i is free once children from i on have been read
+            level[i] = inner;
+            mins[i] = min;
+            child += take;
+        }
+        count = parents;
+    }
+    t->root = level[0];
+    t->size = n;
+    free(built);
+    free(level);
+    free(mins);
+    return CM_SUCCESS;
+
+oom:
+    for (size_t i = 0; i < nbuilt; i++) {
+        for (int j = 0; j < built[i]->count; j++) free(built[i]->keys[j].str);
+        free(built[i]);
+    }
+    free(built);
+    free(level);
+    free(mins);
+    t->first = NULL;
+    cm_error_set(CM_ERROR_MEMORY, "Failed to build B+tree");
+    return CM_ERROR_MEMORY;
+}
+
+static void cm_btree_seek(const cm_btree_t* t, const cm_btree_key_t* key, int upper, cm_btree_iter_t* it) {
+    it->tree = t;
+    it->leaf = cm_btree_find_leaf(t, key);
+    it->pos = it->leaf ? cm_btree_search((cm_btree_node_t*)it->leaf, key, upper) : 0;
+}
+
+void cm_btree_first(cm_btree_t* t, cm_btree_iter_t* it) {
+    if (!it) return;
+    it->tree = t;
+    it->leaf = t ? t->first : NULL;
+    it->pos = 0;
+}
+
+void cm_btree_lower_int(cm_btree_t* t, int64_t key, cm_btree_iter_t* it) {
+    cm_btree_key_t k = cm_btree_int_key(key);
+    if (t && it && t->key_type == CM_BTREE_INT) cm_btree_seek(t, &k, 0, it);
+    else if (it) it->leaf = NULL;
+}
+
+void cm_btree_upper_int(cm_btree_t* t, int64_t key, cm_btree_iter_t* it) {
+    cm_btree_key_t k = cm_btree_int_key(key);
+    if (t && it && t->key_type == CM_BTREE_INT) cm_btree_seek(t, &k, 1, it);
+    else if (it) it->leaf = NULL;
+}
+
+void cm_btree_lower_str(cm_btree_t* t, const char* key, cm_btree_iter_t* it) {
+    if (t && key && it && t->key_type == CM_BTREE_STRING) {
+        cm_btree_key_t k = cm_btree_str_key(key);
+        cm_btree_seek(t, &k, 0, it);
+    } else if (it) {
+        it->leaf = NULL;
+    }
+}
+
+void cm_btree_upper_str(cm_btree_t* t, const char* key, cm_btree_iter_t* it) {
+    if (t && key && it && t->key_type == CM_BTREE_STRING) {
+        cm_btree_key_t k = cm_btree_str_key(key);
+        cm_btree_seek(t, &k, 1, it);
+    } else if (it) {
+        it->leaf = NULL;
+    }
+}
+
+// Steps to the next entry in key order and fills key_int or key_str and value;
+// returns 0 at the end. Changing the tree invalidates its iterators.
+int cm_btree_next(cm_btree_iter_t* it) {
+    if (!it) return 0;
+    cm_btree_node_t* leaf = (cm_btree_node_t*)it->leaf;
+    while (leaf && it->pos >= leaf->count) {
+        leaf = leaf->u.leaf.next;
+        it->pos = 0;
+    }
+    it->leaf = leaf;
+    if (!leaf) return 0;
+
+    const cm_btree_key_t* k = &leaf->keys[it->pos];
+    if (k->str) {
+        it->key_str = k->str;
+        it->key_int = 0;
+    } else {
+        it->key_str = NULL;
+        it->key_int = (int64_t)(k->prefix ^ (1ull << 63));
+    }
+    it->value = leaf->u.leaf.values[it->pos];
+    it->pos++;
+    return 1;
+}
+
+/* ============================================================================
+ * CACHE IMPLEMENTATION
+ * ============================================================================
+ * A bounded key/value cache. Keys hash to one of up to CM_CACHE_SHARDS shards,
+ * each with its own lock, chained hash table and LRU list, and a share of the
+ * byte budget. An entry is charged for its value, its key and its node, so
+ * the budget tracks what the cache really holds rather than an entry count. */
+#define CM_CACHE_SHARDS 16
+#define CM_CACHE_MIN_SHARD (64 * 1024)   // fewer shards rather than slivers of a small budget
+#define CM_CACHE_INITIAL_BUCKETS 64
+
+typedef struct cm_cache_node {
+    struct cm_cache_node* chain;         // bucket chain; also links nodes waiting to be freed
+    struct cm_cache_node* prev;          // LRU list, most recent first
+    struct cm_cache_node* next;
+    uint64_t expires;                    // monotonic ns, 0 = never
+    size_t charge;
+    size_t value_size;
+    uint32_t hash;
+    char* key;                           // stored after the value
+    unsigned char value[];
+} cm_cache_node_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    cm_cache_node_t** buckets;
+    size_t bucket_count;                 // power of two
+    size_t count;
+    cm_cache_node_t* head;
+    cm_cache_node_t* tail;
+    size_t bytes;
+    size_t budget;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t expirations;
+} __attribute__((aligned(64))) cm_cache_shard_t;
+
+struct cm_cache {
+    cm_cache_shard_t* shards;
+    int shard_bits;
+    size_t max_bytes;
+    uint64_t default_ttl_ns;
+};
+
+// djb2 leaves the top bits of short keys empty; the shard comes from those
+static inline uint32_t cm_cache_hash(const char* key) {
+    uint32_t h = cm_hash_string(key);
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline cm_cache_shard_t* cm_cache_shard(cm_cache_t* c, uint32_t hash) {
+    return &c->shards[c->shard_bits ? hash >> (32 - c->shard_bits) : 0];
+}
+
+static void cm_cache_lru_unlink(cm_cache_shard_t* s, cm_cache_node_t* n) {
+    if (n->prev) n->prev->next = n->next;
+    else s->head = n->next;
+    if (n->next) n->next->prev = n->prev;
+    else s->tail = n->prev;
+}
+
+static void cm_cache_lru_push(cm_cache_shard_t* s, cm_cache_node_t* n) {
+    n->prev = NULL;
+    n->next = s->head;
+    if (s->head) s->head->prev = n;
+    else s->tail = n;
+    s->head = n;
+}
+
+static cm_cache_node_t** cm_cache_slot(cm_cache_shard_t* s, uint32_t hash, const char* key) {
+    cm_cache_node_t** p = &s->buckets[hash & (s->bucket_count - 1)];
+    while (*p && ((*p)->hash != hash || strcmp((*p)->key, key) != 0)) p = &(*p)->chain;
+    return p;
+}
+
+// Takes n out of the table and the LRU list; the caller frees it after unlocking
+static void cm_cache_detach(cm_cache_shard_t* s, cm_cache_node_t** slot) {
+    cm_cache_node_t* n = *slot;
+    *slot = n->chain;
+    cm_cache_lru_unlink(s, n);
+    s->count--;
+    s->bytes -= n->charge;
+}
+
+static void cm_cache_grow(cm_cache_shard_t* s) {
+    size_t new_count = s->bucket_count * 2;
+    cm_cache_node_t** nb = (cm_cache_node_t**)calloc(new_count, sizeof(cm_cache_node_t*));
+    if (!nb) return;                     // keep the old table; chains just get longer
+    for (size_t i = 0; i < s->bucket_count; i++) {
+        cm_cache_node_t* n = s->buckets[i];
+        while (n) {
+            cm_cache_node_t* next = n->chain;
+            size_t b = n->hash & (new_count - 1);
+            n->chain = nb[b];
+            nb[b] = n;
+            n = next;
+        }
+    }
+    free(s->buckets);
+    s->buckets = nb;
+    s->bucket_count = new_count;
+}
+
+static void cm_cache_free_list(cm_cache_node_t* n) {
+    while (n) {
+        cm_cache_node_t* next = n->chain;
+        free(n);
+        n = next;
+    }
+}
+
+cm_cache_t* cm_cache_new(size_t max_bytes, int64_t default_ttl_ms) {
+    if (max_bytes == 0 || default_ttl_ms < 0) {
+        cm_error_set(CM_ERROR_INVALID_ARGUMENT, "Cache needs a byte budget and a TTL >= 0");
+        return NULL;
+    }
+    cm_cache_t* c = (cm_cache_t*)calloc(1, sizeof(cm_cache_t));
+    if (!c) {
+        cm_error_set(CM_ERROR_MEMORY, "Failed to allocate cache");
+        return NULL;
+    }
+
+    int bits = 0;
+    while ((1 << (bits + 1)) <= CM_CACHE_SHARDS && max_bytes >> (bits + 1) >= CM_CACHE_MIN_SHARD) bits++;
+    int shards = 1 << bits;
+    c->shard_bits = bits;
+    c->max_bytes = max_bytes;
+    c->default_ttl_ns = (uint64_t)default_ttl_ms * 1000000ull;
+    c->shards = (cm_cache_shard_t*)aligned_alloc(64, sizeof(cm_cache_shard_t) * (size_t)shards);
+    if (!c->shards) {
+        free(c);
+        cm_error_set(CM_ERROR_MEMORY, "Failed to allocate cache");
+        return NULL;
+    }
+    memset(c->shards, 0, sizeof(cm_cache_shard_t) * (size_t)shards);
+
+    for (int i = 0; i < shards; i++) {
+        cm_cache_shard_t* s = &c->shards[i];
+        pthread_mutex_init(&s->lock, NULL);
+        s->budget = max_bytes / (size_t)shards + (i == 0 ? max_bytes % (size_t)shards : 0);
+        s->bucket_count = CM_CACHE_INITIAL_BUCKETS;
+        s->buckets = (cm_cache_node_t**)calloc(s->bucket_count, sizeof(cm_cache_node_t*));
+        if (!s->buckets) {
+            for (int j = 0; j <= i; j++) {
+                free(c->shards[j].buckets);
+                pthread_mutex_destroy(&c->shards[j].lock);
+            }
+            free(c->shards);
+            free(c);
+            cm_error_set(CM_ERROR_MEMORY, "Failed to allocate cache");
+            return NULL;
+        }
+    }
+    return c;
+}
+
+void cm_cache_free(cm_cache_t* c) {
+    if (!c) return;
+    for (int i = 0; i < (1 << c->shard_bits); i++) {
+        cm_cache_shard_t* s = &c->shards[i];
+        cm_cache_node_t* n = s->head;
+        while (n) {
+            cm_cache_node_t* next = n->next;
+            free(n);
+            n = next;
+        }
+        free(s->buckets);
+        pthread_mutex_destroy(&s->lock);
+    }
+    free(c->shards);
+    free(c);
+}
+
+// ttl_ms: 0 keeps the entry until it is evicted
+int cm_cache_set_ttl(cm_cache_t* c, const char* key, const void* value, size_t value_size, int64_t ttl_ms) {
+    if (!c || !key || (!value && value_size)) return CM_ERROR_NULL_POINTER;
+    if (ttl_ms < 0) return CM_ERROR_INVALID_ARGUMENT;
+
+    uint32_t hash = cm_cache_hash(key);
+    cm_cache_shard_t* s = cm_cache_shard(c, hash);
+    size_t key_len = strlen(key);
+    size_t charge = sizeof(cm_cache_node_t) + value_size + key_len + 1;
+    if (charge > s->budget) {
+        cm_error_set(CM_ERROR_INVALID_ARGUMENT, "Cache entry is larger than its shard's byte budget");
+        return CM_ERROR_INVALID_ARGUMENT;
+    }
+
+    // Build the node before taking the lock
+    cm_cache_node_t* n = (cm_cache_node_t*)malloc(charge);
+    if (!n) {
+        cm_error_set(CM_ERROR_MEMORY, "Failed to allocate cache entry");
+        return CM_ERROR_MEMORY;
+    }
+    if (value_size) memcpy(n->value, value, value_size);
+    n->key = (char*)n->value + value_size;
+    memcpy(n->key, key, key_len + 1);
+    n->value_size = value_size;
+    n->charge = charge;
+    n->hash = hash;
+    n->expires = ttl_ms ? cm_monotonic_ns() + (uint64_t)ttl_ms * 1000000ull : 0;
+
+    cm_cache_node_t* dead = NULL;
+    pthread_mutex_lock(&s->lock);
+    cm_cache_node_t** slot = cm_cache_slot(s, hash, key);
+    if (*slot) {
+        cm_cache_node_t* old = *slot;
+        cm_cache_detach(s, slot);
+        old->chain = dead;
+        dead = old;
+    } else if (s->count >= s->bucket_count - s->bucket_count / 4) {
+        cm_cache_grow(s);
+        slot = &s->buckets[hash & (s->bucket_count - 1)];
+    }
+    n->chain = *slot;
+    *slot = n;
+    cm_cache_lru_push(s, n);
+    s->count++;
+    s->bytes += charge;
+
+    if (s->bytes > s->budget) {
+        uint64_t now = cm_monotonic_ns();
+        while (s->bytes > s->budget) {
+            cm_cache_node_t* victim = s->tail;
+            if (victim->expires && victim->expires <= now) s->expirations++;
+            else s->evictions++;
+            cm_cache_detach(s, cm_cache_slot(s, victim->hash, victim->key));
+            victim->chain = dead;
+            dead = victim;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    cm_cache_free_list(dead);
+    return CM_SUCCESS;
+}
+
+int cm_cache_set(cm_cache_t* c, const char* key, const void* value, size_t value_size) {
+    if (!c) return CM_ERROR_NULL_POINTER;
+    return cm_cache_set_ttl(c, key, value, value_size, (int64_t)(c->default_ttl_ns / 1000000ull));
+}
+
+// Copies the value into out. *size holds the room in out on entry and the
+// value's size on return; if out is too small nothing is copied and
+// CM_ERROR_OVERFLOW comes back with *size set to what is needed.
+int cm_cache_get(cm_cache_t* c, const char* key, void* out, size_t* size) {
+    if (!c || !key || !size) return CM_ERROR_NULL_POINTER;
+
+    uint32_t hash = cm_cache_hash(key);
+    cm_cache_shard_t* s = cm_cache_shard(c, hash);
+    cm_cache_node_t* dead = NULL;
+    int rc;
+
+    pthread_mutex_lock(&s->lock);
+    cm_cache_node_t** slot = cm_cache_slot(s, hash, key);
+    cm_cache_node_t* n = *slot;
+    if (n && n->expires && n->expires <= cm_monotonic_ns()) {
+        cm_cache_detach(s, slot);
+        dead = n;
+        n = NULL;
+        s->expirations++;
+    }
+    if (!n) {
+        s->misses++;
+        rc = CM_ERROR_NOT_FOUND;
+    } else {
+        s->hits++;
+        if (s->head != n) {
+            cm_cache_lru_unlink(s, n);
+            cm_cache_lru_push(s, n);
+        }
+        rc = CM_SUCCESS;
+        if (n->value_size > *size) rc = CM_ERROR_OVERFLOW;
+        else if (n->value_size) memcpy(out, n->value, n->value_size);
+        *size = n->value_size;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    free(dead);
+    return rc;
+}
+
+int cm_cache_remove(cm_cache_t* c, const char* key) {
+    if (!c || !key) return CM_ERROR_NULL_POINTER;
+
+    uint32_t hash = cm_cache_hash(key);
+    cm_cache_shard_t* s = cm_cache_shard(c, hash);
+    pthread_mutex_lock(&s->lock);
+    cm_cache_node_t** slot = cm_cache_slot(s, hash, key);
+    cm_cache_node_t* n = *slot;
+    if (n) cm_cache_detach(s, slot);
+    pthread_mutex_unlock(&s->lock);
+
+    if (!n) return CM_ERROR_NOT_FOUND;
+    free(n);
+    return CM_SUCCESS;
+}
+
+// Drops every expired entry now instead of waiting for lookups or eviction to
+// find them; returns how many went. Call it from a timer to return memory early.
+size_t cm_cache_purge(cm_cache_t* c) {
+    if (!c) return 0;
+    size_t purged = 0;
+    uint64_t now = cm_monotonic_ns();
+    for (int i = 0; i < (1 << c->shard_bits); i++) {
+        cm_cache_shard_t* s = &c->shards[i];
+        cm_cache_node_t* dead = NULL;
+        pthread_mutex_lock(&s->lock);
+        for (cm_cache_node_t* n = s->tail; n; ) {
+            cm_cache_node_t* prev = n->prev;
+            if (n->expires && n->expires <= now) {
+                cm_cache_detach(s, cm_cache_slot(s, n->hash, n->key));
+                n->chain = dead;
+                dead = n;
+                s->expirations++;
+                purged++;
+            }
+            n = prev;
+        }
+        pthread_mutex_unlock(&s->lock);
+        cm_cache_free_list(dead);
+    }
+    return purged;
+}
+
+void cm_cache_clear(cm_cache_t* c) {
+    if (!c) return;
+    for (int i = 0; i < (1 << c->shard_bits); i++) {
+        cm_cache_shard_t* s = &c->shards[i];
+        pthread_mutex_lock(&s->lock);
+        cm_cache_node_t* n = s->head;
+        s->head = s->tail = NULL;
+        s->count = 0;
+        s->bytes = 0;
+        memset(s->buckets, 0, s->bucket_count * sizeof(cm_cache_node_t*));
+        pthread_mutex_unlock(&s->lock);
+        while (n) {
+            cm_cache_node_t* next = n->next;
+            free(n);
+            n = next;
+        }
+    }
+}
+
+void cm_cache_stats(cm_cache_t* c, cm_cache_stats_t* out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    if (!c) return;
+    out->max_bytes = c->max_bytes;
+    out->shards = (size_t)1 << c->shard_bits;
+    for (int i = 0; i < (1 << c->shard_bits); i++) {
+        cm_cache_shard_t* s = &c->shards[i];
+        pthread_mutex_lock(&s->lock);
+        out->entries += s->count;
+        out->bytes += s->bytes;
+        out->hits += s->hits;
+        out->misses += s->misses;
+        out->evictions += s->evictions;
+        out->expirations += s->expirations;
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+/* ============================================================================
+ * RUNTIME METRICS IMPLEMENTATION
+ * ============================================================================ */
+// Lock-free snapshot: each counter is exact, but they are not read at one instant
+void cm_runtime_metrics(cm_metrics_t* m) {
+    if (!m) return;
+    memset(m, 0, sizeof(*m));
+
+    m->allocations = CM_STAT_GET(cm_mem.allocations);
+    m->frees = CM_STAT_GET(cm_mem.frees);
+    m->live_objects = CM_STAT_GET(cm_mem.total_objects);
+    m->live_bytes = CM_STAT_GET(cm_mem.total_memory);
+    m->peak_bytes = CM_STAT_GET(cm_mem.peak_memory);
+
+    m->collections = CM_STAT_GET(cm_mem.collections);
+    m->gc_last_freed = CM_STAT_GET(cm_mem.gc_last_collection);
+    m->gc_pause_total_ns = CM_STAT_GET(cm_mem.gc_pause_total_ns);
+    m->gc_pause_max_ns = CM_STAT_GET(cm_mem.gc_pause_max_ns);
+    for (int i = 0; i < CM_METRICS_PAUSE_BUCKETS; i++) {
+        m->gc_pause_hist[i] = CM_STAT_GET(cm_mem.gc_pause_hist[i]);
+    }
+
+    m->arenas_live = CM_STAT_GET(cm_stats.arenas_live);
+    m->arena_bytes_reserved = CM_STAT_GET(cm_stats.arena_bytes_reserved);
+    m->arena_bytes_used = CM_STAT_GET(cm_stats.arena_bytes_used);
+    m->arena_fallbacks = CM_STAT_GET(cm_stats.arena_fallbacks);
+
+    m->map_lookups = CM_STAT_GET(cm_stats.map_lookups);
+    m->map_probes = CM_STAT_GET(cm_stats.map_probes);
+    m->map_probe_max = CM_STAT_GET(cm_stats.map_probe_max);
+
+    m->log_dropped = cm_log_dropped();
+}
+
+typedef struct {
+    char* buf;
+    size_t cap;
+    size_t len;
+} cm_metrics_out_t;
+
+__attribute__((format(printf, 2, 3)))
+static void cm_metrics_put(cm_metrics_out_t* out, const char* format, ...) {
+    if (out->len >= out->cap) return;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out->buf + out->len, out->cap - out->len, format, args);
+    va_end(args);
+    if (n > 0) out->len += (size_t)n;
+}
+
+// Upper bound of pause bucket i in seconds (the last bucket is unbounded)
+static double cm_metrics_pause_le(int i) {
+    return (double)(1ull << i) / 1e6;
+}
+
+static void cm_metrics_prometheus(cm_metrics_out_t* o, const cm_metrics_t* m) {
+    static const struct { const char* name; const char* type; size_t offset; } rows[] = {
+        { "cm_allocations_total",       "counter", offsetof(cm_metrics_t, allocations) },
+        { "cm_frees_total",             "counter", offsetof(cm_metrics_t, frees) },
+        { "cm_live_objects",            "gauge",   offsetof(cm_metrics_t, live_objects) },
+        { "cm_live_bytes",              "gauge",   offsetof(cm_metrics_t, live_bytes) },
+        { "cm_peak_bytes",              "gauge",   offsetof(cm_metrics_t, peak_bytes) },
+        { "cm_gc_last_freed_bytes",     "gauge",   offsetof(cm_metrics_t, gc_last_freed) },
+        { "cm_arenas_live",             "gauge",   offsetof(cm_metrics_t, arenas_live) },
+        { "cm_arena_reserved_bytes",    "gauge",   offsetof(cm_metrics_t, arena_bytes_reserved) },
+        { "cm_arena_used_bytes_total",  "counter", offsetof(cm_metrics_t, arena_bytes_used) },
+        { "cm_arena_fallbacks_total",   "counter", offsetof(cm_metrics_t, arena_fallbacks) },
+        { "cm_map_lookups_total",       "counter", offsetof(cm_metrics_t, map_lookups) },
+        { "cm_map_probes_total",        "counter", offsetof(cm_metrics_t, map_probes) },
+        { "cm_map_probe_max",           "gauge",   offsetof(cm_metrics_t, map_probe_max) },
+        { "cm_log_dropped_total",       "counter", offsetof(cm_metrics_t, log_dropped) },
+    };
+
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        size_t v = *(const size_t*)((const char*)m + rows[i].offset);
+        cm_metrics_put(o, "# TYPE %s %s\n%s %zu\n", rows[i].name, rows[i].type, rows[i].name, v);
+    }
+
+    cm_metrics_put(o, "# TYPE cm_gc_pause_max_seconds gauge\ncm_gc_pause_max_seconds %.9f\n",
+                   (double)m->gc_pause_max_ns / 1e9);
+    cm_metrics_put(o, "# TYPE cm_gc_pause_seconds histogram\n");
+    uint64_t cumulative = 0;
+    for (int i = 0; i < CM_METRICS_PAUSE_BUCKETS - 1; i++) {
+        cumulative += m->gc_pause_hist[i];
+        cm_metrics_put(o, "cm_gc_pause_seconds_bucket{le=\"%g\"} %" PRIu64 "\n",
+                       cm_metrics_pause_le(i), cumulative);
+    }
+    cumulative += m->gc_pause_hist[CM_METRICS_PAUSE_BUCKETS - 1];
+    cm_metrics_put(o, "cm_gc_pause_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n", cumulative);
+    cm_metrics_put(o, "cm_gc_pause_seconds_sum %.9f\n", (double)m->gc_pause_total_ns / 1e9);
+    cm_metrics_put(o, "cm_gc_pause_seconds_count %" PRIu64 "\n", cumulative);
+}
+
+static void cm_metrics_json(cm_metrics_out_t* o, const cm_metrics_t* m) {
+    cm_metrics_put(o, "{\"allocations\":%zu,\"frees\":%zu,\"live_objects\":%zu,"
+                      "\"live_bytes\":%zu,\"peak_bytes\":%zu,",
+                   m->allocations, m->frees, m->live_objects, m->live_bytes, m->peak_bytes);
+    cm_metrics_put(o, "\"gc\":{\"collections\":%zu,\"last_freed_bytes\":%zu,"
+                      "\"pause_total_ns\":%" PRIu64 ",\"pause_max_ns\":%" PRIu64 ",\"pause_hist\":[",
+                   m->collections, m->gc_last_freed, m->gc_pause_total_ns, m->gc_pause_max_ns);
+    for (int i = 0; i < CM_METRICS_PAUSE_BUCKETS; i++) {
+        if (i < CM_METRICS_PAUSE_BUCKETS - 1) {
+            cm_metrics_put(o, "%s{\"le_us\":%llu,\"count\":%" PRIu64 "}", i ? "," : "",
+                           1ull << i, m->gc_pause_hist[i]);
+        } else {
+            cm_metrics_put(o, ",{\"le_us\":null,\"count\":%" PRIu64 "}", m->gc_pause_hist[i]);
+        }
+    }
+    cm_metrics_put(o, "]},\"arena\":{\"live\":%zu,\"reserved_bytes\":%zu,\"used_bytes\":%zu,"
+                      "\"fallbacks\":%zu},",
+                   m->arenas_live, m->arena_bytes_reserved, m->arena_bytes_used, m->arena_fallbacks);
+    cm_metrics_put(o, "\"map\":{\"lookups\":%zu,\"probes\":%zu,\"probe_max\":%zu},"
+                      "\"log_dropped\":%zu}\n",
+                   m->map_lookups, m->map_probes, m->map_probe_max, m->log_dropped);
+}
+
+int cm_runtime_metrics_write(int fd, int format) {
+    if (fd < 0) return CM_ERROR_INVALID_ARGUMENT;
+
+    cm_metrics_t m;
+    cm_runtime_metrics(&m);
+
+    char buf[4096];
+    cm_metrics_out_t out = { buf, sizeof(buf), 0 };
+    switch (format) {
+        case CM_METRICS_PROMETHEUS: cm_metrics_prometheus(&out, &m); break;
+        case CM_METRICS_JSON:       cm_metrics_json(&out, &m); break;
+        default:
+            cm_error_set(CM_ERROR_INVALID_ARGUMENT, "Unknown metrics format");
+            return CM_ERROR_INVALID_ARGUMENT;
+    }
+    if (out.len >= out.cap) return CM_ERROR_OVERFLOW;
+    return cm_fd_write_all(fd, buf, out.len);
+}
+
+/* ============================================================================
+ * UTILITY IMPLEMENTATION
+ * ============================================================================ */
+static inline uint64_t cm_rng_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t cm_splitmix64(uint64_t* x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+void cm_rng_seed(cm_rng_t* rng, uint64_t seed) {
+    if (!rng) return;
+    for (int i = 0; i < 4; i++) rng->s[i] = cm_splitmix64(&seed);
+}
+
+static inline uint64_t cm_rng_step(cm_rng_t* rng) {
+    uint64_t* s = rng->s;
+    uint64_t result = cm_rng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = cm_rng_rotl(s[3], 45);
+    return result;
+}
+
+uint64_t cm_rng_next(cm_rng_t* rng) {
+    return cm_rng_step(rng);
+}
+
+// Lemire's multiply-shift: the low half of the product tells us when the draw
+// falls in the biased tail, which only needs the division on that rare path
+static inline uint64_t cm_rng_bounded_step(cm_rng_t* rng, uint64_t bound) {
+    __uint128_t m = (__uint128_t)cm_rng_step(rng) * bound;
+    uint64_t low = (uint64_t)m;
+    if (low < bound) {
+        uint64_t threshold = -bound % bound;
+        while (low < threshold) {
+            m = (__uint128_t)cm_rng_step(rng) * bound;
+            low = (uint64_t)m;
+        }
+    }
+    return (uint64_t)(m >> 64);
+}
+
+uint64_t cm_rng_bounded(cm_rng_t* rng, uint64_t bound) {
+    if (bound == 0) return cm_rng_step(rng);
+    return cm_rng_bounded_step(rng, bound);
+}
+
+double cm_rng_double(cm_rng_t* rng) {
+    return (double)(cm_rng_step(rng) >> 11) * 0x1.0p-53;
+}
+
+static void cm_rng_jump_by(cm_rng_t* rng, const uint64_t poly[4]) {
+    uint64_t s[4] = {0};
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 64; b++) {
+            if (poly[i] & (1ull << b)) {
+                s[0] ^= rng->s[0];
+                s[1] ^= rng->s[1];
+                s[2] ^= rng->s[2];
+                s[3] ^= rng->s[3];
+            }
+            cm_rng_step(rng);
+        }
+    }
+    memcpy(rng->s, s, sizeof(s));
+}
+
+void cm_rng_jump(cm_rng_t* rng) {
+    static const uint64_t poly[4] = {
+        0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull, 0xa9582618e03fc9aaull, 0x39abdc4529b1661cull
+    };
+    if (rng) cm_rng_jump_by(rng, poly);
+}
+
+void cm_rng_long_jump(cm_rng_t* rng) {
+    static const uint64_t poly[4] = {
+        0x76e15d3efefdcbbfull, 0xc5004e441c522fb3ull, 0x77710069854ee241ull, 0x39109bb02acbe635ull
+    };
+    if (rng) cm_rng_jump_by(rng, poly);
+}
+
+// Per-thread streams. A thread whose epoch is stale copies the next stream
+// under the seed lock and advances it by one jump for whoever comes after.
+static pthread_mutex_t cm_random_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t cm_random_base = 0;
+static unsigned cm_random_epoch = 0;     // bumped by every seed; 0 until the first
+static cm_rng_t cm_random_next;          // stream the next thread to refresh takes
+static __thread cm_rng_t cm_random_tls;
+static __thread unsigned cm_random_tls_epoch = 0;
+
+static void cm_random_reseed_locked(uint64_t base) {
+    cm_random_base = base;
+    cm_rng_seed(&cm_random_next, base);
+    unsigned epoch = cm_random_epoch + 1;
+    if (epoch == 0) epoch = 1;
+    __atomic_store_n(&cm_random_epoch, epoch, __ATOMIC_RELEASE);
+}
+
+static cm_rng_t* cm_random_refresh(void) {
+    pthread_mutex_lock(&cm_random_lock);
+    if (!cm_random_epoch) {
+        cm_random_reseed_locked((uint64_t)time(NULL) ^ cm_monotonic_ns() ^ (uint64_t)getpid() << 32);
+    }
+    cm_random_tls = cm_random_next;
+    cm_rng_jump(&cm_random_next);
+    cm_random_tls_epoch = cm_random_epoch;
+    pthread_mutex_unlock(&cm_random_lock);
+    return &cm_random_tls;
+}
+
+cm_rng_t* cm_random_rng(void) {
+    unsigned epoch = __atomic_load_n(&cm_random_epoch, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(epoch != 0 && epoch == cm_random_tls_epoch, 1)) return &cm_random_tls;
+    return cm_random_refresh();
+}
+
+void cm_random_seed(unsigned int seed) {
+    pthread_mutex_lock(&cm_random_lock);
+    cm_random_reseed_locked(seed);
+    pthread_mutex_unlock(&cm_random_lock);
+    // Claim stream 0 so the seeding thread sees the same sequence every run
+    cm_random_refresh();
+}
+
+uint64_t cm_random_u64(void) {
+    return cm_rng_step(cm_random_rng());
+}
+
+int64_t cm_random_range(int64_t min, int64_t max) {
+    if (max < min) { int64_t t = min; min = max; max = t; }
+    uint64_t span = (uint64_t)max - (uint64_t)min + 1;
+    cm_rng_t* rng = cm_random_rng();
+    if (span == 0) return (int64_t)cm_rng_step(rng);   // the full 64-bit range
+    return (int64_t)((uint64_t)min + cm_rng_bounded_step(rng, span));
+}
+
+double cm_random_double(void) {
+    return cm_rng_double(cm_random_rng());
+}
+
+void cm_random_bytes(void* buffer, size_t length) {
+    if (!buffer) return;
+    cm_rng_t* rng = cm_random_rng();
+    unsigned char* out = (unsigned char*)buffer;
+    while (length >= 8) {
+        uint64_t r = cm_rng_step(rng);
+        memcpy(out, &r, 8);
+        out += 8;
+        length -= 8;
+    }
+    if (length) {
+        uint64_t r = cm_rng_step(rng);
+        memcpy(out, &r, length);
+    }
+}
+
+// Ten 6-bit lanes per 64-bit draw; lanes of 62 and 63 are rejected so every
+// character of the 62-symbol charset stays equally likely
+void cm_random_string(char* buffer, size_t length) {
+    static const char charset[64] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+    if (!buffer || length == 0) return;
+    cm_rng_t* rng = cm_random_rng();
+    size_t i = 0, n = length - 1;
+    while (i < n) {
+        uint64_t r = cm_rng_step(rng);
+        for (int lane = 0; lane < 10 && i < n; lane++, r >>= 6) {
+            unsigned v = (unsigned)(r & 63);
+            buffer[i] = charset[v];
+            i += v < 62;
+        }
+    }
+    buffer[n] = '\0';
+}
+
+/* ============================================================================
+ * CLASS IMPLEMENTATION - OOP
+ * ============================================================================ */
+
+// ===== String Class Implementation =====
+String* string_concat(String* self, const char* other) {
+    if (!self || !other) return self;
+    int new_len = self->length + strlen(other);
+    char* new_data = (char*)cm_alloc(new_len + 1, "string_data", __FILE__, __LINE__);
+    strcpy(new_data, self->data);
+    strcat(new_data, other);
+    cm_free(self->data);
+    self->data = new_data;
+    self->length = new_len;
+    return self;
+}
+
+String* string_upper(String* self) {
+    if (!self || !self->data) return self;
+    for (int i = 0; i < self->length; i++) {
+        self->data[i] = toupper(self->data[i]);
+    }
+    return self;
+}
+
+String* string_lower(String* self) {
+    if (!self || !self->data) return self;
+    for (int i = 0; i < self->length; i++) {
+        self->data[i] = tolower(self->data[i]);
+    }
+    return self;
+}
+
+void string_print(String* self) {
+    if (self && self->data) {
+        printf("%s", self->data);  // ✅ استخدام printf مباشرة
+        fflush(stdout);
+    }
+}
+
+int string_length(String* self) {
+    return self ? self->length : 0;
+}
+
+char string_charAt(String* self, int index) {
+    if (!self || !self->data || index < 0 || index >= self->length) return '\0';
+    return self->data[index];
+}
+
+const struct StringClass String_class = {
+    string_concat, string_upper, string_lower, string_print, string_length, string_charAt
+};
+
+String* String_new(const char* initial) {
+    String* self = (String*)cm_alloc(sizeof(String), "String", __FILE__, __LINE__);
+
+    int len = initial ? strlen(initial) : 0;
+    self->length = len;
+    self->capacity = len + 1;
+    self->data = (char*)cm_alloc(self->capacity, "string_data", __FILE__, __LINE__);
+    if (self->data && initial) {
+        strcpy(self->data, initial);
+    }
+
+    self->cls = &String_class;
+#ifdef CM_INSTANCE_METHODS
+    self->concat = String_class.concat;
+    self->upper = String_class.upper;
+    self->lower = String_class.lower;
+    self->print = String_class.print;
+    self->length_func = String_class.length_func;
+    self->charAt = String_class.charAt;
+#endif
+
+    return self;
+}
+
+void String_delete(String* self) {
+    if (!self) return;
+    if (self->data) cm_free(self->data);
+    cm_free(self);
+}
+
+// ===== Array Class Implementation =====
+Array* array_push(Array* self, void* value) {
+    if (!self || !value) return self;
+
+    if (self->length >= self->capacity) {
+        int new_cap = self->capacity * 2;
+        void* new_data = cm_alloc(self->element_size * new_cap, "array_data", __FILE__, __LINE__);
+        memcpy(new_data, self->data, self->element_size * self->length);
+        cm_free(self->data);
+        self->data = new_data;
+        self->capacity = new_cap;
+    }
+
+    void* dest = (char*)self->data + (self->length * self->element_size);
+    memcpy(dest, value, self->element_size);
+    self->length++;
+    return self;
+}
+
+void* array_pop(Array* self) {
+    if (!self || self->length == 0) return NULL;
+    self->length--;
+    return (char*)self->data + (self->length * self->element_size);
+}
+
+void* array_get(Array* self, int index) {
+    if (!self || index < 0 || index >= self->length) return NULL;
+    return (char*)self->data + (index * self->element_size);
+}
+
+int array_size(Array* self) {
+    return self ? self->length : 0;
+}
+
+const struct ArrayClass Array_class = { array_push, array_pop, array_get, array_size };
+
+Array* Array_new(int element_size, int capacity) {
+    Array* self = (Array*)cm_alloc(sizeof(Array), "Array", __FILE__, __LINE__);
+
+    self->element_size = element_size;
+    self->capacity = capacity > 0 ? capacity : 16;
+    self->length = 0;
+    self->data = cm_alloc(element_size * self->capacity, "array_data", __FILE__, __LINE__);
+
+    self->cls = &Array_class;
+#ifdef CM_INSTANCE_METHODS
+    self->push = Array_class.push;
+    self->pop = Array_class.pop;
+    self->get = Array_class.get;
+    self->size = Array_class.size;
+#endif
+
+    return self;
+}
+
+void Array_delete(Array* self) {
+    if (!self) return;
+    if (self->data) cm_free(self->data);
+    cm_free(self);
+}
+
+// ===== Map Class Implementation =====
+Map* map_set(Map* self, const char* key, void* value) {
+    if (!self || !key || !value) return self;
+    cm_map_set((cm_map_t*)self->map_data, key, value, sizeof(void*));
+    self->size = cm_map_size((cm_map_t*)self->map_data);
+    return self;
+}
+
+void* map_get(Map* self, const char* key) {
+    if (!self || !key) return NULL;
+    return cm_map_get((cm_map_t*)self->map_data, key);
+}
+
+int map_has(Map* self, const char* key) {
+    if (!self || !key) return 0;
+    return cm_map_has((cm_map_t*)self->map_data, key);
+}
+
+int map_size_func(Map* self) {
+    return self ? self->size : 0;
+}
+
+const struct MapClass Map_class = { map_set, map_get, map_has, map_size_func };
+
+Map* Map_new(void) {
+    Map* self = (Map*)cm_alloc(sizeof(Map), "Map", __FILE__, __LINE__);
+
+    self->map_data = cm_map_new();
+    self->size = 0;
+
+    self->cls = &Map_class;
+#ifdef CM_INSTANCE_METHODS
+    self->set = Map_class.set;
+    self->get = Map_class.get;
+    self->has = Map_class.has;
+    self->size_func = Map_class.size_func;
+#endif
+
+    return self;
+}
+
+void Map_delete(Map* self) {
+    if (!self) return;
+    if (self->map_data) cm_map_free((cm_map_t*)self->map_data);
+    cm_free(self);
+}
+
+/* ============================================================================
+ * INPUT IMPLEMENTATION
+ * ============================================================================ */
+String* cm_input(const char* prompt) {
+    if (prompt) {
+        cm_printf("%s", prompt);
+        fflush(stdout);
+    }
+
+    // getline grows its buffer, so long lines arrive whole rather than cut at 1024
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t n = stdin ? getline(&line, &cap, stdin) : -1;
+    if (n > 0 && line[n - 1] == '\n') line[--n] = '\0';
+
+    String* result = String_new(n > 0 ? line : "");
+    free(line);
+    return result;
+}
+
+/* ============================================================================
+ * LINE READER IMPLEMENTATION
+ * ============================================================================ */
+#define CM_READER_OWN_FD 0x01            // close fd in cm_reader_close
+#define CM_READER_MAPPED 0x02            // data is an mmap of the whole file
+#define CM_READER_EOF 0x04               // nothing left to read past end
+#define CM_READER_NO_BLOCK SIZE_MAX
+
+struct cm_reader {
+    int fd;
+    int flags;
+    char* data;
+    size_t capacity;                     // buffer size, or the mapping's length
+    size_t pos;                          // first byte not yet handed out
+    size_t end;                          // bytes of data that are valid
+    size_t scan_base;                    // 64-byte block that scan_mask describes
+    uint64_t scan_mask;                  // one bit per '\n' in that block
+};
+
+#if defined(__SSE2__)
+static inline uint64_t cm_newline_mask(const char* p) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    uint64_t a = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), nl));
+    uint64_t b = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), nl));
+    uint64_t c = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), nl));
+    uint64_t d = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), nl));
+    return a | (b << 16) | (c << 32) | (d << 48);
+}
+#endif
+
+// Index of the first '\n' in [from, end), or CM_READER_NO_BLOCK. One 64-byte
+// compare serves every short line inside it; a block without any newline
+// means a long line, which memchr crosses faster.
+static size_t cm_reader_find_newline(cm_reader_t* r, size_t from) {
+#if defined(__SSE2__)
+    for (;;) {
+        if (r->scan_base != CM_READER_NO_BLOCK && from >= r->scan_base && from - r->scan_base < 64) {
+            uint64_t m = r->scan_mask & (~0ull << (from - r->scan_base));
+            if (m) return r->scan_base + (size_t)__builtin_ctzll(m);
+            from = r->scan_base + 64;
+        }
+        if (r->end - from < 64) break;
+
+        r->scan_base = from;
+        r->scan_mask = cm_newline_mask(r->data + from);
+        if (!r->scan_mask) {
+            r->scan_base = CM_READER_NO_BLOCK;
+            from += 64;
+            break;
+        }
+    }
+#endif
+    const char* nl = (const char*)memchr(r->data + from, '\n', r->end - from);
+    return nl ? (size_t)(nl - r->data) : CM_READER_NO_BLOCK;
+}
+
+static cm_reader_t* cm_reader_alloc(int fd, int flags) {
+    cm_reader_t* r = (cm_reader_t*)calloc(1, sizeof(cm_reader_t));
+    if (!r) {
+        cm_error_set(CM_ERROR_MEMORY, "Failed to allocate reader");
+        return NULL;
+    }
+    r->fd = fd;
+    r->flags = flags;
+    r->scan_base = CM_READER_NO_BLOCK;
+    return r;
+}
+
+// Reads from fd, which stays open after cm_reader_close. buffer_size 0 means
+// CM_READER_BUFFER; the buffer doubles whenever a single line outgrows it.
+cm_reader_t* cm_reader_from_fd(int fd, size_t buffer_size) {
+    if (fd < 0) {
+        cm_error_set(CM_ERROR_INVALID_ARGUMENT, "Invalid file descriptor");
+        return NULL;
+    }
+    cm_reader_t* r = cm_reader_alloc(fd, 0);
+    if (!r) return NULL;
+
+    r->capacity = buffer_size ? buffer_size : CM_READER_BUFFER;
+    r->data = (char*)malloc(r->capacity);
+    if (!r->data) {
+        free(r);
+        cm_error_set(CM_ERROR_MEMORY, "Failed to allocate reader buffer");
+        return NULL;
+    }
+    return r;
+}
+
+// Regular files are mapped whole and their lines point straight into the
+// mapping; anything mmap refuses (pipes, ttys, procfs) is read through a buffer
+cm_reader_t* cm_reader_open(const char* path) {
+    if (!path) return NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        cm_error_set(CM_ERROR_IO, "Failed to open file for reading");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            cm_reader_t* r = cm_reader_alloc(-1, CM_READER_MAPPED | CM_READER_EOF);
+            if (!r) {
+                munmap(map, (size_t)st.st_size);
+                return NULL;
+            }
+            r->data = (char*)map;
+            r->capacity = (size_t)st.st_size;
+            r->end = r->capacity;
+            return r;
+        }
+    }
+
+    cm_reader_t* r = cm_reader_from_fd(fd, 0);
+    if (!r) {
+        close(fd);
+        return NULL;
+    }
+    r->flags |= CM_READER_OWN_FD;
+    return r;
+}
+
+// Makes room past end (moving the unread tail to the front, or growing) and
+// reads once. Returns the number of bytes the tail moved down, or -1 on error.
+static ssize_t cm_reader_fill(cm_reader_t* r) {
+    size_t shift = r->pos;
+    if (shift > 0) {
+        memmove(r->data, r->data + shift, r->end - shift);
+        r->end -= shift;
+        r->pos = 0;
+        r->scan_base = CM_READER_NO_BLOCK;
+    }
+    if (r->end == r->capacity) {
+        char* grown = (char*)realloc(r->data, r->capacity * 2);
+        if (!grown) {
+            cm_error_set(CM_ERROR_MEMORY, "Line too long for reader buffer");
+            return -1;
+        }
+        r->data = grown;
+        r->capacity *= 2;
+    }
+
+    ssize_t n;
+    do {
+        n = read(r->fd, r->data + r->end, r->capacity - r->end);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        cm_error_set(CM_ERROR_IO, "Failed to read input");
+        return -1;
+    }
+    if (n == 0) r->flags |= CM_READER_EOF;
+    r->end += (size_t)n;
+    return (ssize_t)shift;
+}
+
+// Returns 1 and the next line (without its '\n') in *line, 0 once the input
+// is exhausted, or -1 on a read error. The view stays valid until the next call.
+int cm_reader_next_line(cm_reader_t* r, cm_strview_t* line) {
+    if (!r || !line) return -1;
+
+    size_t from = r->pos;
+    for (;;) {
+        size_t nl = cm_reader_find_newline(r, from);
+        if (nl != CM_READER_NO_BLOCK) {
+            line->data = r->data + r->pos;
+            line->length = nl - r->pos;
+            r->pos = nl + 1;
+            return 1;
+        }
+
+        if (r->flags & CM_READER_EOF) {
+            if (r->pos == r->end) return 0;
+            // Last line without a trailing newline
+            line->data = r->data + r->pos;
+            line->length = r->end - r->pos;
+            r->pos = r->end;
+            return 1;
+        }
+
+        // Everything up to end is known to be newline-free; only scan what arrives
+        from = r->end;
+        ssize_t shift = cm_reader_fill(r);
+        if (shift < 0) return -1;
+        from -= (size_t)shift;
+    }
+}
+
+void cm_reader_close(cm_reader_t* r) {
+    if (!r) return;
+    if (r->flags & CM_READER_MAPPED) {
+        munmap(r->data, r->capacity);
+    } else {
+        free(r->data);
+    }
+    if (r->flags & CM_READER_OWN_FD) close(r->fd);
+    free(r);
+}
+
+/* ============================================================================
+ * JSON IMPLEMENTATION
+ * ============================================================================
+ * Two stages, after simdjson. The first classifies 64 bytes at a time into
+ * bitmasks (quotes, backslashes, structural characters, whitespace), works out
+ * which bytes sit inside strings, and records the offset of every token start
+ * and every unescaped quote. The second walks that index and builds the tree
+ * in an arena, without touching the bytes between tokens again. */
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;                         // { } [ ] : ,
+    uint64_t space;
+} cm_json_block_t;
+
+static void cm_json_classify(const char* p, cm_json_block_t* m) {
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i open = _mm_set1_epi8('{');         // also '[' once 0x20 is or'ed in
+    const __m128i close = _mm_set1_epi8('}');        // also ']'
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+
+    memset(m, 0, sizeof(*m));
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+        __m128i folded = _mm_or_si128(v, lower);
+        __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+        int shift = 16 * k;
+        m->quote |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << shift;
+        m->backslash |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) << shift;
+        m->op |= (uint64_t)(uint32_t)_mm_movemask_epi8(op) << shift;
+        m->space |= (uint64_t)(uint32_t)_mm_movemask_epi8(ws) << shift;
+    }
+#else
+    memset(m, 0, sizeof(*m));
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = 1ull << i;
+        switch (p[i]) {
+            case '"': m->quote |= bit; break;
+            case '\\': m->backslash |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',': m->op |= bit; break;
+            case ' ': case '\t': case '\n': case '\r': m->space |= bit; break;
+            default: break;
+        }
+    }
+#endif
+}
+
+// Bit i of the result is the xor of bits 0..i: set from an opening quote up to
+// (not including) its closing one
+static inline uint64_t cm_json_prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Fills index with the offsets of structural characters, quotes and the first
+// byte of every bare scalar. Returns the count, or -1 if a string never closes.
+static ssize_t cm_json_index(const char* text, size_t length, uint32_t* index) {
+    uint64_t carry_escaped = 0;          // last block ended in an unfinished escape
+    uint64_t carry_in_string = 0;        // all ones while a string spans blocks
+    uint64_t carry_scalar = 0;           // last block ended inside a bare scalar
+    size_t n = 0;
+    char tail[64];
+
+    for (size_t base = 0; base < length; base += 64) {
+        const char* p = text + base;
+        if (length - base < 64) {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, p, length - base);
+            p = tail;
+        }
+        cm_json_block_t m;
+        cm_json_classify(p, &m);
+
+        // Backslashes are rare, so walk them one by one; an escaped backslash escapes nothing
+        uint64_t escaped = carry_escaped;
+        carry_escaped = 0;
+        for (uint64_t bs = m.backslash; bs; bs &= bs - 1) {
+            int i = __builtin_ctzll(bs);
+            if ((escaped >> i) & 1) continue;
+            if (i == 63) carry_escaped = 1;
+            else escaped |= 1ull << (i + 1);
+        }
+
+        uint64_t quotes = m.quote & ~escaped;
+        uint64_t in_string = cm_json_prefix_xor(quotes) ^ carry_in_string;
+        carry_in_string = (uint64_t)((int64_t)in_string >> 63);
+
+        uint64_t scalar = ~(m.op | m.space | quotes);
+        uint64_t follows_scalar = (scalar << 1) | carry_scalar;
+        carry_scalar = scalar >> 63;
+        uint64_t starts = scalar & ~follows_scalar & ~in_string;
+
+        for (uint64_t s = (m.op & ~in_string) | quotes | starts; s; s &= s - 1) {
+            index[n++] = (uint32_t)(base + (size_t)__builtin_ctzll(s));
+        }
+    }
+    return carry_in_string ? -1 : (ssize_t)n;
+}
+
+typedef struct {
+    const char* text;
+    size_t length;
+    const uint32_t* index;
+    size_t count;
+    size_t next;                         // next index entry to consume
+    CMArena* arena;
+    cm_json_t** items;                   // elements of the arrays still open
+    size_t items_len, items_cap;
+    cm_json_member_t* members;           // members of the objects still open
+    size_t members_len, members_cap;
+    const char* error;
+    size_t error_at;
+} cm_json_parser_t;
+
+static void* cm_json_fail(cm_json_parser_t* p, const char* error, size_t at) {
+    if (!p->error) {
+        p->error = error;
+        p->error_at = at;
+    }
+    return NULL;
+}
+
+// The tree outgrows the caller's arena block by chaining more blocks onto it
+static void* cm_json_alloc(cm_json_parser_t* p, size_t size) {
+    void* ptr = cm_arena_alloc_grow(p->arena, size);
+    if (!ptr) return cm_json_fail(p, "out of memory", p->length);
+    return ptr;
+}
+
+static cm_json_t* cm_json_node(cm_json_parser_t* p, int type) {
+    cm_json_t* v = (cm_json_t*)cm_json_alloc(p, sizeof(cm_json_t));
+    if (v) {
+        v->type = type;
+        v->count = 0;
+    }
+    return v;
+}
+
+static int cm_json_grow(void** data, size_t* cap, size_t elem) {
+    size_t n = *cap ? *cap * 2 : 64;
+    void* grown = realloc(*data, n * elem);
+    if (!grown) return -1;
+    *data = grown;
+    *cap = n;
+    return 0;
+}
+
+static inline int cm_json_is_delim(const cm_json_parser_t* p, size_t at) {
+    if (at >= p->length) return 1;
+    switch (p->text[at]) {
+        case ' ': case '\t': case '\n': case '\r': case ',': case ']': case '}': case ':': return 1;
+        default: return 0;
+    }
+}
+
+static int cm_json_hex4(const char* s, uint32_t* out) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = s[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= (uint32_t)(c - '0');
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') v |= (uint32_t)((c | 0x20) - 'a' + 10);
+        else return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+static size_t cm_json_utf8(char* out, uint32_t cp) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// Decoded text never outgrows the escaped form, so one allocation of len + 1 suffices
+static int cm_json_unescape(cm_json_parser_t* p, const char* s, size_t len, cm_strview_t* out) {
+    char* dst = (char*)cm_json_alloc(p, len + 1);
+    if (!dst) return -1;
+
+    const char* end = s + len;
+    char* d = dst;
+    while (s < end) {
+        if (*s != '\\') {
+            *d++ = *s++;
+            continue;
+        }
+        size_t at = (size_t)(s - p->text);
+        if (end - s < 2) return cm_json_fail(p, "bad escape", at), -1;
+        char c = s[1];
+        s += 2;
+        switch (c) {
+            case '"': *d++ = '"'; break;
+            case '\\': *d++ = '\\'; break;
+            case '/': *d++ = '/'; break;
+            case 'b': *d++ = '\b'; break;
+            case 'f': *d++ = '\f'; break;
+            case 'n': *d++ = '\n'; break;
+            case 'r': *d++ = '\r'; break;
+            case 't': *d++ = '\t'; break;
+            case 'u': {
+                uint32_t cp;
+                if (end - s < 4 || cm_json_hex4(s, &cp) != 0) return cm_json_fail(p, "bad \\u escape", at), -1;
+                s += 4;
+                if (cp >= 0xD800 && cp < 0xDC00) {
+                    uint32_t lo;
+                    if (end - s < 6 || s[0] != '\\' || s[1] != 'u' || cm_json_hex4(s + 2, &lo) != 0 ||
+                        lo < 0xDC00 || lo > 0xDFFF) {
+                        return cm_json_fail(p, "unpaired surrogate", at), -1;
+                    }
+                    s += 6;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    return cm_json_fail(p, "unpaired surrogate", at), -1;
+                }
+                d += cm_json_utf8(d, cp);
+                break;
+            }
+            default:
+                return cm_json_fail(p, "bad escape", at), -1;
+        }
+    }
+    *d = '\0';
+    out->data = dst;
+    out->length = (size_t)(d - dst);
+    return 0;
+}
+
+// Offset of the first raw byte below 0x20 (RFC 8259 wants those escaped), or len.
+// Eight bytes at a time: x - 0x20.. borrows into the top bit only under 0x20.
+static size_t cm_json_control_scan(const char* s, size_t len) {
+    const uint64_t ones = 0x0101010101010101ull;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t x;
+        memcpy(&x, s + i, 8);
+        if ((x - ones * 0x20) & ~x & (ones * 0x80)) break;
+    }
+    for (; i < len; i++) {
+        if ((unsigned char)s[i] < 0x20) return i;
+    }
+    return len;
+}
+
+// The opening quote has just been consumed; the closing one is always the next entry
+static int cm_json_string(cm_json_parser_t* p, size_t open, cm_strview_t* out) {
+    if (p->next >= p->count) return cm_json_fail(p, "unterminated string", open), -1;
+    size_t close = p->index[p->next++];
+    if (p->text[close] != '"') return cm_json_fail(p, "unterminated string", open), -1;
+
+    const char* s = p->text + open + 1;
+    size_t len = close - open - 1;
+    size_t bad = cm_json_control_scan(s, len);
+    if (bad < len) return cm_json_fail(p, "control character in string", open + 1 + bad), -1;
+    if (memchr(s, '\\', len)) return cm_json_unescape(p, s, len, out);
+    out->data = s;
+    out->length = len;
+    return 0;
+}
+
+static const double cm_json_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static cm_json_t* cm_json_number(cm_json_parser_t* p, size_t at) {
+    const char* s = p->text + at;
+    const char* end = p->text + p->length;
+    const char* c = s;
+    int negative = 0;
+    if (c < end && *c == '-') {
+        negative = 1;
+        c++;
+    }
+    if (c == end || *c < '0' || *c > '9') return cm_json_fail(p, "bad number", at);
+
+    // Up to 19 significant digits accumulate exactly; anything longer goes to strtod
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exp10 = 0;
+    if (*c == '0') {
+        c++;
+    } else {
+        for (; c < end && *c >= '0' && *c <= '9'; c++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*c - '0');
+                digits++;
+            } else {
+                exp10++;
+                digits++;
+            }
+        }
+    }
+    int exact = digits <= 19;
+    if (c < end && *c == '.') {
+        c++;
+        if (c == end || *c < '0' || *c > '9') return cm_json_fail(p, "bad number", at);
+        for (; c < end && *c >= '0' && *c <= '9'; c++) {
+            if (mantissa < 1000000000000000000ull) {
+                mantissa = mantissa * 10 + (uint64_t)(*c - '0');
+                exp10--;
+            } else if (*c != '0') {
+                exact = 0;
+            }
+        }
+    }
+    if (c < end && (*c | 0x20) == 'e') {
+        c++;
+        int eneg = 0;
+        if (c < end && (*c == '+' || *c == '-')) eneg = *c++ == '-';
+        if (c == end || *c < '0' || *c > '9') return cm_json_fail(p, "bad number", at);
+        int e = 0;
+        for (; c < end && *c >= '0' && *c <= '9'; c++) {
+            if (e < 100000) e = e * 10 + (*c - '0');
+        }
+        exp10 += eneg ? -e : e;
+    }
+    if (!cm_json_is_delim(p, (size_t)(c - p->text))) return cm_json_fail(p, "bad number", at);
+
+    cm_json_t* v = cm_json_node(p, CM_JSON_NUMBER);
+    if (!v) return NULL;
+
+    // Exact mantissa and power of ten: one multiply or divide rounds correctly
+    if (exact && mantissa < (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+        double d = (double)mantissa;
+        d = exp10 < 0 ? d / cm_json_pow10[-exp10] : d * cm_json_pow10[exp10];
+        v->as.number = negative ? -d : d;
+        return v;
+    }
+
+    char buf[64];
+    size_t len = (size_t)(c - s);
+    char* tmp = len < sizeof(buf) ? buf : (char*)malloc(len + 1);
+    if (!tmp) return cm_json_fail(p, "out of memory", at);
+    memcpy(tmp, s, len);
+    tmp[len] = '\0';
+    v->as.number = strtod(tmp, NULL);
+    if (tmp != buf) free(tmp);
+    // 1e400 would come back as +-Inf, which JSON cannot spell, so a round
+    // trip through cm_json_stringify would turn it into null
+    if (isinf(v->as.number)) return cm_json_fail(p, "number out of range", at);
+    return v;
+}
+
+static cm_json_t* cm_json_literal(cm_json_parser_t* p, size_t at, const char* word, int type) {
+    size_t len = strlen(word);
+    if (p->length - at < len || memcmp(p->text + at, word, len) != 0 || !cm_json_is_delim(p, at + len)) {
+        return cm_json_fail(p, "unexpected token", at);
+    }
+    cm_json_t* v = cm_json_node(p, type);
+    if (v) v->as.boolean = type == CM_JSON_TRUE;
+    return v;
+}
+
+static cm_json_t* cm_json_value(cm_json_parser_t* p, int depth);
+
+static cm_json_t* cm_json_array(cm_json_parser_t* p, size_t at, int depth) {
+    size_t start = p->items_len;
+    if (p->next < p->count && p->text[p->index[p->next]] == ']') {
+        p->next++;
+    } else {
+        for (;;) {
+            cm_json_t* item = cm_json_value(p, depth + 1);
+            if (!item) return NULL;
+            if (p->items_len == p->items_cap &&
+                cm_json_grow((void**)&p->items, &p->items_cap, sizeof(cm_json_t*)) != 0) {
+                return cm_json_fail(p, "out of memory", at);
+            }
+            p->items[p->items_len++] = item;
+
+            if (p->next >= p->count) return cm_json_fail(p, "unterminated array", at);
+            size_t sep = p->index[p->next++];
+            if (p->text[sep] == ']') break;
+            if (p->text[sep] != ',') return cm_json_fail(p, "expected ',' or ']'", sep);
+        }
+    }
+
+    cm_json_t* v = cm_json_node(p, CM_JSON_ARRAY);
+    if (!v) return NULL;
+    v->count = p->items_len - start;
+    v->as.items = NULL;
+    if (v->count) {
+        v->as.items = (cm_json_t**)cm_json_alloc(p, v->count * sizeof(cm_json_t*));
+        if (!v->as.items) return NULL;
+        memcpy(v->as.items, p->items + start, v->count * sizeof(cm_json_t*));
+    }
+    p->items_len = start;
+    return v;
+}
+
+static cm_json_t* cm_json_object(cm_json_parser_t* p, size_t at, int depth) {
+    size_t start = p->members_len;
+    if (p->next < p->count && p->text[p->index[p->next]] == '}') {
+        p->next++;
+    } else {
+        for (;;) {
+            if (p->next >= p->count) return cm_json_fail(p, "unterminated object", at);
+            size_t key_at = p->index[p->next++];
+            if (p->text[key_at] != '"') return cm_json_fail(p, "expected a string key", key_at);
+            cm_json_member_t member;
+            if (cm_json_string(p, key_at, &member.key) != 0) return NULL;
+
+            if (p->next >= p->count || p->text[p->index[p->next]] != ':') {
+                return cm_json_fail(p, "expected ':'", key_at);
+            }
+            p->next++;
+            member.value = cm_json_value(p, depth + 1);
+            if (!member.value) return NULL;
+            if (p->members_len == p->members_cap &&
+                cm_json_grow((void**)&p->members, &p->members_cap, sizeof(cm_json_member_t)) != 0) {
+                return cm_json_fail(p, "out of memory", at);
+            }
+            p->members[p->members_len++] = member;
+
+            if (p->next >= p->count) return cm_json_fail(p, "unterminated object", at);
+            size_t sep = p->index[p->next++];
+            if (p->text[sep] == '}') break;
+            if (p->text[sep] != ',') return cm_json_fail(p, "expected ',' or '}'", sep);
+        }
+    }
+
+    cm_json_t* v = cm_json_node(p, CM_JSON_OBJECT);
+    if (!v) return NULL;
+    v->count = p->members_len - start;
+    v->as.members = NULL;
+    if (v->count) {
+        v->as.members = (cm_json_member_t*)cm_json_alloc(p, v->count * sizeof(cm_json_member_t));
+        if (!v->as.members) return NULL;
+        memcpy(v->as.members, p->members + start, v->count * sizeof(cm_json_member_t));
+    }
+    p->members_len = start;
+    return v;
+}
+
+static cm_json_t* cm_json_value(cm_json_parser_t* p, int depth) {
+    if (p->next >= p->count) return cm_json_fail(p, "unexpected end of input", p->length);
+    if (depth > CM_JSON_MAX_DEPTH) return cm_json_fail(p, "nested too deeply", p->index[p->next]);
+
+    size_t at = p->index[p->next++];
+    switch (p->text[at]) {
+        case '{': return cm_json_object(p, at, depth);
+        case '[': return cm_json_array(p, at, depth);
+        case '"': {
+            cm_json_t* v = cm_json_node(p, CM_JSON_STRING);
+            if (!v || cm_json_string(p, at, &v->as.string) != 0) return NULL;
+            v->count = v->as.string.length;
+            return v;
+        }
+        case 't': return cm_json_literal(p, at, "true", CM_JSON_TRUE);
+        case 'f': return cm_json_literal(p, at, "false", CM_JSON_FALSE);
+        case 'n': return cm_json_literal(p, at, "null", CM_JSON_NULL);
+        case '-': case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            return cm_json_number(p, at);
+        default: return cm_json_fail(p, "unexpected token", at);
+    }
+}
+
+// Nodes go into arena, or the current one when it is NULL; strings without
+// escapes are views into text, so text must outlive the tree
+cm_json_t* cm_json_parse(CMArena* arena, const char* text, size_t length) {
+    if (!arena) arena = cm_current_arena;
+    if (!arena || !text) {
+        cm_error_set(CM_ERROR_INVALID_ARGUMENT, "cm_json_parse needs text and an arena");
+        return NULL;
+    }
+    if (length >= UINT32_MAX) {
+        cm_error_set(CM_ERROR_OVERFLOW, "JSON input over 4 GiB");
+        return NULL;
+    }
+    CM_TRACE_SCOPE("cm_json_parse");
+
+    uint32_t* index = (uint32_t*)malloc((length + 1) * sizeof(uint32_t));
+    if (!index) {
+        cm_error_set(CM_ERROR_MEMORY, "Failed to allocate JSON index");
+        return NULL;
+    }
+
+    cm_json_parser_t p;
+    memset(&p, 0, sizeof(p));
+    p.text = text;
+    p.length = length;
+    p.index = index;
+    p.arena = arena;
+
+    cm_json_t* root = NULL;
+    ssize_t count = cm_json_index(text, length, index);
+    if (count < 0) {
+        cm_json_fail(&p, "unterminated string", length);
+    } else {
+        p.count = (size_t)count;
+        root = cm_json_value(&p, 0);
+        if (root && p.next != p.count) root = cm_json_fail(&p, "trailing characters", index[p.next]);
+    }
+
+    if (!root) {
+        char message[128];
+        snprintf(message, sizeof(message), "JSON parse error at byte %zu: %s", p.error_at, p.error);
+        cm_error_set(CM_ERROR_PARSE, message);
+    }
+    free(p.items);
+    free(p.members);
+    free(index);
+    return root;
+}
+
+// Linear in the member count; for large objects build a map once with cm_json_to_map
+cm_json_t* cm_json_get(const cm_json_t* object, const char* key) {
+    if (!object || !key || object->type != CM_JSON_OBJECT) return NULL;
+    cm_strview_t k = cm_strview(key);
+    for (size_t i = 0; i < object->count; i++) {
+        if (cm_strview_eq(object->as.members[i].key, k)) return object->as.members[i].value;
+    }
+    return NULL;
+}
+
+cm_json_t* cm_json_at(const cm_json_t* array, size_t i) {
+    if (!array || array->type != CM_JSON_ARRAY || i >= array->count) return NULL;
+    return array->as.items[i];
+}
+
+// Map values are the member nodes themselves (cm_json_t*), as CM_MAP_SET_STRING stores pointers
+cm_map_t* cm_json_to_map(const cm_json_t* object) {
+    if (!object || object->type != CM_JSON_OBJECT) return NULL;
+    cm_map_t* map = cm_map_new();
+    if (!map) return NULL;
+
+    char stack[256];
+    for (size_t i = 0; i < object->count; i++) {
+        cm_strview_t key = object->as.members[i].key;
+        char* k = key.length < sizeof(stack) ? stack : (char*)malloc(key.length + 1);
+        if (!k) {
+            cm_map_free(map);
+            return NULL;
+        }
+        memcpy(k, key.data, key.length);
+        k[key.length] = '\0';
+        cm_map_set(map, k, &object->as.members[i].value, sizeof(cm_json_t*));
+        if (k != stack) free(k);
+    }
+    return map;
+}
+
+// Elements are cm_json_t* pointers
+cm_array_t* cm_json_to_array(const cm_json_t* array) {
+    if (!array || array->type != CM_JSON_ARRAY) return NULL;
+    cm_array_t* arr = cm_array_new(sizeof(cm_json_t*), array->count ? array->count : 1);
+    if (!arr) return NULL;
+    for (size_t i = 0; i < array->count; i++) cm_array_push(arr, &array->as.items[i]);
+    return arr;
+}
+
+static inline int cm_json_needs_escape(unsigned char c) {
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+// Index of the first byte at or after i that must be escaped, or len
+static size_t cm_json_escape_scan(const char* s, size_t i, size_t len) {
+#if defined(__SSE2__)
+    const __m128i ctrl = _mm_set1_epi8(0x1F);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    for (; len - i >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        // max(v, 0x1F) == 0x1F exactly for bytes below 0x20 (unsigned)
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+#endif
+    while (i < len && !cm_json_needs_escape((unsigned char)s[i])) i++;
+    return i;
+}
+
+static void cm_json_write_string(cm_fmt_out_t* out, cm_strview_t s) {
+    static const char hex[] = "0123456789abcdef";
+    cm_fmt_put(out, "\"", 1);
+    size_t run = 0;
+    for (size_t i = cm_json_escape_scan(s.data, 0, s.length); i < s.length;
+         i = cm_json_escape_scan(s.data, i + 1, s.length)) {
+        unsigned char c = (unsigned char)s.data[i];
+        cm_fmt_put(out, s.data + run, i - run);
+        run = i + 1;
+        char esc[6] = { '\\', 0 };
+        switch (c) {
+            case '"': esc[1] = '"'; break;
+            case '\\': esc[1] = '\\'; break;
+            case '\n': esc[1] = 'n'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\t': esc[1] = 't'; break;
+            case '\b': esc[1] = 'b'; break;
+            case '\f': esc[1] = 'f'; break;
+            default:
+                memcpy(esc + 1, "u00", 3);
+                esc[4] = hex[c >> 4];
+                esc[5] = hex[c & 15];
+                cm_fmt_put(out, esc, 6);
+                continue;
+        }
+        cm_fmt_put(out, esc, 2);
+    }
+    cm_fmt_put(out, s.data + run, s.length - run);
+    cm_fmt_put(out, "\"", 1);
+}
+
+static void cm_json_write_number(cm_fmt_out_t* out, double x) {
+    if (x != x || x == HUGE_VAL || x == -HUGE_VAL) {
+        cm_fmt_put(out, "null", 4);
+        return;
+    }
+    if (x == 0 && signbit(x)) {
+        cm_fmt_put(out, "-0", 2);
+        return;
+    }
+    if (x > -9007199254740992.0 && x < 9007199254740992.0 && x == (double)(int64_t)x) {
+        cm_fmt_int(out, (int64_t)x);
+        return;
+    }
+    // Shortest of %.15g and %.17g that reads back as the same double
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%.15g", x);
+    if (strtod(buf, NULL) != x) n = snprintf(buf, sizeof(buf), "%.17g", x);
+    cm_fmt_put(out, buf, (size_t)n);
+}
+
+static void cm_json_write(cm_fmt_out_t* out, const cm_json_t* v) {
+    if (!v) {
+        cm_fmt_put(out, "null", 4);
+        return;
+    }
+    switch (v->type) {
+        case CM_JSON_NULL: cm_fmt_put(out, "null", 4); break;
+        case CM_JSON_TRUE: cm_fmt_put(out, "true", 4); break;
+        case CM_JSON_FALSE: cm_fmt_put(out, "false", 5); break;
+        case CM_JSON_NUMBER: cm_json_write_number(out, v->as.number); break;
+        case CM_JSON_STRING: cm_json_write_string(out, v->as.string); break;
+        case CM_JSON_ARRAY:
+            cm_fmt_put(out, "[", 1);
+            for (size_t i = 0; i < v->count; i++) {
+                if (i) cm_fmt_put(out, ",", 1);
+                cm_json_write(out, v->as.items[i]);
+            }
+            cm_fmt_put(out, "]", 1);
+            break;
+        case CM_JSON_OBJECT:
+            cm_fmt_put(out, "{", 1);
+            for (size_t i = 0; i < v->count; i++) {
+                if (i) cm_fmt_put(out, ",", 1);
+                cm_json_write_string(out, v->as.members[i].key);
+                cm_fmt_put(out, ":", 1);
+                cm_json_write(out, v->as.members[i].value);
+            }
+            cm_fmt_put(out, "}", 1);
+            break;
+        default: cm_fmt_put(out, "null", 4); break;
+    }
+}
+
+// Compact output (no whitespace), built in one buffer and copied into the string once
+cm_string_t* cm_json_stringify(const cm_json_t* value) {
+    char stack[CM_STRING_STACK_FORMAT * 16];
+    cm_fmt_out_t out = { stack, 0, sizeof(stack), cm_fmt_grow_spill, NULL, 0 };
+    cm_json_write(&out, value);
+
+    cm_string_t* result = NULL;
+    if (!out.failed) result = cm_string_alloc_inline(out.data, out.len, out.len + 1);
+    else cm_error_set(CM_ERROR_MEMORY, "Failed to grow JSON output");
+    free(out.ctx);
+    return result;
+}
+
+/* ============================================================================
+ * TASK POOL & FUTURES IMPLEMENTATION
+ * ============================================================================ */
+typedef struct cm_task {
+    void (*run)(void* arg);
+    void* arg;
+    struct cm_task* next;
+} cm_task_t;
+
+struct cm_task_pool {
+    pthread_t* threads;
+    int thread_count;
+    cm_task_t* head;
+    cm_task_t* tail;
+    size_t pending;
+    int stopping;
+    int exited;                // workers that have returned, for cm_task_pool_stop_timed
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+typedef struct cm_future_cb {
+    void (*fn)(cm_future_t* future, void* arg);
+    void* arg;
+    struct cm_future_cb* next;
+} cm_future_cb_t;
+
+struct cm_future {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int state;
+    int error;
+    int index;                 // winning input of cm_future_when_any
+    void* value;
+    void** values;             // owned result slots of cm_future_when_all
+    cm_future_cb_t* callbacks;
+    cm_future_t** inputs;      // then / when_* sources, retained until this completes
+    size_t input_count;
+};
+
+// Future currently being computed by this worker (for cm_task_cancelled)
+static __thread cm_future_t* cm_task_current = NULL;
+
+/*
+ * Once-flags for the lazily started defaults. Unlike pthread_once_t they may be
+ * reset, which shutdown and the fork child handler need to do.
+ */
+typedef struct {
+    int done;
+    pthread_mutex_t lock;
+} cm_once_t;
+
+#define CM_ONCE_INIT { 0, PTHREAD_MUTEX_INITIALIZER }
+
+static void cm_once(cm_once_t* once, void (*init)(void)) {
+    if (__atomic_load_n(&once->done, __ATOMIC_ACQUIRE)) return;
+    pthread_mutex_lock(&once->lock);
+    if (!once->done) {
+        init();
+        __atomic_store_n(&once->done, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&once->lock);
+}
+
+static void cm_once_reset(cm_once_t* once) {
+    pthread_mutex_lock(&once->lock);
+    __atomic_store_n(&once->done, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&once->lock);
+}
+
+// fork() child only: another parent thread may have held the lock
+static void cm_once_reset_child(cm_once_t* once) {
+    pthread_mutex_init(&once->lock, NULL);
+    once->done = 0;
+}
+
+static cm_task_pool_t* cm_default_pool = NULL;
+static cm_once_t cm_default_pool_once = CM_ONCE_INIT;
+
+static void* cm_task_worker(void* arg) {
+    cm_task_pool_t* pool = (cm_task_pool_t*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->head && !pool->stopping) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        cm_task_t* task = pool->head;
+        if (!task) {
+            // stopping and fully drained
+            pool->exited++;
+            pthread_cond_broadcast(&pool->cond);
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        pool->head = task->next;
+        if (!pool->head) pool->tail = NULL;
+        pool->pending--;
+        pthread_mutex_unlock(&pool->lock);
+
+        {
+            CM_TRACE_SCOPE("cm_task");
+            task->run(task->arg);
+        }
+        free(task);
+    }
+
+    return NULL;
+}
+
+cm_task_pool_t* cm_task_pool_create(int threads) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 4;
+    }
+
+    cm_task_pool_t* pool = (cm_task_pool_t*)calloc(1, sizeof(cm_task_pool_t));
+    if (!pool) return NULL;
+
+    pool->threads = (pthread_t*)calloc((size_t)threads, sizeof(pthread_t));
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, cm_task_worker, pool) != 0) {
+            cm_error_set(CM_ERROR_THREAD, "cm_task_pool_create: pthread_create failed");
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count == 0) {
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->cond);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void cm_task_pool_destroy(cm_task_pool_t* pool) {
+    if (!pool) return;
+
+    // Workers drain whatever is still queued before they exit
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+    free(pool->threads);
+    free(pool);
+}
+
+/*
+ * cm_task_pool_destroy with a deadline. Returns 1 once the pool is gone; if a
+ * task is still running at the deadline, the workers are detached and the pool
+ * is left to finish (and leak) on its own, returning 0.
+ */
+static int cm_task_pool_stop_timed(cm_task_pool_t* pool, long timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->cond);
+    while (pool->exited < pool->thread_count) {
+        if (pthread_cond_timedwait(&pool->cond, &pool->lock, &ts) == ETIMEDOUT) break;
+    }
+    int stopped = pool->exited == pool->thread_count;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!stopped) {
+        for (int i = 0; i < pool->thread_count; i++) pthread_detach(pool->threads[i]);
+        return 0;
+    }
+    cm_task_pool_destroy(pool);
+    return 1;
+}
+
+static void cm_default_pool_init(void) {
+    cm_runtime_register();
+    cm_default_pool = cm_task_pool_create(0);
+}
+
+cm_task_pool_t* cm_task_pool_default(void) {
+    cm_once(&cm_default_pool_once, cm_default_pool_init);
+    return cm_default_pool;
+}
+
+int cm_task_pool_submit(cm_task_pool_t* pool, void (*fn)(void*), void* arg) {
+    if (!fn) return CM_ERROR_NULL_POINTER;
+    if (!pool) pool = cm_task_pool_default();
+    if (!pool) return CM_ERROR_THREAD;
+
+    cm_task_t* task = (cm_task_t*)malloc(sizeof(cm_task_t));
+    if (!task) return CM_ERROR_MEMORY;
+    task->run = fn;
+    task->arg = arg;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->stopping) {
+        pthread_mutex_unlock(&pool->lock);
+        free(task);
+        return CM_ERROR_THREAD;
+    }
+    if (pool->tail) {
+        pool->tail->next = task;
+    } else {
+        pool->head = task;
+    }
+    pool->tail = task;
+    pool->pending++;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return CM_SUCCESS;
+}
+
+size_t cm_task_pool_pending(cm_task_pool_t* pool) {
+    if (!pool) return 0;
+    pthread_mutex_lock(&pool->lock);
+    size_t pending = pool->pending;
+    pthread_mutex_unlock(&pool->lock);
+    return pending;
+}
+
+/* ---- Futures ---- */
+
+// Runs on the last cm_free, or under gc_lock from cm_gc_collect: must not call back into the GC
+static void cm_future_destructor(void* ptr) {
+    cm_future_t* f = (cm_future_t*)ptr;
+    cm_future_cb_t* cb = f->callbacks;
+    while (cb) {
+        cm_future_cb_t* next = cb->next;
+        free(cb);
+        cb = next;
+    }
+    free(f->values);
+    free(f->inputs);           // only left over when a pending future is swept
+    pthread_mutex_destroy(&f->lock);
+    pthread_cond_destroy(&f->cond);
+}
+
+cm_future_t* cm_future_new(void) {
+    // Futures are shared across threads, so they always bypass the current arena
+    cm_future_t* f = (cm_future_t*)cm_gc_alloc(sizeof(cm_future_t), "future",
+                                               __FILE__, __LINE__, cm_future_destructor);
+    if (!f) return NULL;
+
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->cond, NULL);
+    f->state = CM_FUTURE_PENDING;
+    f->error = CM_SUCCESS;
+    f->index = -1;
+    f->value = NULL;
+    f->values = NULL;
+    f->callbacks = NULL;
+    f->inputs = NULL;
+    f->input_count = 0;
+
+    return f;
+}
+
+void cm_future_release(cm_future_t* f) {
+    cm_free(f);
+}
+
+static int cm_future_complete(cm_future_t* f, int state, void* value, int error) {
+    if (!f) return 0;
+
+    pthread_mutex_lock(&f->lock);
+    if (f->state != CM_FUTURE_PENDING) {
+        pthread_mutex_unlock(&f->lock);
+        return 0;
+    }
+    f->state = state;
+    f->value = value;
+    f->error = error;
+
+    // Detach callbacks and reverse them into registration order
+    cm_future_cb_t* list = NULL;
+    cm_future_cb_t* cb = f->callbacks;
+    while (cb) {
+        cm_future_cb_t* next = cb->next;
+        cb->next = list;
+        list = cb;
+        cb = next;
+    }
+    f->callbacks = NULL;
+    cm_future_t** inputs = f->inputs;
+    size_t input_count = f->input_count;
+    f->inputs = NULL;
+    f->input_count = 0;
+
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->lock);
+
+    // Continuations run inline on the completing thread
+    while (list) {
+        cm_future_cb_t* next = list->next;
+        list->fn(f, list->arg);
+        free(list);
+        list = next;
+    }
+
+    // Cancelling a derived future cancels the work it was waiting on
+    for (size_t i = 0; i < input_count; i++) {
+        if (state == CM_FUTURE_CANCELLED) cm_future_cancel(inputs[i]);
+        cm_future_release(inputs[i]);
+    }
+    free(inputs);
+
+    return 1;
+}
+
+// Keeps a reference to each source of a derived future so that cancelling it
+// can reach them; must run before the sources can complete the result
+static int cm_future_set_inputs(cm_future_t* result, cm_future_t** inputs, size_t count) {
+    cm_future_t** copy = (cm_future_t**)malloc(count * sizeof(cm_future_t*));
+    if (!copy) return CM_ERROR_MEMORY;
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!inputs[i]) continue;
+        cm_retain(inputs[i]);
+        copy[n++] = inputs[i];
+    }
+    result->inputs = copy;
+    result->input_count = n;
+    return CM_SUCCESS;
+}
+
+int cm_future_resolve(cm_future_t* f, void* value) {
+    return cm_future_complete(f, CM_FUTURE_READY, value, CM_SUCCESS);
+}
+
+int cm_future_reject(cm_future_t* f, int error) {
+    return cm_future_complete(f, CM_FUTURE_FAILED, NULL, error ? error : CM_ERROR_UNKNOWN);
+}
+
+int cm_future_cancel(cm_future_t* f) {
+    return cm_future_complete(f, CM_FUTURE_CANCELLED, NULL, CM_SUCCESS);
+}
+
+int cm_future_on_complete(cm_future_t* f, void (*fn)(cm_future_t*, void*), void* arg) {
+    if (!f || !fn) return CM_ERROR_NULL_POINTER;
+
+    pthread_mutex_lock(&f->lock);
+    if (f->state == CM_FUTURE_PENDING) {
+        cm_future_cb_t* cb = (cm_future_cb_t*)malloc(sizeof(cm_future_cb_t));
+        if (!cb) {
+            pthread_mutex_unlock(&f->lock);
+            return CM_ERROR_MEMORY;
+        }
+        cb->fn = fn;
+        cb->arg = arg;
+        cb->next = f->callbacks;
+        f->callbacks = cb;
+        pthread_mutex_unlock(&f->lock);
+        return CM_SUCCESS;
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    // Already settled: run inline on the caller
+    fn(f, arg);
+    return CM_SUCCESS;
+}
+
+int cm_future_state(cm_future_t* f) {
+    if (!f) return CM_FUTURE_CANCELLED;
+    pthread_mutex_lock(&f->lock);
+    int state = f->state;
+    pthread_mutex_unlock(&f->lock);
+    return state;
+}
+
+int cm_future_error(cm_future_t* f) {
+    if (!f) return CM_ERROR_NULL_POINTER;
+    pthread_mutex_lock(&f->lock);
+    int error = f->error;
+    pthread_mutex_unlock(&f->lock);
+    return error;
+}
+
+int cm_future_index(cm_future_t* f) {
+    if (!f) return -1;
+    pthread_mutex_lock(&f->lock);
+    int index = f->index;
+    pthread_mutex_unlock(&f->lock);
+    return index;
+}
+
+int cm_future_wait(cm_future_t* f) {
+    if (!f) return CM_FUTURE_CANCELLED;
+
+    pthread_mutex_lock(&f->lock);
+    while (f->state == CM_FUTURE_PENDING) {
+        pthread_cond_wait(&f->cond, &f->lock);
+    }
+    int state = f->state;
+    pthread_mutex_unlock(&f->lock);
+    return state;
+}
+
+void* cm_future_get(cm_future_t* f) {
+    int state = cm_future_wait(f);
+    if (state == CM_FUTURE_READY) return f->value;
+
+    if (state == CM_FUTURE_FAILED) {
+        cm_error_set(f->error, "cm_future_get: future failed");
+    } else {
+        cm_error_set(CM_ERROR_INVALID_ARGUMENT, "cm_future_get: future cancelled");
+    }
+    return NULL;
+}
+
+/* ---- cm_async ---- */
+typedef struct {
+    cm_future_t* future;
+    void* (*fn)(void*);
+    void* arg;
+} cm_async_ctx_t;
+
+static void cm_async_run(void* ptr) {
+    cm_async_ctx_t* ctx = (cm_async_ctx_t*)ptr;
+
+    // Skip work that was cancelled while still queued
+    if (cm_future_state(ctx->future) == CM_FUTURE_PENDING) {
+        cm_task_current = ctx->future;
+        void* value = ctx->fn(ctx->arg);
+        cm_task_current = NULL;
+        cm_future_resolve(ctx->future, value);
+    }
+
+    cm_future_release(ctx->future);
+    free(ctx);
+}
+
+cm_future_t* cm_async(cm_task_pool_t* pool, void* (*fn)(void*), void* arg) {
+    if (!fn) return NULL;
+
+    cm_future_t* f = cm_future_new();
+    if (!f) return NULL;
+
+    cm_async_ctx_t* ctx = (cm_async_ctx_t*)malloc(sizeof(cm_async_ctx_t));
+    if (!ctx) {
+        cm_future_release(f);
+        return NULL;
+    }
+    ctx->future = f;
+    ctx->fn = fn;
+    ctx->arg = arg;
+
+    cm_retain(f);  // reference held by the queued task
+    int rc = cm_task_pool_submit(pool, cm_async_run, ctx);
+    if (rc != CM_SUCCESS) {
+        cm_future_reject(f, rc);
+        cm_future_release(f);
+        free(ctx);
+    }
+
+    return f;
+}
+
+// Cancelled, or settled by someone else first (e.g. a cm_future_timeout deadline)
+int cm_task_cancelled(void) {
+    return cm_task_current && cm_future_state(cm_task_current) != CM_FUTURE_PENDING;
+}
+
+/* ---- then ---- */
+typedef struct {
+    cm_future_t* result;
+    void* (*fn)(void* value, void* arg);
+    void* arg;
+    void* value;
+    cm_task_pool_t* pool;
+} cm_then_ctx_t;
+
+static void cm_then_run(void* ptr) {
+    cm_then_ctx_t* ctx = (cm_then_ctx_t*)ptr;
+
+    if (cm_future_state(ctx->result) == CM_FUTURE_PENDING) {
+        cm_task_current = ctx->result;
+        void* value = ctx->fn(ctx->value, ctx->arg);
+        cm_task_current = NULL;
+        cm_future_resolve(ctx->result, value);
+    }
+
+    cm_future_release(ctx->result);
+    free(ctx);
+}
+
+static void cm_then_cb(cm_future_t* source, void* arg) {
+    cm_then_ctx_t* ctx = (cm_then_ctx_t*)arg;
+
+    if (source->state == CM_FUTURE_READY) {
+        ctx->value = source->value;
+        if (!ctx->pool || cm_task_pool_submit(ctx->pool, cm_then_run, ctx) != CM_SUCCESS) {
+            cm_then_run(ctx);
+        }
+        return;
+    }
+
+    if (source->state == CM_FUTURE_FAILED) {
+        cm_future_reject(ctx->result, source->error);
+    } else {
+        cm_future_cancel(ctx->result);
+    }
+    cm_future_release(ctx->result);
+    free(ctx);
+}
+
+static cm_future_t* cm_future_then_impl(cm_future_t* f, cm_task_pool_t* pool,
+                                        void* (*fn)(void*, void*), void* arg) {
+    if (!f || !fn) return NULL;
+
+    cm_future_t* result = cm_future_new();
+    if (!result) return NULL;
+
+    cm_then_ctx_t* ctx = (cm_then_ctx_t*)malloc(sizeof(cm_then_ctx_t));
+    if (!ctx) {
+        cm_future_release(result);
+        return NULL;
+    }
+    ctx->result = result;
+    ctx->fn = fn;
+    ctx->arg = arg;
+    ctx->value = NULL;
+    ctx->pool = pool;
+
+    if (cm_future_set_inputs(result, &f, 1) != CM_SUCCESS) {
+        cm_future_release(result);
+        free(ctx);
+        return NULL;
+    }
+    cm_retain(result);  // reference held by the continuation
+    if (cm_future_on_complete(f, cm_then_cb, ctx) != CM_SUCCESS) {
+        cm_future_reject(result, CM_ERROR_MEMORY);
+        cm_future_release(result);
+        free(ctx);
+    }
+
+    return result;
+}
+
+cm_future_t* cm_future_then(cm_future_t* f, void* (*fn)(void* value, void* arg), void* arg) {
+    return cm_future_then_impl(f, NULL, fn, arg);
+}
+
+cm_future_t* cm_future_then_async(cm_future_t* f, cm_task_pool_t* pool,
+                                  void* (*fn)(void* value, void* arg), void* arg) {
+    if (!pool) pool = cm_task_pool_default();
+    return cm_future_then_impl(f, pool, fn, arg);
+}
+
+/* ---- when_all / when_any ---- */
+typedef struct {
+    cm_future_t* result;
+    size_t remaining;       // callbacks still holding the context (atomic)
+    size_t ready;           // inputs resolved successfully (atomic)
+    size_t failed;          // inputs that failed or were cancelled (atomic)
+    size_t count;
+    int last_error;
+} cm_join_ctx_t;
+
+typedef struct {
+    cm_join_ctx_t* join;
+    size_t index;
+} cm_join_slot_t;
+
+static void cm_join_finish(cm_join_ctx_t* join) {
+    if (__atomic_sub_fetch(&join->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+        cm_future_release(join->result);
+        free(join);
+    }
+}
+
+static void cm_when_all_cb(cm_future_t* source, void* arg) {
+    cm_join_slot_t* slot = (cm_join_slot_t*)arg;
+    cm_join_ctx_t* join = slot->join;
+    cm_future_t* result = join->result;
+
+    if (source->state == CM_FUTURE_READY) {
+        result->values[slot->index] = source->value;
+        if (__atomic_add_fetch(&join->ready, 1, __ATOMIC_ACQ_REL) == join->count) {
+            cm_future_resolve(result, result->values);
+        }
+    } else if (source->state == CM_FUTURE_FAILED) {
+        cm_future_reject(result, source->error);
+    } else {
+        cm_future_cancel(result);
+    }
+
+    free(slot);
+    cm_join_finish(join);
+}
+
+static void cm_when_any_cb(cm_future_t* source, void* arg) {
+    cm_join_slot_t* slot = (cm_join_slot_t*)arg;
+    cm_join_ctx_t* join = slot->join;
+    cm_future_t* result = join->result;
+
+    if (source->state == CM_FUTURE_READY) {
+        pthread_mutex_lock(&result->lock);
+        if (result->state == CM_FUTURE_PENDING) result->index = (int)slot->index;
+        pthread_mutex_unlock(&result->lock);
+        cm_future_resolve(result, source->value);
+    } else {
+        if (source->state == CM_FUTURE_FAILED) {
+            __atomic_store_n(&join->last_error, source->error, __ATOMIC_RELEASE);
+        }
+        // Only fail once every input has failed or been cancelled
+        if (__atomic_add_fetch(&join->failed, 1, __ATOMIC_ACQ_REL) == join->count) {
+            int error = __atomic_load_n(&join->last_error, __ATOMIC_ACQUIRE);
+            if (error) {
+                cm_future_reject(result, error);
+            } else {
+                cm_future_cancel(result);
+            }
+        }
+    }
+
+    free(slot);
+    cm_join_finish(join);
+}
+
+static cm_future_t* cm_future_join(cm_future_t** futures, size_t count, int all) {
+    if (!futures) return NULL;
+
+    cm_future_t* result = cm_future_new();
+    if (!result) return NULL;
+
+    if (count == 0) {
+        cm_future_resolve(result, NULL);
+        return result;
+    }
+
+    if (all) {
+        result->values = (void**)calloc(count, sizeof(void*));
+        if (!result->values) {
+            cm_future_reject(result, CM_ERROR_MEMORY);
+            return result;
+        }
+    }
+
+    cm_join_ctx_t* join = (cm_join_ctx_t*)calloc(1, sizeof(cm_join_ctx_t));
+    if (!join || cm_future_set_inputs(result, futures, count) != CM_SUCCESS) {
+        free(join);
+        cm_future_reject(result, CM_ERROR_MEMORY);
+        return result;
+    }
+    join->result = result;
+    join->count = count;
+    // One extra count keeps the context alive until every callback is registered
+    join->remaining = count + 1;
+
+    cm_retain(result);  // reference held by the join context
+    for (size_t i = 0; i < count; i++) {
+        cm_join_slot_t* slot = (cm_join_slot_t*)malloc(sizeof(cm_join_slot_t));
+        if (!slot) {
+            cm_future_reject(result, CM_ERROR_MEMORY);
+            // Account for the inputs that will never report back
+            for (size_t j = i; j < count; j++) cm_join_finish(join);
+            break;
+        }
+        slot->join = join;
+        slot->index = i;
+        cm_future_on_complete(futures[i], all ? cm_when_all_cb : cm_when_any_cb, slot);
+    }
+
+    cm_join_finish(join);
+
+    return result;
+}
+
+cm_future_t* cm_future_when_all(cm_future_t** futures, size_t count) {
+    return cm_future_join(futures, count, 1);
+}
+
+cm_future_t* cm_future_when_any(cm_future_t** futures, size_t count) {
+    return cm_future_join(futures, count, 0);
+}
+
+/* ============================================================================
+ * TIMER WHEEL IMPLEMENTATION (hierarchical, 1 ms ticks)
+ * ============================================================================ */
+#define CM_WHEEL_BITS   6
+#define CM_WHEEL_SLOTS  (1 << CM_WHEEL_BITS)
+#define CM_WHEEL_MASK   (CM_WHEEL_SLOTS - 1)
+#define CM_WHEEL_LEVELS 6                    // 2^36 ms (~2 years); later timers re-cascade
+#define CM_WHEEL_FIRING 0xFFFFu              // bucket of timers detached for firing
+
+struct cm_timer_wheel {
+    pthread_mutex_t lock;
+    uint64_t now;                            // next tick (ms) to process
+    uint64_t horizon;                        // tick the driver last planned to sleep until
+    size_t count;
+    cm_timer_t* expired;                     // slot being fired, still cancellable
+    cm_timer_t* running;                     // callback in progress, for cm_timer_stop
+    pthread_cond_t ran;                      // signalled when running clears and someone waits
+    int stop_waiters;
+    void (*kick)(void*);                     // wakes the driver when an earlier timer arrives
+    void* kick_arg;
+    uint64_t occupied[CM_WHEEL_LEVELS];      // one bit per non-empty slot
+    cm_timer_t* slots[CM_WHEEL_LEVELS][CM_WHEEL_SLOTS];
+};
+
+static __thread cm_timer_t* cm_timer_firing = NULL;
+
+static cm_timer_wheel_t* cm_default_wheel = NULL;
+static cm_once_t cm_default_wheel_once = CM_ONCE_INIT;
+static pthread_t cm_default_wheel_thread;
+static pthread_mutex_t cm_default_wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cm_default_wheel_cond;
+static int cm_default_wheel_kicked = 0;
+static int cm_default_wheel_stop = 0;
+
+static inline void cm_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static uint64_t cm_monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t cm_monotonic_ms(void) {
+    return cm_monotonic_ns() / 1000000ull;
+}
+
+// Condition variables created with cm_cond_init_monotonic only
+static int cm_cond_wait_ms(pthread_cond_t* cond, pthread_mutex_t* lock, long ms) {
+    uint64_t deadline = cm_monotonic_ns() + (uint64_t)ms * 1000000ull;
+    struct timespec ts;
+    ts.tv_sec = (time_t)(deadline / 1000000000ull);
+    ts.tv_nsec = (long)(deadline % 1000000000ull);
+    return pthread_cond_timedwait(cond, lock, &ts);
+}
+
+static void cm_cond_init_monotonic(pthread_cond_t* cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* ---- slot bookkeeping (wheel lock held) ---- */
+static void cm_wheel_link(cm_timer_wheel_t* w, cm_timer_t* t) {
+    uint64_t expires = t->expires < w->now ? w->now : t->expires;
+    uint64_t delta = expires - w->now;
+
+    int level = 0;
+    while (level < CM_WHEEL_LEVELS - 1 && delta >> (CM_WHEEL_BITS * (level + 1))) level++;
+    if (delta >> (CM_WHEEL_BITS * CM_WHEEL_LEVELS)) {
+        // Beyond the top level: park in its furthest slot and re-cascade from there
+        expires = w->now + (1ull << (CM_WHEEL_BITS * CM_WHEEL_LEVELS)) - 1;
+    }
+
+    unsigned idx = (unsigned)(expires >> (CM_WHEEL_BITS * level)) & CM_WHEEL_MASK;
+    cm_timer_t** head = &w->slots[level][idx];
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+    t->bucket = (unsigned)(level * CM_WHEEL_SLOTS) + idx;
+    w->occupied[level] |= 1ull << idx;
+}
+
+static void cm_wheel_unlink(cm_timer_wheel_t* w, cm_timer_t* t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    if (t->bucket != CM_WHEEL_FIRING) {
+        unsigned level = t->bucket / CM_WHEEL_SLOTS;
+        unsigned idx = t->bucket % CM_WHEEL_SLOTS;
+        if (!w->slots[level][idx]) w->occupied[level] &= ~(1ull << idx);
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+// First tick at or after w->now that needs attention: a level-0 slot to fire or
+// a higher-level slot to cascade. Lets the wheel skip idle stretches in a few steps.
+static uint64_t cm_wheel_next_tick(cm_timer_wheel_t* w) {
+    uint64_t now = w->now;
+
+    // A cascade due on this very tick comes before any level-0 slot ahead
+    for (int level = 1; level < CM_WHEEL_LEVELS; level++) {
+        unsigned shift = CM_WHEEL_BITS * (unsigned)level;
+        if (now & ((1ull << shift) - 1)) break;
+        if ((w->occupied[level] >> ((now >> shift) & CM_WHEEL_MASK)) & 1) return now;
+    }
+
+    for (int level = 0; level < CM_WHEEL_LEVELS; level++) {
+        unsigned shift = CM_WHEEL_BITS * (unsigned)level;
+        uint64_t block = now >> shift;
+        unsigned idx = (unsigned)block & CM_WHEEL_MASK;
+
+        // A slot whose block has already started was cascaded on entry
+        unsigned first = (now & ((1ull << shift) - 1)) ? idx + 1 : idx;
+        uint64_t ahead = first < CM_WHEEL_SLOTS ? w->occupied[level] >> first << first : 0;
+        if (ahead) {
+            return (block - idx + (uint64_t)__builtin_ctzll(ahead)) << shift;
+        }
+        if (w->occupied[level]) {
+            // Only slots of the next rotation left: wake at the next boundary
+            return ((now >> (shift + CM_WHEEL_BITS)) + 1) << (shift + CM_WHEEL_BITS);
+        }
+    }
+    return UINT64_MAX;
+}
+
+static cm_timer_wheel_t* cm_timer_wheel_create(void (*kick)(void*), void* kick_arg) {
+    cm_timer_wheel_t* w = (cm_timer_wheel_t*)calloc(1, sizeof(cm_timer_wheel_t));
+    if (!w) return NULL;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->ran, NULL);
+    w->now = cm_monotonic_ms();
+    w->horizon = UINT64_MAX;
+    w->kick = kick;
+    w->kick_arg = kick_arg;
+    return w;
+}
+
+cm_timer_wheel_t* cm_timer_wheel_new(void) {
+    return cm_timer_wheel_create(NULL, NULL);
+}
+
+void cm_timer_wheel_free(cm_timer_wheel_t* w) {
+    if (!w) return;
+    // Detach whatever is still queued so a late cm_timer_stop sees it idle
+    for (int level = 0; level < CM_WHEEL_LEVELS; level++) {
+        for (int idx = 0; idx < CM_WHEEL_SLOTS; idx++) {
+            cm_timer_t* t = w->slots[level][idx];
+            while (t) {
+                cm_timer_t* next = t->next;
+                t->next = NULL;
+                t->pprev = NULL;
+                t->wheel = NULL;
+                t = next;
+            }
+        }
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->ran);
+    free(w);
+}
+
+void cm_timer_init(cm_timer_t* t, cm_timer_cb_t cb, void* arg) {
+    if (!t) return;
+    memset(t, 0, sizeof(cm_timer_t));
+    t->cb = cb;
+    t->arg = arg;
+}
+
+int cm_timer_start(cm_timer_wheel_t* w, cm_timer_t* t, long timeout_ms) {
+    if (!w || !t || !t->cb) return CM_ERROR_NULL_POINTER;
+    if (timeout_ms < 0) timeout_ms = 0;
+
+    cm_timer_wheel_t* old = __atomic_load_n(&t->wheel, __ATOMIC_ACQUIRE);
+    if (old && old != w) cm_timer_stop(t);
+
+    uint64_t now = cm_monotonic_ms();
+    pthread_mutex_lock(&w->lock);
+    if (t->pprev) {
+        cm_wheel_unlink(w, t);
+        w->count--;
+    }
+    // Nothing queued: catch up so a long-idle wheel need not replay the gap
+    if (w->count == 0 && !w->expired && w->now < now) w->now = now;
+
+    t->expires = now + (uint64_t)timeout_ms;
+    __atomic_store_n(&t->wheel, w, __ATOMIC_RELEASE);
+    cm_wheel_link(w, t);
+    w->count++;
+
+    int kick = w->kick && t->expires < w->horizon;
+    if (kick) w->horizon = t->expires;
+    pthread_mutex_unlock(&w->lock);
+
+    if (kick) w->kick(w->kick_arg);
+    return CM_SUCCESS;
+}
+
+int cm_timer_stop(cm_timer_t* t) {
+    if (!t) return 0;
+    for (;;) {
+        cm_timer_wheel_t* w = __atomic_load_n(&t->wheel, __ATOMIC_ACQUIRE);
+        if (!w) return 0;
+
+        pthread_mutex_lock(&w->lock);
+        if (t->wheel != w) {
+            // Re-armed on another wheel meanwhile
+            pthread_mutex_unlock(&w->lock);
+            continue;
+        }
+        if (t->pprev) {
+            cm_wheel_unlink(w, t);
+            w->count--;
+            pthread_mutex_unlock(&w->lock);
+            return 1;
+        }
+        if (w->running == t && cm_timer_firing != t) {
+            // The callback may free the timer: from here on only compare its address
+            w->stop_waiters++;
+            while (w->running == t) pthread_cond_wait(&w->ran, &w->lock);
+            w->stop_waiters--;
+        }
+        pthread_mutex_unlock(&w->lock);
+        return 0;
+    }
+}
+
+int cm_timer_pending(cm_timer_t* t) {
+    if (!t) return 0;
+    cm_timer_wheel_t* w = __atomic_load_n(&t->wheel, __ATOMIC_ACQUIRE);
+    if (!w) return 0;
+    pthread_mutex_lock(&w->lock);
+    int pending = t->wheel == w && t->pprev != NULL;
+    pthread_mutex_unlock(&w->lock);
+    return pending;
+}
+
+size_t cm_timer_wheel_count(cm_timer_wheel_t* w) {
+    return w ? __atomic_load_n(&w->count, __ATOMIC_RELAXED) : 0;
+}
+
+size_t cm_timer_wheel_advance(cm_timer_wheel_t* w) {
+    if (!w || __atomic_load_n(&w->count, __ATOMIC_RELAXED) == 0) return 0;
+
+    uint64_t target = cm_monotonic_ms();
+    size_t fired = 0;
+
+    pthread_mutex_lock(&w->lock);
+    while (w->now <= target) {
+        uint64_t now = w->now;
+
+        // Entering a new block at level N: redistribute its slot downwards
+        for (int level = 1; level < CM_WHEEL_LEVELS; level++) {
+            unsigned shift = CM_WHEEL_BITS * (unsigned)level;
+            if (now & ((1ull << shift) - 1)) break;
+            unsigned idx = (unsigned)(now >> shift) & CM_WHEEL_MASK;
+            cm_timer_t* t = w->slots[level][idx];
+            w->slots[level][idx] = NULL;
+            w->occupied[level] &= ~(1ull << idx);
+            while (t) {
+                cm_timer_t* next = t->next;
+                cm_wheel_link(w, t);
+                t = next;
+            }
+        }
+
+        unsigned idx = (unsigned)now & CM_WHEEL_MASK;
+        w->now = now + 1;  // timers re-armed from callbacks land on a later tick
+
+        cm_timer_t* list = w->slots[0][idx];
+        if (list) {
+            w->slots[0][idx] = NULL;
+            w->occupied[0] &= ~(1ull << idx);
+            w->expired = list;
+            list->pprev = &w->expired;
+            for (cm_timer_t* t = list; t; t = t->next) t->bucket = CM_WHEEL_FIRING;
+
+            cm_timer_t* t;
+            while ((t = w->expired) != NULL) {
+                cm_wheel_unlink(w, t);
+                w->count--;
+                w->running = t;
+                cm_timer_cb_t cb = t->cb;
+                void* arg = t->arg;
+                pthread_mutex_unlock(&w->lock);
+
+                cm_timer_firing = t;
+                cb(t, arg);  // may free, re-arm or stop the timer
+                cm_timer_firing = NULL;
+                fired++;
+
+                pthread_mutex_lock(&w->lock);
+                w->running = NULL;
+                if (w->stop_waiters) pthread_cond_broadcast(&w->ran);
+            }
+        }
+
+        uint64_t next = cm_wheel_next_tick(w);
+        w->now = next > target + 1 ? target + 1 : next;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return fired;
+}
+
+long cm_timer_wheel_next(cm_timer_wheel_t* w) {
+    if (!w) return -1;
+
+    pthread_mutex_lock(&w->lock);
+    uint64_t tick = w->count ? cm_wheel_next_tick(w) : UINT64_MAX;
+    w->horizon = tick;
+    pthread_mutex_unlock(&w->lock);
+
+    if (tick == UINT64_MAX) return -1;
+    uint64_t now = cm_monotonic_ms();
+    if (tick <= now) return 0;
+    uint64_t wait = tick - now;
+    return wait > (uint64_t)INT_MAX ? INT_MAX : (long)wait;
+}
+
+/* ---- default wheel: one shared thread for deadlines outside schedulers and loops ---- */
+static void cm_default_wheel_kick(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&cm_default_wheel_lock);
+    cm_default_wheel_kicked = 1;
+    pthread_cond_signal(&cm_default_wheel_cond);
+    pthread_mutex_unlock(&cm_default_wheel_lock);
+}
+
+static void* cm_default_wheel_run(void* arg) {
+    cm_timer_wheel_t* w = (cm_timer_wheel_t*)arg;
+
+    pthread_mutex_lock(&cm_default_wheel_lock);
+    while (!cm_default_wheel_stop) {
+        long wait_ms = cm_timer_wheel_next(w);
+        while (!cm_default_wheel_kicked && !cm_default_wheel_stop && wait_ms != 0) {
+            if (wait_ms < 0) {
+                pthread_cond_wait(&cm_default_wheel_cond, &cm_default_wheel_lock);
+            } else if (cm_cond_wait_ms(&cm_default_wheel_cond, &cm_default_wheel_lock, wait_ms) == ETIMEDOUT) {
+                break;
+            }
+        }
+        cm_default_wheel_kicked = 0;
+        pthread_mutex_unlock(&cm_default_wheel_lock);
+
+        cm_timer_wheel_advance(w);
+
+        pthread_mutex_lock(&cm_default_wheel_lock);
+    }
+    pthread_mutex_unlock(&cm_default_wheel_lock);
+    return NULL;
+}
+
+static void cm_default_wheel_init(void) {
+    cm_runtime_register();
+    cm_cond_init_monotonic(&cm_default_wheel_cond);
+    cm_timer_wheel_t* w = cm_timer_wheel_create(cm_default_wheel_kick, NULL);
+    if (!w) return;
+    if (pthread_create(&cm_default_wheel_thread, NULL, cm_default_wheel_run, w) != 0) {
+        cm_timer_wheel_free(w);
+        return;
+    }
+    cm_default_wheel = w;
+}
+
+cm_timer_wheel_t* cm_timer_wheel_default(void) {
+    cm_once(&cm_default_wheel_once, cm_default_wheel_init);
+    return cm_default_wheel;
+}
+
+static void cm_default_wheel_shutdown(void) {
+    if (!cm_default_wheel) return;
+    pthread_mutex_lock(&cm_default_wheel_lock);
+    cm_default_wheel_stop = 1;
+    pthread_cond_signal(&cm_default_wheel_cond);
+    pthread_mutex_unlock(&cm_default_wheel_lock);
+    pthread_join(cm_default_wheel_thread, NULL);
+    cm_timer_wheel_free(cm_default_wheel);
+    cm_default_wheel = NULL;
+}
+
+/* ---- future deadlines ---- */
+typedef struct {
+    cm_timer_t timer;
+    cm_future_t* future;
+    void (*expire)(cm_future_t* f, void* arg);  // runs before the rejection
+    void* expire_arg;
+    int refs;                                   // timer side + completion side
+} cm_deadline_t;
+
+static void cm_deadline_put(cm_deadline_t* d) {
+    if (__atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        cm_future_release(d->future);
+        free(d);
+    }
+}
+
+static void cm_deadline_fire(cm_timer_t* timer, void* arg) {
+    (void)timer;
+    cm_deadline_t* d = (cm_deadline_t*)arg;
+    if (cm_future_state(d->future) == CM_FUTURE_PENDING) {
+        if (d->expire) d->expire(d->future, d->expire_arg);
+        cm_future_reject(d->future, CM_ERROR_TIMEOUT);
+    }
+    cm_deadline_put(d);
+}
+
+static void cm_deadline_done(cm_future_t* f, void* arg) {
+    (void)f;
+    cm_deadline_t* d = (cm_deadline_t*)arg;
+    // Settled first: the timer reference is ours to drop if it never fires
+    if (cm_timer_stop(&d->timer)) cm_deadline_put(d);
+    cm_deadline_put(d);
+}
+
+static int cm_future_deadline(cm_timer_wheel_t* w, cm_future_t* f, long timeout_ms,
+                              void (*expire)(cm_future_t*, void*), void* expire_arg) {
+    if (!w) return CM_ERROR_MEMORY;
+
+    cm_deadline_t* d = (cm_deadline_t*)malloc(sizeof(cm_deadline_t));
+    if (!d) return CM_ERROR_MEMORY;
+    cm_timer_init(&d->timer, cm_deadline_fire, d);
+    cm_retain(f);
+    d->future = f;
+    d->expire = expire;
+    d->expire_arg = expire_arg;
+    d->refs = 2;
+
+    cm_timer_start(w, &d->timer, timeout_ms);
+    cm_future_on_complete(f, cm_deadline_done, d);
+    return CM_SUCCESS;
+}
+
+int cm_future_timeout(cm_future_t* f, long timeout_ms) {
+    if (!f) return CM_ERROR_NULL_POINTER;
+    if (timeout_ms < 0) return CM_SUCCESS;
+    if (cm_future_state(f) != CM_FUTURE_PENDING) return CM_SUCCESS;
+    return cm_future_deadline(cm_timer_wheel_default(), f, timeout_ms, NULL, NULL);
+}
+
+/* ============================================================================
+ * COROUTINE SCHEDULER IMPLEMENTATION
+ * ============================================================================ */
+#define CM_CORO_RUNNABLE 0
+#define CM_CORO_YIELDED  1
+#define CM_CORO_WAITING  2
+#define CM_CORO_DONE     3
+#define CM_CORO_SLEEPING 4
+
+#define CM_CORO_STACK_CACHE 1024
+#define CM_CORO_VMA_GUARDS  16384   // mprotect guards per scheduler; each splits a VMA
+
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+
+typedef struct cm_coro {
+    ucontext_t ctx;
+    void* stack;                 // mapping base (guard page first), low bit set if mprotect-guarded
+    void* (*fn)(void*);
+    void* arg;
+    void* result;
+    cm_future_t* future;
+    cm_future_t* await_on;
+    cm_sched_t* sched;
+    int state;
+    cm_cleanup_t* cleanup;       // this coroutine's cleanup stack and CM_TRY chain while parked
+    CMArena* arena;              // and its current arena
+    cm_error_t error;            // and its error state, which follows it across workers
+    struct cm_coro* next;
+} cm_coro_t;
+
+struct cm_sched {
+    pthread_t* threads;
+    int thread_count;
+    cm_coro_t* head;
+    cm_coro_t* tail;
+    size_t live;
+    int stopping;
+    int flags;
+    size_t stack_size;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_cond_t idle;
+    void* stack_cache[CM_CORO_STACK_CACHE];
+    int stack_cached;
+    size_t vma_guards;           // live stacks whose guard came from mprotect
+    int vma_guard_warned;
+    cm_timer_wheel_t** wheels;   // one per worker, only advanced by its owner
+    int worker_seq;
+};
+
+static __thread cm_coro_t* cm_coro_running = NULL;
+static __thread ucontext_t cm_sched_worker_ctx;
+static __thread cm_timer_wheel_t* cm_sched_worker_wheel = NULL;
+
+static cm_sched_t* cm_default_sched = NULL;
+static cm_once_t cm_default_sched_once = CM_ONCE_INIT;
+
+/*
+ * A coroutine may resume on a different worker than the one it yielded on.
+ * Thread-local state is therefore only read through these out-of-line helpers
+ * so the compiler cannot reuse a TLS address computed before the switch.
+ */
+static __attribute__((noinline)) cm_coro_t* cm_coro_tls_self(void) {
+    return cm_coro_running;
+}
+
+static __attribute__((noinline)) cm_timer_wheel_t* cm_coro_tls_wheel(void) {
+    return cm_sched_worker_wheel;
+}
+static __attribute__((noinline)) ucontext_t* cm_coro_tls_worker(void) {
+    return &cm_sched_worker_ctx;
+}
+
+static size_t cm_page_size(void) {
+    static size_t page = 0;
+    if (!page) {
+        long sz = sysconf(_SC_PAGESIZE);
+        page = sz > 0 ? (size_t)sz : 4096;
+    }
+    return page;
+}
+
+#define CM_CORO_STACK_BASE(s) ((void*)((uintptr_t)(s) & ~(uintptr_t)1))
+
+static void* cm_coro_stack_get(cm_sched_t* sched) {
+    pthread_mutex_lock(&sched->lock);
+    if (sched->stack_cached > 0) {
+        void* stack = sched->stack_cache[--sched->stack_cached];
+        pthread_mutex_unlock(&sched->lock);
+        return stack;
+    }
+    pthread_mutex_unlock(&sched->lock);
+
+    size_t guard = (sched->flags & CM_SCHED_NO_GUARD) ? 0 : cm_page_size();
+    void* stack = mmap(NULL, sched->stack_size + guard, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED) return NULL;
+
+    // Stacks grow down: an overflow runs into the inaccessible first page.
+    // Guard regions (Linux 6.13+) keep the mapping a single VMA. The mprotect
+    // fallback splits it in two, so only the first CM_CORO_VMA_GUARDS stacks
+    // get one; past that they run unguarded rather than hit vm.max_map_count.
+    if (!guard || madvise(stack, guard, MADV_GUARD_INSTALL) == 0) return stack;
+
+    int protect = 0, warn = 0;
+    pthread_mutex_lock(&sched->lock);
+    if (sched->vma_guards < CM_CORO_VMA_GUARDS) {
+        sched->vma_guards++;
+        protect = 1;
+    } else if (!sched->vma_guard_warned) {
+        sched->vma_guard_warned = 1;
+        warn = 1;
+    }
+    pthread_mutex_unlock(&sched->lock);
+
+    if (warn) {
+        cm_log(CM_LOG_WARN, "coroutine guard page budget exhausted; new stacks are unguarded");
+    }
+    if (!protect) return stack;
+    if (mprotect(stack, guard, PROT_NONE) != 0) {
+        pthread_mutex_lock(&sched->lock);
+        sched->vma_guards--;
+        pthread_mutex_unlock(&sched->lock);
+        munmap(stack, sched->stack_size + guard);
+        return NULL;
+    }
+    return (void*)((uintptr_t)stack | 1);
+}
+
+static void cm_coro_stack_unmap(cm_sched_t* sched, void* stack) {
+    size_t guard = (sched->flags & CM_SCHED_NO_GUARD) ? 0 : cm_page_size();
+    munmap(CM_CORO_STACK_BASE(stack), sched->stack_size + guard);
+}
+
+static void cm_coro_stack_put(cm_sched_t* sched, void* stack) {
+    pthread_mutex_lock(&sched->lock);
+    if (sched->stack_cached < CM_CORO_STACK_CACHE) {
+        sched->stack_cache[sched->stack_cached++] = stack;
+        stack = NULL;
+    } else if ((uintptr_t)stack & 1) {
+        sched->vma_guards--;
+    }
+    pthread_mutex_unlock(&sched->lock);
+
+    if (stack) cm_coro_stack_unmap(sched, stack);
+}
+
+static void cm_sched_enqueue(cm_sched_t* sched, cm_coro_t* co) {
+    co->state = CM_CORO_RUNNABLE;
+    co->next = NULL;
+
+    pthread_mutex_lock(&sched->lock);
+    if (sched->tail) {
+        sched->tail->next = co;
+    } else {
+        sched->head = co;
+    }
+    sched->tail = co;
+    pthread_cond_signal(&sched->cond);
+    pthread_mutex_unlock(&sched->lock);
+}
+
+static void cm_coro_wake(cm_future_t* f, void* arg) {
+    (void)f;
+    cm_coro_t* co = (cm_coro_t*)arg;
+    cm_sched_enqueue(co->sched, co);
+}
+
+static void cm_coro_entry(void) {
+    cm_coro_t* co = cm_coro_tls_self();
+    co->result = co->fn(co->arg);
+    co->state = CM_CORO_DONE;
+    swapcontext(&co->ctx, cm_coro_tls_worker());
+}
+
+static void cm_coro_switch_out(cm_coro_t* co, int state) {
+    co->state = state;
+    swapcontext(&co->ctx, cm_coro_tls_worker());
+}
+
+static void cm_coro_finish(cm_sched_t* sched, cm_coro_t* co) {
+    cm_coro_stack_put(sched, co->stack);
+    cm_future_resolve(co->future, co->result);
+    cm_future_release(co->future);
+    free(co->error.text);
+    free(co);
+
+    pthread_mutex_lock(&sched->lock);
+    if (--sched->live == 0) {
+        pthread_cond_broadcast(&sched->idle);
+        // Workers parked by a pending shutdown are waiting for exactly this
+        if (sched->stopping) pthread_cond_broadcast(&sched->cond);
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+static void* cm_sched_worker(void* arg) {
+    cm_sched_t* sched = (cm_sched_t*)arg;
+    cm_timer_wheel_t* wheel = sched->wheels[__atomic_fetch_add(&sched->worker_seq, 1, __ATOMIC_RELAXED)];
+    cm_sched_worker_wheel = wheel;
+
+    for (;;) {
+        // Sleepers whose time has come go back on the run queue
+        cm_timer_wheel_advance(wheel);
+
+        int timed_out = 0;
+        pthread_mutex_lock(&sched->lock);
+        while (!sched->head && !(sched->stopping && (sched->live == 0 || sched->stopping > 1))) {
+            long wait_ms = cm_timer_wheel_next(wheel);
+            if (wait_ms < 0) {
+                pthread_cond_wait(&sched->cond, &sched->lock);
+            } else if (wait_ms == 0 || cm_cond_wait_ms(&sched->cond, &sched->lock, wait_ms) == ETIMEDOUT) {
+                timed_out = 1;
+                break;
+            }
+        }
+
+        cm_coro_t* co = sched->head;
+        if (!co) {
+            pthread_mutex_unlock(&sched->lock);
+            if (timed_out) continue;
+            break;
+        }
+        sched->head = co->next;
+        if (!sched->head) sched->tail = NULL;
+        pthread_mutex_unlock(&sched->lock);
+
+        // Swap the coroutine's cleanup stack, arena and error state in for its slice
+        cm_cleanup_t* saved_cleanup = cm_cleanup_top;
+        cm_cleanup_top = co->cleanup;
+        CMArena* saved_arena = cm_current_arena;
+        cm_current_arena = co->arena;
+        cm_error_t* saved_error = cm_error_state;
+        cm_error_state = &co->error;
+        cm_coro_running = co;
+
+        {
+            CM_TRACE_SCOPE("cm_coro_slice");
+            swapcontext(&cm_sched_worker_ctx, &co->ctx);
+        }
+
+        cm_coro_running = NULL;
+        co->cleanup = cm_cleanup_top;
+        cm_cleanup_top = saved_cleanup;
+        co->arena = cm_current_arena;
+        cm_current_arena = saved_arena;
+        cm_error_state = saved_error;
+
+        switch (co->state) {
+            case CM_CORO_YIELDED:
+                cm_sched_enqueue(sched, co);
+                break;
+            case CM_CORO_WAITING:
+                // Registered only now that the coroutine is off its stack;
+                // an already-settled future re-queues it inline
+                cm_future_on_complete(co->await_on, cm_coro_wake, co);
+                break;
+            case CM_CORO_DONE:
+                cm_coro_finish(sched, co);
+                break;
+            default:
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+cm_sched_t* cm_sched_create(int threads, size_t stack_size, int flags) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 4;
+    }
+    if (stack_size == 0) stack_size = CM_CORO_DEFAULT_STACK;
+    size_t page = cm_page_size();
+    stack_size = (stack_size + page - 1) & ~(page - 1);
+
+    cm_sched_t* sched = (cm_sched_t*)calloc(1, sizeof(cm_sched_t));
+    if (!sched) return NULL;
+
+    sched->threads = (pthread_t*)calloc((size_t)threads, sizeof(pthread_t));
+    if (!sched->threads) {
+        free(sched);
+        return NULL;
+    }
+
+    sched->wheels = (cm_timer_wheel_t**)calloc((size_t)threads, sizeof(cm_timer_wheel_t*));
+    for (int i = 0; sched->wheels && i < threads; i++) {
+        sched->wheels[i] = cm_timer_wheel_new();
+        if (!sched->wheels[i]) {
+            threads = i;  // run with the workers we could equip
+            break;
+        }
+    }
+    if (!sched->wheels || threads == 0) {
+        free(sched->wheels);
+        free(sched->threads);
+        free(sched);
+        return NULL;
+    }
+
+    sched->stack_size = stack_size;
+    sched->flags = flags;
+    pthread_mutex_init(&sched->lock, NULL);
+    cm_cond_init_monotonic(&sched->cond);
+    pthread_cond_init(&sched->idle, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&sched->threads[i], NULL, cm_sched_worker, sched) != 0) {
+            cm_error_set(CM_ERROR_THREAD, "cm_sched_create: pthread_create failed");
+            break;
+        }
+        sched->thread_count++;
+    }
+
+    for (int i = sched->thread_count; i < threads; i++) {
+        cm_timer_wheel_free(sched->wheels[i]);
+    }
+
+    if (sched->thread_count == 0) {
+        pthread_mutex_destroy(&sched->lock);
+        pthread_cond_destroy(&sched->cond);
+        pthread_cond_destroy(&sched->idle);
+        free(sched->wheels);
+        free(sched->threads);
+        free(sched);
+        return NULL;
+    }
+
+    return sched;
+}
+
+static void cm_sched_shutdown(cm_sched_t* sched, int force) {
+    pthread_mutex_lock(&sched->lock);
+    sched->stopping = force ? 2 : 1;
+    pthread_cond_broadcast(&sched->cond);
+    pthread_mutex_unlock(&sched->lock);
+
+    for (int i = 0; i < sched->thread_count; i++) {
+        pthread_join(sched->threads[i], NULL);
+    }
+
+    for (int i = 0; i < sched->stack_cached; i++) {
+        cm_coro_stack_unmap(sched, sched->stack_cache[i]);
+    }
+    for (int i = 0; i < sched->thread_count; i++) {
+        cm_timer_wheel_free(sched->wheels[i]);
+    }
+
+    pthread_mutex_destroy(&sched->lock);
+    pthread_cond_destroy(&sched->cond);
+    pthread_cond_destroy(&sched->idle);
+    free(sched->wheels);
+    free(sched->threads);
+    free(sched);
+}
+
+void cm_sched_destroy(cm_sched_t* sched) {
+    if (!sched) return;
+    // Waits until every spawned coroutine has returned
+    cm_sched_shutdown(sched, 0);
+}
+
+void cm_sched_wait_idle(cm_sched_t* sched) {
+    if (!sched) sched = cm_sched_default();
+    if (!sched) return;
+
+    pthread_mutex_lock(&sched->lock);
+    while (sched->live > 0) {
+        pthread_cond_wait(&sched->idle, &sched->lock);
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+static void cm_default_sched_init(void) {
+    cm_runtime_register();
+    cm_default_sched = cm_sched_create(0, 0, 0);
+}
+
+cm_sched_t* cm_sched_default(void) {
+    cm_once(&cm_default_sched_once, cm_default_sched_init);
+    return cm_default_sched;
+}
+
+// Kept out of line: getcontext returns twice and would clobber the caller's locals
+static __attribute__((noinline)) void cm_coro_prepare(cm_sched_t* sched, cm_coro_t* co) {
+    size_t guard = (sched->flags & CM_SCHED_NO_GUARD) ? 0 : cm_page_size();
+    getcontext(&co->ctx);
+    co->ctx.uc_stack.ss_sp = (char*)CM_CORO_STACK_BASE(co->stack) + guard;
+    co->ctx.uc_stack.ss_size = sched->stack_size;
+    co->ctx.uc_link = NULL;
+    makecontext(&co->ctx, cm_coro_entry, 0);
+}
+
+cm_future_t* cm_coro_spawn(cm_sched_t* sched, void* (*fn)(void*), void* arg) {
+    if (!fn) return NULL;
+    if (!sched) sched = cm_sched_default();
+    if (!sched) return NULL;
+
+    cm_coro_t* co = (cm_coro_t*)calloc(1, sizeof(cm_coro_t));
+    if (!co) return NULL;
+
+    co->stack = cm_coro_stack_get(sched);
+    if (!co->stack) {
+        free(co);
+        cm_error_set(CM_ERROR_MEMORY, "cm_coro_spawn: stack allocation failed");
+        return NULL;
+    }
+
+    co->future = cm_future_new();
+    if (!co->future) {
+        cm_coro_stack_put(sched, co->stack);
+        free(co);
+        return NULL;
+    }
+
+    cm_coro_prepare(sched, co);
+    co->fn = fn;
+    co->arg = arg;
+    co->sched = sched;
+
+    pthread_mutex_lock(&sched->lock);
+    sched->live++;
+    pthread_mutex_unlock(&sched->lock);
+
+    // co may run and be freed by a worker as soon as it is queued
+    cm_future_t* future = co->future;
+    cm_retain(future);  // reference handed to the caller
+    cm_sched_enqueue(sched, co);
+
+    return future;
+}
+
+int cm_coro_active(void) {
+    return cm_coro_tls_self() != NULL;
+}
+
+void cm_coro_yield(void) {
+    cm_coro_t* co = cm_coro_tls_self();
+    if (!co) {
+        sched_yield();
+        return;
+    }
+    cm_coro_switch_out(co, CM_CORO_YIELDED);
+}
+
+void* cm_coro_await(cm_future_t* f) {
+    if (!f) return NULL;
+
+    cm_coro_t* co = cm_coro_tls_self();
+    // Outside a coroutine there is nothing to switch to: block the thread
+    if (!co) return cm_future_get(f);
+
+    if (cm_future_state(f) == CM_FUTURE_PENDING) {
+        co->await_on = f;
+        cm_coro_switch_out(co, CM_CORO_WAITING);
+        co->await_on = NULL;
+    }
+
+    return cm_future_get(f);
+}
+
+static void cm_coro_timer_wake(cm_timer_t* timer, void* arg) {
+    (void)timer;
+    cm_coro_t* co = (cm_coro_t*)arg;
+    cm_sched_enqueue(co->sched, co);
+}
+
+void cm_coro_sleep(long ms) {
+    cm_coro_t* co = cm_coro_tls_self();
+    if (!co) {
+        if (ms > 0) {
+            struct timespec ts;
+            ts.tv_sec = ms / 1000;
+            ts.tv_nsec = (ms % 1000) * 1000000L;
+            while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+        }
+        return;
+    }
+    if (ms <= 0) {
+        cm_coro_yield();
+        return;
+    }
+
+    // Only this worker advances its wheel, so the timer cannot fire before we are off the stack
+    cm_timer_t timer;
+    cm_timer_init(&timer, cm_coro_timer_wake, co);
+    cm_timer_start(cm_coro_tls_wheel(), &timer, ms);
+    cm_coro_switch_out(co, CM_CORO_SLEEPING);
 }
 
 /* ============================================================================
- * STRING IMPLEMENTATION
+ * CHANNEL IMPLEMENTATION (bounded MPMC ring, Vyukov style)
  * ============================================================================ */
-#define CM_STRING_COPY 0x01
-#define CM_STRING_NOCOPY 0x02
+#define CM_CACHE_LINE 64
+#define CM_CHAN_SPIN 64
+
+typedef struct cm_chan_waiter {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int signaled;
+    cm_future_t* future;         // set while a coroutine is parked on this waiter
+} cm_chan_waiter_t;
+
+typedef struct cm_chan_link {
+    cm_chan_waiter_t* waiter;
+    struct cm_chan_link* next;
+} cm_chan_link_t;
+
+// Channels are GC blocks, which are only 16-byte aligned, so the cursors get
+// their own cache lines from padding rather than alignment: with a full
+// line's worth of bytes on either side, no line holding one cursor can reach
+// the other cursor, the GC header or the fields below.
+struct cm_channel {
+    char pad0[CM_CACHE_LINE - sizeof(size_t)];
+    size_t enqueue_pos;
+    char pad1[CM_CACHE_LINE - sizeof(size_t)];
+    size_t dequeue_pos;
+    char pad2[CM_CACHE_LINE - sizeof(size_t)];
+    unsigned char* cells;
+    size_t mask;
+    size_t cell_size;
+    size_t element_size;
+    int closed;
+    int waiter_count;
+    pthread_mutex_t wait_lock;
+    cm_chan_link_t* waiters;
+};
+
+#define CM_CHAN_SEQ(ch, pos) ((size_t*)((ch)->cells + ((pos) & (ch)->mask) * (ch)->cell_size))
+#define CM_CHAN_DATA(seq) ((void*)((size_t*)(seq) + 1))
+
+// Runs from the last cm_free, or under gc_lock when cm_gc_collect sweeps the
+// channel: only raw free() here
+static void cm_channel_destructor(void* ptr) {
+    cm_channel_t* ch = (cm_channel_t*)ptr;
+    cm_chan_link_t* link = ch->waiters;
+    while (link) {
+        cm_chan_link_t* next = link->next;
+        free(link);
+        link = next;
+    }
+    free(ch->cells);
+    pthread_mutex_destroy(&ch->wait_lock);
+}
 
-cm_string_t* cm_string_new(const char* initial) {
-    cm_string_t* s = (cm_string_t*)cm_alloc(sizeof(cm_string_t), "string", __FILE__, __LINE__);
-    if (!s) return NULL;
+cm_channel_t* cm_channel_new(size_t element_size, size_t capacity) {
+    if (element_size == 0 || element_size > SIZE_MAX / 2) return NULL;
+    if (capacity > (SIZE_MAX >> 1) + 1) return NULL;
 
-    size_t len = initial ? strlen(initial) : 0;
-    s->length = len;
-    s->capacity = len + 1;
-    s->data = (char*)cm_alloc(s->capacity, "string_data", __FILE__, __LINE__);
-    s->ref_count = 1;
-    s->hash = 0;
-    s->created = time(NULL);
-    s->flags = CM_STRING_COPY;
+    size_t cap = 2;
+    while (cap < capacity) cap <<= 1;
+
+    size_t cell_size = (sizeof(size_t) + element_size + 7) & ~(size_t)7;
+    if (cell_size > SIZE_MAX / cap) return NULL;
+
+    cm_channel_t* ch = (cm_channel_t*)cm_gc_alloc(sizeof(cm_channel_t), "channel",
+                                                  __FILE__, __LINE__, cm_channel_destructor);
+    if (!ch) return NULL;
+    memset(ch, 0, sizeof(cm_channel_t));
+
+    ch->element_size = element_size;
+    ch->cell_size = cell_size;
+    ch->mask = cap - 1;
+    pthread_mutex_init(&ch->wait_lock, NULL);
+
+    if (posix_memalign((void**)&ch->cells, CM_CACHE_LINE, ch->cell_size * cap) != 0) {
+        ch->cells = NULL;
+        cm_free(ch);
+        return NULL;
+    }
+    for (size_t i = 0; i < cap; i++) {
+        *CM_CHAN_SEQ(ch, i) = i;
+    }
+
+    return ch;
+}
+
+void cm_channel_free(cm_channel_t* ch) {
+    cm_free(ch);
+}
+
+size_t cm_channel_capacity(cm_channel_t* ch) {
+    return ch ? ch->mask + 1 : 0;
+}
+
+size_t cm_channel_length(cm_channel_t* ch) {
+    if (!ch) return 0;
+    size_t head = __atomic_load_n(&ch->dequeue_pos, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&ch->enqueue_pos, __ATOMIC_RELAXED);
+    return tail > head ? tail - head : 0;
+}
+
+int cm_channel_is_closed(cm_channel_t* ch) {
+    return ch ? __atomic_load_n(&ch->closed, __ATOMIC_ACQUIRE) : 1;
+}
+
+/* ---- waiter registry: only touched once a caller is about to sleep ---- */
+static void cm_chan_notify(cm_channel_t* ch) {
+    // Pairs with the fence in cm_chan_watch: either the sleeper sees our
+    // update on its re-check, or we see it registered here
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ch->waiter_count, __ATOMIC_RELAXED) == 0) return;
+
+    pthread_mutex_lock(&ch->wait_lock);
+    for (cm_chan_link_t* link = ch->waiters; link; link = link->next) {
+        cm_chan_waiter_t* w = link->waiter;
+        pthread_mutex_lock(&w->lock);
+        w->signaled = 1;
+        if (w->future) {
+            cm_future_resolve(w->future, NULL);
+        } else {
+            pthread_cond_signal(&w->cond);
+        }
+        pthread_mutex_unlock(&w->lock);
+    }
+    pthread_mutex_unlock(&ch->wait_lock);
+}
+
+static int cm_chan_watch(cm_channel_t* ch, cm_chan_waiter_t* w) {
+    cm_chan_link_t* link = (cm_chan_link_t*)malloc(sizeof(cm_chan_link_t));
+    if (!link) return 0;
+    link->waiter = w;
+
+    pthread_mutex_lock(&ch->wait_lock);
+    link->next = ch->waiters;
+    ch->waiters = link;
+    __atomic_add_fetch(&ch->waiter_count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ch->wait_lock);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return 1;
+}
+
+static void cm_chan_unwatch(cm_channel_t* ch, cm_chan_waiter_t* w) {
+    pthread_mutex_lock(&ch->wait_lock);
+    for (cm_chan_link_t** pp = &ch->waiters; *pp; pp = &(*pp)->next) {
+        if ((*pp)->waiter == w) {
+            cm_chan_link_t* link = *pp;
+            *pp = link->next;
+            free(link);
+            __atomic_sub_fetch(&ch->waiter_count, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ch->wait_lock);
+}
+
+static void cm_chan_waiter_init(cm_chan_waiter_t* w) {
+    cm_cond_init_monotonic(&w->cond);
+    pthread_mutex_init(&w->lock, NULL);
+    w->signaled = 0;
+    w->future = NULL;
+}
+
+static void cm_chan_waiter_destroy(cm_chan_waiter_t* w) {
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+}
+
+static void cm_chan_coro_timeout(cm_timer_t* timer, void* arg) {
+    (void)timer;
+    cm_future_resolve((cm_future_t*)arg, NULL);
+}
+
+// Coroutine flavour: park on a future settled by either a channel notification
+// or a timer on this worker's wheel, instead of yield-polling until the deadline
+static int cm_chan_coro_sleep(cm_chan_waiter_t* w, uint64_t deadline) {
+    cm_future_t* f = cm_future_new();
+    if (!f) {
+        cm_coro_yield();
+        return !deadline || cm_monotonic_ns() < deadline;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    int signaled = w->signaled;
+    w->signaled = 0;
+    if (!signaled) w->future = f;
+    pthread_mutex_unlock(&w->lock);
+    if (signaled) {
+        cm_future_release(f);
+        return 1;
+    }
+
+    cm_timer_t timer;
+    if (deadline) {
+        uint64_t now = cm_monotonic_ns();
+        long ms = now < deadline ? (long)((deadline - now + 999999ull) / 1000000ull) : 0;
+        cm_timer_init(&timer, cm_chan_coro_timeout, f);
+        cm_timer_start(cm_coro_tls_wheel(), &timer, ms);
+    }
+
+    cm_coro_await(f);
+    if (deadline) cm_timer_stop(&timer);
+
+    pthread_mutex_lock(&w->lock);
+    int alive = w->signaled || !deadline || cm_monotonic_ns() < deadline;
+    w->signaled = 0;
+    w->future = NULL;
+    pthread_mutex_unlock(&w->lock);
+
+    cm_future_release(f);
+    return alive;
+}
+
+// Returns 0 once the deadline (ns, 0 = none) has passed
+static int cm_chan_waiter_sleep(cm_chan_waiter_t* w, uint64_t deadline) {
+    if (cm_coro_active()) return cm_chan_coro_sleep(w, deadline);
+
+    int alive = 1;
+    pthread_mutex_lock(&w->lock);
+    while (!w->signaled) {
+        if (deadline) {
+            struct timespec ts;
+            ts.tv_sec = (time_t)(deadline / 1000000000ull);
+            ts.tv_nsec = (long)(deadline % 1000000000ull);
+            if (pthread_cond_timedwait(&w->cond, &w->lock, &ts) == ETIMEDOUT) {
+                alive = w->signaled;
+                break;
+            }
+        } else {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+    }
+    w->signaled = 0;
+    pthread_mutex_unlock(&w->lock);
+    return alive;
+}
+
+/* ---- lock-free core ---- */
+
+// Claims up to `want` consecutive cells for one side of the ring. A cell is
+// ready for a sender when seq == pos and for a receiver when seq == pos + 1.
+static size_t cm_chan_claim(cm_channel_t* ch, size_t* cursor, size_t want,
+                            size_t offset, size_t* first) {
+    size_t pos = __atomic_load_n(cursor, __ATOMIC_RELAXED);
+
+    for (;;) {
+        size_t n = 0;
+        int stale = 0;
+        while (n < want) {
+            size_t seq = __atomic_load_n(CM_CHAN_SEQ(ch, pos + n), __ATOMIC_ACQUIRE);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + n + offset);
+            if (diff == 0) {
+                n++;
+                continue;
+            }
+            if (diff > 0 && n == 0) stale = 1;  // another thread already took pos
+            break;
+        }
+
+        if (n == 0) {
+            if (!stale) return 0;  // full (send) or empty (recv)
+            pos = __atomic_load_n(cursor, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(cursor, &pos, pos + n, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            *first = pos;
+            return n;
+        }
+    }
+}
+
+static size_t cm_chan_push(cm_channel_t* ch, const void* values, size_t count) {
+    size_t pos;
+    size_t n = cm_chan_claim(ch, &ch->enqueue_pos, count, 0, &pos);
+    for (size_t i = 0; i < n; i++) {
+        size_t* seq = CM_CHAN_SEQ(ch, pos + i);
+        memcpy(CM_CHAN_DATA(seq), (const char*)values + i * ch->element_size, ch->element_size);
+        __atomic_store_n(seq, pos + i + 1, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+static size_t cm_chan_pop(cm_channel_t* ch, void* out, size_t count) {
+    size_t pos;
+    size_t n = cm_chan_claim(ch, &ch->dequeue_pos, count, 1, &pos);
+    for (size_t i = 0; i < n; i++) {
+        size_t* seq = CM_CHAN_SEQ(ch, pos + i);
+        if (out) memcpy((char*)out + i * ch->element_size, CM_CHAN_DATA(seq), ch->element_size);
+        __atomic_store_n(seq, pos + i + ch->mask + 1, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+/* ---- blocking layer ---- */
+#define CM_CHAN_SEND 0
+#define CM_CHAN_RECV 1
+
+// One non-blocking attempt; returns elements moved, or sets *status
+static size_t cm_chan_attempt(cm_channel_t* ch, int dir, void* data, size_t count, int* status) {
+    size_t n;
+    if (dir == CM_CHAN_SEND) {
+        if (__atomic_load_n(&ch->closed, __ATOMIC_ACQUIRE)) {
+            *status = CM_ERROR_CLOSED;
+            return 0;
+        }
+        n = cm_chan_push(ch, data, count);
+    } else {
+        n = cm_chan_pop(ch, data, count);
+        if (n == 0 && __atomic_load_n(&ch->closed, __ATOMIC_ACQUIRE)) {
+            // Drain anything published before close, then report closed
+            n = cm_chan_pop(ch, data, count);
+            if (n == 0) {
+                *status = CM_ERROR_CLOSED;
+                return 0;
+            }
+        }
+    }
+
+    if (n > 0) {
+        cm_chan_notify(ch);
+        *status = CM_SUCCESS;
+    } else {
+        *status = CM_ERROR_WOULD_BLOCK;
+    }
+    return n;
+}
+
+static uint64_t cm_chan_deadline(long timeout_ms) {
+    if (timeout_ms < 0) return 0;
+    return cm_monotonic_ns() + (uint64_t)timeout_ms * 1000000ull;
+}
+
+static size_t cm_chan_transfer(cm_channel_t* ch, int dir, void* data, size_t count,
+                               long timeout_ms, int* status) {
+    size_t n = cm_chan_attempt(ch, dir, data, count, status);
+    if (*status != CM_ERROR_WOULD_BLOCK || timeout_ms == 0) return n;
+
+    uint64_t deadline = cm_chan_deadline(timeout_ms);
+
+    // Short spin first: most hand-offs complete within a few hundred cycles
+    for (int i = 0; i < CM_CHAN_SPIN; i++) {
+        cm_cpu_relax();
+        n = cm_chan_attempt(ch, dir, data, count, status);
+        if (*status != CM_ERROR_WOULD_BLOCK) return n;
+    }
+
+    cm_chan_waiter_t w;
+    cm_chan_waiter_init(&w);
+    if (!cm_chan_watch(ch, &w)) {
+        cm_chan_waiter_destroy(&w);
+        *status = CM_ERROR_MEMORY;
+        return 0;
+    }
+
+    for (;;) {
+        n = cm_chan_attempt(ch, dir, data, count, status);
+        if (*status != CM_ERROR_WOULD_BLOCK) break;
+        if (!cm_chan_waiter_sleep(&w, deadline)) {
+            n = cm_chan_attempt(ch, dir, data, count, status);
+            if (*status == CM_ERROR_WOULD_BLOCK) *status = CM_ERROR_TIMEOUT;
+            break;
+        }
+    }
+
+    cm_chan_unwatch(ch, &w);
+    cm_chan_waiter_destroy(&w);
+    return n;
+}
+
+int cm_channel_send_timed(cm_channel_t* ch, const void* value, long timeout_ms) {
+    if (!ch || !value) return CM_ERROR_NULL_POINTER;
+    int status;
+    cm_chan_transfer(ch, CM_CHAN_SEND, (void*)value, 1, timeout_ms, &status);
+    return status;
+}
+
+int cm_channel_recv_timed(cm_channel_t* ch, void* out, long timeout_ms) {
+    if (!ch) return CM_ERROR_NULL_POINTER;
+    int status;
+    cm_chan_transfer(ch, CM_CHAN_RECV, out, 1, timeout_ms, &status);
+    return status;
+}
+
+int cm_channel_send(cm_channel_t* ch, const void* value) {
+    return cm_channel_send_timed(ch, value, -1);
+}
+
+int cm_channel_recv(cm_channel_t* ch, void* out) {
+    return cm_channel_recv_timed(ch, out, -1);
+}
+
+int cm_channel_try_send(cm_channel_t* ch, const void* value) {
+    return cm_channel_send_timed(ch, value, 0);
+}
+
+int cm_channel_try_recv(cm_channel_t* ch, void* out) {
+    return cm_channel_recv_timed(ch, out, 0);
+}
+
+size_t cm_channel_send_batch(cm_channel_t* ch, const void* values, size_t count, long timeout_ms) {
+    if (!ch || !values || count == 0) return 0;
+    int status;
+    return cm_chan_transfer(ch, CM_CHAN_SEND, (void*)values, count, timeout_ms, &status);
+}
+
+size_t cm_channel_recv_batch(cm_channel_t* ch, void* out, size_t max, long timeout_ms) {
+    if (!ch || max == 0) return 0;
+    int status;
+    return cm_chan_transfer(ch, CM_CHAN_RECV, out, max, timeout_ms, &status);
+}
+
+void cm_channel_close(cm_channel_t* ch) {
+    if (!ch) return;
+    __atomic_store_n(&ch->closed, 1, __ATOMIC_RELEASE);
+    cm_chan_notify(ch);
+}
+
+/* ---- select ---- */
+static int cm_chan_select_once(cm_chan_op_t* ops, size_t count, size_t start, int* status) {
+    size_t active = 0, closed = 0;
+    for (size_t k = 0; k < count; k++) {
+        size_t i = (start + k) % count;
+        if (!ops[i].channel) continue;
+        active++;
+
+        int st;
+        cm_chan_attempt(ops[i].channel, ops[i].op == CM_CHAN_OP_SEND ? CM_CHAN_SEND : CM_CHAN_RECV,
+                        ops[i].data, 1, &st);
+        ops[i].status = st;
+        if (st == CM_SUCCESS) {
+            *status = CM_SUCCESS;
+            return (int)i;
+        }
+        if (st == CM_ERROR_CLOSED) closed++;
+    }
+    *status = (closed == active) ? CM_ERROR_CLOSED : CM_ERROR_WOULD_BLOCK;
+    return -1;
+}
+
+int cm_channel_select(cm_chan_op_t* ops, size_t count, long timeout_ms) {
+    if (!ops || count == 0) return -1;
+
+    // Rotate the starting case so a busy channel cannot starve the others
+    static __thread size_t rotor = 0;
+    size_t start = rotor++;
+
+    int status;
+    int idx = cm_chan_select_once(ops, count, start, &status);
+    if (idx >= 0 || status == CM_ERROR_CLOSED || timeout_ms == 0) return idx;
+
+    uint64_t deadline = cm_chan_deadline(timeout_ms);
+
+    // One waiter registered on every channel: whichever moves first wakes us
+    cm_chan_waiter_t w;
+    cm_chan_waiter_init(&w);
+    size_t watched = 0;
+    while (watched < count) {
+        if (ops[watched].channel && !cm_chan_watch(ops[watched].channel, &w)) break;
+        watched++;
+    }
 
-    if (s->data) {
-        if (initial && len > 0) {
-            memcpy(s->data, initial, len + 1);
-        } else {
-            s->data[0] = '\0';
+    // A channel we cannot watch could never wake us: fail rather than sleep
+    if (watched < count) {
+        ops[watched].status = CM_ERROR_MEMORY;
+        cm_error_set(CM_ERROR_MEMORY, "cm_channel_select: failed to register waiter");
+        idx = -1;
+    }
+
+    while (watched == count) {
+        idx = cm_chan_select_once(ops, count, start, &status);
+        if (idx >= 0 || status == CM_ERROR_CLOSED) break;
+        if (!cm_chan_waiter_sleep(&w, deadline)) {
+            idx = cm_chan_select_once(ops, count, start, &status);
+            break;
         }
     }
 
-    return s;
+    for (size_t i = 0; i < watched; i++) {
+        if (ops[i].channel) cm_chan_unwatch(ops[i].channel, &w);
+    }
+    cm_chan_waiter_destroy(&w);
+    return idx;
 }
 
-void cm_string_free(cm_string_t* s) {
-    if (!s) return;
+/* ============================================================================
+ * EVENT LOOP IMPLEMENTATION (epoll)
+ * ============================================================================ */
+#ifdef __linux__
 
-    s->ref_count--;
-    if (s->ref_count <= 0) {
-        if (s->data && !(s->flags & CM_STRING_NOCOPY)) {
-            cm_free(s->data);
-        }
-        cm_free(s);
+#define CM_LOOP_MAX_EVENTS 256
+
+typedef struct {
+    uint32_t gen;                // bumped on every (re)registration
+    int events;                  // interest registered with epoll
+    cm_loop_cb_t cb;
+    void* arg;
+    cm_future_t* ready[2];       // one-shot awaitables: [0] read, [1] write
+} cm_loop_watch_t;
+
+typedef struct cm_loop_post {
+    void (*fn)(void*);
+    void* arg;
+    struct cm_loop_post* next;
+} cm_loop_post_t;
+
+struct cm_loop_timer {
+    cm_timer_t timer;
+    cm_loop_t* loop;
+    long repeat_ms;
+    int firing;
+    int stopped;                 // cm_loop_timer_stop called from its own callback
+    void (*cb)(cm_loop_t* loop, cm_loop_timer_t* timer, void* arg);
+    void* arg;
+};
+
+struct cm_loop {
+    int epfd;
+    int wakefd;
+    int stop;
+    cm_loop_watch_t* watches;    // indexed by fd
+    size_t watch_cap;
+    pthread_mutex_t lock;
+    cm_loop_post_t* post_head;
+    cm_loop_post_t* post_tail;
+    cm_timer_wheel_t* wheel;     // advanced after every epoll_wait
+};
+
+static void cm_loop_kick(void* arg);
+
+int cm_set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return CM_ERROR_IO;
     }
+    return CM_SUCCESS;
 }
 
-size_t cm_string_length(cm_string_t* s) {
-    return s ? s->length : 0;
+static uint32_t cm_loop_to_epoll(int events) {
+    uint32_t ev = 0;
+    if (events & CM_IO_READ) ev |= EPOLLIN | EPOLLRDHUP;
+    if (events & CM_IO_WRITE) ev |= EPOLLOUT;
+    return ev;
 }
 
-cm_string_t* cm_string_format(const char* format, ...) {
-    if (!format) return NULL;
-
-    va_list args;
-    va_start(args, format);
+static int cm_loop_from_epoll(uint32_t ev) {
+    int events = 0;
+    if (ev & (EPOLLIN | EPOLLRDHUP)) events |= CM_IO_READ;
+    if (ev & EPOLLOUT) events |= CM_IO_WRITE;
+    if (ev & EPOLLERR) events |= CM_IO_ERROR;
+    if (ev & EPOLLHUP) events |= CM_IO_HUP;
+    return events;
+}
 
-    int size = vsnprintf(NULL, 0, format, args);
-    va_end(args);
+// Caller holds loop->lock
+static cm_loop_watch_t* cm_loop_slot(cm_loop_t* loop, int fd) {
+    if ((size_t)fd >= loop->watch_cap) {
+        size_t cap = loop->watch_cap ? loop->watch_cap : 64;
+        while (cap <= (size_t)fd) cap *= 2;
+        cm_loop_watch_t* grown = (cm_loop_watch_t*)realloc(loop->watches, cap * sizeof(cm_loop_watch_t));
+        if (!grown) return NULL;
+        memset(grown + loop->watch_cap, 0, (cap - loop->watch_cap) * sizeof(cm_loop_watch_t));
+        loop->watches = grown;
+        loop->watch_cap = cap;
+    }
+    return &loop->watches[fd];
+}
 
-    if (size < 0) return NULL;
+// Caller holds loop->lock: push the slot's combined interest to epoll
+static int cm_loop_sync(cm_loop_t* loop, int fd, cm_loop_watch_t* w) {
+    int events = w->cb ? w->events : 0;
+    if (w->ready[0]) events |= CM_IO_READ;
+    if (w->ready[1]) events |= CM_IO_WRITE;
 
-    char* buffer = (char*)malloc(size + 1);
-    if (!buffer) return NULL;
+    int was_registered = w->gen & 1;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
 
-    va_start(args, format);
-    vsnprintf(buffer, size + 1, format, args);
-    va_end(args);
+    if (!events && !w->cb) {
+        if (was_registered) {
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+            w->gen++;
+        }
+        return CM_SUCCESS;
+    }
 
-    cm_string_t* result = cm_string_new(buffer);
-    free(buffer);
+    if (!was_registered) w->gen++;
+    ev.events = cm_loop_to_epoll(events);
+    ev.data.u64 = ((uint64_t)w->gen << 32) | (uint32_t)fd;
 
-    return result;
+    int op = was_registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(loop->epfd, op, fd, &ev) < 0) {
+        if (!was_registered) w->gen++;
+        return CM_ERROR_IO;
+    }
+    return CM_SUCCESS;
 }
 
-void cm_string_set(cm_string_t* s, const char* value) {
-    if (!s) return;
-    if (!value) value = "";
+cm_loop_t* cm_loop_new(void) {
+    cm_loop_t* loop = (cm_loop_t*)calloc(1, sizeof(cm_loop_t));
+    if (!loop) return NULL;
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->epfd < 0 || loop->wakefd < 0) {
+        if (loop->epfd >= 0) close(loop->epfd);
+        if (loop->wakefd >= 0) close(loop->wakefd);
+        free(loop);
+        cm_error_set(CM_ERROR_IO, "cm_loop_new: epoll/eventfd unavailable");
+        return NULL;
+    }
 
-    size_t len = strlen(value);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = UINT64_MAX;  // wake-up marker, never a valid fd slot
+    epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev);
+
+    // Timers armed from other threads shorten the current epoll_wait via the eventfd
+    loop->wheel = cm_timer_wheel_create(cm_loop_kick, loop);
+    if (!loop->wheel) {
+        close(loop->epfd);
+        close(loop->wakefd);
+        free(loop);
+        return NULL;
+    }
 
-    if (len + 1 > s->capacity || (s->flags & CM_STRING_NOCOPY)) {
-        char* new_data = (char*)cm_alloc(len + 1, "string_data", __FILE__, __LINE__);
-        if (!new_data) return;
+    pthread_mutex_init(&loop->lock, NULL);
+    return loop;
+}
 
-        if (s->data && !(s->flags & CM_STRING_NOCOPY)) {
-            cm_free(s->data);
+void cm_loop_free(cm_loop_t* loop) {
+    if (!loop) return;
+
+    for (size_t fd = 0; fd < loop->watch_cap; fd++) {
+        for (int i = 0; i < 2; i++) {
+            cm_future_t* f = loop->watches[fd].ready[i];
+            if (f) {
+                cm_future_cancel(f);
+                cm_future_release(f);
+            }
         }
+    }
 
-        s->data = new_data;
-        s->capacity = len + 1;
-        s->flags &= ~CM_STRING_NOCOPY;
+    cm_loop_post_t* post = loop->post_head;
+    while (post) {
+        cm_loop_post_t* next = post->next;
+        free(post);
+        post = next;
     }
 
-    memcpy(s->data, value, len + 1);
-    s->length = len;
-    s->hash = 0;
+    // After the cancellations above, which retire any cm_loop_ready_timed deadlines
+    cm_timer_wheel_free(loop->wheel);
+    close(loop->epfd);
+    close(loop->wakefd);
+    pthread_mutex_destroy(&loop->lock);
+    free(loop->watches);
+    free(loop);
 }
 
-void cm_string_upper(cm_string_t* s) {
-    if (!s || !s->data) return;
+int cm_loop_watch(cm_loop_t* loop, int fd, int events, cm_loop_cb_t cb, void* arg) {
+    if (!loop || fd < 0 || !cb) return CM_ERROR_INVALID_ARGUMENT;
 
-    for (size_t i = 0; i < s->length; i++) {
-        s->data[i] = toupper(s->data[i]);
+    pthread_mutex_lock(&loop->lock);
+    cm_loop_watch_t* w = cm_loop_slot(loop, fd);
+    if (!w) {
+        pthread_mutex_unlock(&loop->lock);
+        return CM_ERROR_MEMORY;
     }
-    s->hash = 0;
+    w->cb = cb;
+    w->arg = arg;
+    w->events = events;
+    int rc = cm_loop_sync(loop, fd, w);
+    pthread_mutex_unlock(&loop->lock);
+    return rc;
 }
 
-void cm_string_lower(cm_string_t* s) {
-    if (!s || !s->data) return;
+int cm_loop_unwatch(cm_loop_t* loop, int fd) {
+    if (!loop || fd < 0) return CM_ERROR_INVALID_ARGUMENT;
 
-    for (size_t i = 0; i < s->length; i++) {
-        s->data[i] = tolower(s->data[i]);
+    pthread_mutex_lock(&loop->lock);
+    if ((size_t)fd >= loop->watch_cap) {
+        pthread_mutex_unlock(&loop->lock);
+        return CM_ERROR_NOT_FOUND;
     }
-    s->hash = 0;
+    cm_loop_watch_t* w = &loop->watches[fd];
+    w->cb = NULL;
+    w->arg = NULL;
+    w->events = 0;
+    int rc = cm_loop_sync(loop, fd, w);
+    pthread_mutex_unlock(&loop->lock);
+    return rc;
 }
 
-/* ============================================================================
- * ARRAY IMPLEMENTATION
- * ============================================================================ */
-cm_array_t* cm_array_new(size_t element_size, size_t initial_capacity) {
-    if (element_size == 0) return NULL;
+cm_future_t* cm_loop_ready(cm_loop_t* loop, int fd, int events) {
+    if (!loop || fd < 0) return NULL;
+    int slot = (events & CM_IO_WRITE) ? 1 : 0;
 
-    cm_array_t* arr = (cm_array_t*)cm_alloc(sizeof(cm_array_t), "array", __FILE__, __LINE__);
-    if (!arr) return NULL;
+    cm_future_t* f = cm_future_new();
+    if (!f) return NULL;
 
-    arr->element_size = element_size;
-    arr->capacity = initial_capacity > 0 ? initial_capacity : 16;
-    arr->length = 0;
-    arr->data = cm_alloc(element_size * arr->capacity, "array_data", __FILE__, __LINE__);
-    arr->ref_counts = (int*)cm_alloc(sizeof(int) * arr->capacity, "array_refs", __FILE__, __LINE__);
-    arr->element_destructor = NULL;
-    arr->flags = 0;
+    pthread_mutex_lock(&loop->lock);
+    cm_loop_watch_t* w = cm_loop_slot(loop, fd);
+    if (!w || w->ready[slot]) {
+        // One waiter per direction per fd
+        pthread_mutex_unlock(&loop->lock);
+        cm_future_reject(f, w ? CM_ERROR_ALREADY_EXISTS : CM_ERROR_MEMORY);
+        return f;
+    }
+    cm_retain(f);  // reference held by the loop until the fd fires
+    w->ready[slot] = f;
+    if (cm_loop_sync(loop, fd, w) != CM_SUCCESS) {
+        w->ready[slot] = NULL;
+        pthread_mutex_unlock(&loop->lock);
+        cm_future_reject(f, CM_ERROR_IO);
+        cm_future_release(f);
+        return f;
+    }
+    pthread_mutex_unlock(&loop->lock);
+    return f;
+}
 
-    if (!arr->data || !arr->ref_counts) {
-        if (arr->data) cm_free(arr->data);
-        if (arr->ref_counts) cm_free(arr->ref_counts);
-        cm_free(arr);
-        return NULL;
+int cm_loop_post(cm_loop_t* loop, void (*fn)(void*), void* arg) {
+    if (!loop || !fn) return CM_ERROR_NULL_POINTER;
+
+    cm_loop_post_t* post = (cm_loop_post_t*)malloc(sizeof(cm_loop_post_t));
+    if (!post) return CM_ERROR_MEMORY;
+    post->fn = fn;
+    post->arg = arg;
+    post->next = NULL;
+
+    pthread_mutex_lock(&loop->lock);
+    if (loop->post_tail) {
+        loop->post_tail->next = post;
+    } else {
+        loop->post_head = post;
     }
+    loop->post_tail = post;
+    pthread_mutex_unlock(&loop->lock);
 
-    memset(arr->ref_counts, 0, sizeof(int) * arr->capacity);
+    cm_loop_kick(loop);
+    return CM_SUCCESS;
+}
 
-    return arr;
+static void cm_loop_kick(void* arg) {
+    cm_loop_t* loop = (cm_loop_t*)arg;
+    uint64_t one = 1;
+    ssize_t n = write(loop->wakefd, &one, sizeof(one));
+    (void)n;
 }
 
-void cm_array_free(cm_array_t* arr) {
-    if (!arr) return;
+cm_timer_wheel_t* cm_loop_wheel(cm_loop_t* loop) {
+    return loop ? loop->wheel : NULL;
+}
 
-    if (arr->element_destructor) {
-        for (size_t i = 0; i < arr->length; i++) {
-            void* elem = (char*)arr->data + (i * arr->element_size);
-            arr->element_destructor(elem);
+static void cm_loop_stop_cb(void* arg) {
+    ((cm_loop_t*)arg)->stop = 1;
+}
+
+void cm_loop_stop(cm_loop_t* loop) {
+    if (loop) cm_loop_post(loop, cm_loop_stop_cb, loop);
+}
+
+static void cm_loop_drain_posts(cm_loop_t* loop) {
+    uint64_t count;
+    ssize_t n = read(loop->wakefd, &count, sizeof(count));
+    (void)n;
+
+    pthread_mutex_lock(&loop->lock);
+    cm_loop_post_t* post = loop->post_head;
+    loop->post_head = loop->post_tail = NULL;
+    pthread_mutex_unlock(&loop->lock);
+
+    while (post) {
+        cm_loop_post_t* next = post->next;
+        post->fn(post->arg);
+        free(post);
+        post = next;
+    }
+}
+
+static void cm_loop_dispatch(cm_loop_t* loop, uint64_t data, uint32_t ev) {
+    int fd = (int)(uint32_t)data;
+    uint32_t gen = (uint32_t)(data >> 32);
+    int events = cm_loop_from_epoll(ev);
+    cm_future_t* fired[2] = {NULL, NULL};
+
+    pthread_mutex_lock(&loop->lock);
+    if ((size_t)fd >= loop->watch_cap || loop->watches[fd].gen != gen) {
+        // Unwatched (or fd reused) after epoll_wait returned
+        pthread_mutex_unlock(&loop->lock);
+        return;
+    }
+    cm_loop_watch_t* w = &loop->watches[fd];
+    int failed = events & (CM_IO_ERROR | CM_IO_HUP);
+    if (w->ready[0] && (events & CM_IO_READ || failed)) {
+        fired[0] = w->ready[0];
+        w->ready[0] = NULL;
+    }
+    if (w->ready[1] && (events & CM_IO_WRITE || failed)) {
+        fired[1] = w->ready[1];
+        w->ready[1] = NULL;
+    }
+    if (fired[0] || fired[1]) cm_loop_sync(loop, fd, w);
+    cm_loop_cb_t cb = (w->cb && (events & (w->events | CM_IO_ERROR | CM_IO_HUP))) ? w->cb : NULL;
+    void* arg = w->arg;
+    pthread_mutex_unlock(&loop->lock);
+
+    for (int i = 0; i < 2; i++) {
+        if (fired[i]) {
+            cm_future_resolve(fired[i], (void*)(intptr_t)events);
+            cm_future_release(fired[i]);
         }
     }
+    if (cb) cb(loop, fd, events, arg);
+}
 
-    cm_free(arr->data);
-    cm_free(arr->ref_counts);
-    cm_free(arr);
+int cm_loop_run_once(cm_loop_t* loop, int timeout_ms) {
+    if (!loop) return -1;
+
+    long next = cm_timer_wheel_next(loop->wheel);
+    if (next >= 0 && (timeout_ms < 0 || next < timeout_ms)) timeout_ms = (int)next;
+
+    struct epoll_event events[CM_LOOP_MAX_EVENTS];
+    int n = epoll_wait(loop->epfd, events, CM_LOOP_MAX_EVENTS, timeout_ms);
+    if (n < 0) {
+        if (errno != EINTR) return -1;
+        n = 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.u64 == UINT64_MAX) {
+            cm_loop_drain_posts(loop);
+        } else {
+            cm_loop_dispatch(loop, events[i].data.u64, events[i].events);
+        }
+    }
+    return n + (int)cm_timer_wheel_advance(loop->wheel);
 }
 
-void* cm_array_get(cm_array_t* arr, size_t index) {
-    if (!arr) return NULL;
-    if (index >= arr->length) return NULL;
+int cm_loop_run(cm_loop_t* loop) {
+    if (!loop) return CM_ERROR_NULL_POINTER;
 
-    arr->ref_counts[index]++;
-    return (char*)arr->data + (index * arr->element_size);
+    loop->stop = 0;
+    while (!loop->stop) {
+        if (cm_loop_run_once(loop, -1) < 0) return CM_ERROR_IO;
+    }
+    return CM_SUCCESS;
 }
 
-void cm_array_push(cm_array_t* arr, const void* value) {
-    if (!arr || !value) return;
+/* ---- timers (on the loop's wheel, no fd per timer) ---- */
+static void cm_loop_timer_fire(cm_timer_t* t, void* arg) {
+    (void)t;
+    cm_loop_timer_t* timer = (cm_loop_timer_t*)arg;
 
-    if (arr->length >= arr->capacity) {
-        size_t new_capacity = arr->capacity * 2;
-        void* new_data = cm_alloc(arr->element_size * new_capacity, "array_data", __FILE__, __LINE__);
-        int* new_refs = (int*)cm_alloc(sizeof(int) * new_capacity, "array_refs", __FILE__, __LINE__);
+    timer->firing = 1;
+    timer->cb(timer->loop, timer, timer->arg);
+    timer->firing = 0;
 
-        if (!new_data || !new_refs) {
-            if (new_data) cm_free(new_data);
-            if (new_refs) cm_free(new_refs);
-            return;
-        }
+    // One-shot timers release themselves once they have fired
+    if (timer->repeat_ms <= 0 || timer->stopped) {
+        free(timer);
+        return;
+    }
+    cm_timer_start(timer->loop->wheel, &timer->timer, timer->repeat_ms);
+}
 
-        memcpy(new_data, arr->data, arr->element_size * arr->length);
-        memset(new_refs, 0, sizeof(int) * new_capacity);
+cm_loop_timer_t* cm_loop_timer_start(cm_loop_t* loop, long after_ms, long repeat_ms,
+                                     void (*cb)(cm_loop_t*, cm_loop_timer_t*, void*), void* arg) {
+    if (!loop || !cb) return NULL;
 
-        cm_free(arr->data);
-        cm_free(arr->ref_counts);
+    cm_loop_timer_t* timer = (cm_loop_timer_t*)calloc(1, sizeof(cm_loop_timer_t));
+    if (!timer) return NULL;
 
-        arr->data = new_data;
-        arr->ref_counts = new_refs;
-        arr->capacity = new_capacity;
+    timer->loop = loop;
+    timer->repeat_ms = repeat_ms;
+    timer->cb = cb;
+    timer->arg = arg;
+    cm_timer_init(&timer->timer, cm_loop_timer_fire, timer);
+
+    if (cm_timer_start(loop->wheel, &timer->timer, after_ms) != CM_SUCCESS) {
+        free(timer);
+        return NULL;
     }
+    return timer;
+}
 
-    void* dest = (char*)arr->data + (arr->length * arr->element_size);
-    memcpy(dest, value, arr->element_size);
-    arr->length++;
+void cm_loop_timer_stop(cm_loop_t* loop, cm_loop_timer_t* timer) {
+    if (!loop || !timer) return;
+    if (timer->firing) {
+        // Inside its own callback: cm_loop_timer_fire frees it on return
+        timer->stopped = 1;
+        return;
+    }
+    cm_timer_stop(&timer->timer);
+    free(timer);
 }
 
-void* cm_array_pop(cm_array_t* arr) {
-    if (!arr || arr->length == 0) return NULL;
+/* ---- readiness with a deadline ---- */
+typedef struct {
+    cm_loop_t* loop;
+    int fd;
+    int slot;
+} cm_loop_expiry_t;
+
+// Drops the expired waiter so the fd is not left armed for nobody
+static void cm_loop_ready_expire(cm_future_t* f, void* arg) {
+    cm_loop_expiry_t* e = (cm_loop_expiry_t*)arg;
+    cm_loop_t* loop = e->loop;
+    int owned = 0;
+
+    pthread_mutex_lock(&loop->lock);
+    if ((size_t)e->fd < loop->watch_cap && loop->watches[e->fd].ready[e->slot] == f) {
+        loop->watches[e->fd].ready[e->slot] = NULL;
+        cm_loop_sync(loop, e->fd, &loop->watches[e->fd]);
+        owned = 1;
+    }
+    pthread_mutex_unlock(&loop->lock);
 
-    arr->length--;
-    return (char*)arr->data + (arr->length * arr->element_size);
+    if (owned) cm_future_release(f);
 }
 
-size_t cm_array_length(cm_array_t* arr) {
-    return arr ? arr->length : 0;
+static void cm_loop_expiry_free(cm_future_t* f, void* arg) {
+    (void)f;
+    free(arg);
+}
+
+cm_future_t* cm_loop_ready_timed(cm_loop_t* loop, int fd, int events, long timeout_ms) {
+    cm_future_t* f = cm_loop_ready(loop, fd, events);
+    if (!f || timeout_ms < 0 || cm_future_state(f) != CM_FUTURE_PENDING) return f;
+
+    cm_loop_expiry_t* e = (cm_loop_expiry_t*)malloc(sizeof(cm_loop_expiry_t));
+    if (!e) return f;
+    e->loop = loop;
+    e->fd = fd;
+    e->slot = (events & CM_IO_WRITE) ? 1 : 0;
+
+    if (cm_future_deadline(loop->wheel, f, timeout_ms, cm_loop_ready_expire, e) != CM_SUCCESS) {
+        free(e);
+        return f;
+    }
+    // Registered after the deadline's own callback, so it runs last
+    cm_future_on_complete(f, cm_loop_expiry_free, e);
+    return f;
+}
+
+/* ---- coroutine-friendly I/O: retry on EAGAIN after awaiting readiness ---- */
+static int cm_loop_await_fd(cm_loop_t* loop, int fd, int events) {
+    cm_future_t* f = cm_loop_ready(loop, fd, events);
+    if (!f) return CM_ERROR_MEMORY;
+    cm_coro_await(f);
+    int rc = cm_future_state(f) == CM_FUTURE_READY ? CM_SUCCESS : cm_future_error(f);
+    cm_future_release(f);
+    return rc;
+}
+
+ssize_t cm_loop_read(cm_loop_t* loop, int fd, void* buf, size_t len) {
+    for (;;) {
+        ssize_t n = read(fd, buf, len);
+        if (n >= 0) return n;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        if (cm_loop_await_fd(loop, fd, CM_IO_READ) != CM_SUCCESS) return -1;
+    }
+}
+
+ssize_t cm_loop_write(cm_loop_t* loop, int fd, const void* buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, (const char*)buf + done, len - done);
+        if (n > 0) {
+            done += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return done ? (ssize_t)done : -1;
+        if (cm_loop_await_fd(loop, fd, CM_IO_WRITE) != CM_SUCCESS) return done ? (ssize_t)done : -1;
+    }
+    return (ssize_t)done;
 }
 
+int cm_loop_accept(cm_loop_t* loop, int listen_fd) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0) return fd;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        if (cm_loop_await_fd(loop, listen_fd, CM_IO_READ) != CM_SUCCESS) return -1;
+    }
+}
+
+#endif /* __linux__ */
+
 /* ============================================================================
- * MAP IMPLEMENTATION
+ * ASYNC I/O IMPLEMENTATION (io_uring, epoll fallback)
  * ============================================================================ */
-#define CM_MAP_INITIAL_SIZE 16
-#define CM_MAP_LOAD_FACTOR 0.75
-
-static uint32_t cm_hash_string(const char* str) {
-    uint32_t hash = 5381;
-    int c;
+#ifdef __linux__
+
+#define CM_AIO_OP_READ    0
+#define CM_AIO_OP_WRITE   1
+#define CM_AIO_OP_RECV    2
+#define CM_AIO_OP_SEND    3
+#define CM_AIO_OP_ACCEPT  4   // multishot
+#define CM_AIO_OP_RECV_MS 5   // multishot, provided buffers
+
+#define CM_AIO_BGID 1
+
+typedef struct cm_aio_req {
+    int op;
+    int fd;
+    void* buf;
+    size_t len;
+    uint64_t offset;
+    cm_aio_cb_t cb;
+    void* arg;
+    struct cm_aio_req* next;
+    struct cm_aio_req* all_next;  // every request ever allocated, for cm_aio_free
+} cm_aio_req_t;
+
+struct cm_aio {
+    int backend;
+    cm_aio_req_t* free_reqs;
+    cm_aio_req_t* all_reqs;
+
+    // Registered buffer region, carved out of the caller's arena
+    char* buf_base;
+    size_t buf_size;
+    unsigned buf_count;
+    int fixed_buffers;
+    unsigned* free_bufs;         // epoll backend: stack of free buffer ids
+    unsigned free_buf_count;
+
+    // fd -> fixed file slot + 1 (0 = not registered)
+    int* fixed_files;
+    size_t fixed_cap;
+
+#ifdef CM_HAVE_IO_URING
+    int ring_fd;
+    unsigned features;
+    struct __kernel_timespec wait_ts;   // read by the kernel when a wait-timeout SQE is submitted
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_khead;
+    unsigned* sq_ktail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_tail;            // local tail, published on submit
+    unsigned to_submit;
+    unsigned* cq_khead;
+    unsigned* cq_ktail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    unsigned buf_ring_mask;
+#endif
 
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c;
+    // epoll backend
+    cm_loop_t* loop;
+    cm_aio_req_t* pending_head;
+    cm_aio_req_t* pending_tail;
+    cm_aio_req_t** waiting;      // per-fd list of requests waiting for readiness
+    size_t waiting_cap;
+};
+
+static cm_aio_req_t* cm_aio_req_new(cm_aio_t* aio) {
+    cm_aio_req_t* req = aio->free_reqs;
+    if (req) {
+        aio->free_reqs = req->next;
+    } else {
+        req = (cm_aio_req_t*)malloc(sizeof(cm_aio_req_t));
+        if (!req) return NULL;
+        req->all_next = aio->all_reqs;
+        aio->all_reqs = req;
     }
+    cm_aio_req_t* all_next = req->all_next;
+    memset(req, 0, sizeof(cm_aio_req_t));
+    req->all_next = all_next;
+    return req;
+}
 
-    return hash;
+static void cm_aio_req_free(cm_aio_t* aio, cm_aio_req_t* req) {
+    req->next = aio->free_reqs;
+    aio->free_reqs = req;
 }
 
-cm_map_t* cm_map_new(void) {
-    cm_map_t* map = (cm_map_t*)cm_alloc(sizeof(cm_map_t), "map", __FILE__, __LINE__);
-    if (!map) return NULL;
+static int cm_aio_is_fixed_buf(cm_aio_t* aio, const void* buf, size_t len) {
+    const char* p = (const char*)buf;
+    return aio->fixed_buffers && p >= aio->buf_base &&
+           p + len <= aio->buf_base + aio->buf_size * aio->buf_count;
+}
 
-    map->bucket_count = CM_MAP_INITIAL_SIZE;
-    map->size = 0;
-    map->load_factor = CM_MAP_LOAD_FACTOR;
-    map->growth_factor = 2;
-    map->buckets = (cm_map_entry_t**)cm_alloc(sizeof(cm_map_entry_t*) * map->bucket_count, 
-                                               "map_buckets", __FILE__, __LINE__);
+// Bump-allocate straight from an arena block, independent of the current arena
+static void* cm_arena_take(CMArena* arena, size_t size, size_t align) {
+    // Align the address, not the offset: blocks themselves are only 16-byte aligned
+    uintptr_t base = (uintptr_t)arena->block;
+    uintptr_t addr = (base + arena->offset + align - 1) & ~(uintptr_t)(align - 1);
+    size_t start = (size_t)(addr - base);
+    if (start > arena->block_size || size > arena->block_size - start) return NULL;
+    arena->offset = start + size;
+    if (arena->offset > arena->peak_usage) arena->peak_usage = arena->offset;
+    return (char*)arena->block + start;
+}
 
-    if (!map->buckets) {
-        cm_free(map);
-        return NULL;
+#ifdef CM_HAVE_IO_URING
+/* ---- io_uring backend ---- */
+static int cm_uring_setup(cm_aio_t* aio, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) return -1;
+
+    aio->ring_fd = fd;
+    aio->features = p.features;
+    aio->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    aio->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (aio->cq_size > aio->sq_size) aio->sq_size = aio->cq_size;
+        aio->cq_size = aio->sq_size;
     }
 
-    memset(map->buckets, 0, sizeof(cm_map_entry_t*) * map->bucket_count);
+    aio->sq_ptr = mmap(NULL, aio->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQ_RING);
+    if (aio->sq_ptr == MAP_FAILED) goto fail;
 
-    return map;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        aio->cq_ptr = aio->sq_ptr;
+    } else {
+        aio->cq_ptr = mmap(NULL, aio->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           fd, IORING_OFF_CQ_RING);
+        if (aio->cq_ptr == MAP_FAILED) goto fail_sq;
+    }
+
+    aio->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    aio->sqes = (struct io_uring_sqe*)mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (aio->sqes == MAP_FAILED) goto fail_cq;
+
+    char* sq = (char*)aio->sq_ptr;
+    char* cq = (char*)aio->cq_ptr;
+    aio->sq_khead = (unsigned*)(sq + p.sq_off.head);
+    aio->sq_ktail = (unsigned*)(sq + p.sq_off.tail);
+    aio->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    aio->sq_array = (unsigned*)(sq + p.sq_off.array);
+    aio->sq_entries = p.sq_entries;
+    aio->sq_tail = *aio->sq_ktail;
+    aio->cq_khead = (unsigned*)(cq + p.cq_off.head);
+    aio->cq_ktail = (unsigned*)(cq + p.cq_off.tail);
+    aio->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    aio->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+
+fail_cq:
+    if (aio->cq_ptr != aio->sq_ptr) munmap(aio->cq_ptr, aio->cq_size);
+fail_sq:
+    munmap(aio->sq_ptr, aio->sq_size);
+fail:
+    close(fd);
+    return -1;
 }
 
-static void cm_map_resize(cm_map_t* map, int new_size) {
-    if (!map) return;
+static struct io_uring_sqe* cm_uring_sqe(cm_aio_t* aio);
 
-    cm_map_entry_t** new_buckets = (cm_map_entry_t**)cm_alloc(
-        sizeof(cm_map_entry_t*) * new_size, "map_buckets", __FILE__, __LINE__);
+static int cm_uring_enter(cm_aio_t* aio, unsigned to_submit, unsigned min_complete, int timeout_ms) {
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    struct io_uring_getevents_arg arg;
+    void* argp = NULL;
+    size_t argsz = 0;
 
-    if (!new_buckets) return;
+    if (min_complete && timeout_ms >= 0) {
+        aio->wait_ts.tv_sec = timeout_ms / 1000;
+        aio->wait_ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000LL;
 
-    memset(new_buckets, 0, sizeof(cm_map_entry_t*) * new_size);
+        if (aio->features & IORING_FEAT_EXT_ARG) {
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (uint64_t)(uintptr_t)&aio->wait_ts;
+            argp = &arg;
+            argsz = sizeof(arg);
+            flags |= IORING_ENTER_EXT_ARG;
+        } else {
+            // Pre-5.11 kernels: a timeout SQE that also completes after one other
+            // CQE bounds the wait. Its own CQE carries user_data 0 and is skipped.
+            struct io_uring_sqe* sqe = cm_uring_sqe(aio);
+            if (sqe) {
+                sqe->opcode = IORING_OP_TIMEOUT;
+                sqe->fd = -1;
+                sqe->addr = (uint64_t)(uintptr_t)&aio->wait_ts;
+                sqe->len = 1;
+                sqe->off = 1;
+                sqe->user_data = 0;
+                __atomic_store_n(aio->sq_ktail, aio->sq_tail, __ATOMIC_RELEASE);
+                to_submit = aio->to_submit;
+            } else {
+                // No room for the timeout: poll rather than risk waiting forever
+                min_complete = 0;
+                flags &= ~IORING_ENTER_GETEVENTS;
+            }
+        }
+    }
 
-    for (int i = 0; i < map->bucket_count; i++) {
-        cm_map_entry_t* entry = map->buckets[i];
-        while (entry) {
-            cm_map_entry_t* next = entry->next;
+    int ret = (int)syscall(__NR_io_uring_enter, aio->ring_fd, to_submit, min_complete,
+                           flags, argp, argsz);
+    if (ret < 0 && (errno == ETIME || errno == EINTR)) {
+        // Timed out or interrupted: anything not consumed is still queued
+        return 0;
+    }
+    return ret;
+}
 
-            int new_index = entry->hash % new_size;
-            entry->next = new_buckets[new_index];
-            new_buckets[new_index] = entry;
+static int cm_uring_submit(cm_aio_t* aio) {
+    if (aio->to_submit == 0) return 0;
+    __atomic_store_n(aio->sq_ktail, aio->sq_tail, __ATOMIC_RELEASE);
+    int ret = cm_uring_enter(aio, aio->to_submit, 0, -1);
+    if (ret > 0) aio->to_submit -= (unsigned)ret;
+    return ret;
+}
 
-            entry = next;
+static struct io_uring_sqe* cm_uring_sqe(cm_aio_t* aio) {
+    unsigned head = __atomic_load_n(aio->sq_khead, __ATOMIC_ACQUIRE);
+    if (aio->sq_tail - head >= aio->sq_entries) {
+        // Ring full: flush what we have to make room
+        cm_uring_submit(aio);
+        head = __atomic_load_n(aio->sq_khead, __ATOMIC_ACQUIRE);
+        if (aio->sq_tail - head >= aio->sq_entries) return NULL;
+    }
+
+    unsigned idx = aio->sq_tail & aio->sq_mask;
+    struct io_uring_sqe* sqe = &aio->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    aio->sq_array[idx] = idx;
+    aio->sq_tail++;
+    aio->to_submit++;
+    return sqe;
+}
+
+static int cm_uring_queue(cm_aio_t* aio, cm_aio_req_t* req) {
+    struct io_uring_sqe* sqe = cm_uring_sqe(aio);
+    if (!sqe) return CM_ERROR_OVERFLOW;
+
+    sqe->fd = req->fd;
+    if ((size_t)req->fd < aio->fixed_cap && aio->fixed_files[req->fd]) {
+        sqe->fd = aio->fixed_files[req->fd] - 1;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+
+    switch (req->op) {
+        case CM_AIO_OP_READ:
+        case CM_AIO_OP_WRITE: {
+            int fixed = cm_aio_is_fixed_buf(aio, req->buf, req->len);
+            if (req->op == CM_AIO_OP_READ) {
+                sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            } else {
+                sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            }
+            sqe->addr = (uint64_t)(uintptr_t)req->buf;
+            sqe->len = (unsigned)req->len;
+            sqe->off = req->offset;
+            sqe->buf_index = 0;
+            break;
         }
+        case CM_AIO_OP_RECV:
+            sqe->opcode = IORING_OP_RECV;
+            sqe->addr = (uint64_t)(uintptr_t)req->buf;
+            sqe->len = (unsigned)req->len;
+            break;
+        case CM_AIO_OP_SEND:
+            sqe->opcode = IORING_OP_SEND;
+            sqe->addr = (uint64_t)(uintptr_t)req->buf;
+            sqe->len = (unsigned)req->len;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            break;
+        case CM_AIO_OP_ACCEPT:
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            break;
+        case CM_AIO_OP_RECV_MS:
+            sqe->opcode = IORING_OP_RECV;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags |= IOSQE_BUFFER_SELECT;
+            sqe->buf_group = CM_AIO_BGID;
+            break;
+        default:
+            break;
     }
+    return CM_SUCCESS;
+}
 
-    cm_free(map->buckets);
-    map->buckets = new_buckets;
-    map->bucket_count = new_size;
+static int cm_uring_reap(cm_aio_t* aio) {
+    unsigned head = *aio->cq_khead;
+    unsigned tail = __atomic_load_n(aio->cq_ktail, __ATOMIC_ACQUIRE);
+    int handled = 0;
+
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &aio->cqes[head & aio->cq_mask];
+        cm_aio_req_t* req = (cm_aio_req_t*)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        unsigned cflags = cqe->flags;
+        head++;
+        // Release the slot before the callback so it can queue new work
+        __atomic_store_n(aio->cq_khead, head, __ATOMIC_RELEASE);
+        if (!req) {
+            // Wait-timeout from cm_uring_enter
+            tail = __atomic_load_n(aio->cq_ktail, __ATOMIC_ACQUIRE);
+            continue;
+        }
+
+        void* buf = req->buf;
+        if (cflags & IORING_CQE_F_BUFFER) {
+            unsigned bid = cflags >> IORING_CQE_BUFFER_SHIFT;
+            buf = aio->buf_base + (size_t)bid * aio->buf_size;
+        } else if (req->op == CM_AIO_OP_RECV_MS || req->op == CM_AIO_OP_ACCEPT) {
+            buf = NULL;
+        }
+
+        int more = (cflags & IORING_CQE_F_MORE) ? CM_AIO_MORE : 0;
+        req->cb(aio, res, buf, more, req->arg);
+        if (!more) cm_aio_req_free(aio, req);
+
+        handled++;
+        tail = __atomic_load_n(aio->cq_ktail, __ATOMIC_ACQUIRE);
+    }
+    return handled;
 }
 
-void cm_map_set(cm_map_t* map, const char* key, const void* value, size_t value_size) {
-    if (!map || !key || !value) return;
+static void cm_uring_buf_put(cm_aio_t* aio, unsigned bid) {
+    struct io_uring_buf_ring* br = aio->buf_ring;
+    unsigned short tail = br->tail;
+    struct io_uring_buf* b = &br->bufs[tail & aio->buf_ring_mask];
+    b->addr = (uint64_t)(uintptr_t)(aio->buf_base + (size_t)bid * aio->buf_size);
+    b->len = (unsigned)aio->buf_size;
+    b->bid = (unsigned short)bid;
+    __atomic_store_n(&br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
 
-    if (map->size >= map->bucket_count * map->load_factor) {
-        cm_map_resize(map, map->bucket_count * map->growth_factor);
+static int cm_uring_register_buffers(cm_aio_t* aio) {
+    // One fixed buffer spanning the whole region: any slice qualifies for *_FIXED
+    struct iovec iov;
+    iov.iov_base = aio->buf_base;
+    iov.iov_len = aio->buf_size * aio->buf_count;
+    if (syscall(__NR_io_uring_register, aio->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0) {
+        aio->fixed_buffers = 1;
     }
 
-    uint32_t hash = cm_hash_string(key);
-    int index = hash % map->bucket_count;
+    // Provided-buffer ring feeding multishot recv
+    unsigned entries = 1;
+    while (entries < aio->buf_count) entries <<= 1;
+    aio->buf_ring_size = entries * sizeof(struct io_uring_buf);
+    void* ring = mmap(NULL, aio->buf_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) return CM_ERROR_MEMORY;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring;
+    reg.ring_entries = entries;
+    reg.bgid = CM_AIO_BGID;
+    if (syscall(__NR_io_uring_register, aio->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(ring, aio->buf_ring_size);
+        return CM_ERROR_UNIMPLEMENTED;
+    }
 
-    cm_map_entry_t* entry = map->buckets[index];
-    while (entry) {
-        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
-            cm_free(entry->value);
-            entry->value = cm_alloc(value_size, "map_value", __FILE__, __LINE__);
-            memcpy(entry->value, value, value_size);
-            entry->value_size = value_size;
-            return;
-        }
-        entry = entry->next;
+    aio->buf_ring = (struct io_uring_buf_ring*)ring;
+    aio->buf_ring_mask = entries - 1;
+    for (unsigned i = 0; i < aio->buf_count; i++) {
+        cm_uring_buf_put(aio, i);
     }
+    return CM_SUCCESS;
+}
 
-    entry = (cm_map_entry_t*)cm_alloc(sizeof(cm_map_entry_t), "map_entry", __FILE__, __LINE__);
-    if (!entry) return;
+static void cm_uring_close(cm_aio_t* aio) {
+    if (aio->buf_ring) munmap(aio->buf_ring, aio->buf_ring_size);
+    munmap(aio->sqes, aio->sqes_size);
+    if (aio->cq_ptr != aio->sq_ptr) munmap(aio->cq_ptr, aio->cq_size);
+    munmap(aio->sq_ptr, aio->sq_size);
+    close(aio->ring_fd);
+}
+#endif /* CM_HAVE_IO_URING */
 
-    entry->key = strdup(key);
-    entry->value = cm_alloc(value_size, "map_value", __FILE__, __LINE__);
-    memcpy(entry->value, value, value_size);
-    entry->value_size = value_size;
-    entry->hash = hash;
-    entry->next = map->buckets[index];
+/* ---- epoll backend: readiness emulation of the same completion API ---- */
+static void cm_aio_epoll_ready(cm_loop_t* loop, int fd, int events, void* arg);
 
-    map->buckets[index] = entry;
-    map->size++;
+static int cm_aio_wants_write(int op) {
+    return op == CM_AIO_OP_WRITE || op == CM_AIO_OP_SEND;
 }
 
-void* cm_map_get(cm_map_t* map, const char* key) {
-    if (!map || !key) return NULL;
-
-    uint32_t hash = cm_hash_string(key);
-    int index = hash % map->bucket_count;
+static void cm_aio_epoll_rearm(cm_aio_t* aio, int fd) {
+    int events = 0;
+    for (cm_aio_req_t* r = aio->waiting[fd]; r; r = r->next) {
+        events |= cm_aio_wants_write(r->op) ? CM_IO_WRITE : CM_IO_READ;
+    }
+    if (events) {
+        cm_loop_watch(aio->loop, fd, events, cm_aio_epoll_ready, aio);
+    } else {
+        cm_loop_unwatch(aio->loop, fd);
+    }
+}
 
-    cm_map_entry_t* entry = map->buckets[index];
-    while (entry) {
-        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
-            return entry->value;
-        }
-        entry = entry->next;
+// Runs one request as far as it can go; returns 1 when it is finished
+static int cm_aio_epoll_attempt(cm_aio_t* aio, cm_aio_req_t* req) {
+    ssize_t n;
+    switch (req->op) {
+        case CM_AIO_OP_READ:
+            n = req->offset == CM_AIO_NO_OFFSET ? read(req->fd, req->buf, req->len)
+                                                : pread(req->fd, req->buf, req->len, (off_t)req->offset);
+            break;
+        case CM_AIO_OP_WRITE:
+            n = req->offset == CM_AIO_NO_OFFSET ? write(req->fd, req->buf, req->len)
+                                                : pwrite(req->fd, req->buf, req->len, (off_t)req->offset);
+            break;
+        case CM_AIO_OP_RECV:
+            n = recv(req->fd, req->buf, req->len, 0);
+            break;
+        case CM_AIO_OP_SEND:
+            // Parenthesised: CM.h's OOP send() macro would otherwise expand here
+            n = (send)(req->fd, req->buf, req->len, MSG_NOSIGNAL);
+            break;
+        case CM_AIO_OP_ACCEPT:
+            for (;;) {
+                int cfd = accept4(req->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (cfd >= 0) {
+                    req->cb(aio, cfd, NULL, CM_AIO_MORE, req->arg);
+                    continue;
+                }
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+                req->cb(aio, -errno, NULL, 0, req->arg);
+                return 1;
+            }
+        case CM_AIO_OP_RECV_MS:
+            for (;;) {
+                if (aio->free_buf_count == 0) {
+                    // Same contract as io_uring: out of buffers ends the multishot
+                    req->cb(aio, -ENOBUFS, NULL, 0, req->arg);
+                    return 1;
+                }
+                unsigned bid = aio->free_bufs[aio->free_buf_count - 1];
+                char* buf = aio->buf_base + (size_t)bid * aio->buf_size;
+                n = recv(req->fd, buf, aio->buf_size, 0);
+                if (n > 0) {
+                    aio->free_buf_count--;
+                    req->cb(aio, (int)n, buf, CM_AIO_MORE, req->arg);
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+                req->cb(aio, n == 0 ? 0 : -errno, NULL, 0, req->arg);
+                return 1;
+            }
+        default:
+            return 1;
     }
 
-    return NULL;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+    req->cb(aio, n < 0 ? -errno : (int)n, n < 0 ? NULL : req->buf, 0, req->arg);
+    return 1;
 }
 
-int cm_map_has(cm_map_t* map, const char* key) {
-    return cm_map_get(map, key) != NULL;
-}
+static void cm_aio_epoll_ready(cm_loop_t* loop, int fd, int events, void* arg) {
+    (void)loop;
+    (void)events;
+    cm_aio_t* aio = (cm_aio_t*)arg;
 
-void cm_map_free(cm_map_t* map) {
-    if (!map) return;
+    // Detach the list first: callbacks may queue new requests on this fd
+    cm_aio_req_t* list = aio->waiting[fd];
+    aio->waiting[fd] = NULL;
 
-    for (int i = 0; i < map->bucket_count; i++) {
-        cm_map_entry_t* entry = map->buckets[i];
-        while (entry) {
-            cm_map_entry_t* next = entry->next;
-            free(entry->key);
-            cm_free(entry->value);
-            cm_free(entry);
-            entry = next;
+    cm_aio_req_t* keep = NULL;
+    while (list) {
+        cm_aio_req_t* next = list->next;
+        if (cm_aio_epoll_attempt(aio, list)) {
+            cm_aio_req_free(aio, list);
+        } else {
+            list->next = keep;
+            keep = list;
         }
+        list = next;
     }
 
-    cm_free(map->buckets);
-    cm_free(map);
+    while (keep) {
+        cm_aio_req_t* next = keep->next;
+        keep->next = aio->waiting[fd];
+        aio->waiting[fd] = keep;
+        keep = next;
+    }
+    cm_aio_epoll_rearm(aio, fd);
 }
 
-size_t cm_map_size(cm_map_t* map) {
-    return map ? (size_t)map->size : 0;
+static int cm_aio_epoll_park(cm_aio_t* aio, cm_aio_req_t* req) {
+    if ((size_t)req->fd >= aio->waiting_cap) {
+        size_t cap = aio->waiting_cap ? aio->waiting_cap : 64;
+        while (cap <= (size_t)req->fd) cap *= 2;
+        cm_aio_req_t** grown = (cm_aio_req_t**)realloc(aio->waiting, cap * sizeof(cm_aio_req_t*));
+        if (!grown) return CM_ERROR_MEMORY;
+        memset(grown + aio->waiting_cap, 0, (cap - aio->waiting_cap) * sizeof(cm_aio_req_t*));
+        aio->waiting = grown;
+        aio->waiting_cap = cap;
+    }
+    req->next = aio->waiting[req->fd];
+    aio->waiting[req->fd] = req;
+    cm_aio_epoll_rearm(aio, req->fd);
+    return CM_SUCCESS;
 }
 
-/* ============================================================================
- * UTILITY IMPLEMENTATION
- * ============================================================================ */
-void cm_random_seed(unsigned int seed) {
-    srand(seed);
+static int cm_aio_epoll_run(cm_aio_t* aio, int timeout_ms) {
+    int handled = 0;
+
+    cm_aio_req_t* req = aio->pending_head;
+    aio->pending_head = aio->pending_tail = NULL;
+    while (req) {
+        cm_aio_req_t* next = req->next;
+        if (cm_aio_epoll_attempt(aio, req)) {
+            cm_aio_req_free(aio, req);
+            handled++;
+        } else if (cm_aio_epoll_park(aio, req) != CM_SUCCESS) {
+            req->cb(aio, -ENOMEM, NULL, 0, req->arg);
+            cm_aio_req_free(aio, req);
+        }
+        req = next;
+    }
+
+    int n = cm_loop_run_once(aio->loop, handled ? 0 : timeout_ms);
+    return handled + (n > 0 ? n : 0);
 }
 
-void cm_random_string(char* buffer, size_t length) {
-    const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-    size_t charset_size = sizeof(charset) - 1;
+/* ---- public API ---- */
+cm_aio_t* cm_aio_new(unsigned entries, int flags) {
+    cm_aio_t* aio = (cm_aio_t*)calloc(1, sizeof(cm_aio_t));
+    if (!aio) return NULL;
+    if (entries == 0) entries = 256;
 
-    for (size_t i = 0; i < length - 1; i++) {
-        buffer[i] = charset[rand() % charset_size];
+#ifdef CM_HAVE_IO_URING
+    if (!(flags & CM_AIO_FORCE_EPOLL) && cm_uring_setup(aio, entries) == 0) {
+        aio->backend = CM_AIO_BACKEND_URING;
+        return aio;
     }
-    buffer[length - 1] = '\0';
+#else
+    (void)flags;
+#endif
+
+    // io_uring missing, disabled by seccomp, or not wanted: emulate on epoll
+    aio->loop = cm_loop_new();
+    if (!aio->loop) {
+        free(aio);
+        return NULL;
+    }
+    aio->backend = CM_AIO_BACKEND_EPOLL;
+    return aio;
 }
 
-/* ============================================================================
- * CLASS IMPLEMENTATION - OOP
- * ============================================================================ */
+void cm_aio_free(cm_aio_t* aio) {
+    if (!aio) return;
 
-// ===== String Class Implementation =====
-String* string_concat(String* self, const char* other) {
-    if (!self || !other) return self;
-    int new_len = self->length + strlen(other);
-    char* new_data = (char*)cm_alloc(new_len + 1, "string_data", __FILE__, __LINE__);
-    strcpy(new_data, self->data);
-    strcat(new_data, other);
-    cm_free(self->data);
-    self->data = new_data;
-    self->length = new_len;
-    return self;
-}
+#ifdef CM_HAVE_IO_URING
+    if (aio->backend == CM_AIO_BACKEND_URING) cm_uring_close(aio);
+#endif
 
-String* string_upper(String* self) {
-    if (!self || !self->data) return self;
-    for (int i = 0; i < self->length; i++) {
-        self->data[i] = toupper(self->data[i]);
+    if (aio->loop) cm_loop_free(aio->loop);
+
+    // Covers free, pending, parked and still in-flight multishot requests
+    cm_aio_req_t* r = aio->all_reqs;
+    while (r) {
+        cm_aio_req_t* next = r->all_next;
+        free(r);
+        r = next;
     }
-    return self;
+    free(aio->waiting);
+    free(aio->free_bufs);
+    free(aio->fixed_files);
+    free(aio);
 }
 
-String* string_lower(String* self) {
-    if (!self || !self->data) return self;
-    for (int i = 0; i < self->length; i++) {
-        self->data[i] = tolower(self->data[i]);
-    }
-    return self;
+int cm_aio_backend(cm_aio_t* aio) {
+    return aio ? aio->backend : -1;
 }
 
-void string_print(String* self) {
-    if (self && self->data) {
-        printf("%s", self->data);  // ✅ استخدام printf مباشرة
-        fflush(stdout);
-    }
+int cm_aio_register_buffers(cm_aio_t* aio, CMArena* arena, size_t buf_size, unsigned count) {
+    if (!aio || !arena || buf_size == 0 || count == 0) return CM_ERROR_INVALID_ARGUMENT;
+    if (aio->buf_base) return CM_ERROR_ALREADY_EXISTS;
+    if (count > 32768) return CM_ERROR_OVERFLOW;  // buffer ids are 16-bit
+
+    if (buf_size > SIZE_MAX - 63) return CM_ERROR_OVERFLOW;
+    buf_size = (buf_size + 63) & ~(size_t)63;
+    if (buf_size > SIZE_MAX / count) return CM_ERROR_OVERFLOW;
+    char* base = (char*)cm_arena_take(arena, buf_size * count, 4096);
+    if (!base) return CM_ERROR_MEMORY;
+
+    aio->buf_base = base;
+    aio->buf_size = buf_size;
+    aio->buf_count = count;
+
+#ifdef CM_HAVE_IO_URING
+    if (aio->backend == CM_AIO_BACKEND_URING) return cm_uring_register_buffers(aio);
+#endif
+
+    aio->free_bufs = (unsigned*)malloc(count * sizeof(unsigned));
+    if (!aio->free_bufs) return CM_ERROR_MEMORY;
+    for (unsigned i = 0; i < count; i++) aio->free_bufs[i] = count - 1 - i;
+    aio->free_buf_count = count;
+    return CM_SUCCESS;
 }
 
-int string_length(String* self) {
-    return self ? self->length : 0;
+void cm_aio_buffer_release(cm_aio_t* aio, void* buf) {
+    if (!aio || !buf || !aio->buf_base) return;
+    size_t off = (size_t)((char*)buf - aio->buf_base);
+    unsigned bid = (unsigned)(off / aio->buf_size);
+    if (bid >= aio->buf_count) return;
+
+#ifdef CM_HAVE_IO_URING
+    if (aio->backend == CM_AIO_BACKEND_URING) {
+        if (aio->buf_ring) cm_uring_buf_put(aio, bid);
+        return;
+    }
+#endif
+    aio->free_bufs[aio->free_buf_count++] = bid;
 }
 
-char string_charAt(String* self, int index) {
-    if (!self || !self->data || index < 0 || index >= self->length) return '\0';
-    return self->data[index];
+void* cm_aio_buffer(cm_aio_t* aio, unsigned index) {
+    if (!aio || !aio->buf_base || index >= aio->buf_count) return NULL;
+    return aio->buf_base + (size_t)index * aio->buf_size;
 }
 
-String* String_new(const char* initial) {
-    String* self = (String*)cm_alloc(sizeof(String), "String", __FILE__, __LINE__);
+int cm_aio_register_files(cm_aio_t* aio, const int* fds, unsigned count) {
+    if (!aio || !fds || count == 0) return CM_ERROR_INVALID_ARGUMENT;
 
-    int len = initial ? strlen(initial) : 0;
-    self->length = len;
-    self->capacity = len + 1;
-    self->data = (char*)cm_alloc(self->capacity, "string_data", __FILE__, __LINE__);
-    if (self->data && initial) {
-        strcpy(self->data, initial);
+    int max_fd = -1;
+    for (unsigned i = 0; i < count; i++) {
+        if (fds[i] > max_fd) max_fd = fds[i];
     }
+    if (max_fd < 0) return CM_ERROR_INVALID_ARGUMENT;
 
-    self->concat = string_concat;
-    self->upper = string_upper;
-    self->lower = string_lower;
-    self->print = string_print;
-    self->length_func = string_length;
-    self->charAt = string_charAt;
-
-    return self;
-}
+#ifdef CM_HAVE_IO_URING
+    if (aio->backend == CM_AIO_BACKEND_URING &&
+        syscall(__NR_io_uring_register, aio->ring_fd, IORING_REGISTER_FILES, fds, count) != 0) {
+        return CM_ERROR_IO;
+    }
+#endif
 
-void String_delete(String* self) {
-    if (!self) return;
-    if (self->data) cm_free(self->data);
-    cm_free(self);
+    int* map = (int*)calloc((size_t)max_fd + 1, sizeof(int));
+    if (!map) return CM_ERROR_MEMORY;
+    // Only io_uring has a fixed file table; epoll just keeps the fd
+    if (aio->backend == CM_AIO_BACKEND_URING) {
+        for (unsigned i = 0; i < count; i++) {
+            if (fds[i] >= 0) map[fds[i]] = (int)i + 1;
+        }
+    }
+    free(aio->fixed_files);
+    aio->fixed_files = map;
+    aio->fixed_cap = (size_t)max_fd + 1;
+    return CM_SUCCESS;
 }
 
-// ===== Array Class Implementation =====
-Array* array_push(Array* self, void* value) {
-    if (!self || !value) return self;
+static int cm_aio_queue(cm_aio_t* aio, int op, int fd, void* buf, size_t len, uint64_t offset,
+                        cm_aio_cb_t cb, void* arg) {
+    if (!aio || fd < 0 || !cb) return CM_ERROR_INVALID_ARGUMENT;
+    if (op == CM_AIO_OP_RECV_MS && !aio->buf_base) return CM_ERROR_INVALID_ARGUMENT;
+#ifdef CM_HAVE_IO_URING
+    if (op == CM_AIO_OP_RECV_MS && aio->backend == CM_AIO_BACKEND_URING && !aio->buf_ring) {
+        return CM_ERROR_UNIMPLEMENTED;
+    }
+#endif
 
-    if (self->length >= self->capacity) {
-        int new_cap = self->capacity * 2;
-        void* new_data = cm_alloc(self->element_size * new_cap, "array_data", __FILE__, __LINE__);
-        memcpy(new_data, self->data, self->element_size * self->length);
-        cm_free(self->data);
-        self->data = new_data;
-        self->capacity = new_cap;
+    cm_aio_req_t* req = cm_aio_req_new(aio);
+    if (!req) return CM_ERROR_MEMORY;
+    req->op = op;
+    req->fd = fd;
+    req->buf = buf;
+    req->len = len;
+    req->offset = offset;
+    req->cb = cb;
+    req->arg = arg;
+
+#ifdef CM_HAVE_IO_URING
+    if (aio->backend == CM_AIO_BACKEND_URING) {
+        int rc = cm_uring_queue(aio, req);
+        if (rc != CM_SUCCESS) cm_aio_req_free(aio, req);
+        return rc;
     }
+#endif
 
-    void* dest = (char*)self->data + (self->length * self->element_size);
-    memcpy(dest, value, self->element_size);
-    self->length++;
-    return self;
+    if (aio->pending_tail) {
+        aio->pending_tail->next = req;
+    } else {
+        aio->pending_head = req;
+    }
+    aio->pending_tail = req;
+    return CM_SUCCESS;
 }
 
-void* array_pop(Array* self) {
-    if (!self || self->length == 0) return NULL;
-    self->length--;
-    return (char*)self->data + (self->length * self->element_size);
+int cm_aio_read(cm_aio_t* aio, int fd, void* buf, size_t len, uint64_t offset, cm_aio_cb_t cb, void* arg) {
+    return cm_aio_queue(aio, CM_AIO_OP_READ, fd, buf, len, offset, cb, arg);
 }
 
-void* array_get(Array* self, int index) {
-    if (!self || index < 0 || index >= self->length) return NULL;
-    return (char*)self->data + (index * self->element_size);
+int cm_aio_write(cm_aio_t* aio, int fd, const void* buf, size_t len, uint64_t offset, cm_aio_cb_t cb, void* arg) {
+    return cm_aio_queue(aio, CM_AIO_OP_WRITE, fd, (void*)buf, len, offset, cb, arg);
 }
 
-int array_size(Array* self) {
-    return self ? self->length : 0;
+int cm_aio_recv(cm_aio_t* aio, int fd, void* buf, size_t len, cm_aio_cb_t cb, void* arg) {
+    return cm_aio_queue(aio, CM_AIO_OP_RECV, fd, buf, len, 0, cb, arg);
 }
 
-Array* Array_new(int element_size, int capacity) {
-    Array* self = (Array*)cm_alloc(sizeof(Array), "Array", __FILE__, __LINE__);
-
-    self->element_size = element_size;
-    self->capacity = capacity > 0 ? capacity : 16;
-    self->length = 0;
-    self->data = cm_alloc(element_size * self->capacity, "array_data", __FILE__, __LINE__);
-
-    self->push = array_push;
-    self->pop = array_pop;
-    self->get = array_get;
-    self->size = array_size;
-
-    return self;
+int cm_aio_send(cm_aio_t* aio, int fd, const void* buf, size_t len, cm_aio_cb_t cb, void* arg) {
+    return cm_aio_queue(aio, CM_AIO_OP_SEND, fd, (void*)buf, len, 0, cb, arg);
 }
 
-void Array_delete(Array* self) {
-    if (!self) return;
-    if (self->data) cm_free(self->data);
-    cm_free(self);
+int cm_aio_accept_multishot(cm_aio_t* aio, int listen_fd, cm_aio_cb_t cb, void* arg) {
+    return cm_aio_queue(aio, CM_AIO_OP_ACCEPT, listen_fd, NULL, 0, 0, cb, arg);
 }
 
-// ===== Map Class Implementation =====
-Map* map_set(Map* self, const char* key, void* value) {
-    if (!self || !key || !value) return self;
-    cm_map_set((cm_map_t*)self->map_data, key, value, sizeof(void*));
-    self->size = cm_map_size((cm_map_t*)self->map_data);
-    return self;
+int cm_aio_recv_multishot(cm_aio_t* aio, int fd, cm_aio_cb_t cb, void* arg) {
+    return cm_aio_queue(aio, CM_AIO_OP_RECV_MS, fd, NULL, 0, 0, cb, arg);
 }
 
-void* map_get(Map* self, const char* key) {
-    if (!self || !key) return NULL;
-    return cm_map_get((cm_map_t*)self->map_data, key);
+int cm_aio_submit(cm_aio_t* aio) {
+    if (!aio) return CM_ERROR_NULL_POINTER;
+#ifdef CM_HAVE_IO_URING
+    if (aio->backend == CM_AIO_BACKEND_URING) {
+        return cm_uring_submit(aio) < 0 ? CM_ERROR_IO : CM_SUCCESS;
+    }
+#endif
+    // epoll backend issues its syscalls from cm_aio_run_once
+    return CM_SUCCESS;
 }
 
-int map_has(Map* self, const char* key) {
-    if (!self || !key) return 0;
-    return cm_map_has((cm_map_t*)self->map_data, key);
-}
+int cm_aio_run_once(cm_aio_t* aio, int timeout_ms) {
+    if (!aio) return -1;
+
+#ifdef CM_HAVE_IO_URING
+    if (aio->backend == CM_AIO_BACKEND_URING) {
+        int handled = cm_uring_reap(aio);
+        // Submit and wait in the same syscall
+        if (aio->to_submit || (!handled && timeout_ms != 0)) {
+            unsigned wait = (!handled && timeout_ms != 0) ? 1 : 0;
+            if (aio->to_submit) __atomic_store_n(aio->sq_ktail, aio->sq_tail, __ATOMIC_RELEASE);
+            int ret = cm_uring_enter(aio, aio->to_submit, wait, timeout_ms);
+            if (ret < 0) return -1;
+            if ((unsigned)ret > aio->to_submit) ret = (int)aio->to_submit;
+            aio->to_submit -= (unsigned)ret;
+            handled += cm_uring_reap(aio);
+        }
+        return handled;
+    }
+#endif
 
-int map_size_func(Map* self) {
-    return self ? self->size : 0;
+    return cm_aio_epoll_run(aio, timeout_ms);
 }
 
-Map* Map_new(void) {
-    Map* self = (Map*)cm_alloc(sizeof(Map), "Map", __FILE__, __LINE__);
+#endif /* __linux__ */
 
-    self->map_data = cm_map_new();
-    self->size = 0;
+/* ============================================================================
+ * RUNTIME INITIALIZATION AND SHUTDOWN
+ * ============================================================================ */
+#ifndef CM_RUNTIME_DRAIN_MS
+#define CM_RUNTIME_DRAIN_MS 2000         // NORMAL shutdown: longest wait for the default pool
+#endif
 
-    self->set = map_set;
-    self->get = map_get;
-    self->has = map_has;
-    self->size_func = map_size_func;
+static int cm_runtime_exit_mode = CM_SHUTDOWN_NORMAL;
+static int cm_runtime_leak_report = 0;
+static int cm_runtime_done = 0;          // explicit shutdown ran; the exit hook does nothing
+static pthread_once_t cm_runtime_fork_once = PTHREAD_ONCE_INIT;
 
-    return self;
+// Holding the heap locks across fork() keeps the child from inheriting them mid-update
+static void cm_runtime_prefork(void) {
+    pthread_mutex_lock(&cm_mem.gc_lock);
+    pthread_mutex_lock(&cm_random_lock);
 }
 
-void Map_delete(Map* self) {
-    if (!self) return;
-    if (self->map_data) cm_map_free((cm_map_t*)self->map_data);
-    cm_free(self);
+static void cm_runtime_postfork_parent(void) {
+    pthread_mutex_unlock(&cm_random_lock);
+    pthread_mutex_unlock(&cm_mem.gc_lock);
 }
 
-/* ============================================================================
- * INPUT IMPLEMENTATION
- * ============================================================================ */
-String* cm_input(const char* prompt) {
-    if (prompt) {
-        cm_printf("%s", prompt);
-        fflush(stdout);
+// Background threads do not survive fork(): the child forgets the parent's
+// defaults (they start again on first use) and its log writes go straight out
+static void cm_runtime_postfork_child(void) {
+    cm_runtime_postfork_parent();
+    __atomic_store_n(&cm_log_async, 0, __ATOMIC_RELEASE);
+
+    // Otherwise parent and child would keep drawing the same random sequence
+    if (cm_random_epoch) cm_random_reseed_locked(cm_random_base ^ ((uint64_t)getpid() << 32));
+
+    cm_default_pool = NULL;
+    cm_once_reset_child(&cm_default_pool_once);
+    cm_default_sched = NULL;
+    cm_once_reset_child(&cm_default_sched_once);
+    cm_default_wheel = NULL;
+    cm_default_wheel_stop = 0;
+    cm_default_wheel_kicked = 0;
+    pthread_mutex_init(&cm_default_wheel_lock, NULL);
+    cm_once_reset_child(&cm_default_wheel_once);
+}
+
+static void cm_runtime_fork_init(void) {
+    pthread_atfork(cm_runtime_prefork, cm_runtime_postfork_parent, cm_runtime_postfork_child);
+}
+
+static void cm_runtime_register(void) {
+    pthread_once(&cm_runtime_fork_once, cm_runtime_fork_init);
+}
+
+int cm_runtime_init(const cm_runtime_config_t* config) {
+    static const cm_runtime_config_t defaults = CM_RUNTIME_DEFAULTS;
+    if (!config) config = &defaults;
+    if (config->exit_mode < CM_SHUTDOWN_FAST || config->exit_mode > CM_SHUTDOWN_FULL) {
+        cm_error_set(CM_ERROR_INVALID_ARGUMENT, "Unknown shutdown mode");
+        return CM_ERROR_INVALID_ARGUMENT;
     }
 
-    char buffer[1024]; 
-    if (cm_gets(buffer, sizeof(buffer))) {
-        buffer[strcspn(buffer, "\n")] = 0;
-        return String_new(buffer);
+    cm_runtime_register();
+    if (config->log_level >= 0) cm_log_set_level(config->log_level);
+    if (config->log_fd >= 0) cm_log_set_fd(config->log_fd);
+    if (config->seed) cm_random_seed(config->seed);
+    cm_runtime_exit_mode = config->exit_mode;
+    cm_runtime_leak_report = config->leak_report;
+    __atomic_store_n(&cm_runtime_done, 0, __ATOMIC_RELEASE);
+
+    if (config->banner) {
+        cm_printf("\n🔷 [CM] Library v%s initialized by %s\n", CM_VERSION, CM_AUTHOR);
     }
-    return String_new("");
+    return CM_SUCCESS;
 }
 
-/* ============================================================================
- * INITIALIZATION
- * ============================================================================ */
-__attribute__((constructor)) void cm_init_all(void) {
-    cm_gc_init();
-    cm_random_seed((unsigned int)time(NULL));
-    cm_printf("\n🔷 [CM] Library v%s initialized by %s\n", CM_VERSION, CM_AUTHOR);
-}
+// Call once no other thread is using the library; defaults restart lazily afterwards
+void cm_runtime_shutdown(int mode) {
+    if (__atomic_exchange_n(&cm_runtime_done, 1, __ATOMIC_ACQ_REL)) return;
 
-__attribute__((destructor)) void cm_cleanup_all(void) {
-    pthread_mutex_lock(&cm_mem.gc_lock);
-    for (CMObject* obj = cm_mem.head; obj; obj = obj->next) {
-        obj->ref_count = 0; 
+    if (mode >= CM_SHUTDOWN_NORMAL) {
+        // Let queued tasks finish before their futures are swept, but not forever:
+        // a task blocked past CM_RUNTIME_DRAIN_MS leaves the pool running detached
+        if (cm_default_pool) {
+            if (!cm_task_pool_stop_timed(cm_default_pool, CM_RUNTIME_DRAIN_MS)) {
+                cm_log(CM_LOG_WARN, "[CM] default task pool still busy at shutdown; left running");
+            }
+            cm_default_pool = NULL;
+            cm_once_reset(&cm_default_pool_once);
+        }
+        // Coroutines still parked on futures at exit are abandoned, not awaited
+        if (cm_default_sched) {
+            cm_sched_shutdown(cm_default_sched, 1);
+            cm_default_sched = NULL;
+            cm_once_reset(&cm_default_sched_once);
+        }
+        // Deadlines still pending at exit never fire
+        if (cm_default_wheel) {
+            cm_default_wheel_shutdown();
+            cm_default_wheel_stop = 0;
+            cm_once_reset(&cm_default_wheel_once);
+        }
     }
-    pthread_mutex_unlock(&cm_mem.gc_lock);
 
-    cm_gc_collect();
+    if (mode >= CM_SHUTDOWN_FULL) {
+        if (cm_runtime_leak_report && cm_mem.total_objects > 0) {
+            cm_log(CM_LOG_WARN, "[CM] %zu objects still alive at shutdown", cm_mem.total_objects);
+            cm_gc_stats();
+        }
+
+        // Empty the owners' merge queues first, or threads still running
+        // would later walk objects the collection below frees
+        pthread_mutex_lock(&cm_mem.gc_lock);
+        for (CMObject* obj = cm_mem.head; obj; obj = obj->next) {
+            cm_gc_owner_t* owner = (cm_gc_owner_t*)__atomic_load_n(&obj->owner, __ATOMIC_RELAXED);
+            if (owner) {
+                pthread_mutex_lock(&owner->lock);
+                owner->queue = NULL;
+                __atomic_store_n(&owner->pending, 0, __ATOMIC_RELAXED);
+                pthread_mutex_unlock(&owner->lock);
+                obj->queue_next = NULL;
+                __atomic_store_n(&obj->owner, NULL, __ATOMIC_RELAXED);
+                cm_gc_owner_put(owner);
+            }
+            __atomic_store_n(&obj->refs, CM_RC_MERGED, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&cm_mem.gc_lock);
+
+        cm_gc_collect();
+    }
 
-    if (cm_mem.total_objects > 0) {
-        cm_printf("\n⚠️ [CM] Warning: %zu objects still alive\n", cm_mem.total_objects);
-        cm_gc_stats();
+    // Last: everything above may still have logged
+    if (mode >= CM_SHUTDOWN_NORMAL) {
+        cm_log_shutdown();
     } else {
-        cm_printf("\n✅ [CM] Clean shutdown - all memory recovered!\n");
+        cm_log_flush();
     }
+}
 
-    pthread_mutex_destroy(&cm_mem.gc_lock);
-    pthread_mutex_destroy(&cm_mem.arena_lock);
+__attribute__((destructor)) static void cm_runtime_exit(void) {
+    cm_runtime_shutdown(cm_runtime_exit_mode);
 }
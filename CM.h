@@ -32,6 +32,7 @@
 #include <signal.h>
 #include <setjmp.h>
 #include <pthread.h>
+#include <sys/types.h>
 
 /* ============================================================================
  * CONFIGURATION
@@ -39,7 +40,9 @@
 #define CM_VERSION "4.2.2"
 #define CM_AUTHOR "Adham Hossam"
 #define CM_GC_THRESHOLD (1024 * 1024)
-#define CM_LOG_LEVEL 3
+#ifndef CM_LOG_LEVEL
+#define CM_LOG_LEVEL 3                  // compile-time ceiling: CM_LOG calls above it compile away
+#endif
 
 /* ============================================================================
  * ERROR CODES
@@ -65,19 +68,123 @@
 #define CM_ERROR_UNIMPLEMENTED          18
 #define CM_ERROR_UNKNOWN                19
 #define CM_ERROR_TEST                   20
+#define CM_ERROR_WOULD_BLOCK            21
+#define CM_ERROR_CLOSED                 22
+
+/* ============================================================================
+ * FUTURE STATES
+ * ============================================================================ */
+#define CM_FUTURE_PENDING               0
+#define CM_FUTURE_READY                 1
+#define CM_FUTURE_FAILED                2
+#define CM_FUTURE_CANCELLED             3
+
+/* Log levels (higher = more verbose) */
+#define CM_LOG_OFF                      0
+#define CM_LOG_ERROR                    1
+#define CM_LOG_WARN                     2
+#define CM_LOG_INFO                     3
+#define CM_LOG_DEBUG                    4
+#define CM_LOG_TRACE                    5
+#define CM_LOG_MAX_ARGS                 6      // deferred records capture at most this many args
+
+/* Error messages longer than this are truncated when copied or formatted */
+#define CM_ERROR_MESSAGE_MAX            1024
+
+/* Tracing: CM_TRACE 0 compiles CM_TRACE_SCOPE / CM_TRACE_INSTANT out entirely */
+#ifndef CM_TRACE
+#define CM_TRACE                        1
+#endif
+
+/* Object pools: CM_POOLS 0 makes map entries and string headers plain cm_alloc objects */
+#ifndef CM_POOLS
+#define CM_POOLS                        1
+#endif
+#define CM_POOL_DEFAULT_CHUNK           256    // objects per chunk when cm_pool_create gets 0
+
+/* Line reader */
+#define CM_READER_BUFFER                (1 << 20)  // initial read buffer for non-mapped input
+
+/* JSON value types (cm_json_t.type) */
+#define CM_JSON_NULL                    0
+#define CM_JSON_FALSE                   1
+#define CM_JSON_TRUE                    2
+#define CM_JSON_NUMBER                  3
+#define CM_JSON_STRING                  4
+#define CM_JSON_ARRAY                   5
+#define CM_JSON_OBJECT                  6
+#define CM_JSON_MAX_DEPTH               256    // deeper nesting is a parse error (coroutine stacks are small)
+
+/* B+tree key types (cm_btree_new) */
+#define CM_BTREE_INT                    0      // int64_t keys
+#define CM_BTREE_STRING                 1      // NUL-terminated keys, copied on insert, strcmp order
+
+/* Runtime metrics */
+#define CM_METRICS_PAUSE_BUCKETS        16     // GC pause histogram: under 1 us, then powers of two
+#define CM_METRICS_PROMETHEUS           0      // cm_runtime_metrics_write formats
+#define CM_METRICS_JSON                 1
+
+/* Heap profile values (cm_heap_profile_write) */
+#define CM_HEAP_INUSE_BYTES             0
+#define CM_HEAP_INUSE_OBJECTS           1
+#define CM_HEAP_ALLOC_BYTES             2      // cumulative since sampling started
+#define CM_HEAP_ALLOC_OBJECTS           3
+
+/* Runtime shutdown modes (cm_runtime_shutdown, and what runs at exit) */
+#define CM_SHUTDOWN_FAST                0      // flush logs only; threads and heap go with the process
+#define CM_SHUTDOWN_NORMAL              1      // also drain pools (up to CM_RUNTIME_DRAIN_MS), schedulers and timer/log threads
+#define CM_SHUTDOWN_FULL                2      // also sweep every live object, running destructors
+
+/* Coroutine scheduler */
+#define CM_CORO_DEFAULT_STACK           (64 * 1024)
+#define CM_SCHED_NO_GUARD               0x01   // skip guard pages (without MADV_GUARD_INSTALL only the first 16384 stacks get one)
+
+/* Channel select operations */
+#define CM_CHAN_OP_SEND                 0
+#define CM_CHAN_OP_RECV                 1
+
+/* Event loop readiness flags */
+#define CM_IO_READ                      0x01
+#define CM_IO_WRITE                     0x02
+#define CM_IO_ERROR                     0x04
+#define CM_IO_HUP                       0x08
+
+/* Async I/O (io_uring with epoll fallback) */
+#define CM_AIO_BACKEND_URING            1
+#define CM_AIO_BACKEND_EPOLL            2
+#define CM_AIO_FORCE_EPOLL              0x01   // cm_aio_new flag
+#define CM_AIO_MORE                     0x01   // completion flag: multishot continues
+#define CM_AIO_NO_OFFSET                ((uint64_t)-1)
 
 /* ============================================================================
  * FORWARD DECLARATIONS
  * ============================================================================ */
 struct CMObject;
 struct CMArena;
+struct cm_arena_chunk;
 struct cm_string;
 struct cm_array;
 struct cm_map_entry;
 struct cm_map;
+struct cm_map_snapshot;
 struct String;
 struct Array;
 struct Map;
+struct cm_task_pool;
+struct cm_future;
+struct cm_sched;
+struct cm_channel;
+struct cm_loop;
+struct cm_loop_timer;
+struct cm_aio;
+struct cm_timer;
+struct cm_timer_wheel;
+struct cm_pool;
+struct cm_reader;
+struct cm_json;
+struct cm_json_member;
+struct cm_btree;
+struct cm_cache;
 
 /* ============================================================================
  * TYPE DEFINITIONS (typedefs first)
@@ -91,6 +198,25 @@ typedef struct cm_map cm_map_t;
 typedef struct String String;
 typedef struct Array Array;
 typedef struct Map Map;
+typedef struct cm_task_pool cm_task_pool_t;
+typedef struct cm_future cm_future_t;
+typedef struct cm_sched cm_sched_t;
+typedef struct cm_channel cm_channel_t;
+typedef struct cm_loop cm_loop_t;
+typedef struct cm_loop_timer cm_loop_timer_t;
+typedef void (*cm_loop_cb_t)(cm_loop_t* loop, int fd, int events, void* arg);
+typedef struct cm_aio cm_aio_t;
+typedef struct cm_timer cm_timer_t;
+typedef struct cm_timer_wheel cm_timer_wheel_t;
+typedef void (*cm_timer_cb_t)(cm_timer_t* timer, void* arg);
+typedef struct cm_pool cm_pool_t;
+typedef struct cm_reader cm_reader_t;
+typedef struct cm_json cm_json_t;
+typedef struct cm_json_member cm_json_member_t;
+typedef struct cm_btree cm_btree_t;
+typedef struct cm_cache cm_cache_t;
+// res: bytes / accepted fd, or -errno. buf: data for reads (provided buffer for multishot recv)
+typedef void (*cm_aio_cb_t)(cm_aio_t* aio, int res, void* buf, int flags, void* arg);
 
 /* ============================================================================
  * STRUCTURE DEFINITIONS - بالترتيب الصحيح
@@ -99,18 +225,23 @@ typedef struct Map Map;
 // 1. GC Object Structure
 struct CMObject {
     void* ptr;
+    uint64_t magic;                 // CM_GC_MAGIC while live; cm_free checks it with ptr
     size_t size;
     const char* type;
     const char* file;
     int line;
     time_t alloc_time;
-    int ref_count;
+    int64_t refs;                   // shared count and CM_RC_* flags, atomic
+    int biased_refs;                // the owner thread's count (cm_gc_bias_thread)
+    void* owner;                    // biasing thread, NULL once the counts are merged
+    struct CMObject* queue_next;    // on the owner's merge queue
     int marked;
-    uint32_t hash;
+    uint32_t hash;                  // heap profiler site + 1 when sampled
     struct CMObject* next;
     struct CMObject* prev;
     void (*destructor)(void*);
     void (*mark_cb)(void*);
+    size_t sample_bytes;            // heap profiler weight, 0 when not sampled
 };
 
 // 2. Arena Structure
@@ -118,9 +249,10 @@ struct CMArena {
     void* block;
     size_t block_size;
     size_t offset;
-    struct CMArena* next;
+    struct CMArena* next;           // arena this one shadows while pushed
     const char* name;
     size_t peak_usage;
+    struct cm_arena_chunk* chain;   // extra blocks from cm_arena_alloc_grow, newest first
 };
 
 // 3. String Structure
@@ -161,13 +293,28 @@ struct cm_map {
     int size;
     float load_factor;
     int growth_factor;
+    struct cm_map_snapshot* snapshot;  // set by cm_map_open_snapshot: read-only, mmap'd
 };
 
 // 7. OOP String Class
 struct String {
+    const struct StringClass* cls;  // shared method table: s->cls->upper(s) or vsend(s, upper)
     char* data;
     int length;
     int capacity;
+#ifdef CM_INSTANCE_METHODS
+    // Legacy per-instance copies of the class table, so s->upper(s) still works.
+    // Opt in by building CM.c and your code with -DCM_INSTANCE_METHODS.
+    struct String* (*concat)(struct String* self, const char* other);
+    struct String* (*upper)(struct String* self);
+    struct String* (*lower)(struct String* self);
+    void (*print)(struct String* self);
+    int (*length_func)(struct String* self);
+    char (*charAt)(struct String* self, int index);
+#endif
+};
+
+struct StringClass {
     struct String* (*concat)(struct String* self, const char* other);
     struct String* (*upper)(struct String* self);
     struct String* (*lower)(struct String* self);
@@ -178,10 +325,20 @@ struct String {
 
 // 8. OOP Array Class
 struct Array {
+    const struct ArrayClass* cls;
     void* data;
     int element_size;
     int length;
     int capacity;
+#ifdef CM_INSTANCE_METHODS
+    struct Array* (*push)(struct Array* self, void* value);
+    void* (*pop)(struct Array* self);
+    void* (*get)(struct Array* self, int index);
+    int (*size)(struct Array* self);
+#endif
+};
+
+struct ArrayClass {
     struct Array* (*push)(struct Array* self, void* value);
     void* (*pop)(struct Array* self);
     void* (*get)(struct Array* self, int index);
@@ -190,46 +347,285 @@ struct Array {
 
 // 9. OOP Map Class
 struct Map {
+    const struct MapClass* cls;
     void* map_data;
     int size;
+#ifdef CM_INSTANCE_METHODS
+    struct Map* (*set)(struct Map* self, const char* key, void* value);
+    void* (*get)(struct Map* self, const char* key);
+    int (*has)(struct Map* self, const char* key);
+    int (*size_func)(struct Map* self);
+#endif
+};
+
+struct MapClass {
     struct Map* (*set)(struct Map* self, const char* key, void* value);
     void* (*get)(struct Map* self, const char* key);
     int (*has)(struct Map* self, const char* key);
     int (*size_func)(struct Map* self);
 };
 
+// 10. Channel select case
+typedef struct {
+    cm_channel_t* channel;
+    int op;             // CM_CHAN_OP_SEND / CM_CHAN_OP_RECV
+    void* data;         // element to send, or where to receive into
+    int status;         // per-case result of the last attempt
+} cm_chan_op_t;
+
+// 11. Timer (embed in your own structs, no allocation per timer; fields are private)
+struct cm_timer {
+    struct cm_timer* next;
+    struct cm_timer** pprev;    // NULL when not queued
+    cm_timer_wheel_t* wheel;
+    uint64_t expires;           // monotonic ms
+    unsigned bucket;
+    cm_timer_cb_t cb;
+    void* arg;
+};
+
+// 12. Runtime configuration (start from CM_RUNTIME_DEFAULTS)
+typedef struct {
+    int log_level;              // -1: keep CM_LOG_LEVEL
+    int log_fd;                 // -1: stderr
+    unsigned int seed;          // cm_random_* seed; 0: seed from the clock on first use
+    int exit_mode;              // CM_SHUTDOWN_* run by the at-exit hook
+    int banner;                 // print the version banner
+    int leak_report;            // CM_SHUTDOWN_FULL: report objects still alive
+} cm_runtime_config_t;
+
+#define CM_RUNTIME_DEFAULTS { -1, -1, 0, CM_SHUTDOWN_NORMAL, 0, 0 }
+
+// 13. Runtime metrics snapshot (cm_runtime_metrics)
+typedef struct {
+    size_t allocations;
+    size_t frees;
+    size_t live_objects;
+    size_t live_bytes;
+    size_t peak_bytes;
+
+    size_t collections;
+    size_t gc_last_freed;                       // bytes freed by the last collection
+    uint64_t gc_pause_total_ns;
+    uint64_t gc_pause_max_ns;
+    uint64_t gc_pause_hist[CM_METRICS_PAUSE_BUCKETS];  // [i]: pauses under 2^i us; last: the rest
+
+    size_t arenas_live;
+    size_t arena_bytes_reserved;                // block sizes of live arenas
+    size_t arena_bytes_used;                    // peak usage of destroyed arenas, summed
+    size_t arena_fallbacks;                     // cm_alloc calls the current arena could not serve
+
+    size_t map_lookups;                         // cm_map_get/cm_map_set key searches
+    size_t map_probes;                          // chain entries visited by those searches
+    size_t map_probe_max;
+
+    size_t log_dropped;
+} cm_metrics_t;
+
+// 14. Trace span (declared by CM_TRACE_SCOPE; start is 0 while tracing is off)
+typedef struct {
+    const char* name;
+    uint64_t start;
+} cm_trace_span_t;
+
+// 15. Error state, one per thread (and per coroutine while it runs).
+// message is either caller-owned static text or points into text; a pending
+// CM_THROWF format is only rendered when the message is first read.
+typedef struct {
+    int code;
+    const char* message;
+    const char* fmt;
+    int nargs;
+    uintptr_t args[CM_LOG_MAX_ARGS];
+    char* text;                   // CM_ERROR_MESSAGE_MAX bytes, allocated on first copy
+} cm_error_t;
+
+// 16. Cleanup stack entry. Entries live in the frame that pushed them and form
+// a per-thread LIFO; CM_THROW runs them down to the innermost CM_TRY, which
+// sits on the same stack as an entry with fn == NULL and arg = its jmp_buf.
+typedef struct cm_cleanup {
+    void (*fn)(void*);
+    void* arg;
+    struct cm_cleanup* prev;
+} cm_cleanup_t;
+
+// 17. xoshiro256** generator state; seed with cm_rng_seed, never all zero
+typedef struct {
+    uint64_t s[4];
+} cm_rng_t;
+
+// 18. Non-owning string slice: not NUL-terminated, valid while its source is
+typedef struct {
+    const char* data;
+    size_t length;
+} cm_strview_t;
+
+// 19. Object pool occupancy (cm_pool_stats)
+typedef struct {
+    size_t obj_size;                 // after rounding up for alignment
+    size_t chunks;
+    size_t capacity;                 // objects carved so far
+    size_t in_use;
+    size_t free_shared;              // on the pool's own list; the rest sit in thread caches
+    size_t allocs;
+    size_t frees;
+} cm_pool_stats_t;
+
+// 20. JSON value (cm_json_parse). Nodes live in the parse arena; strings without
+// escapes point into the input text, so both must outlive the tree.
+struct cm_json {
+    int type;                        // CM_JSON_*
+    size_t count;                    // array elements, object members or string length
+    union {
+        int boolean;
+        double number;
+        cm_strview_t string;
+        cm_json_t** items;           // CM_JSON_ARRAY
+        cm_json_member_t* members;   // CM_JSON_OBJECT, in document order
+    } as;
+};
+
+// 21. JSON object member
+struct cm_json_member {
+    cm_strview_t key;
+    cm_json_t* value;
+};
+
+// 22. B+tree cursor: position it with cm_btree_first / _lower_* / _upper_*,
+// then each cm_btree_next fills in the key and value it steps over
+typedef struct {
+    const cm_btree_t* tree;
+    void* leaf;
+    int pos;
+    int64_t key_int;                 // CM_BTREE_INT trees
+    const char* key_str;             // CM_BTREE_STRING trees; owned by the tree
+    void* value;
+} cm_btree_iter_t;
+
+// 23. Cache occupancy and counters (cm_cache_stats), summed over shards
+typedef struct {
+    size_t entries;
+    size_t bytes;                    // values + keys + per-entry overhead
+    size_t max_bytes;
+    size_t shards;
+    size_t hits;
+    size_t misses;                   // includes lookups that found an expired entry
+    size_t evictions;                // dropped for space while still live
+    size_t expirations;              // dropped because their TTL ran out
+} cm_cache_stats_t;
+
 /* ============================================================================
  * MACROS
  * ============================================================================ */
+// The scope entry pops and destroys the arena on any exit, including CM_THROW;
+// _once ends the outer loop, the inner one only exposes the arena as _a
 #define CM_WITH_ARENA(size) \
-    for (CMArena* _a __attribute__((cleanup(cm_arena_cleanup))) = cm_arena_create(size); \
-         _a; _a = NULL) \
-        for (int _i = (cm_arena_push(_a), 0); _i < 1; _i++)
+    for (cm_cleanup_t _scope __attribute__((cleanup(cm_cleanup_leave))) = \
+             { NULL, cm_arena_create(size), NULL }, \
+         *_once = cm_arena_scope(&_scope); _once; _once = NULL) \
+        for (CMArena* _a = (CMArena*)_scope.arg; _a; _a = NULL)
 
-// في CM.h
-extern __thread jmp_buf* cm_exception_buffer;  // Thread-local storage
+#define CM_CAT_(a, b) a##b
+#define CM_CAT(a, b) CM_CAT_(a, b)
 
-#define CM_TRY() \
-    jmp_buf __cm_buf; \
-    jmp_buf* __old = cm_exception_buffer; \
-    cm_exception_buffer = &__cm_buf; \
-    if (setjmp(__cm_buf) == 0)
+// The try frame is popped by CM_CATCH when the body finishes, by the throw
+// itself, or by its cleanup attribute when break, continue, return or goto
+// leave the enclosing block. The body is a plain if-statement body, so
+// break/continue act on the surrounding loop. CM_CATCH is required.
+#define CM_TRY() CM_TRY_(CM_CAT(__cm_buf_, __COUNTER__), CM_CAT(__cm_try_, __COUNTER__))
+#define CM_TRY_(buf, frame) \
+    jmp_buf buf; \
+    cm_cleanup_t frame __attribute__((cleanup(cm_try_leave))) = { NULL, NULL, NULL }; \
+    if (setjmp(buf) == 0) \
+        if (cm_cleanup_push(&frame, NULL, &buf))
 
 #define CM_CATCH() \
-    else { cm_exception_buffer = __old; }
+    ; if (cm_try_end())
+
+// Runs fn(arg) when the enclosing block exits, or when CM_THROW unwinds past it
+#define CM_DEFER(fn, arg) CM_DEFER_(CM_CAT(__cm_defer_, __COUNTER__), fn, arg)
+#define CM_DEFER_(name, fn, arg) \
+    cm_cleanup_t name __attribute__((cleanup(cm_cleanup_leave))); \
+    cm_cleanup_push(&name, (fn), (arg))
 
+// Copies message into the thread's own error state, so a stack buffer is fine
 #define CM_THROW(error, message) \
     do { \
-        cm_last_error = error; \
-        strncpy(cm_error_message, message, sizeof(cm_error_message) - 1); \
-        if (cm_exception_buffer) { \
-            longjmp(*cm_exception_buffer, error); \
-        } else { \
-            fprintf(stderr, "FATAL: Uncaught exception: %s\n", message); \
-            exit(error); \
+        cm_error_set(error, message); \
+        cm_error_throw(error); \
+    } while(0)
+
+// Fast path: message must have static storage; only the pointer is stored
+#define CM_THROW_STATIC(error, message) \
+    do { \
+        cm_error_set_static(error, message); \
+        cm_error_throw(error); \
+    } while(0)
+
+// Captures the format and up to CM_LOG_MAX_ARGS word-sized args like CM_LOGF;
+// the message is formatted only if someone reads it. %s args must outlive the catch.
+#define CM_THROWF(error, ...) \
+    do { \
+        const uintptr_t __cm_eargs[] = { CM_LOG_ARGS_(CM_LOG_NARGS(__VA_ARGS__), __VA_ARGS__) }; \
+        cm_error_set_deferred(error, CM_LOG_FMT(__VA_ARGS__), __cm_eargs + 1, \
+                              (int)(sizeof(__cm_eargs) / sizeof(__cm_eargs[0])) - 1); \
+        cm_error_throw(error); \
+    } while(0)
+
+// Level check happens at compile time first, then against the runtime level;
+// arguments are not evaluated when the record is filtered out
+#define CM_LOG(level, ...) \
+    do { \
+        if ((level) <= CM_LOG_LEVEL && cm_log_enabled(level)) cm_log(level, __VA_ARGS__); \
+    } while(0)
+
+// Deferred formatting: the hot path only copies the format pointer and up to
+// CM_LOG_MAX_ARGS integer/pointer args; the flusher thread runs the printf.
+// Use %ld/%lu/%lx/%p conversions, and %s only for strings that outlive the flush.
+// The format travels as the first array element so a call with no args still
+// leaves a non-empty array (ISO C has no empty __VA_ARGS__); it is skipped below.
+#define CM_LOG_NARGS_(_1, _2, _3, _4, _5, _6, _7, n, ...) n
+#define CM_LOG_NARGS(...) CM_LOG_NARGS_(__VA_ARGS__, 7, 6, 5, 4, 3, 2, 1, 0)
+#define CM_LOG_FMT_(fmt, ...) fmt
+#define CM_LOG_FMT(...) CM_LOG_FMT_(__VA_ARGS__, 0)
+#define CM_LOG_U(x) ((uintptr_t)(x))
+#define CM_LOG_ARGS_1(a) CM_LOG_U(a)
+#define CM_LOG_ARGS_2(a, ...) CM_LOG_U(a), CM_LOG_ARGS_1(__VA_ARGS__)
+#define CM_LOG_ARGS_3(a, ...) CM_LOG_U(a), CM_LOG_ARGS_2(__VA_ARGS__)
+#define CM_LOG_ARGS_4(a, ...) CM_LOG_U(a), CM_LOG_ARGS_3(__VA_ARGS__)
+#define CM_LOG_ARGS_5(a, ...) CM_LOG_U(a), CM_LOG_ARGS_4(__VA_ARGS__)
+#define CM_LOG_ARGS_6(a, ...) CM_LOG_U(a), CM_LOG_ARGS_5(__VA_ARGS__)
+#define CM_LOG_ARGS_7(a, ...) CM_LOG_U(a), CM_LOG_ARGS_6(__VA_ARGS__)
+#define CM_LOG_ARGS__(n, ...) CM_LOG_ARGS_##n(__VA_ARGS__)
+#define CM_LOG_ARGS_(n, ...) CM_LOG_ARGS__(n, __VA_ARGS__)
+
+#define CM_LOGF(level, ...) \
+    do { \
+        if ((level) <= CM_LOG_LEVEL && cm_log_enabled(level)) { \
+            const uintptr_t __cm_args[] = { CM_LOG_ARGS_(CM_LOG_NARGS(__VA_ARGS__), __VA_ARGS__) }; \
+            cm_log_deferred(level, CM_LOG_FMT(__VA_ARGS__), __cm_args + 1, \
+                            (int)(sizeof(__cm_args) / sizeof(__cm_args[0])) - 1); \
         } \
     } while(0)
 
+// Records a complete event from here to the end of the enclosing block.
+// While tracing is off the cost is one relaxed load and one call at scope exit.
+extern int cm_trace_active;
+#if CM_TRACE
+#define CM_TRACE_CAT_(a, b) a##b
+#define CM_TRACE_CAT(a, b) CM_TRACE_CAT_(a, b)
+#define CM_TRACE_SCOPE(name) \
+    cm_trace_span_t CM_TRACE_CAT(__cm_span_, __LINE__) __attribute__((cleanup(cm_trace_end))) = \
+        { (name), __builtin_expect(__atomic_load_n(&cm_trace_active, __ATOMIC_RELAXED), 0) ? cm_trace_now() : 0 }
+#define CM_TRACE_INSTANT(name) \
+    do { \
+        if (__builtin_expect(__atomic_load_n(&cm_trace_active, __ATOMIC_RELAXED), 0)) cm_trace_instant(name); \
+    } while(0)
+#else
+#define CM_TRACE_SCOPE(name) do { } while(0)
+#define CM_TRACE_INSTANT(name) do { } while(0)
+#endif
+
 #define CM_ABOUT() \
     do { \
         printf("\n"); \
@@ -266,8 +662,13 @@ extern __thread jmp_buf* cm_exception_buffer;  // Thread-local storage
 #define CM_MAP_GET_STRING(m, k) (*(char**)cm_map_get(m, k))
 #define CM_MAP_HAS(m, k) cm_map_has(m, k)
 
+/* String view macros: CM_SV("literal"), printf("%.*s", CM_SV_ARG(v)) */
+#define CM_STRVIEW_NPOS ((size_t)-1)
+#define CM_SV(lit) ((cm_strview_t){ (lit), sizeof(lit) - 1 })
+#define CM_SV_ARG(v) (int)(v).length, (v).data
+
 /* Random macros */
-#define CM_RAND_INT(min, max) ((min) + rand() % ((max) - (min) + 1))
+#define CM_RAND_INT(min, max) ((int)cm_random_range((min), (max)))
 
 /* Debug macros */
 #define CM_REPORT() cm_gc_stats()
@@ -291,21 +692,51 @@ extern __thread jmp_buf* cm_exception_buffer;  // Thread-local storage
 #define method(return_type, name, ...) \
     return_type (*name)(void* self, __VA_ARGS__)
 
+// Where send() looks a method up: the shared class table for String / Array /
+// Map, the object itself for cmlass types with per-instance members
+#define CM_SEND_TABLE(obj) _Generic((obj), \
+    String*: ((String*)(void*)(obj))->cls, \
+    Array*: ((Array*)(void*)(obj))->cls, \
+    Map*: ((Map*)(void*)(obj))->cls, \
+    default: (obj))
+
 // ماكرو لنداء الدوال - بيشتغل مع وبدون parameters
 #define send(obj, method, ...) \
-    ((obj)->method ? (obj)->method(obj, ##__VA_ARGS__) : (void)0)
+    (CM_SEND_TABLE(obj)->method ? CM_SEND_TABLE(obj)->method(obj, ##__VA_ARGS__) : (void)0)
+
+// Built-in String / Array / Map objects keep their methods in one shared class table;
+// a NULL object or table yields a zero of the method's return type instead of crashing
+#define vsend(obj, method, ...) \
+    ((obj) && (obj)->cls && (obj)->cls->method \
+        ? (obj)->cls->method((obj), ##__VA_ARGS__) \
+        : (__typeof__((obj)->cls->method((obj), ##__VA_ARGS__)))0)
 
 /* ============================================================================
  * FUNCTION DECLARATIONS
  * ============================================================================ */
 
+/* Runtime Functions (optional: every subsystem also starts lazily on first use) */
+int cm_runtime_init(const cm_runtime_config_t* config);    // NULL: defaults
+void cm_runtime_shutdown(int mode);                         // CM_SHUTDOWN_*; the at-exit hook then does nothing
+void cm_runtime_metrics(cm_metrics_t* m);                   // lock-free snapshot
+int cm_runtime_metrics_write(int fd, int format);           // CM_METRICS_PROMETHEUS / CM_METRICS_JSON
+
+/* Heap Profiler Functions (samples GC allocations by bytes; arena allocations are not seen) */
+int cm_heap_profile_start(size_t sample_bytes);             // mean bytes between samples; 0: 512 KiB
+void cm_heap_profile_stop(void);
+int cm_heap_profile_write(int fd, int what);                // folded stacks: "file:line;type value"
+int cm_heap_profile_signal(int signo, int fd);              // dump CM_HEAP_INUSE_BYTES to fd on signo
+
 /* GC Functions */
 void cm_gc_init(void);
 void cm_gc_collect(void);
 void cm_gc_stats(void);
 void* cm_alloc(size_t size, const char* type, const char* file, int line);
-void cm_free(void* ptr);
-void cm_retain(void* ptr);
+void cm_free(void* ptr);                            // drops a reference; O(1), lock-free until the last
+void cm_retain(void* ptr);                          // lock-free
+void cm_set_destructor(void* ptr, void (*destructor)(void*));
+int cm_gc_bias_thread(int enable);                  // this thread's new objects count its refs without atomics
+size_t cm_gc_drain(void);                           // merge biased objects other threads released
 
 /* Arena Functions */
 CMArena* cm_arena_create(size_t size);
@@ -314,18 +745,66 @@ void cm_arena_push(CMArena* arena);
 void cm_arena_pop(void);
 // في CM.h - أضف هذا السطر مع الدوال التانية
 void cm_arena_cleanup(void* ptr);
+void cm_arena_release(void* arena);                 // pop if current, then destroy
+cm_cleanup_t* cm_arena_scope(cm_cleanup_t* scope);  // CM_WITH_ARENA helper
+void* cm_arena_alloc(CMArena* arena, size_t size);  // NULL when full; never falls back to the GC
+void* cm_arena_alloc_grow(CMArena* arena, size_t size);  // chains another block when full; freed with the arena
 
+/* Object Pool Functions (fixed-size objects, outside the GC) */
+cm_pool_t* cm_pool_create(size_t obj_size, size_t per_chunk);
+void cm_pool_set_hooks(cm_pool_t* pool, void (*ctor)(void*), void (*dtor)(void*));
+void* cm_pool_alloc(cm_pool_t* pool);
+void cm_pool_free(cm_pool_t* pool, void* obj);
+void cm_pool_stats(cm_pool_t* pool, cm_pool_stats_t* out);
+void cm_pool_destroy(cm_pool_t* pool);
 
 /* String Functions */
 cm_string_t* cm_string_new(const char* initial);
 void cm_string_free(cm_string_t* s);
 size_t cm_string_length(cm_string_t* s);
 cm_string_t* cm_string_format(const char* format, ...);
+cm_string_t* cm_string_vformat(const char* format, va_list args);
+int cm_string_reserve(cm_string_t* s, size_t capacity);
+int cm_string_append(cm_string_t* s, const char* text);
+int cm_string_appendf(cm_string_t* s, const char* format, ...);
+int cm_string_vappendf(cm_string_t* s, const char* format, va_list args);
+cm_string_t* cm_string_wrap(const char* data, size_t length);  // borrow if data[length] is NUL, else copy
+cm_string_t* cm_string_copy(cm_string_t* s);                   // shares shared text; never modifies s
+void cm_string_retain(cm_string_t* s);
+
+/* String View Functions (never allocate, except cm_strview_to_string) */
+cm_strview_t cm_strview(const char* cstr);
+cm_strview_t cm_strview_of(const cm_string_t* s);
+cm_strview_t cm_strview_sub(cm_strview_t v, size_t pos, size_t len);
+int cm_strview_eq(cm_strview_t a, cm_strview_t b);
+int cm_strview_cmp(cm_strview_t a, cm_strview_t b);
+int cm_strview_starts_with(cm_strview_t v, cm_strview_t prefix);
+size_t cm_strview_find(cm_strview_t v, cm_strview_t needle);   // CM_STRVIEW_NPOS if absent
+size_t cm_strview_find_char(cm_strview_t v, char c);
+cm_strview_t cm_strview_trim(cm_strview_t v);
+int cm_strview_split(cm_strview_t* rest, char sep, cm_strview_t* token);
+int cm_strview_split_any(cm_strview_t* rest, const char* seps, cm_strview_t* token);
+int cm_strview_to_int(cm_strview_t v, int64_t* out);
+cm_string_t* cm_strview_to_string(cm_strview_t v);
 void cm_string_set(cm_string_t* s, const char* value);
 void cm_string_upper(cm_string_t* s);
 void cm_string_lower(cm_string_t* s);
 String* cm_input(const char* prompt);
 
+/* Line Reader Functions (views are valid until the next cm_reader_next_line) */
+cm_reader_t* cm_reader_open(const char* path);      // mmap regular files, buffer everything else
+cm_reader_t* cm_reader_from_fd(int fd, size_t buffer_size);   // fd is not closed by the reader
+int cm_reader_next_line(cm_reader_t* r, cm_strview_t* line);  // 1 line, 0 end of input, -1 error
+void cm_reader_close(cm_reader_t* r);
+
+/* JSON Functions (arena NULL = the current arena) */
+cm_json_t* cm_json_parse(CMArena* arena, const char* text, size_t length);
+cm_json_t* cm_json_get(const cm_json_t* object, const char* key);
+cm_json_t* cm_json_at(const cm_json_t* array, size_t i);
+cm_map_t* cm_json_to_map(const cm_json_t* object);       // values are cm_json_t*
+cm_array_t* cm_json_to_array(const cm_json_t* array);    // elements are cm_json_t*
+cm_string_t* cm_json_stringify(const cm_json_t* value);
+
 /* Array Functions */
 cm_array_t* cm_array_new(size_t element_size, size_t initial_capacity);
 void cm_array_free(cm_array_t* arr);
@@ -341,12 +820,168 @@ void cm_map_set(cm_map_t* map, const char* key, const void* value, size_t value_
 void* cm_map_get(cm_map_t* map, const char* key);
 int cm_map_has(cm_map_t* map, const char* key);
 size_t cm_map_size(cm_map_t* map);
+int cm_map_save_snapshot(cm_map_t* map, const char* path);
+cm_map_t* cm_map_open_snapshot(const char* path);   // zero-copy, read-only; free with cm_map_free
+
+/* B+tree Functions (ordered; values are caller-owned pointers) */
+cm_btree_t* cm_btree_new(int key_type);
+void cm_btree_free(cm_btree_t* t);
+size_t cm_btree_size(cm_btree_t* t);
+int cm_btree_put_int(cm_btree_t* t, int64_t key, void* value);
+int cm_btree_put_str(cm_btree_t* t, const char* key, void* value);
+void* cm_btree_get_int(cm_btree_t* t, int64_t key);
+void* cm_btree_get_str(cm_btree_t* t, const char* key);
+int cm_btree_remove_int(cm_btree_t* t, int64_t key);
+int cm_btree_remove_str(cm_btree_t* t, const char* key);
+int cm_btree_load(cm_btree_t* t, const void* keys, void* const* values, size_t n);   // sorted, unique
+void cm_btree_first(cm_btree_t* t, cm_btree_iter_t* it);
+void cm_btree_lower_int(cm_btree_t* t, int64_t key, cm_btree_iter_t* it);       // first key >= key
+void cm_btree_upper_int(cm_btree_t* t, int64_t key, cm_btree_iter_t* it);       // first key > key
+void cm_btree_lower_str(cm_btree_t* t, const char* key, cm_btree_iter_t* it);
+void cm_btree_upper_str(cm_btree_t* t, const char* key, cm_btree_iter_t* it);
+int cm_btree_next(cm_btree_iter_t* it);             // 1 and the next entry, 0 at the end
+
+/* Cache Functions (bounded, sharded LRU with TTLs; values are copied in and out) */
+cm_cache_t* cm_cache_new(size_t max_bytes, int64_t default_ttl_ms);   // ttl 0: no expiry
+void cm_cache_free(cm_cache_t* c);
+int cm_cache_set(cm_cache_t* c, const char* key, const void* value, size_t value_size);
+int cm_cache_set_ttl(cm_cache_t* c, const char* key, const void* value, size_t value_size, int64_t ttl_ms);
+int cm_cache_get(cm_cache_t* c, const char* key, void* out, size_t* size);   // *size: room in, value size out
+int cm_cache_remove(cm_cache_t* c, const char* key);
+size_t cm_cache_purge(cm_cache_t* c);              // drop expired entries now
+void cm_cache_clear(cm_cache_t* c);
+void cm_cache_stats(cm_cache_t* c, cm_cache_stats_t* out);
+
+/* Task Pool Functions */
+cm_task_pool_t* cm_task_pool_create(int threads);   // threads <= 0: one per CPU
+void cm_task_pool_destroy(cm_task_pool_t* pool);    // drains queued tasks, joins workers
+cm_task_pool_t* cm_task_pool_default(void);
+int cm_task_pool_submit(cm_task_pool_t* pool, void (*fn)(void*), void* arg);
+size_t cm_task_pool_pending(cm_task_pool_t* pool);
+
+/* Future Functions */
+cm_future_t* cm_future_new(void);
+void cm_future_release(cm_future_t* f);
+int cm_future_resolve(cm_future_t* f, void* value);
+int cm_future_reject(cm_future_t* f, int error);
+int cm_future_cancel(cm_future_t* f);                 // also cancels then / when_* inputs
+int cm_future_on_complete(cm_future_t* f, void (*fn)(cm_future_t*, void*), void* arg);
+int cm_future_state(cm_future_t* f);
+int cm_future_error(cm_future_t* f);
+int cm_future_index(cm_future_t* f);
+int cm_future_wait(cm_future_t* f);
+void* cm_future_get(cm_future_t* f);
+cm_future_t* cm_async(cm_task_pool_t* pool, void* (*fn)(void*), void* arg);
+int cm_task_cancelled(void);
+cm_future_t* cm_future_then(cm_future_t* f, void* (*fn)(void* value, void* arg), void* arg);
+cm_future_t* cm_future_then_async(cm_future_t* f, cm_task_pool_t* pool,
+                                  void* (*fn)(void* value, void* arg), void* arg);
+cm_future_t* cm_future_when_all(cm_future_t** futures, size_t count);
+cm_future_t* cm_future_when_any(cm_future_t** futures, size_t count);
+int cm_future_timeout(cm_future_t* f, long timeout_ms);  // reject with CM_ERROR_TIMEOUT if still pending
+
+/* Timer Wheel Functions (1 ms ticks, O(1) start/stop) */
+cm_timer_wheel_t* cm_timer_wheel_new(void);
+void cm_timer_wheel_free(cm_timer_wheel_t* wheel);  // pending timers are dropped, not fired
+cm_timer_wheel_t* cm_timer_wheel_default(void);     // driven by a shared timer thread
+size_t cm_timer_wheel_advance(cm_timer_wheel_t* wheel);  // fire everything due, returns count
+long cm_timer_wheel_next(cm_timer_wheel_t* wheel);  // ms until the next tick worth waking for, -1 if empty
+size_t cm_timer_wheel_count(cm_timer_wheel_t* wheel);
+void cm_timer_init(cm_timer_t* timer, cm_timer_cb_t cb, void* arg);
+int cm_timer_start(cm_timer_wheel_t* wheel, cm_timer_t* timer, long timeout_ms);  // re-arms if pending
+int cm_timer_stop(cm_timer_t* timer);              // 1 if it was pending; waits out a running callback
+int cm_timer_pending(cm_timer_t* timer);
+
+/* Coroutine Functions */
+cm_sched_t* cm_sched_create(int threads, size_t stack_size, int flags);
+void cm_sched_destroy(cm_sched_t* sched);           // waits for live coroutines
+void cm_sched_wait_idle(cm_sched_t* sched);
+cm_sched_t* cm_sched_default(void);
+cm_future_t* cm_coro_spawn(cm_sched_t* sched, void* (*fn)(void*), void* arg);
+int cm_coro_active(void);
+void cm_coro_yield(void);
+void* cm_coro_await(cm_future_t* f);                // blocks the thread outside a coroutine
+void cm_coro_sleep(long ms);                        // parks on the worker's timer wheel
+
+/* Channel Functions (timeout_ms: -1 = forever, 0 = non-blocking) */
+cm_channel_t* cm_channel_new(size_t element_size, size_t capacity);
+void cm_channel_free(cm_channel_t* ch);
+int cm_channel_send(cm_channel_t* ch, const void* value);
+int cm_channel_recv(cm_channel_t* ch, void* out);
+int cm_channel_try_send(cm_channel_t* ch, const void* value);
+int cm_channel_try_recv(cm_channel_t* ch, void* out);
+int cm_channel_send_timed(cm_channel_t* ch, const void* value, long timeout_ms);
+int cm_channel_recv_timed(cm_channel_t* ch, void* out, long timeout_ms);
+size_t cm_channel_send_batch(cm_channel_t* ch, const void* values, size_t count, long timeout_ms);
+size_t cm_channel_recv_batch(cm_channel_t* ch, void* out, size_t max, long timeout_ms);
+int cm_channel_select(cm_chan_op_t* ops, size_t count, long timeout_ms);
+void cm_channel_close(cm_channel_t* ch);
+int cm_channel_is_closed(cm_channel_t* ch);
+size_t cm_channel_length(cm_channel_t* ch);
+size_t cm_channel_capacity(cm_channel_t* ch);
+
+/* Event Loop Functions (Linux epoll) */
+cm_loop_t* cm_loop_new(void);
+void cm_loop_free(cm_loop_t* loop);
+int cm_loop_run(cm_loop_t* loop);                   // until cm_loop_stop
+int cm_loop_run_once(cm_loop_t* loop, int timeout_ms);
+void cm_loop_stop(cm_loop_t* loop);                 // thread-safe
+int cm_loop_post(cm_loop_t* loop, void (*fn)(void*), void* arg);  // run fn on the loop thread
+int cm_loop_watch(cm_loop_t* loop, int fd, int events, cm_loop_cb_t cb, void* arg);
+int cm_loop_unwatch(cm_loop_t* loop, int fd);
+cm_future_t* cm_loop_ready(cm_loop_t* loop, int fd, int events);  // one-shot, resolves with events
+cm_future_t* cm_loop_ready_timed(cm_loop_t* loop, int fd, int events, long timeout_ms);
+cm_loop_timer_t* cm_loop_timer_start(cm_loop_t* loop, long after_ms, long repeat_ms,
+                                     void (*cb)(cm_loop_t*, cm_loop_timer_t*, void*), void* arg);
+void cm_loop_timer_stop(cm_loop_t* loop, cm_loop_timer_t* timer);  // loop thread only
+cm_timer_wheel_t* cm_loop_wheel(cm_loop_t* loop);   // timers here fire on the loop thread
+ssize_t cm_loop_read(cm_loop_t* loop, int fd, void* buf, size_t len);
+ssize_t cm_loop_write(cm_loop_t* loop, int fd, const void* buf, size_t len);
+int cm_loop_accept(cm_loop_t* loop, int listen_fd);
+int cm_set_nonblocking(int fd);
+
+/* Async I/O Functions (Linux: io_uring, falls back to epoll) */
+cm_aio_t* cm_aio_new(unsigned entries, int flags);
+void cm_aio_free(cm_aio_t* aio);
+int cm_aio_backend(cm_aio_t* aio);
+int cm_aio_register_buffers(cm_aio_t* aio, CMArena* arena, size_t buf_size, unsigned count);
+int cm_aio_register_files(cm_aio_t* aio, const int* fds, unsigned count);
+void* cm_aio_buffer(cm_aio_t* aio, unsigned index);
+void cm_aio_buffer_release(cm_aio_t* aio, void* buf);   // hand a multishot recv buffer back
+int cm_aio_read(cm_aio_t* aio, int fd, void* buf, size_t len, uint64_t offset, cm_aio_cb_t cb, void* arg);
+int cm_aio_write(cm_aio_t* aio, int fd, const void* buf, size_t len, uint64_t offset, cm_aio_cb_t cb, void* arg);
+int cm_aio_recv(cm_aio_t* aio, int fd, void* buf, size_t len, cm_aio_cb_t cb, void* arg);
+int cm_aio_send(cm_aio_t* aio, int fd, const void* buf, size_t len, cm_aio_cb_t cb, void* arg);
+int cm_aio_accept_multishot(cm_aio_t* aio, int listen_fd, cm_aio_cb_t cb, void* arg);
+int cm_aio_recv_multishot(cm_aio_t* aio, int fd, cm_aio_cb_t cb, void* arg);
+int cm_aio_submit(cm_aio_t* aio);                     // one syscall for everything queued
+int cm_aio_run_once(cm_aio_t* aio, int timeout_ms);   // submit, wait, dispatch completions
 
 /* Utility Functions */
+// cm_random_* draw from a per-thread xoshiro256** stream. cm_random_seed makes
+// the calling thread's stream reproducible and hands other threads jumped-ahead,
+// non-overlapping streams of the same seed in the order they first draw.
 void cm_random_seed(unsigned int seed);
 void cm_random_string(char* buffer, size_t length);
+uint64_t cm_random_u64(void);
+int64_t cm_random_range(int64_t min, int64_t max);   // inclusive, unbiased
+double cm_random_double(void);                       // [0, 1)
+void cm_random_bytes(void* buffer, size_t length);
+cm_rng_t* cm_random_rng(void);                       // the calling thread's generator
+
+/* PRNG Functions (explicit state, for reproducible parallel streams) */
+void cm_rng_seed(cm_rng_t* rng, uint64_t seed);
+uint64_t cm_rng_next(cm_rng_t* rng);
+uint64_t cm_rng_bounded(cm_rng_t* rng, uint64_t bound);  // [0, bound), Lemire's method
+double cm_rng_double(cm_rng_t* rng);
+void cm_rng_jump(cm_rng_t* rng);         // advance 2^128 draws: one stream per thread
+void cm_rng_long_jump(cm_rng_t* rng);    // advance 2^192 draws: one stream per process
 
 /* OOP Class Functions */
+extern const struct StringClass String_class;
+extern const struct ArrayClass Array_class;
+extern const struct MapClass Map_class;
+
 String* String_new(const char* initial);
 void String_delete(String* self);
 String* string_concat(String* self, const char* other);
@@ -376,6 +1011,21 @@ const char* cm_error_get_message(void);
 int cm_error_get_last(void);
 void cm_error_clear(void);
 void cm_error_set(int error, const char* message);
+void cm_error_set_static(int error, const char* message);
+void cm_error_set_deferred(int error, const char* format, const uintptr_t* args, int nargs);
+cm_error_t* cm_error_current(void);
+void cm_error_throw(int error) __attribute__((noreturn));
+
+/* Cleanup Stack Functions (per thread; entries must be popped in LIFO order) */
+cm_cleanup_t* cm_cleanup_push(cm_cleanup_t* c, void (*fn)(void*), void* arg);
+void cm_cleanup_pop(cm_cleanup_t* c, int run);
+void cm_cleanup_leave(cm_cleanup_t* c);             // pop and run; for cleanup attributes
+int cm_try_end(void);                               // CM_CATCH helper: 1 if a throw landed here
+void cm_try_leave(cm_cleanup_t* frame);             // CM_TRY helper: pop the frame if still active
+
+// Before CM_TRY frames moved onto the cleanup stack, code could point this at
+// its own jmp_buf. It is still honoured, but only for throws no CM_TRY catches.
+extern __thread jmp_buf* cm_exception_buffer;
 /* ============================================================================
  * SAFE I/O FUNCTIONS - للاستخدام العام
  * ============================================================================ */
@@ -383,6 +1033,26 @@ void cm_printf(const char* format, ...);
 void cm_error(const char* format, ...);
 char* cm_gets(char* buffer, size_t size);
 
+/* Logging Functions (per-thread rings drained by a background flusher) */
+void cm_log(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void cm_logv(int level, const char* format, va_list args);
+void cm_log_deferred(int level, const char* format, const uintptr_t* args, int nargs);
+int cm_log_enabled(int level);
+void cm_log_set_level(int level);                   // runtime level, capped by CM_LOG_LEVEL
+int cm_log_get_level(void);
+void cm_log_set_fd(int fd);                         // default: stderr
+void cm_log_flush(void);                            // drain every ring now
+size_t cm_log_dropped(void);                        // warnings and below lost to full rings
+
+/* Tracing Functions (Chrome trace JSON, loads in chrome://tracing and Perfetto) */
+void cm_trace_start(void);
+void cm_trace_stop(void);
+int cm_trace_write(int fd);                         // events since the previous write, then frees them
+size_t cm_trace_dropped(void);                      // events lost to full thread buffers
+uint64_t cm_trace_now(void);
+void cm_trace_end(cm_trace_span_t* span);           // CM_TRACE_SCOPE cleanup
+void cm_trace_instant(const char* name);
+
 
 /* Short Macros */
 #define cmAlloc(sz) cm_alloc(sz, "object", __FILE__, __LINE__)
@@ -391,10 +1061,17 @@ char* cm_gets(char* buffer, size_t size);
 #define cmGC() cm_gc_collect()
 #define cmStats() cm_gc_stats()
 
+#define cmPool(type, n) cm_pool_create(sizeof(type), n)
+#define cmPoolGet(p) cm_pool_alloc(p)
+#define cmPoolPut(p, obj) cm_pool_free(p, obj)
+#define cmPoolFree(p) cm_pool_destroy(p)
+
 #define cmStr(s) cm_string_new(s)
 #define cmStrFree(s) cm_string_free(s)
 #define cmStrLen(s) cm_string_length(s)
 #define cmStrFmt(...) cm_string_format(__VA_ARGS__)
+#define cmStrAppendf(s, ...) cm_string_appendf(s, __VA_ARGS__)
+#define cmSv(lit) CM_SV(lit)
 #define cmStrUpper(s) cm_string_upper(s)
 #define cmStrLower(s) cm_string_lower(s)
 
@@ -412,21 +1089,56 @@ char* cm_gets(char* buffer, size_t size);
 #define cmMapGetInt(m, k) (*(int*)cm_map_get(m, k))
 #define cmMapGetStr(m, k) (*(char**)cm_map_get(m, k))
 #define cmMapHas(m, k) cm_map_has(m, k)
+#define cmMapSave(m, path) cm_map_save_snapshot(m, path)
+#define cmMapOpen(path) cm_map_open_snapshot(path)
+
+#define cmBtree(type) cm_btree_new(type)
+#define cmBtreeFree(t) cm_btree_free(t)
+#define cmBtreeEach(t, it) for (cm_btree_first(t, &(it)); cm_btree_next(&(it)); )
+
+#define cmCache(bytes, ttl_ms) cm_cache_new(bytes, ttl_ms)
+#define cmCacheFree(c) cm_cache_free(c)
 
 #define cmTry CM_TRY()
 #define cmCatch CM_CATCH()
+#define cmDefer(fn, arg) CM_DEFER(fn, arg)
 #define cmThrow(e, m) CM_THROW(e, m)
+#define cmThrowStatic(e, m) CM_THROW_STATIC(e, m)
+#define cmThrowf(e, ...) CM_THROWF(e, __VA_ARGS__)
 #define cmErrorMsg() cm_error_get_message()
 #define cmErrorCode() cm_error_get_last()
 
-#define cmRandInt(min, max) ((min) + rand() % ((max) - (min) + 1))
+#define cmLogError(...) CM_LOG(CM_LOG_ERROR, __VA_ARGS__)
+#define cmLogWarn(...) CM_LOG(CM_LOG_WARN, __VA_ARGS__)
+#define cmLogInfo(...) CM_LOG(CM_LOG_INFO, __VA_ARGS__)
+#define cmLogDebug(...) CM_LOG(CM_LOG_DEBUG, __VA_ARGS__)
+
+#define cmAsync(fn, arg) cm_async(NULL, fn, arg)
+#define cmThen(f, fn, arg) cm_future_then(f, fn, arg)
+#define cmAwait(f) cm_future_get(f)
+#define cmFutureFree(f) cm_future_release(f)
+
+#define cmGo(fn, arg) cm_coro_spawn(NULL, fn, arg)
+#define cmYield() cm_coro_yield()
+#define cmCoAwait(f) cm_coro_await(f)
+#define cmSleep(ms) cm_coro_sleep(ms)
+
+#define cmChan(type, cap) cm_channel_new(sizeof(type), cap)
+#define cmChanFree(ch) cm_channel_free(ch)
+#define cmChanSend(ch, type, v) do { type __tmp = (v); cm_channel_send(ch, &__tmp); } while(0)
+#define cmChanRecv(ch, ptr) cm_channel_recv(ch, ptr)
+
+#define cmRandInt(min, max) ((int)cm_random_range((min), (max)))
 #define cmRandStr(buf, len) cm_random_string(buf, len)
+#define cmRandBytes(buf, len) cm_random_bytes(buf, len)
+#define cmRandDouble() cm_random_double()
 
 /* ============================================================================
  * GLOBAL VARIABLES DECLARATIONS
  * ============================================================================ */
-extern int cm_last_error;
-extern char cm_error_message[1024];
+// The former process-wide globals now read the calling thread's error state
+#define cm_last_error (cm_error_current()->code)
+#define cm_error_message (cm_error_get_message())
 
 #endif /* CM_H */
 
@@ -0,0 +1,444 @@
+/*
+ * ============================================================================
+ * cm_bench.c - Micro-benchmarks for the CM hot paths
+ *
+ * Times batches of operations and reports throughput plus per-operation
+ * latency percentiles (each sample is one batch divided by its size), as
+ * CSV or JSON so results can be diffed between library versions.
+ *
+ *   make -C bench && ./bench/cm_bench [-f csv|json] [-t max_threads]
+ *                                     [-d ms_per_case] [-b filter]
+ *
+ * Cases:
+ *   alloc_free      cm_alloc + cm_free of 64 bytes next to N live objects
+ *   arena_bump      cm_alloc of 32 bytes inside CM_WITH_ARENA
+ *   pool_alloc      cm_pool_alloc + cm_pool_free of 64 bytes, one pool for all threads
+ *   retain_release  cm_retain + cm_free on one object: shared by every thread,
+ *                   or biased, each thread owning its own (cm_gc_bias_thread)
+ *   string_format   cm_string_format + cm_string_free
+ *   random_range    cm_random_range over [0, 999] from the thread's stream
+ *   array_push      cm_array_push of ints into a growing array
+ *   array_get       cm_array_get at random indexes of an N-element array
+ *   map_set         cm_map_set overwriting N existing keys
+ *   map_get         cm_map_get over N keys
+ *                   (both map cases: seq / uniform / zipf key order, N = 1000 and 10000)
+ *
+ * Cases that do not share mutable state also run with 2, 4, ... threads
+ * (up to -t); each thread owns its own array or map.
+ * ============================================================================
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "CM.h"
+
+#define BATCH_OPS      256
+#define MAX_SAMPLES    (1 << 16)
+#define KEY_LEN        40
+
+typedef struct bench_case bench_case_t;
+
+typedef struct {
+    const bench_case_t* bc;
+    int id;
+    void* state;                 // per-thread fixture from setup()
+    uint64_t rng;
+    size_t ops;
+    uint64_t elapsed_ns;         // measured loop only, setup and teardown excluded
+    size_t nsamples;
+    double* samples;             // ns per op, one per batch
+} worker_t;
+
+struct bench_case {
+    const char* name;
+    const char* dist;            // key order for map cases, "-" otherwise
+    size_t param;                // live objects / elements / keys
+    int threaded;                // safe to run with more than one thread
+    void* (*setup)(worker_t* w);
+    void (*run)(worker_t* w, size_t ops);
+    void (*teardown)(worker_t* w);
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t* s) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+/* ---- alloc_free ---- */
+static void* alloc_setup(worker_t* w) {
+    size_t n = w->bc->param;
+    void** live = (void**)malloc((n ? n : 1) * sizeof(void*));
+    for (size_t i = 0; i < n; i++) live[i] = cm_alloc(64, "bench_live", __FILE__, __LINE__);
+    return live;
+}
+
+static void alloc_run(worker_t* w, size_t ops) {
+    (void)w;
+    for (size_t i = 0; i < ops; i++) {
+        void* p = cm_alloc(64, "bench", __FILE__, __LINE__);
+        cm_free(p);
+    }
+}
+
+static void alloc_teardown(worker_t* w) {
+    void** live = (void**)w->state;
+    for (size_t i = 0; i < w->bc->param; i++) cm_free(live[i]);
+    free(live);
+}
+
+/* ---- arena_bump ---- */
+static void arena_run(worker_t* w, size_t ops) {
+    (void)w;
+    CM_WITH_ARENA(ops * 32) {
+        for (size_t i = 0; i < ops; i++) {
+            void* p = cm_alloc(32, "bench", __FILE__, __LINE__);
+            __asm__ __volatile__("" : : "r"(p) : "memory");
+        }
+    }
+}
+
+/* ---- pool_alloc ---- */
+static cm_pool_t* bench_pool;
+static pthread_once_t bench_pool_once = PTHREAD_ONCE_INIT;
+
+static void bench_pool_init(void) {
+    bench_pool = cm_pool_create(64, 0);
+}
+
+static void* pool_setup(worker_t* w) {
+    (void)w;
+    pthread_once(&bench_pool_once, bench_pool_init);
+    return bench_pool;
+}
+
+static void pool_run(worker_t* w, size_t ops) {
+    cm_pool_t* pool = (cm_pool_t*)w->state;
+    for (size_t i = 0; i < ops; i++) {
+        void* p = cm_pool_alloc(pool);
+        cm_pool_free(pool, p);
+    }
+}
+
+/* ---- retain_release ---- */
+static void* bench_shared_obj;
+static pthread_once_t bench_shared_once = PTHREAD_ONCE_INIT;
+
+static void bench_shared_init(void) {
+    bench_shared_obj = cm_alloc(64, "bench_shared", __FILE__, __LINE__);
+}
+
+static void* rc_setup(worker_t* w) {
+    if (strcmp(w->bc->dist, "biased") == 0) {
+        cm_gc_bias_thread(1);
+        void* obj = cm_alloc(64, "bench_biased", __FILE__, __LINE__);
+        cm_gc_bias_thread(0);
+        return obj;
+    }
+    pthread_once(&bench_shared_once, bench_shared_init);
+    return bench_shared_obj;
+}
+
+static void rc_run(worker_t* w, size_t ops) {
+    for (size_t i = 0; i < ops; i++) {
+        cm_retain(w->state);
+        cm_free(w->state);
+    }
+}
+
+static void rc_teardown(worker_t* w) {
+    if (w->state != bench_shared_obj) cm_free(w->state);
+}
+
+/* ---- string_format ---- */
+static void string_run(worker_t* w, size_t ops) {
+    for (size_t i = 0; i < ops; i++) {
+        cm_string_t* s = cm_string_format("user-%d:%s:%.3f", w->id, "bench", (double)i * 0.5);
+        cm_string_free(s);
+    }
+}
+
+/* ---- random_range ---- */
+static void random_run(worker_t* w, size_t ops) {
+    (void)w;
+    for (size_t i = 0; i < ops; i++) {
+        int64_t v = cm_random_range(0, 999);
+        __asm__ __volatile__("" : : "r"(v));
+    }
+}
+
+/* ---- array_push / array_get ---- */
+static void* array_setup(worker_t* w) {
+    cm_array_t* a = cm_array_new(sizeof(int), 16);
+    for (size_t i = 0; i < w->bc->param; i++) {
+        int v = (int)i;
+        cm_array_push(a, &v);
+    }
+    return a;
+}
+
+static void array_push_run(worker_t* w, size_t ops) {
+    cm_array_t* a = (cm_array_t*)w->state;
+    for (size_t i = 0; i < ops; i++) {
+        int v = (int)i;
+        cm_array_push(a, &v);
+    }
+}
+
+static void array_get_run(worker_t* w, size_t ops) {
+    cm_array_t* a = (cm_array_t*)w->state;
+    size_t n = w->bc->param;
+    long sum = 0;
+    for (size_t i = 0; i < ops; i++) {
+        sum += *(int*)cm_array_get(a, (size_t)(xorshift(&w->rng) % n));
+    }
+    __asm__ __volatile__("" : : "r"(sum));
+}
+
+static void array_teardown(worker_t* w) {
+    cm_array_free((cm_array_t*)w->state);
+}
+
+/* ---- map_set / map_get ---- */
+typedef struct {
+    cm_map_t* map;
+    char* keys;                  // param keys of KEY_LEN bytes
+    uint32_t* order;             // key index per op, precomputed from the distribution
+    size_t norder;
+    size_t next;
+} map_fixture_t;
+
+// Zipf(s = 1) over n ranks by inverse CDF; rank r maps to key (r * 7919) % n
+static void zipf_fill(uint32_t* out, size_t count, size_t n, uint64_t* rng) {
+    double* cdf = (double*)malloc(n * sizeof(double));
+    double total = 0;
+    for (size_t i = 0; i < n; i++) cdf[i] = (total += 1.0 / (double)(i + 1));
+    for (size_t i = 0; i < count; i++) {
+        double u = (double)(xorshift(rng) >> 11) / 9007199254740992.0 * total;
+        size_t lo = 0, hi = n - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+        }
+        out[i] = (uint32_t)((lo * 7919) % n);
+    }
+    free(cdf);
+}
+
+static void* map_setup(worker_t* w) {
+    size_t n = w->bc->param;
+    map_fixture_t* f = (map_fixture_t*)calloc(1, sizeof(map_fixture_t));
+    f->map = cm_map_new();
+    f->keys = (char*)malloc(n * KEY_LEN);
+    for (size_t i = 0; i < n; i++) {
+        snprintf(f->keys + i * KEY_LEN, KEY_LEN, "key:%d:%zu", w->id, i);
+        int v = (int)i;
+        cm_map_set(f->map, f->keys + i * KEY_LEN, &v, sizeof(v));
+    }
+
+    f->norder = 1 << 16;
+    f->order = (uint32_t*)malloc(f->norder * sizeof(uint32_t));
+    if (strcmp(w->bc->dist, "zipf") == 0) {
+        zipf_fill(f->order, f->norder, n, &w->rng);
+    } else {
+        for (size_t i = 0; i < f->norder; i++) {
+            f->order[i] = strcmp(w->bc->dist, "seq") == 0
+                ? (uint32_t)(i % n) : (uint32_t)(xorshift(&w->rng) % n);
+        }
+    }
+    return f;
+}
+
+static void map_get_run(worker_t* w, size_t ops) {
+    map_fixture_t* f = (map_fixture_t*)w->state;
+    long sum = 0;
+    for (size_t i = 0; i < ops; i++) {
+        uint32_t k = f->order[f->next++ & (f->norder - 1)];
+        sum += *(int*)cm_map_get(f->map, f->keys + (size_t)k * KEY_LEN);
+    }
+    __asm__ __volatile__("" : : "r"(sum));
+}
+
+static void map_set_run(worker_t* w, size_t ops) {
+    map_fixture_t* f = (map_fixture_t*)w->state;
+    for (size_t i = 0; i < ops; i++) {
+        uint32_t k = f->order[f->next++ & (f->norder - 1)];
+        int v = (int)i;
+        cm_map_set(f->map, f->keys + (size_t)k * KEY_LEN, &v, sizeof(v));
+    }
+}
+
+static void map_teardown(worker_t* w) {
+    map_fixture_t* f = (map_fixture_t*)w->state;
+    cm_map_free(f->map);
+    free(f->keys);
+    free(f->order);
+    free(f);
+}
+
+static const bench_case_t cases[] = {
+    { "alloc_free",    "-",       0,      1, alloc_setup, alloc_run,      alloc_teardown },
+    { "alloc_free",    "-",       1000,   1, alloc_setup, alloc_run,      alloc_teardown },
+    { "alloc_free",    "-",       10000,  1, alloc_setup, alloc_run,      alloc_teardown },
+    { "arena_bump",    "-",       0,      1, NULL,        arena_run,      NULL },
+    { "pool_alloc",    "-",       0,      1, pool_setup,  pool_run,       NULL },
+    { "retain_release", "shared", 0,      1, rc_setup,    rc_run,         rc_teardown },
+    { "retain_release", "biased", 0,      1, rc_setup,    rc_run,         rc_teardown },
+    { "string_format", "-",       0,      1, NULL,        string_run,     NULL },
+    { "random_range",  "-",       0,      1, NULL,        random_run,     NULL },
+    { "array_push",    "-",       0,      1, array_setup, array_push_run, array_teardown },
+    { "array_get",     "-",       100000, 1, array_setup, array_get_run,  array_teardown },
+    { "map_set",       "seq",     1000,   1, map_setup,   map_set_run,    map_teardown },
+    { "map_set",       "uniform", 1000,   1, map_setup,   map_set_run,    map_teardown },
+    { "map_set",       "zipf",    1000,   1, map_setup,   map_set_run,    map_teardown },
+    { "map_set",       "seq",     10000,  1, map_setup,   map_set_run,    map_teardown },
+    { "map_set",       "uniform", 10000,  1, map_setup,   map_set_run,    map_teardown },
+    { "map_set",       "zipf",    10000,  1, map_setup,   map_set_run,    map_teardown },
+    { "map_get",       "seq",     1000,   1, map_setup,   map_get_run,    map_teardown },
+    { "map_get",       "uniform", 1000,   1, map_setup,   map_get_run,    map_teardown },
+    { "map_get",       "zipf",    1000,   1, map_setup,   map_get_run,    map_teardown },
+    { "map_get",       "seq",     10000,  1, map_setup,   map_get_run,    map_teardown },
+    { "map_get",       "uniform", 10000,  1, map_setup,   map_get_run,    map_teardown },
+    { "map_get",       "zipf",    10000,  1, map_setup,   map_get_run,    map_teardown },
+};
+
+/* ---- harness ---- */
+static pthread_barrier_t start_barrier;
+static uint64_t budget_ns;
+
+static void* worker_main(void* arg) {
+    worker_t* w = (worker_t*)arg;
+    const bench_case_t* bc = w->bc;
+    w->state = bc->setup ? bc->setup(w) : NULL;
+
+    // Warm caches and code paths outside the measurement
+    bc->run(w, BATCH_OPS);
+
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+    uint64_t deadline = start + budget_ns;
+    while (w->nsamples < MAX_SAMPLES) {
+        uint64_t t0 = now_ns();
+        bc->run(w, BATCH_OPS);
+        uint64_t t1 = now_ns();
+        w->samples[w->nsamples++] = (double)(t1 - t0) / BATCH_OPS;
+        w->ops += BATCH_OPS;
+        if (t1 >= deadline) break;
+    }
+    w->elapsed_ns = now_ns() - start;
+
+    if (bc->teardown) bc->teardown(w);
+    return NULL;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double pct(const double* sorted, size_t n, double p) {
+    return sorted[(size_t)(p / 100.0 * (double)(n - 1))];
+}
+
+static void run_case(const bench_case_t* bc, int threads, int json, int* first) {
+    worker_t* ws = (worker_t*)calloc((size_t)threads, sizeof(worker_t));
+    pthread_t* tids = (pthread_t*)malloc((size_t)threads * sizeof(pthread_t));
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)threads + 1);
+
+    for (int i = 0; i < threads; i++) {
+        ws[i].bc = bc;
+        ws[i].id = i;
+        ws[i].rng = 0x9E3779B97F4A7C15ull * (uint64_t)(i + 1);
+        ws[i].samples = (double*)malloc(MAX_SAMPLES * sizeof(double));
+        pthread_create(&tids[i], NULL, worker_main, &ws[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    for (int i = 0; i < threads; i++) pthread_join(tids[i], NULL);
+
+    size_t ops = 0, n = 0;
+    uint64_t longest = 1;
+    for (int i = 0; i < threads; i++) {
+        ops += ws[i].ops;
+        n += ws[i].nsamples;
+        if (ws[i].elapsed_ns > longest) longest = ws[i].elapsed_ns;
+    }
+    double* all = (double*)malloc(n * sizeof(double));
+    n = 0;
+    for (int i = 0; i < threads; i++) {
+        memcpy(all + n, ws[i].samples, ws[i].nsamples * sizeof(double));
+        n += ws[i].nsamples;
+        free(ws[i].samples);
+    }
+    qsort(all, n, sizeof(double), cmp_double);
+
+    double rate = (double)ops / ((double)longest / 1e9);
+    if (json) {
+        printf("%s  {\"case\":\"%s\",\"dist\":\"%s\",\"param\":%zu,\"threads\":%d,\"ops\":%zu,"
+               "\"ops_per_sec\":%.0f,\"ns_p50\":%.1f,\"ns_p90\":%.1f,\"ns_p99\":%.1f,\"ns_max\":%.1f}",
+               *first ? "" : ",\n", bc->name, bc->dist, bc->param, threads, ops, rate,
+               pct(all, n, 50), pct(all, n, 90), pct(all, n, 99), all[n - 1]);
+    } else {
+        printf("%s,%s,%zu,%d,%zu,%.0f,%.1f,%.1f,%.1f,%.1f\n",
+               bc->name, bc->dist, bc->param, threads, ops, rate,
+               pct(all, n, 50), pct(all, n, 90), pct(all, n, 99), all[n - 1]);
+    }
+    fflush(stdout);
+    *first = 0;
+
+    pthread_barrier_destroy(&start_barrier);
+    free(all);
+    free(tids);
+    free(ws);
+}
+
+int main(int argc, char** argv) {
+    int json = 0, max_threads = 4, budget_ms = 300;
+    const char* filter = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:d:b:")) != -1) {
+        switch (opt) {
+            case 'f': json = strcmp(optarg, "json") == 0; break;
+            case 't': max_threads = atoi(optarg); break;
+            case 'd': budget_ms = atoi(optarg); break;
+            case 'b': filter = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-f csv|json] [-t max_threads] [-d ms_per_case] [-b filter]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (max_threads < 1) max_threads = 1;
+    budget_ns = (uint64_t)(budget_ms > 0 ? budget_ms : 300) * 1000000ull;
+
+    int first = 1;
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("case,dist,param,threads,ops,ops_per_sec,ns_p50,ns_p90,ns_p99,ns_max\n");
+    }
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const bench_case_t* bc = &cases[i];
+        if (filter && !strstr(bc->name, filter)) continue;
+        for (int t = 1; t <= max_threads; t *= 2) {
+            run_case(bc, t, json, &first);
+            if (!bc->threaded) break;
+        }
+    }
+
+    if (json) printf("\n]\n");
+    return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * ============================================================================
+ * echo_bench.c - Loopback echo server benchmark for cm_loop_t
+ *
+ * Starts an epoll echo server on 127.0.0.1 and drives it with blocking
+ * ping-pong clients, one thread per connection. Reports requests/sec and
+ * round-trip latency percentiles.
+ *
+ *   gcc -O2 -I.. echo_bench.c ../CM.c -o echo_bench -lpthread -lm
+ *   ./echo_bench [-c connections] [-n requests_per_conn] [-s msg_size] [-m cb|coro]
+ *
+ * Mode "cb" serves every connection from loop callbacks on one thread.
+ * Mode "coro" runs one coroutine per connection on the default scheduler,
+ * awaiting readiness through cm_loop_read / cm_loop_write.
+ * ============================================================================
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "CM.h"
+
+#define ECHO_BUF 65536
+
+typedef struct {
+    int fd;
+    size_t pending;          // bytes read but not yet written back
+    size_t offset;
+    char buf[ECHO_BUF];
+} echo_conn_t;
+
+typedef struct {
+    int id;
+    int requests;
+    size_t msg_size;
+    uint64_t* latencies;     // ns per round trip
+} client_t;
+
+static cm_loop_t* loop;
+static int listen_fd;
+static unsigned short port;
+static int use_coro = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* ---- callback server ---- */
+static void conn_close(echo_conn_t* c) {
+    cm_loop_unwatch(loop, c->fd);
+    close(c->fd);
+    free(c);
+}
+
+static void on_conn(cm_loop_t* l, int fd, int events, void* arg) {
+    echo_conn_t* c = (echo_conn_t*)arg;
+    (void)l;
+
+    if (events & (CM_IO_ERROR | CM_IO_HUP)) {
+        conn_close(c);
+        return;
+    }
+
+    for (;;) {
+        if (c->pending == 0) {
+            ssize_t n = read(fd, c->buf, sizeof(c->buf));
+            if (n == 0 || (n < 0 && errno != EAGAIN)) {
+                conn_close(c);
+                return;
+            }
+            if (n < 0) break;
+            c->pending = (size_t)n;
+            c->offset = 0;
+        }
+
+        ssize_t w = write(fd, c->buf + c->offset, c->pending);
+        if (w < 0 && errno != EAGAIN) {
+            conn_close(c);
+            return;
+        }
+        if (w < 0) {
+            // Socket buffer full: wait for writability before reading more
+            cm_loop_watch(loop, fd, CM_IO_WRITE, on_conn, c);
+            return;
+        }
+        c->offset += (size_t)w;
+        c->pending -= (size_t)w;
+        if (c->pending) continue;
+    }
+    cm_loop_watch(loop, fd, CM_IO_READ, on_conn, c);
+}
+
+static void on_accept(cm_loop_t* l, int fd, int events, void* arg) {
+    (void)l;
+    (void)events;
+    (void)arg;
+
+    for (;;) {
+        int cfd = accept(fd, NULL, NULL);
+        if (cfd < 0) return;
+        cm_set_nonblocking(cfd);
+        int one = 1;
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        echo_conn_t* c = (echo_conn_t*)calloc(1, sizeof(echo_conn_t));
+        c->fd = cfd;
+        cm_loop_watch(loop, cfd, CM_IO_READ, on_conn, c);
+    }
+}
+
+/* ---- coroutine server ---- */
+static void* coro_conn(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    char* buf = (char*)malloc(ECHO_BUF);
+
+    for (;;) {
+        ssize_t n = cm_loop_read(loop, fd, buf, ECHO_BUF);
+        if (n <= 0) break;
+        if (cm_loop_write(loop, fd, buf, (size_t)n) != n) break;
+    }
+
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+static void* coro_acceptor(void* arg) {
+    (void)arg;
+    for (;;) {
+        int cfd = cm_loop_accept(loop, listen_fd);
+        if (cfd < 0) break;
+        int one = 1;
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        cm_future_t* f = cm_coro_spawn(NULL, coro_conn, (void*)(intptr_t)cfd);
+        cm_future_release(f);
+    }
+    return NULL;
+}
+
+static void* loop_thread(void* arg) {
+    (void)arg;
+    cm_loop_run(loop);
+    return NULL;
+}
+
+/* ---- clients ---- */
+static void* client_main(void* arg) {
+    client_t* cl = (client_t*)arg;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    char* out = (char*)malloc(cl->msg_size);
+    char* in = (char*)malloc(cl->msg_size);
+    memset(out, 'a' + cl->id % 26, cl->msg_size);
+
+    for (int i = 0; i < cl->requests; i++) {
+        uint64_t start = now_ns();
+        if (write(fd, out, cl->msg_size) != (ssize_t)cl->msg_size) break;
+        size_t got = 0;
+        while (got < cl->msg_size) {
+            ssize_t n = read(fd, in + got, cl->msg_size - got);
+            if (n <= 0) goto done;
+            got += (size_t)n;
+        }
+        cl->latencies[i] = now_ns() - start;
+    }
+
+done:
+    free(out);
+    free(in);
+    close(fd);
+    return NULL;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double pct(uint64_t* sorted, size_t n, double p) {
+    size_t idx = (size_t)(p / 100.0 * (double)(n - 1));
+    return (double)sorted[idx] / 1000.0;
+}
+
+int main(int argc, char** argv) {
+    int conns = 16, requests = 20000;
+    size_t msg_size = 64;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:s:m:")) != -1) {
+        switch (opt) {
+            case 'c': conns = atoi(optarg); break;
+            case 'n': requests = atoi(optarg); break;
+            case 's': msg_size = (size_t)atol(optarg); break;
+            case 'm': use_coro = strcmp(optarg, "coro") == 0; break;
+            default:
+                fprintf(stderr, "usage: %s [-c conns] [-n requests] [-s size] [-m cb|coro]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    loop = cm_loop_new();
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd, (struct sockaddr*)&addr, &len);
+    port = ntohs(addr.sin_port);
+    listen(listen_fd, 1024);
+    cm_set_nonblocking(listen_fd);
+
+    if (use_coro) {
+        cm_future_t* f = cm_coro_spawn(NULL, coro_acceptor, NULL);
+        cm_future_release(f);
+    } else {
+        cm_loop_watch(loop, listen_fd, CM_IO_READ, on_accept, NULL);
+    }
+
+    pthread_t server;
+    pthread_create(&server, NULL, loop_thread, NULL);
+
+    client_t* clients = (client_t*)calloc((size_t)conns, sizeof(client_t));
+    pthread_t* threads = (pthread_t*)calloc((size_t)conns, sizeof(pthread_t));
+    uint64_t start = now_ns();
+    for (int i = 0; i < conns; i++) {
+        clients[i].id = i;
+        clients[i].requests = requests;
+        clients[i].msg_size = msg_size;
+        clients[i].latencies = (uint64_t*)calloc((size_t)requests, sizeof(uint64_t));
+        pthread_create(&threads[i], NULL, client_main, &clients[i]);
+    }
+    for (int i = 0; i < conns; i++) pthread_join(threads[i], NULL);
+    double elapsed = (double)(now_ns() - start) / 1e9;
+
+    size_t total = (size_t)conns * (size_t)requests;
+    uint64_t* all = (uint64_t*)malloc(total * sizeof(uint64_t));
+    for (int i = 0; i < conns; i++) {
+        memcpy(all + (size_t)i * requests, clients[i].latencies, (size_t)requests * sizeof(uint64_t));
+        free(clients[i].latencies);
+    }
+    qsort(all, total, sizeof(uint64_t), cmp_u64);
+
+    printf("mode,conns,requests,msg_size,seconds,req_per_sec,p50_us,p90_us,p99_us,p999_us,max_us\n");
+    printf("%s,%d,%zu,%zu,%.3f,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+           use_coro ? "coro" : "cb", conns, total, msg_size, elapsed, (double)total / elapsed,
+           pct(all, total, 50), pct(all, total, 90), pct(all, total, 99), pct(all, total, 99.9),
+           (double)all[total - 1] / 1000.0);
+
+    cm_loop_stop(loop);
+    pthread_join(server, NULL);
+    free(all);
+    free(clients);
+    free(threads);
+    return 0;
+}